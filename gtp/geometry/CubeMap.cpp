@@ -153,6 +153,12 @@ CubeMap::CubeMap( string iName, char *iCubeTexFile,
   ////////////loadInfoRES.Usage = D3D11_USAGE_DYNAMIC ; // CPU WRITE / GPU READ
   ////////////loadInfoRES.CpuAccessFlags = D3D11_CPU_ACCESS_WRITE ;
 
+  if( window->headless )
+  {
+    error( "Headless, there's no device to load texture cube '%s' with", iCubeTexFile ) ;
+    return ;
+  }
+
   if( !DX_CHECK( D3DX11CreateTextureFromFileA( window->d3d, iCubeTexFile, &loadInfoRES, 0, (ID3D11Resource**)&cubeTex, 0 ), "load texture cube" ) )
   {
     error( "Couldn't load texture cube!" ) ;
@@ -392,43 +398,46 @@ CubeMap::CubeMap( string iName, int px, Scene* scene )
   // Now since this IS a cubemap, and will be used for
   // wavelet lighting, I need to put one on the GPU just
   // to go with the rest of the code.
+  // (headless has no device, the colorValues are all it gets)
+  if( !window->headless )
+  {
+    // Create the cubemap via staging cubemap first,
+    D3D11_TEXTURE2D_DESC cubeTexDesc = { 0 } ;
+    cubeTexDesc.Width = px ;
+    cubeTexDesc.Height = px ;
+    cubeTexDesc.MipLevels = 1 ;
+    cubeTexDesc.ArraySize = 6 ;
+    cubeTexDesc.Format = DXGI_FORMAT::DXGI_FORMAT_R8G8B8A8_UNORM ;
+    cubeTexDesc.Usage  = D3D11_USAGE::D3D11_USAGE_DEFAULT ;
+    // D3D11: ERROR: ID3D11Device::CreateTexture2D: Cubemaps do not support multisampling!
+    // You must set SampleDesc.Count (value = 0) to 1 and SampleDesc.Quality (value = 1) to 0.
+    // [ STATE_CREATION ERROR #93: CREATETEXTURE2D_INVALIDSAMPLES ]
+    cubeTexDesc.SampleDesc.Count = 1;
+    cubeTexDesc.SampleDesc.Quality = 0;
+    cubeTexDesc.CPUAccessFlags = 0 ;
+    cubeTexDesc.BindFlags = D3D11_BIND_FLAG::D3D11_BIND_SHADER_RESOURCE ;
+    cubeTexDesc.MiscFlags = D3D11_RESOURCE_MISC_FLAG::D3D11_RESOURCE_MISC_TEXTURECUBE ; // it's a texture cube.
+
+    // create the texture cube
+    D3D11_SUBRESOURCE_DATA subresData[6] ; // this has to be an ARRAY, one entry for each cubemap face
+    for( int FACE = 0 ; FACE < 6 ; FACE++ )
+    {
+      subresData[FACE].pSysMem = (void*)&byteColors[FACE*px*px] ;
+      subresData[FACE].SysMemPitch = 4 * px ; // 4 bpp * #pixels per row = distance in bytes from beginning of one line of texture to next line.
+      subresData[FACE].SysMemSlicePitch = 4*px*px ; // bytes on surface.
+    }
 
-  // Create the cubemap via staging cubemap first,
-  D3D11_TEXTURE2D_DESC cubeTexDesc = { 0 } ;
-  cubeTexDesc.Width = px ;
-  cubeTexDesc.Height = px ;
-  cubeTexDesc.MipLevels = 1 ;
-  cubeTexDesc.ArraySize = 6 ;
-  cubeTexDesc.Format = DXGI_FORMAT::DXGI_FORMAT_R8G8B8A8_UNORM ;
-  cubeTexDesc.Usage  = D3D11_USAGE::D3D11_USAGE_DEFAULT ;
-  // D3D11: ERROR: ID3D11Device::CreateTexture2D: Cubemaps do not support multisampling!
-  // You must set SampleDesc.Count (value = 0) to 1 and SampleDesc.Quality (value = 1) to 0.
-  // [ STATE_CREATION ERROR #93: CREATETEXTURE2D_INVALIDSAMPLES ]
-  cubeTexDesc.SampleDesc.Count = 1;
-  cubeTexDesc.SampleDesc.Quality = 0;
-  cubeTexDesc.CPUAccessFlags = 0 ;
-  cubeTexDesc.BindFlags = D3D11_BIND_FLAG::D3D11_BIND_SHADER_RESOURCE ;
-  cubeTexDesc.MiscFlags = D3D11_RESOURCE_MISC_FLAG::D3D11_RESOURCE_MISC_TEXTURECUBE ; // it's a texture cube.
-
-  // create the texture cube
-  D3D11_SUBRESOURCE_DATA subresData[6] ; // this has to be an ARRAY, one entry for each cubemap face
-  for( int FACE = 0 ; FACE < 6 ; FACE++ )
-  {
-    subresData[FACE].pSysMem = (void*)&byteColors[FACE*px*px] ;
-    subresData[FACE].SysMemPitch = 4 * px ; // 4 bpp * #pixels per row = distance in bytes from beginning of one line of texture to next line.
-    subresData[FACE].SysMemSlicePitch = 4*px*px ; // bytes on surface.
-  }
-
-  // Copies in the data.
-  DX_CHECK( window->d3d->CreateTexture2D( &cubeTexDesc, subresData, &cubeTex ), "create cubemap texture" ) ;
+    // Copies in the data.
+    DX_CHECK( window->d3d->CreateTexture2D( &cubeTexDesc, subresData, &cubeTex ), "create cubemap texture" ) ;
 
-	D3D11_SHADER_RESOURCE_VIEW_DESC cubeTexRsvDesc;
-	cubeTexRsvDesc.Format = cubeTexDesc.Format;
-	cubeTexRsvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE;
-	cubeTexRsvDesc.TextureCube.MipLevels = cubeTexDesc.MipLevels;
-	cubeTexRsvDesc.TextureCube.MostDetailedMip = 0; //always 0
+    D3D11_SHADER_RESOURCE_VIEW_DESC cubeTexRsvDesc;
+    cubeTexRsvDesc.Format = cubeTexDesc.Format;
+    cubeTexRsvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE;
+    cubeTexRsvDesc.TextureCube.MipLevels = cubeTexDesc.MipLevels;
+    cubeTexRsvDesc.TextureCube.MostDetailedMip = 0; //always 0
   
-  DX_CHECK( window->d3d->CreateShaderResourceView( cubeTex, &cubeTexRsvDesc, &cubeTexRsv ), "create shader res view cubetex" ) ;
+    DX_CHECK( window->d3d->CreateShaderResourceView( cubeTex, &cubeTexRsvDesc, &cubeTexRsv ), "create shader res view cubetex" ) ;
+  }
 
   slices=stacks=64;
   createMesh( MeshType::Indexed, defaultVertexType ) ;
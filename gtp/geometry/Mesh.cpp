@@ -488,6 +488,13 @@ void Mesh::addIndexedTri( const AllVertex& A, const AllVertex& B, const AllVerte
 // call this after you've added all your tris
 bool Mesh::createVertexBuffer()
 {
+  // headless: no device to put a vb on, but the centroid is still wanted
+  if( window->headless )
+  {
+    computeCentroid() ;
+    return true ;
+  }
+
   bool ret ;
   switch( vertexType )
   {
@@ -691,6 +698,9 @@ bool Mesh::createVertexBufferVT10NC10()
 
 void Mesh::updateVertexBuffer()
 {
+  if( window->headless )
+    return ;
+
   if( !vb )
   {
     warning( "You tried to update vb but no vertexbuffer existed! Creating.." ) ;
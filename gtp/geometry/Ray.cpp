@@ -5,6 +5,8 @@
 Ray::Ray():direction(0.0,0.0,-1.0),length(1.0)
 {
   isShadowRay=false;
+  afterDiffuse=causticPath=directCounted=false;
+  specularBounces=0;
 }
 
 Ray::Ray( const Vector& iStartPos, const Vector& iEndPos ):
@@ -16,6 +18,8 @@ Ray::Ray( const Vector& iStartPos, const Vector& iEndPos ):
   if( length )
     direction /= length ; //.normalize() ; // save comp
   isShadowRay=false;
+  afterDiffuse=causticPath=directCounted=false;
+  specularBounces=0;
 }
 
 ////Ray::Ray( const Vector& iStartPos, const Vector& iEndPos, bool DONOTNORMALIZE, bool SAFETY2 ):
@@ -36,6 +40,8 @@ Ray::Ray( const Vector& iStartPos, const Vector& iDirection, real iLength ):
 {
   direction.normalize();//make sure its normalized
   isShadowRay=false;
+  afterDiffuse=causticPath=directCounted=false;
+  specularBounces=0;
 }
 
 Ray::Ray( const Vector& iStartPos, const Vector& iDirection, real iLength, const Vector& startingEta, const Vector& rayPower, int iBounceNum ):
@@ -43,6 +49,15 @@ Ray::Ray( const Vector& iStartPos, const Vector& iDirection, real iLength, const
 {
   direction.normalize() ;
   isShadowRay=false;
+  afterDiffuse=causticPath=directCounted=false;
+  specularBounces=0;
+}
+
+void Ray::markSpecularOf( const Ray& parent )
+{
+  afterDiffuse = parent.afterDiffuse ;
+  causticPath = parent.afterDiffuse ;
+  specularBounces = parent.afterDiffuse ? parent.specularBounces + 1 : 0 ;
 }
 
 Vector Ray::getEndPoint() const
@@ -58,13 +73,17 @@ Vector Ray::at( real t ) const
 Ray Ray::reflect( const Vector& normal, const Vector& spacePoint, const Vector& ks ) const
 {
   Vector reflDir = direction.reflectedCopy( normal ) ;
-  return Ray( spacePoint + EPS_MIN*normal, reflDir, 1000, eta, power*ks, bounceNum+1 ) ;
+  Ray r( spacePoint + EPS_MIN*normal, reflDir, 1000, eta, power*ks, bounceNum+1 ) ;
+  r.markSpecularOf( *this ) ;
+  return r ;
 }
 
 Ray* Ray::reflectPtr( const Vector& normal, const Vector& spacePoint, const Vector& ks ) const
 {
   Vector reflDir = direction.reflectedCopy( normal ) ;
-  return new Ray( spacePoint + EPS_MIN*normal, reflDir, 1000, eta, power*ks, bounceNum+1 ) ;
+  Ray* r = new Ray( spacePoint + EPS_MIN*normal, reflDir, 1000, eta, power*ks, bounceNum+1 ) ;
+  r->markSpecularOf( *this ) ;
+  return r ;
 }
 
 void Ray::refract3( const Vector& normal, const Vector& toEta, const Vector& spacePoint, const Vector& kt, Ray rays[3] ) const
@@ -82,6 +101,7 @@ void Ray::refract3( const Vector& normal, const Vector& toEta, const Vector& spa
     // (because if the ray is ENTERING the surface, then you need to go in the OPPOSITE direction
     // of the normal).
     rays[i] = Ray( spacePoint + refractDir * EPS_MIN, refractDir, length, toEta, newPower, bounceNum+1 ) ;
+    rays[i].markSpecularOf( *this ) ;
   }
 }
 
@@ -94,7 +114,9 @@ Ray Ray::refract( const Vector& normal, int etaIndex, real toEta, const Vector&
   Vector newPower ;
   newPower.e[ etaIndex ] = power.e[ etaIndex ] * kt.e[ etaIndex ];
   
-  return Ray( spacePoint + refractDir * EPS_MIN, refractDir, length, toEta, newPower, bounceNum+1 ) ;
+  Ray r( spacePoint + refractDir * EPS_MIN, refractDir, length, toEta, newPower, bounceNum+1 ) ;
+  r.markSpecularOf( *this ) ;
+  return r ;
 }
 
 Ray Ray::refract( const Vector& normal, real toEta, const Vector& spacePoint, const Vector& kt ) const
@@ -105,7 +127,9 @@ Ray Ray::refract( const Vector& normal, real toEta, const Vector& spacePoint, co
   Vector newPower ;
   newPower = power * kt ;
   
-  return Ray( spacePoint + refractDir * EPS_MIN, refractDir, length, toEta, newPower, bounceNum+1 ) ;
+  Ray r( spacePoint + refractDir * EPS_MIN, refractDir, length, toEta, newPower, bounceNum+1 ) ;
+  r.markSpecularOf( *this ) ;
+  return r ;
 }
 
 Ray* Ray::refractPtr( const Vector& normal, int etaIndex, real toEta, const Vector& spacePoint, const Vector& kt ) const
@@ -116,7 +140,9 @@ Ray* Ray::refractPtr( const Vector& normal, int etaIndex, real toEta, const Vect
   Vector newPower ;
   newPower.e[ etaIndex ] = power.e[ etaIndex ] * kt.e[ etaIndex ];
   
-  return new Ray( spacePoint + refractDir * EPS_MIN, refractDir, length, toEta, newPower, bounceNum+1 ) ;
+  Ray* r = new Ray( spacePoint + refractDir * EPS_MIN, refractDir, length, toEta, newPower, bounceNum+1 ) ;
+  r->markSpecularOf( *this ) ;
+  return r ;
 }
 
 Ray* Ray::refractPtr( const Vector& normal, real toEta, const Vector& spacePoint, const Vector& kt ) const
@@ -128,5 +154,7 @@ Ray* Ray::refractPtr( const Vector& normal, real toEta, const Vector& spacePoint
   Vector newPower ;
   newPower = power * kt ;
   
-  return new Ray( spacePoint + refractDir * EPS_MIN, refractDir, length, toEta, newPower, bounceNum+1 ) ;
+  Ray* r = new Ray( spacePoint + refractDir * EPS_MIN, refractDir, length, toEta, newPower, bounceNum+1 ) ;
+  r->markSpecularOf( *this ) ;
+  return r ;
 }
\ No newline at end of file
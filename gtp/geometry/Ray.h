@@ -68,6 +68,20 @@ struct Ray
   // a specular bounce.
   bool isShadowRay ; // Can't reflect specularly
 
+  // For the caustic photon map.  afterDiffuse is set on rays that leave
+  // a diffuse surface (gathers, shadow rays), and causticPath on the
+  // specular bounces of those, with specularBounces counting how many
+  // there have been since the diffuse surface.  PhotonMap::covers says if a
+  // causticPath ray that reaches a light is carrying light the photon map
+  // already estimated at the diffuse surface.
+  bool afterDiffuse, causticPath ;
+  int specularBounces ;
+
+  // For multiple importance sampling.  The surface this ray left already
+  // counted the light arriving straight from the emitters along it, so
+  // whatever this ray hits first doesn't add its emission.  Not inherited.
+  bool directCounted ;
+
   /// the length of the Ray.
   real length ;
 
@@ -98,6 +112,10 @@ struct Ray
   // Point in space along ray at t-value.
   Vector at( real t ) const ;
 
+  // Copies the diffuse history of the ray this one
+  // specularly bounced off of (reflect/refract call this).
+  void markSpecularOf( const Ray& parent ) ;
+
   // Reflects a ray, using normal to reflect from.
   // Includes power loss by factor KS,
   // and increases bounce number of the ray.
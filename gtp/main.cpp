@@ -24,11 +24,14 @@
 #include "geometry/Model.h"
 #include "Globals.h"
 #include "rendering/RaytracingCore.h"
+#include "rendering/TemporalReprojector.h"
 #include "rendering/RadiosityCore.h"
 #include "rendering/FullCubeRenderer.h"
 #include "math/SHVector.h"
+#include "window/BatchRenderer.h"
 
 GTPWindow *window ;
+BatchRenderer batch ; // -batch on the command line: render without interaction and exit
 
 enum Scenes
 {
@@ -1509,6 +1512,24 @@ void testSH()
 
 }
 
+// A bare .obj/.ply from the batch command line.  Meshes don't carry
+// lights, so it gets the same Sun the default scene uses.
+void loadBatchMesh( const string& filename )
+{
+  const char* ext = strrchr( filename.c_str(), '.' ) ;
+  FileType fileType = !strcmpi( ext, ".ply" ) ? FileType::PLY : FileType::OBJ ;
+
+  Model *model = new Model( (char*)filename.c_str(), fileType, MeshType::Indexed, Material::White ) ;
+  if( !model->meshGroup || model->meshGroup->meshes.empty() )
+    error( "Batch: no meshes loaded from %s", filename.c_str() ) ;
+  window->scene->addShape( model ) ;
+
+  generateLights( LightScenes::Sun ) ;
+
+  if( window->scene->spacePartitioningOn )
+    window->scene->computeSpacePartition() ;
+}
+
 void init()
 {
   //srand( 121 ) ;
@@ -1516,7 +1537,20 @@ void init()
 
   window->camera->setPrepos( 0 ) ;
 
-  loadScene() ;
+  if( batch.enabled && batch.sceneFile.size() )
+  {
+    // no file dialogs in batch mode
+    if( batch.sceneIsMesh() )
+      loadBatchMesh( batch.sceneFile ) ;
+    else
+      window->load( (char*)batch.sceneFile.c_str() ) ;
+    window->radCore->assignIds( window->scene ) ;
+  }
+  else
+    loadScene() ;
+
+  if( batch.enabled )
+    batch.applyCamera( window->camera ) ;
   //testSplit() ;
   //testSHRuntime() ;
   //testSH() ;
@@ -1593,6 +1627,20 @@ void update()
   */
 
   window->step() ;
+
+  // Real time ray tracing: start the next frame as soon as the last one's done.
+  // Each frame only traces a few rpp and reprojects the previous one.
+  if( window->rtCore->realTimeMode && window->programState == ProgramState::Idle )
+  {
+    window->programState = ProgramState::Busy ;
+    window->bakeRotationsIntoLights() ;
+    window->rtCore->raytrace(
+      window->camera->eye,
+      window->camera->getLook(),
+      window->camera->up,
+      window->scene
+    ) ;
+  }
 }
 
 int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR szCmdLine, int iCmdShow )
@@ -1603,21 +1651,41 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR szCmdLin
   threadPool.mainThreadId = GetCurrentThreadId() ;
   threadPool.mainThread = GetCurrentThread() ;
 
-  // Start up the log.
-  logStartup( "C:/vctemp/builds/gtp/lastRunLog.txt", "gtp", windX, windY, windWidth, windHeight ) ;
+  // Start up the log.  Render farm workers each get their own.
+  // -batch runs are headless: no window, no device, no log window.
+  // The log has to start before parseCommandLine, so I just look for the flag here.
+  char logFile[ MAX_PATH ] = "C:/vctemp/builds/gtp/lastRunLog.txt" ;
+  if( szCmdLine && strstr( szCmdLine, "-worker " ) )
+    sprintf( logFile, "C:/vctemp/builds/gtp/lastRunLog-worker%lu.txt", GetCurrentProcessId() ) ;
+  bool headless = szCmdLine && strstr( szCmdLine, "-batch" ) ;
+  logStartup( logFile, "gtp", windX, windY, windWidth, windHeight, headless ) ;
   
   // Prepare the factorials table.
   prepFactorials() ;
 
+  batch.parseCommandLine( szCmdLine ) ;
+
   // Setup the window
   window = new GTPWindow( hInstance, TEXT( "gtp" ),
     windX, windY, // x pos, y pos
-    windWidth, windHeight// width, height
+    windWidth, windHeight, // width, height
+    headless
   ) ;
 
   init() ;
   window->programState = Idle ;  // no longer busy
 
+  if( batch.enabled )
+  {
+    // no window, no device.  Just run the steps and leave.
+    int exitCode = batch.run() ;
+
+    threadPool.die() ;
+    DESTROY( window ) ;
+    logShutdown() ;
+    ExitProcess( exitCode ) ;
+  }
+
   MSG msg;
 
   while( 1 )
@@ -2012,6 +2080,7 @@ LRESULT CALLBACK WndProc( HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam
 
     case 'R':
       window->rtCore->realTimeMode = !window->rtCore->realTimeMode ;
+      window->rtCore->temporal->invalidate() ; // scene may have changed since the last real time frame
       info( "Real-time ray trace mode %s", onOrOff( window->rtCore->realTimeMode ) ) ;
       break;
 
@@ -2148,7 +2217,7 @@ LRESULT CALLBACK WndProc( HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam
         // just a one off render
         window->radCore->radiosity( window->scene, 
           FormFactorDetermination::FormFactorsHemicube,
-          MatrixSolverMethod::GaussSeidel ) ;
+          (MatrixSolverMethod)window->radCore->matrixSolverMethod ) ;
         
         // Does several snapshots of radiosity
         //window->radCore->scheduleRadiosity( window->scene,
@@ -2166,7 +2235,7 @@ LRESULT CALLBACK WndProc( HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam
         // rotated the light sources
         info( Red, ">> Starting radiosity raycasted" ) ;
         window->radCore->radiosity( window->scene,
-          FormFactorDetermination::FormFactorsRaycast, MatrixSolverMethod::GaussSeidel ) ;
+          FormFactorDetermination::FormFactorsRaycast, (MatrixSolverMethod)window->radCore->matrixSolverMethod ) ;
       }
       //else info( "Busy" ) ;
       break ;
@@ -0,0 +1,439 @@
+#include "CSRMatrix.h"
+#include <algorithm>
+#include <intrin.h>
+
+// entries gathered up before a WriteFile, out of core
+#define CSR_WRITE_BLOCK (256*1024)
+
+bool cpuHasF16C()
+{
+  static int has = -1 ; // asked once.  2 threads racing here get the same answer
+  if( has < 0 )
+  {
+    int regs[ 4 ] ;
+    __cpuid( regs, 1 ) ;
+    bool f16c = ( regs[2] >> 29 ) & 1 ;
+    bool osxsave = ( regs[2] >> 27 ) & 1 ;
+    has = f16c && osxsave && ( _xgetbv( 0 ) & 6 ) == 6 ;
+  }
+  return has != 0 ;
+}
+
+void CSRRowBuilder::reset( int N )
+{
+  if( dense.size() != N )
+    dense.assign( N, 0.f ) ;
+  touched.clear() ;
+}
+
+CSRMatrix::CSRMatrix()
+{
+  N = 0 ;
+  threshold = 0 ;
+  halfValues = false ;
+  droppedEntries = 0 ;
+
+  colsFile = valsFile = INVALID_HANDLE_VALUE ;
+  colsMapping = valsMapping = 0 ;
+  mappedCols = 0 ;
+  mappedVals = 0 ;
+  mutexWrite = 0 ;
+  nextRowToWrite = 0 ;
+  written = 0 ;
+}
+
+CSRMatrix::~CSRMatrix()
+{
+  closeFiles() ;
+}
+
+void CSRMatrix::begin( int iN, real iThreshold, const string& iDirectory, bool iHalfValues )
+{
+  N = iN ;
+  threshold = iThreshold ;
+  if( iHalfValues && !cpuHasF16C() )
+  {
+    warning( "CSRMatrix: this cpu has no F16C, storing floats instead of half values" ) ;
+    iHalfValues = false ;
+  }
+  halfValues = iHalfValues ;
+  droppedEntries = 0 ;
+  directory = iDirectory ;
+
+  closeFiles() ;
+  rowStart.clear() ;
+  cols.clear() ;
+  vals.clear() ;
+  halfVals.clear() ;
+  pending.clear() ;
+  pending.resize( N ) ;
+
+  if( directory.empty() )  return ;
+
+  // temp files, gone when they're closed (even if we crash)
+  char name[ 64 ] ;
+  sprintf( name, "/csr%lu_%p", GetCurrentProcessId(), this ) ;
+  string path = directory + name ;
+  DWORD flags = FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE | FILE_FLAG_SEQUENTIAL_SCAN ;
+  colsFile = CreateFileA( ( path + ".cols" ).c_str(), GENERIC_READ | GENERIC_WRITE, 0, 0, CREATE_ALWAYS, flags, 0 ) ;
+  valsFile = CreateFileA( ( path + ".vals" ).c_str(), GENERIC_READ | GENERIC_WRITE, 0, 0, CREATE_ALWAYS, flags, 0 ) ;
+  if( colsFile == INVALID_HANDLE_VALUE || valsFile == INVALID_HANDLE_VALUE )
+  {
+    warning( "CSRMatrix: couldn't make the out of core files in `%s`, keeping it in memory", directory.c_str() ) ;
+    closeFiles() ;
+    return ;
+  }
+
+  mutexWrite = CreateMutexA( 0, 0, 0 ) ;
+  rowReady.assign( N, 0 ) ;
+  rowStart.resize( N ) ; // the last one goes on in pack()
+  nextRowToWrite = 0 ;
+  written = 0 ;
+  info( "CSRMatrix: %d rows out of core in `%s`", N, directory.c_str() ) ;
+}
+
+void CSRMatrix::setRow( int row, CSRRowBuilder& builder )
+{
+  if( row < 0 || row >= N )
+  {
+    error( "CSRMatrix: row %d out of bounds (N=%d)", row, N ) ;
+    builder.touched.clear() ;
+    return ;
+  }
+
+  sort( builder.touched.begin(), builder.touched.end() ) ;
+
+  vector<Entry>& out = pending[ row ] ;
+  out.clear() ;
+  int dropped = 0 ;
+  for( int i = 0 ; i < builder.touched.size() ; i++ )
+  {
+    int col = builder.touched[i] ;
+    float val = builder.dense[ col ] ;
+    builder.dense[ col ] = 0 ; // also skips col if it's in touched twice
+    if( !val )  continue ;
+    if( fabs( val ) < threshold )
+    {
+      dropped++ ;
+      continue ;
+    }
+    Entry e = { col, val } ;
+    out.push_back( e ) ;
+  }
+  builder.touched.clear() ;
+
+  // the row won't grow any more
+  vector<Entry>( out ).swap( out ) ;
+
+  if( dropped )
+    InterlockedExchangeAdd( &droppedEntries, dropped ) ;
+
+  if( isOutOfCore() )
+  {
+    MutexLock lock( mutexWrite, INFINITE ) ;
+    rowReady[ row ] = 1 ;
+    writeReadyRows() ;
+  }
+}
+
+// Writes out rows from nextRowToWrite on, for as long as they're ready.
+// Call with mutexWrite held.
+void CSRMatrix::writeReadyRows()
+{
+  for( ; nextRowToWrite < N && rowReady[ nextRowToWrite ] ; nextRowToWrite++ )
+  {
+    vector<Entry>& row = pending[ nextRowToWrite ] ;
+    rowStart[ nextRowToWrite ] = written ;
+    for( int i = 0 ; i < row.size() ; i++ )
+    {
+      colBuf.push_back( row[i].col ) ;
+      if( halfValues )
+        halfBuf.push_back( floatToHalf( row[i].val ) ) ;
+      else
+        valBuf.push_back( row[i].val ) ;
+    }
+    written += row.size() ;
+    vector<Entry>().swap( row ) ;
+
+    if( colBuf.size() >= CSR_WRITE_BLOCK )
+      flushWriteBuffer() ;
+  }
+}
+
+void CSRMatrix::flushWriteBuffer()
+{
+  DWORD bytes ;
+  if( colBuf.size() )
+  {
+    const void *v = halfValues ? (const void*)halfBuf.data() : (const void*)valBuf.data() ;
+    if( !WriteFile( colsFile, colBuf.data(), (DWORD)( colBuf.size()*sizeof(int) ), &bytes, 0 ) ||
+        !WriteFile( valsFile, v, (DWORD)( colBuf.size()*valueSize() ), &bytes, 0 ) )
+      printWindowsLastError( "CSRMatrix: writing out of core rows" ) ;
+  }
+  colBuf.clear() ;
+  valBuf.clear() ;
+  halfBuf.clear() ;
+}
+
+void CSRMatrix::toFloatValues()
+{
+  if( !halfValues )  return ;
+  if( isOutOfCore() )
+  {
+    error( "CSRMatrix: can't decode an out of core half matrix in place" ) ;
+    return ;
+  }
+
+  vals.resize( halfVals.size() ) ;
+  if( vals.size() )
+    halfp2singles( vals.data(), halfVals.data(), (int)halfVals.size() ) ;
+  for( long long k = 0 ; k < vals.size() ; k++ )
+    vals[ k ] *= 1.0f / CSR_HALF_SCALE ;
+
+  vector<Half>().swap( halfVals ) ; // actually give the memory back
+  halfValues = false ;
+}
+
+void CSRMatrix::pack()
+{
+  if( isOutOfCore() )
+  {
+    {
+      MutexLock lock( mutexWrite, INFINITE ) ;
+      // rows never set are empty
+      for( int row = nextRowToWrite ; row < N ; row++ )
+        rowReady[ row ] = 1 ;
+      writeReadyRows() ;
+      flushWriteBuffer() ;
+    }
+    rowStart.push_back( written ) ;
+    vector< vector<Entry> >().swap( pending ) ;
+    vector<char>().swap( rowReady ) ;
+    vector<int>().swap( colBuf ) ;
+    vector<float>().swap( valBuf ) ;
+    vector<Half>().swap( halfBuf ) ;
+
+    mapFiles() ;
+    info( "CSRMatrix: %lld nonzeros in %d x %d (%.3f%% dense), %d below threshold %g dropped, %lld MB on disk%s",
+      written, N, N, N ? 100.0*written/( (real)N*N ) : 0.0, (int)droppedEntries, threshold, sizeInBytes()/(1<<20),
+      halfValues ? " (fp16 values)" : "" ) ;
+    return ;
+  }
+
+  rowStart.resize( N+1 ) ;
+  long long total = 0 ;
+  for( int row = 0 ; row < N ; row++ )
+  {
+    rowStart[ row ] = total ;
+    total += pending[ row ].size() ;
+  }
+  rowStart[ N ] = total ;
+
+  cols.resize( total ) ;
+  if( halfValues )  halfVals.resize( total ) ;
+  else  vals.resize( total ) ;
+  for( int row = 0 ; row < N ; row++ )
+  {
+    long long k = rowStart[ row ] ;
+    for( int i = 0 ; i < pending[ row ].size() ; i++, k++ )
+    {
+      cols[ k ] = pending[ row ][ i ].col ;
+      if( halfValues )
+        halfVals[ k ] = floatToHalf( pending[ row ][ i ].val ) ;
+      else
+        vals[ k ] = pending[ row ][ i ].val ;
+    }
+    vector<Entry>().swap( pending[ row ] ) ; // free it as we go, so peak memory is ~1 copy
+  }
+  vector< vector<Entry> >().swap( pending ) ;
+
+  info( "CSRMatrix: %lld nonzeros in %d x %d (%.3f%% dense), %d below threshold %g dropped, %lld MB%s",
+    total, N, N, N ? 100.0*total/( (real)N*N ) : 0.0, (int)droppedEntries, threshold, sizeInBytes()/(1<<20),
+    halfValues ? " (fp16 values)" : "" ) ;
+}
+
+float CSRMatrix::get( int row, int col ) const
+{
+  const int *lo = colData() + rowStart[ row ], *hi = colData() + rowStart[ row+1 ] ;
+  const int *it = lower_bound( lo, hi, col ) ;
+  if( it == hi || *it != col )  return 0 ;
+  return val( it - colData() ) ;
+}
+
+real CSRMatrix::rowSum( int row ) const
+{
+  real sum = 0 ;
+  for( long long k = rowStart[ row ] ; k < rowStart[ row+1 ] ; k++ )
+    sum += val( k ) ;
+  return sum ;
+}
+
+void CSRMatrix::transpose( CSRMatrix& t ) const
+{
+  // an out of core matrix is one we can't fit twice in RAM
+  t.begin( N, threshold, isOutOfCore() ? directory : "", halfValues ) ;
+  vector< vector<Entry> >().swap( t.pending ) ; // filled straight in, not a row at a time
+
+  const int *c = colData() ;
+
+  // count each column, then prefix sum into t's row starts
+  t.rowStart.assign( N+1, 0 ) ;
+  for( long long k = 0 ; k < nnz() ; k++ )
+    t.rowStart[ c[k] + 1 ]++ ;
+  for( int j = 0 ; j < N ; j++ )
+    t.rowStart[ j+1 ] += t.rowStart[ j ] ;
+
+  if( t.isOutOfCore() )
+  {
+    transposeOutOfCore( t ) ;
+    return ;
+  }
+
+  // going down the rows in order leaves each of t's rows sorted
+  // (halfs are copied as they are, no point decoding & encoding them again)
+  t.cols.resize( nnz() ) ;
+  if( halfValues )  t.halfVals.resize( nnz() ) ;
+  else  t.vals.resize( nnz() ) ;
+  vector<long long> next( t.rowStart.begin(), t.rowStart.end() - 1 ) ;
+  for( int row = 0 ; row < N ; row++ )
+    for( long long k = rowStart[ row ] ; k < rowStart[ row+1 ] ; k++ )
+    {
+      long long dst = next[ c[k] ]++ ;
+      t.cols[ dst ] = row ;
+      if( halfValues )
+        t.halfVals[ dst ] = halfData()[ k ] ;
+      else
+        t.vals[ dst ] = valData()[ k ] ;
+    }
+}
+
+// t's rows get built a band at a time, in its write buffers, and written out
+// in order.  Each band is one pass down this matrix picking out the columns
+// in the band, so only a band is ever in memory.  A band is at least
+// CSR_TRANSPOSE_BAND entries and at least 1/16th of the matrix (so it's
+// at most ~16 passes over the file), capped at CSR_TRANSPOSE_BAND_MAX.
+void CSRMatrix::transposeOutOfCore( CSRMatrix& t ) const
+{
+  const int *c = colData() ;
+  long long band = max( (long long)CSR_TRANSPOSE_BAND, nnz()/16 ) ;
+  band = min( band, (long long)CSR_TRANSPOSE_BAND_MAX ) ;
+
+  vector<long long> next( N ) ;
+  int passes = 0 ;
+  for( int j0 = 0 ; j0 < N ; passes++ )
+  {
+    // as many of t's rows as fit in the band, but always at least 1
+    int j1 = j0+1 ;
+    while( j1 < N && t.rowStart[ j1+1 ] - t.rowStart[ j0 ] <= band )
+      j1++ ;
+    long long k0 = t.rowStart[ j0 ] ;
+    long long count = t.rowStart[ j1 ] - k0 ;
+
+    t.colBuf.resize( count ) ;
+    if( halfValues )  t.halfBuf.resize( count ) ;
+    else  t.valBuf.resize( count ) ;
+    for( int j = j0 ; j < j1 ; j++ )
+      next[ j ] = t.rowStart[ j ] - k0 ;
+
+    // going down the rows in order leaves each of t's rows sorted
+    for( int row = 0 ; row < N ; row++ )
+    {
+      streamRows( row, N ) ;
+      for( long long k = rowStart[ row ] ; k < rowStart[ row+1 ] ; k++ )
+      {
+        int col = c[ k ] ;
+        if( col < j0 || col >= j1 )  continue ;
+        long long dst = next[ col ]++ ;
+        t.colBuf[ dst ] = row ;
+        if( halfValues )
+          t.halfBuf[ dst ] = halfData()[ k ] ;
+        else
+          t.valBuf[ dst ] = valData()[ k ] ;
+      }
+    }
+
+    t.flushWriteBuffer() ;
+    j0 = j1 ;
+  }
+
+  // what pack() does at the end, the rows are all in
+  t.written = nnz() ;
+  vector<char>().swap( t.rowReady ) ;
+  vector<int>().swap( t.colBuf ) ;
+  vector<float>().swap( t.valBuf ) ;
+  vector<Half>().swap( t.halfBuf ) ;
+  t.mapFiles() ;
+  info( "CSRMatrix: transposed %lld nonzeros out of core in %d pass(es)", t.written, passes ) ;
+}
+
+long long CSRMatrix::sizeInBytes() const
+{
+  return rowStart.size()*sizeof(long long) + nnz()*( sizeof(int) + valueSize() ) ;
+}
+
+void CSRMatrix::prefetchRows( int row0, int row1 ) const
+{
+  row1 = min( row1, N ) ;
+  if( !mappedCols || row0 >= row1 )  return ;
+
+  long long k0 = rowStart[ row0 ], k1 = rowStart[ row1 ] ;
+  if( k1 <= k0 )  return ;
+
+  WIN32_MEMORY_RANGE_ENTRY ranges[ 2 ] ;
+  ranges[0].VirtualAddress = (PVOID)( mappedCols + k0 ) ;
+  ranges[0].NumberOfBytes = ( k1 - k0 )*sizeof(int) ;
+  ranges[1].VirtualAddress = (PVOID)( (const char*)mappedVals + k0*valueSize() ) ;
+  ranges[1].NumberOfBytes = ( k1 - k0 )*valueSize() ;
+  PrefetchVirtualMemory( GetCurrentProcess(), 2, ranges, 0 ) ; // only a hint, fine if it fails
+}
+
+void CSRMatrix::mapFiles()
+{
+  if( !written )  return ; // an empty file can't be mapped, and there's nothing to read
+
+  colsMapping = CreateFileMappingA( colsFile, 0, PAGE_READONLY, 0, 0, 0 ) ;
+  valsMapping = CreateFileMappingA( valsFile, 0, PAGE_READONLY, 0, 0, 0 ) ;
+  if( colsMapping )  mappedCols = (const int*)MapViewOfFile( colsMapping, FILE_MAP_READ, 0, 0, 0 ) ;
+  if( valsMapping )  mappedVals = MapViewOfFile( valsMapping, FILE_MAP_READ, 0, 0, 0 ) ;
+  if( mappedCols && mappedVals )  return ;
+
+  // Couldn't map them (out of address space?).  Read them
+  // back in, it's no worse than not being out of core at all.
+  printWindowsLastError( "CSRMatrix: couldn't map the out of core rows, reading them into memory" ) ;
+  cols.resize( written ) ;
+  if( halfValues )  halfVals.resize( written ) ;
+  else  vals.resize( written ) ;
+  HANDLE files[ 2 ] = { colsFile, valsFile } ;
+  char *dst[ 2 ] = { (char*)cols.data(), halfValues ? (char*)halfVals.data() : (char*)vals.data() } ;
+  long long size[ 2 ] = { written*sizeof(int), written*valueSize() } ;
+  for( int f = 0 ; f < 2 ; f++ )
+  {
+    SetFilePointer( files[ f ], 0, 0, FILE_BEGIN ) ;
+    long long left = size[ f ] ;
+    for( DWORD got ; left > 0 ; left -= got, dst[ f ] += got )
+      if( !ReadFile( files[ f ], dst[ f ], (DWORD)min( left, 1LL<<30 ), &got, 0 ) || !got )
+      {
+        printWindowsLastError( "CSRMatrix: reading back the out of core rows" ) ;
+        break ;
+      }
+  }
+  closeFiles() ;
+}
+
+void CSRMatrix::closeFiles()
+{
+  if( mappedCols )  UnmapViewOfFile( mappedCols ) ;
+  if( mappedVals )  UnmapViewOfFile( mappedVals ) ;
+  if( colsMapping )  CloseHandle( colsMapping ) ;
+  if( valsMapping )  CloseHandle( valsMapping ) ;
+  if( colsFile != INVALID_HANDLE_VALUE )  CloseHandle( colsFile ) ; // deletes it
+  if( valsFile != INVALID_HANDLE_VALUE )  CloseHandle( valsFile ) ;
+  if( mutexWrite )  CloseHandle( mutexWrite ) ;
+
+  colsFile = valsFile = INVALID_HANDLE_VALUE ;
+  colsMapping = valsMapping = 0 ;
+  mappedCols = 0 ;
+  mappedVals = 0 ;
+  mutexWrite = 0 ;
+  written = 0 ;
+}
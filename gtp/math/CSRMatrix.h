@@ -0,0 +1,184 @@
+#ifndef CSRMATRIX_H
+#define CSRMATRIX_H
+
+#include "../util/StdWilUtil.h"
+#include <immintrin.h>
+
+// Accumulates one row of a sparse matrix.  add() is O(1): a dense
+// scratch row of N floats plus the list of columns that got touched,
+// so a hemicube or a raycast can hit the same column thousands of times
+// without a map lookup.  Keep one per thread and reuse it.
+struct CSRRowBuilder
+{
+  vector<float> dense ;
+  vector<int> touched ;
+
+  // sizes the scratch row for an N column matrix (no-op if already that size)
+  void reset( int N ) ;
+
+  inline void add( int col, float val )
+  {
+    if( !dense[ col ] )  touched.push_back( col ) ;
+    dense[ col ] += val ;
+  }
+} ;
+
+// the solvers prefetch this many rows ahead of themselves from an out of core matrix
+#define CSR_PREFETCH_ROWS 256
+
+// An out of core transpose holds at least this many entries in memory at
+// once (see transposeOutOfCore), and never more than CSR_TRANSPOSE_BAND_MAX.
+#define CSR_TRANSPOSE_BAND     (1<<24)
+#define CSR_TRANSPOSE_BAND_MAX (1<<28)
+
+// Half precision values are stored times this.  Form factors are <= 1, and
+// the ones kept go down to the threshold (1e-6 or so), way under fp16's
+// smallest normal number (6e-5), where it starts losing bits.  Times 2^12
+// everything from 1.5e-8 up to 1 is normal, and a power of 2 scales exactly.
+#define CSR_HALF_SCALE 4096.0f
+
+typedef unsigned short Half ;
+
+// Encoding is off the hot path, so it's StdWilUtil's singles2halfp
+// (rounds to nearest).  Decoding is in the solvers' inner loops, so it's
+// F16C, which every x64 cpu since Ivy Bridge / Piledriver has.  Not every
+// cpu we might run on though, so check cpuHasF16C() before making a half
+// matrix: begin() does, and stores floats instead without it.
+
+// cpuid leaf 1 ECX bit 29, and the OS saving the YMM registers (F16C is VEX encoded)
+bool cpuHasF16C() ;
+
+inline Half floatToHalf( float v )
+{
+  Half h ;
+  v *= CSR_HALF_SCALE ;
+  singles2halfp( &h, &v, 1 ) ;
+  return h ;
+}
+inline float halfToFloat( Half h ) { return _cvtsh_ss( h ) * ( 1.0f / CSR_HALF_SCALE ) ; }
+
+// either kind of stored value as a float, for loops templated on which one it is
+inline float csrValue( float v ) { return v ; }
+inline float csrValue( Half h ) { return halfToFloat( h ) ; }
+
+// Compressed sparse row matrix of floats, N x N.
+//
+// Row i's nonzeros are colData()/valData()[ rowStart[i] .. rowStart[i+1] ), sorted by column.
+// The matrix is built a row at a time: setRow() may be called for the rows in
+// any order and from any thread (as long as each row has one writer), and
+// pack() then lays the rows end to end.  Nothing can be read before pack().
+//
+// Out of core: begin() with a directory keeps cols & vals in 2 temp files
+// there instead of in cols/vals.  Rows are written out in order as soon as
+// every row before them is in (the jobs finish roughly in order, so only a
+// few rows wait in memory), and pack() maps the files read only, so the
+// matrix can be bigger than RAM and gets paged in as the solvers stream
+// over it.  The files are deleted when the matrix is.
+//
+// Half values: begin() with halfValues keeps the values as fp16 (see
+// CSR_HALF_SCALE) in halfVals instead of vals, 6 bytes an entry instead
+// of 8.  ~3 significant digits is plenty for a form factor.  Read them
+// through halfData(), or val(k) where speed doesn't matter.
+struct CSRMatrix
+{
+  int N ;
+  vector<long long> rowStart ; // N+1 of them.  500k rows * 5k entries overflows an int
+  vector<int> cols ;    // empty when out of core,
+  vector<float> vals ;  // read through colData()/valData()
+  vector<Half> halfVals ; // (or halfData()), only one of vals/halfVals is used
+  bool halfValues ;
+
+  // setRow() drops entries smaller than this
+  real threshold ;
+
+  CSRMatrix() ;
+  ~CSRMatrix() ;
+
+  // starts an empty N x N matrix, in memory, or out of core in directory.
+  // (If the files can't be made there, it warns and stays in memory.)
+  void begin( int iN, real iThreshold, const string& directory="", bool iHalfValues=false ) ;
+
+  // decodes halfVals into vals without F16C (StdWilUtil's halfp2singles),
+  // for a half matrix read back on a cpu that can't use it.  In memory only.
+  void toFloatValues() ;
+
+  // takes row's entries (and clears row, ready for the next one)
+  void setRow( int row, CSRRowBuilder& builder ) ;
+
+  // packs the rows set so far into cols/vals.  Rows never set are empty.
+  void pack() ;
+
+  inline bool isPacked() const { return rowStart.size() == N+1 ; }
+  inline bool isOutOfCore() const { return colsFile != INVALID_HANDLE_VALUE ; }
+  inline long long nnz() const { return isOutOfCore() ? written : (long long)cols.size() ; }
+  inline const int* colData() const { return isOutOfCore() ? mappedCols : cols.data() ; }
+  inline const float* valData() const { return isOutOfCore() ? (const float*)mappedVals : vals.data() ; }
+  inline const Half* halfData() const { return isOutOfCore() ? (const Half*)mappedVals : halfVals.data() ; }
+  inline int valueSize() const { return halfValues ? sizeof(Half) : sizeof(float) ; }
+
+  // stored value k, whichever way it's stored
+  inline float val( long long k ) const { return halfValues ? halfToFloat( halfData()[k] ) : valData()[k] ; }
+  inline long long rowBegin( int row ) const { return rowStart[ row ] ; }
+  inline long long rowEnd( int row ) const { return rowStart[ row+1 ] ; }
+
+  // entry (row,col), 0 if it isn't stored.  Binary search of the row.
+  float get( int row, int col ) const ;
+
+  real rowSum( int row ) const ;
+
+  // t = this transposed (packed), so t's row j is this one's column j.
+  // If this is out of core, so is t, in the same directory.
+  void transpose( CSRMatrix& t ) const ;
+
+  long long sizeInBytes() const ;
+
+  // Asks for rows [row0,row1) to start coming in off disk, because
+  // they're about to be read in order.  Does nothing in memory.
+  void prefetchRows( int row0, int row1 ) const ;
+
+  // For a loop reading rows in order up to end: every CSR_PREFETCH_ROWS
+  // rows, prefetches the next CSR_PREFETCH_ROWS.
+  inline void streamRows( int row, int end ) const
+  {
+    if( mappedCols && !( row % CSR_PREFETCH_ROWS ) )
+      prefetchRows( row + CSR_PREFETCH_ROWS, min( row + 2*CSR_PREFETCH_ROWS, end ) ) ;
+  }
+
+private:
+  struct Entry
+  {
+    int col ;
+    float val ;
+  } ;
+
+  // the rows as they come in, freed by pack()
+  // (out of core, freed as soon as they're written)
+  vector< vector<Entry> > pending ;
+  volatile LONG droppedEntries ;
+
+  // out of core
+  string directory ;        // where begin() put the files, for transpose()
+  HANDLE colsFile, valsFile ;
+  HANDLE colsMapping, valsMapping ;
+  const int *mappedCols ;
+  const void *mappedVals ;  // floats or Halfs
+  HANDLE mutexWrite ;
+  vector<char> rowReady ;   // setRow() is done with it (guarded by mutexWrite)
+  int nextRowToWrite ;
+  long long written ;       // entries written (or buffered) so far
+  vector<int> colBuf ;      // rows waiting to go out in one WriteFile
+  vector<float> valBuf ;
+  vector<Half> halfBuf ;
+
+  void writeReadyRows() ;
+  void flushWriteBuffer() ;
+  void transposeOutOfCore( CSRMatrix& t ) const ;
+  void mapFiles() ;
+  void closeFiles() ;
+
+  // owns files & mappings
+  CSRMatrix( const CSRMatrix& ) ;
+  CSRMatrix& operator=( const CSRMatrix& ) ;
+} ;
+
+#endif
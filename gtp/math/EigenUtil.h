@@ -17,6 +17,11 @@
 #include "IterativeSolverJacobi.h"
 #include "IterativeSolverSeidel.h"
 #include "IterativeSolverSouthwell.h"
+#include "IterativeSolverParallelJacobi.h"
+#include "IterativeSolverParallelSeidel.h"
+#include "IterativeSolverSeidelRGB.h"
+#include "IterativeSolverBiCGSTAB.h"
+#include "IterativeSolverGMRES.h"
 
 void printMat( const Eigen::MatrixXf & mat ) ;
 
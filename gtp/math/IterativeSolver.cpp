@@ -1,12 +1,12 @@
 #include "IterativeSolver.h"
 
-IterativeSolver::IterativeSolver( const Eigen::MatrixXf * A_System,
+IterativeSolver::IterativeSolver( const RadiositySystem * A_System,
   const Eigen::VectorXf * b_solution,
   Eigen::VectorXf * xVariable,
   real iTolerance )
 {
   A = A_System ;
-  N = A->rows() ;
+  N = A->size() ;
 
   b = b_solution ;
   xGuess = xVariable ;
@@ -38,7 +38,8 @@ Eigen::VectorXf* IterativeSolver::getSolutionX()
 void IterativeSolver::updateResidual()
 {
   // if the xGuess IS a solution, then A*xGuess IS b.
-  *residual = ((*A)*(*xGuess)) - (*b) ;
+  A->multiply( *xGuess, *residual ) ;
+  *residual -= *b ;
   // if this is the zero vector then the approximation
   // xGuess is perfect
 }
@@ -84,35 +85,26 @@ IterativeSolver::SolutionState IterativeSolver::checkConvergence() // does not r
   return solutionState ;
 }
 
-/// Returns true if a Eigen::MatrixXf is
+/// Returns true if A is
 /// diagonally dominant.  DD is
 /// a sufficient condition for
 /// convergence with the Gauss-Seidel method.
-bool IterativeSolver::isDiagonallyDominant( const Eigen::MatrixXf * mat )
+bool IterativeSolver::isDiagonallyDominant()
 {
-  return isDiagonallyDominant( mat, 0 ) ;
+  return isDiagonallyDominant( 0 ) ;
 }
 
-/// Tells you if the matrix is DD,
+/// Tells you if A is DD,
 /// and returns the first row that
 /// was not DD
-bool IterativeSolver::isDiagonallyDominant( const Eigen::MatrixXf * mat, int *rowNotDD )
+bool IterativeSolver::isDiagonallyDominant( int *rowNotDD )
 {
-  if( mat->rows() != mat->cols() )
-    return false ; // non-square
-
-  for( int i = 0 ; i < mat->rows() ; i++ )
+  // (A is always square)
+  for( int i = 0 ; i < N ; i++ )
   {
-    real rowSum = 0.0 ;
-    for( int j = 0 ; j < mat->cols() ; j++ )
-    {
-      if( j == i )
-        continue ;
-      else
-        rowSum += fabs( (*mat)( i, j ) ) ;
-    }
+    real rowSum = A->offDiagonalAbsSum( i ) ;
 
-    if( fabs( (*mat)(i,i) ) < rowSum )
+    if( fabs( A->diagonal( i ) ) < rowSum )
     {
       // give back the row# that was not DD
       if( rowNotDD )  *rowNotDD = i ; 
@@ -9,6 +9,7 @@
 
 #include "../Globals.h"
 #include "../util/StdWilUtil.h"
+#include "RadiositySystem.h"
 
 class IterativeSolver
 {
@@ -51,8 +52,10 @@ protected:
   /// huge waste of memory.
   /// The IterativeSolver
   /// series of classes will never
-  /// modify the system A
-  const Eigen::MatrixXf * A ;
+  /// modify the system A.
+  /// A is I - rho*F, read a row at
+  /// a time from the sparse F.
+  const RadiositySystem * A ;
   
   /// The solution vector that we
   /// want A*x = b.
@@ -106,7 +109,7 @@ public:
 public:
   // xVariable is the memory space to put the unknown 'x'
   // in Ax=b.
-  IterativeSolver( const Eigen::MatrixXf * A_System,
+  IterativeSolver( const RadiositySystem * A_System,
     const Eigen::VectorXf * b_solution,
     Eigen::VectorXf * xVariable,
     real iTolerance ) ;
@@ -128,16 +131,16 @@ public:
 
   SolutionState checkConvergence() ;
 
-  /// Returns true if a Eigen::MatrixXf is
+  /// Returns true if A is
   /// diagonally dominant.  DD is
   /// a sufficient condition for
   /// convergence with the Gauss-Seidel method.
-  bool isDiagonallyDominant( const Eigen::MatrixXf * mat ) ;
+  bool isDiagonallyDominant() ;
 
-  /// Tells you if the matrix is DD,
+  /// Tells you if A is DD,
   /// and returns the first row that
   /// was not DD
-  bool isDiagonallyDominant( const Eigen::MatrixXf * mat, int *rowNotDD ) ;
+  bool isDiagonallyDominant( int *rowNotDD ) ;
 
   /// Completely solves the system to
   /// the tolerance precision you have
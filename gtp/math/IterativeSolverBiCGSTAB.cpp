@@ -0,0 +1,161 @@
+#include "IterativeSolverBiCGSTAB.h"
+
+// dot products of 10^5 floats need a double to add up in
+static real dotd( const Eigen::VectorXf& a, const Eigen::VectorXf& b )
+{
+  real sum = 0 ;
+  for( int i = 0 ; i < a.size() ; i++ )
+    sum += (real)a( i ) * b( i ) ;
+  return sum ;
+}
+
+IterativeSolverBiCGSTAB::IterativeSolverBiCGSTAB(
+  const RadiositySystem *A_System,
+  const Eigen::VectorXf *b_solution,
+  Eigen::VectorXf * xVariable,
+  real iTolerance
+  ) : IterativeSolver( A_System, b_solution, xVariable, iTolerance )
+{
+  rho = alpha = omega = 1 ;
+  needRestart = breakdown = false ;
+}
+
+void IterativeSolverBiCGSTAB::solve() // override
+{
+  xGuess->setConstant( 0.0 ) ;
+  residual = new Eigen::VectorXf( N ) ;
+
+  invDiag.resize( N ) ;
+  for( int i = 0 ; i < N ; i++ )
+    invDiag( i ) = 1.0f / A->diagonal( i ) ;
+
+  restart() ;
+  norm2 = lastNorm2 = dotd( r, r ) ;
+
+  // b = 0 (a channel with no lights in it) is solved by x = 0 already,
+  // and the first step would be 0/0
+  if( IsNear( norm2, 0, tolerance ) )
+    solutionState = Converged ;
+
+  // it can stall, where the stationary methods can't,
+  // so it doesn't get to go forever
+  long long maxIterations = max( N, 100 ) ;
+  iteration = 0 ;
+
+  while( solutionState != Converged &&
+          solutionState != Diverged )
+  {
+    if( iteration >= maxIterations )
+    {
+      warning( "BiCGSTAB stopped after %lld iterations, |r|^2=%g", iteration, norm2 ) ;
+      break ;
+    }
+
+    IterativeSolverBiCGSTAB::preIterate() ;
+    IterativeSolverBiCGSTAB::iterate() ;
+    IterativeSolverBiCGSTAB::postIterate() ;
+
+    info( "BiCGSTAB iteration %lld, |r|^2=%g", iteration, norm2 ) ;
+
+    if( breakdown )
+    {
+      warning( "BiCGSTAB broke down after %lld iterations, stopping with |r|^2=%g", iteration, norm2 ) ;
+      break ;
+    }
+  }
+
+  info( "%d iterations, BiCGSTAB method", iteration ) ;
+  DESTROY( residual ) ;
+}
+
+void IterativeSolverBiCGSTAB::restart()
+{
+  // r = b - A x
+  A->multiply( *xGuess, r ) ;
+  r = *b - r ;
+  rHat = r ;
+  p.setZero( N ) ;
+  v.setZero( N ) ;
+  rho = alpha = omega = 1 ;
+  needRestart = false ;
+}
+
+void IterativeSolverBiCGSTAB::preIterate()
+{
+  iteration++ ;
+}
+
+void IterativeSolverBiCGSTAB::iterate() // override
+{
+  real rhoNext = dotd( rHat, r ) ;
+  bool restarted = false ;
+  if( rhoNext == 0 || needRestart )
+  {
+    // r came out orthogonal to rHat (or the last step hit a 0),
+    // the recurrence can't go on.  Start again from where x has got to.
+    // After a restart rHat = r, so rhoNext = 0 then means r = 0: x is
+    // exact, and postIterate will find it converged.
+    restart() ;
+    restarted = true ;
+    rhoNext = dotd( rHat, r ) ;
+    if( rhoNext == 0 )
+      return ;
+  }
+
+  real beta = ( rhoNext / rho ) * ( alpha / omega ) ;
+  rho = rhoNext ;
+
+  p = r + (float)beta * ( p - (float)omega * v ) ;
+  y = invDiag.cwiseProduct( p ) ;
+  A->multiply( y, v ) ;
+  real rHatV = dotd( rHat, v ) ;
+  if( rHatV == 0 )
+  {
+    // alpha would be rho/0.  Nothing moved yet, so restart next
+    // step, unless this step was a restart: then it's stuck.
+    if( restarted )  breakdown = true ;
+    else  needRestart = true ;
+    return ;
+  }
+  alpha = rho / rHatV ;
+
+  s = r - (float)alpha * v ;
+  if( IsNear( dotd( s, s ), 0, tolerance ) )
+  {
+    // half a step was enough
+    *xGuess += (float)alpha * y ;
+    r = s ;
+    return ;
+  }
+
+  z = invDiag.cwiseProduct( s ) ;
+  A->multiply( z, t ) ;
+  real tt = dotd( t, t ) ;
+  omega = tt ? dotd( t, s ) / tt : 0 ;
+
+  *xGuess += (float)alpha * y + (float)omega * z ;
+  r = s - (float)omega * t ;
+
+  // the next beta divides by omega
+  if( omega == 0 )
+    needRestart = true ;
+}
+
+void IterativeSolverBiCGSTAB::postIterate()
+{
+  *residual = -r ;
+  checkConvergence() ;
+
+  // r is updated by recurrence, it drifts away from the
+  // real b - A x.  Don't believe it until it's checked.
+  if( solutionState == Converged )
+  {
+    updateResidual() ;
+    checkConvergence() ;
+    if( solutionState != Converged )
+      restart() ;
+  }
+
+  // The residual of BiCGSTAB goes up as well as down, that's
+  // not diverging, only a NaN is.
+}
@@ -0,0 +1,55 @@
+#ifndef ITERATIVE_SOLVER_BICGSTAB_H
+#define ITERATIVE_SOLVER_BICGSTAB_H
+
+#include "IterativeSolver.h"
+
+class IterativeSolver ;
+
+/// BiCGSTAB (van der Vorst 92), preconditioned by the diagonal of A.
+///
+/// Jacobi and Gauss-Seidel shave off a factor of about the
+/// spectral radius of rho F each sweep, so a white room (rho
+/// near 1, light bouncing around for ages) takes hundreds of sweeps.
+/// A Krylov method doesn't care nearly as much.  Matrix free: all it
+/// ever does with A is 2 A*x a iteration, through the RadiositySystem.
+class IterativeSolverBiCGSTAB : public IterativeSolver
+{
+  /// r = b - A x (the opposite sign to *residual), and
+  /// the rest of BiCGSTAB's vectors
+  Eigen::VectorXf r, rHat, p, v, s, t, y, z ;
+
+  /// 1/A(i,i), the preconditioner
+  Eigen::VectorXf invDiag ;
+
+  real rho, alpha, omega ;
+
+  /// the last step divided by 0 (rHat.v or omega), so the
+  /// next one starts the recurrences over instead
+  bool needRestart ;
+
+  /// even a fresh restart divides by 0, x is as good as it gets
+  bool breakdown ;
+
+public:
+  IterativeSolverBiCGSTAB(
+    const RadiositySystem *A_System,
+    const Eigen::VectorXf *b_solution,
+    Eigen::VectorXf * xVariable,
+    real iTolerance
+    ) ;
+
+  void solve() ;
+
+  void preIterate() ;
+
+  /// one BiCGSTAB step (2 A*x)
+  void iterate() ;
+
+  void postIterate() ;
+
+private:
+  /// starts the recurrences over from r = b - A x
+  void restart() ;
+} ;
+
+#endif
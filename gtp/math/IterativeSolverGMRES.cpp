@@ -0,0 +1,161 @@
+#include "IterativeSolverGMRES.h"
+
+IterativeSolverGMRES::IterativeSolverGMRES(
+  const RadiositySystem *A_System,
+  const Eigen::VectorXf *b_solution,
+  Eigen::VectorXf * xVariable,
+  real iTolerance,
+  int iRestart
+  ) : IterativeSolver( A_System, b_solution, xVariable, iTolerance )
+{
+  m = max( 1, iRestart ) ;
+  j = -1 ; // no cycle going
+  breakdown = false ;
+}
+
+void IterativeSolverGMRES::solve() // override
+{
+  xGuess->setConstant( 0.0 ) ;
+  residual = new Eigen::VectorXf( N ) ;
+
+  invDiag.resize( N ) ;
+  for( int i = 0 ; i < N ; i++ )
+    invDiag( i ) = 1.0f / A->diagonal( i ) ;
+
+  V.resize( N, m+1 ) ;
+  H.resize( m+1, m ) ;
+  cs.resize( m ) ;
+  sn.resize( m ) ;
+  g.resize( m+1 ) ;
+
+  updateResidual() ;
+  norm2 = lastNorm2 = residual->dot( *residual ) ;
+
+  // b = 0 (a channel with no lights in it) is solved by x = 0 already,
+  // and the first basis vector would be r/|r| = 0/0
+  if( IsNear( norm2, 0, tolerance ) )
+    solutionState = Converged ;
+
+  long long maxIterations = max( N, 100 ) ;
+  iteration = 0 ;
+
+  while( solutionState != Converged &&
+          solutionState != Diverged )
+  {
+    if( iteration >= maxIterations )
+    {
+      warning( "GMRES(%d) stopped after %lld iterations, |r|^2=%g", m, iteration, norm2 ) ;
+      if( j >= 0 )  finishCycle() ;
+      break ;
+    }
+
+    IterativeSolverGMRES::preIterate() ;
+    IterativeSolverGMRES::iterate() ;
+    IterativeSolverGMRES::postIterate() ;
+
+    info( "GMRES(%d) iteration %lld, |r|^2=%g", m, iteration, norm2 ) ;
+  }
+
+  info( "%d iterations, GMRES(%d) method", iteration, m ) ;
+  DESTROY( residual ) ;
+}
+
+void IterativeSolverGMRES::preIterate()
+{
+  iteration++ ;
+  if( j >= 0 )  return ;
+
+  // new cycle, from the residual of where x is now.
+  // *residual is A x - b, the basis starts from b - A x
+  real beta = sqrt( residual->cast<double>().squaredNorm() ) ;
+  H.setZero() ;
+  g.setZero() ;
+  g( 0 ) = beta ;
+  j = 0 ;
+  breakdown = false ;
+  if( !beta )
+  {
+    // x is exact already, there's nothing to build a basis from.
+    // postIterate ends the (empty) cycle, and the real residual
+    // of 0 converges it.
+    breakdown = true ;
+    return ;
+  }
+  V.col( 0 ) = -*residual / (float)beta ;
+}
+
+void IterativeSolverGMRES::iterate() // override
+{
+  if( breakdown )  return ; // preIterate found r = 0
+
+  // w = A M^-1 v_j
+  Eigen::VectorXf w ;
+  Eigen::VectorXf z = invDiag.cwiseProduct( V.col( j ) ) ;
+  A->multiply( z, w ) ;
+
+  // modified Gram-Schmidt against the basis so far
+  for( int i = 0 ; i <= j ; i++ )
+  {
+    H( i, j ) = V.col( i ).cast<double>().dot( w.cast<double>() ) ;
+    w -= (float)H( i, j ) * V.col( i ) ;
+  }
+  H( j+1, j ) = sqrt( w.cast<double>().squaredNorm() ) ;
+  // nothing left over: the basis spans the answer, x is exact
+  breakdown = !H( j+1, j ) ;
+  if( !breakdown )
+    V.col( j+1 ) = w / (float)H( j+1, j ) ;
+
+  // the earlier rotations on the new column
+  for( int i = 0 ; i < j ; i++ )
+  {
+    real h = cs( i )*H( i, j ) + sn( i )*H( i+1, j ) ;
+    H( i+1, j ) = -sn( i )*H( i, j ) + cs( i )*H( i+1, j ) ;
+    H( i, j ) = h ;
+  }
+
+  // and a new one to zero H(j+1,j)
+  real hyp = sqrt( H( j, j )*H( j, j ) + H( j+1, j )*H( j+1, j ) ) ;
+  cs( j ) = hyp ? H( j, j ) / hyp : 1 ;
+  sn( j ) = hyp ? H( j+1, j ) / hyp : 0 ;
+  H( j, j ) = hyp ;
+  H( j+1, j ) = 0 ;
+  g( j+1 ) = -sn( j ) * g( j ) ;
+  g( j ) = cs( j ) * g( j ) ;
+
+  j++ ;
+
+  // |g(j)| is the residual, without having to form x
+  norm2 = g( j )*g( j ) ;
+}
+
+void IterativeSolverGMRES::postIterate()
+{
+  // keep going while the cycle has room, the basis didn't run
+  // out, and the estimate isn't in tolerance
+  if( j < m && !IsNear( norm2, 0, tolerance ) && !breakdown )
+    return ;
+
+  finishCycle() ;
+}
+
+void IterativeSolverGMRES::finishCycle()
+{
+  // back substitute the upper triangular H y = g
+  Eigen::VectorXd yy( j ) ;
+  for( int i = j-1 ; i >= 0 ; i-- )
+  {
+    real sum = g( i ) ;
+    for( int k = i+1 ; k < j ; k++ )
+      sum -= H( i, k ) * yy( k ) ;
+    yy( i ) = H( i, i ) ? sum / H( i, i ) : 0 ;
+  }
+
+  // x += M^-1 V y
+  Eigen::VectorXf dx = V.leftCols( j ) * yy.cast<float>() ;
+  *xGuess += invDiag.cwiseProduct( dx ) ;
+  j = -1 ;
+
+  // the real residual, for the convergence check and the next cycle
+  updateResidual() ;
+  checkConvergence() ;
+}
@@ -0,0 +1,62 @@
+#ifndef ITERATIVE_SOLVER_GMRES_H
+#define ITERATIVE_SOLVER_GMRES_H
+
+#include "IterativeSolver.h"
+
+class IterativeSolver ;
+
+/// Restarted GMRES(m) (Saad & Schultz 86), right preconditioned
+/// by the diagonal of A.  Finds the x in the Krylov space that
+/// has the smallest residual, so the residual never goes up inside a
+/// cycle, unlike BiCGSTAB's.  Costs one A*x an iteration, plus keeping
+/// m+1 basis vectors: after m it starts again from where x got to.
+/// Matrix free, A is only touched through the RadiositySystem.
+class IterativeSolverGMRES : public IterativeSolver
+{
+  /// iterations before a restart
+  int m ;
+
+  /// the Krylov basis, a column each
+  Eigen::MatrixXf V ;
+
+  /// the Hessenberg matrix, rotated upper triangular as it goes
+  Eigen::MatrixXd H ;
+
+  /// the Givens rotations, and the rotated rhs |r0| e1
+  Eigen::VectorXd cs, sn, g ;
+
+  /// 1/A(i,i), the preconditioner
+  Eigen::VectorXf invDiag ;
+
+  /// column of V being built this cycle
+  int j ;
+
+  /// the last Arnoldi step had nothing left to add to the basis
+  bool breakdown ;
+
+public:
+  IterativeSolverGMRES(
+    const RadiositySystem *A_System,
+    const Eigen::VectorXf *b_solution,
+    Eigen::VectorXf * xVariable,
+    real iTolerance,
+    int iRestart
+    ) ;
+
+  void solve() ;
+
+  /// starts a cycle if one isn't going
+  void preIterate() ;
+
+  /// one Arnoldi step (1 A*x)
+  void iterate() ;
+
+  /// ends the cycle if it's full or done
+  void postIterate() ;
+
+private:
+  /// x += M^-1 V y for the j columns so far, then r = A x - b for real
+  void finishCycle() ;
+} ;
+
+#endif
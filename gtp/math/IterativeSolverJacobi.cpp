@@ -1,7 +1,7 @@
 #include "IterativeSolverJacobi.h"
 
 IterativeSolverJacobi::IterativeSolverJacobi(
-  const Eigen::MatrixXf *A_System,
+  const RadiositySystem *A_System,
   const Eigen::VectorXf *b_solution,
   Eigen::VectorXf * xVariable,
   real iTolerance
@@ -29,7 +29,7 @@ void IterativeSolverJacobi::solve() // override
   norm2 = lastNorm2 = residual->dot( *residual ) ;
 
   // check first for diagonal dominance
-  if( !isDiagonallyDominant( A ) )
+  if( !isDiagonallyDominant() )
     warning( "Your matrix A is not diagonally dominant.  A solution is not guaranteed" ) ; //!! This warning should be removed
 
   iteration = 0 ;
@@ -68,16 +68,12 @@ void IterativeSolverJacobi::iterate() // override
 {
   // the definition for a single iteration
   // of the Jacobi method:
-  real sum = 0.0 ;
-
-  // for all j EXCEPT j!=i
-  for( int j = 0 ; j < curRow ; j++ )
-    sum += (*A)(curRow,j)*(*xGuess)(j) ;
-  for( int j = curRow+1 ; j < N ; j++ )
-    sum += (*A)(curRow,j)*(*xGuess)(j) ;
+  // for all j EXCEPT j!=i (only the nonzeros of the row are visited)
+  A->F->streamRows( (int)curRow, N ) ;
+  real sum = A->offDiagonalDot( curRow, *xGuess ) ;
 
   (*xNext)(curRow) = ( (*b)(curRow) - sum ) /
-                  (*A)( curRow, curRow ) ;
+                  A->diagonal( curRow ) ;
 
 #if ITERATIVE_SOLVERS_SHOW_PROGRESS_CONSOLE
   printf( "Jacobi iteration %lld, norm2=%f\r",
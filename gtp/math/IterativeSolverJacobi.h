@@ -11,7 +11,7 @@ class IterativeSolverJacobi : public IterativeSolver
 
 public:
   IterativeSolverJacobi(
-    const Eigen::MatrixXf *A_System,
+    const RadiositySystem *A_System,
     const Eigen::VectorXf *b_solution,
     Eigen::VectorXf * xVariable,
     real iTolerance
@@ -0,0 +1,86 @@
+#include "IterativeSolverParallelJacobi.h"
+#include "../threading/ThreadPool.h"
+
+// A row of A has a nonzero for every patch the row's
+// patch can see, so a job of this many rows is plenty
+// to be worth dequeuing, and there are still lots of jobs
+// to go around so the threads finish together.
+#define PARALLEL_JACOBI_ROWS_PER_JOB 256
+
+IterativeSolverParallelJacobi::IterativeSolverParallelJacobi(
+  const RadiositySystem *A_System,
+  const Eigen::VectorXf *b_solution,
+  Eigen::VectorXf * xVariable,
+  real iTolerance
+  ) : IterativeSolver( A_System, b_solution, xVariable, iTolerance )
+{
+  rowsPerJob = PARALLEL_JACOBI_ROWS_PER_JOB ;
+}
+
+IterativeSolverParallelJacobi::~IterativeSolverParallelJacobi()
+{
+  // DO NOT delete xGuess. It should be maintained by
+  // the client code
+}
+
+void IterativeSolverParallelJacobi::solve() // override
+{
+  xNext = new Eigen::VectorXf( N ) ;
+  xNext->setConstant( 0.0 ) ;
+  xGuess->setConstant( 0.0 ) ;
+
+  residual = new Eigen::VectorXf( N ) ;
+
+  updateResidual() ;
+  norm2 = lastNorm2 = residual->dot( *residual ) ;
+
+  if( !isDiagonallyDominant() )
+    warning( "Your matrix A is not diagonally dominant.  A solution is not guaranteed" ) ;
+
+  info( "Parallel Jacobi, %d rows over %d threads + this one", N, threadPool.getNumThreads() ) ;
+  Timer timer ;
+  iteration = 0 ;
+
+  while( solutionState != Converged &&
+          solutionState != Diverged )
+  {
+    IterativeSolverParallelJacobi::preIterate() ;
+    IterativeSolverParallelJacobi::iterate() ;
+    IterativeSolverParallelJacobi::postIterate() ;
+
+    info( "Parallel Jacobi sweep %lld, |r|^2=%g, %f s", iteration, norm2, timer.getTime() ) ;
+  }
+
+  info( "%d iterations, parallel Jacobi method", iteration ) ;
+  DESTROY( xNext ) ;
+  DESTROY( residual ) ;
+}
+
+void IterativeSolverParallelJacobi::preIterate()
+{
+  iteration++ ;
+}
+
+void IterativeSolverParallelJacobi::iterate() // override
+{
+  threadPool.parallelFor( "jacobi rows", N, rowsPerJob, [this]( int begin, int end ){
+    for( int i = begin ; i < end ; i++ )
+    {
+      A->F->streamRows( i, end ) ;
+      real r = A->diagonal( i ) * (*xGuess)( i ) + A->offDiagonalDot( i, *xGuess ) - (*b)( i ) ;
+      (*residual)( i ) = r ;
+      (*xNext)( i ) = (*xGuess)( i ) - r / A->diagonal( i ) ;
+    }
+  } ) ;
+}
+
+void IterativeSolverParallelJacobi::postIterate()
+{
+  // xNext is the new guess.  swap just trades the 2 buffers.
+  xGuess->swap( *xNext ) ;
+
+  checkConvergence() ;
+
+  if( solutionState == IsDiverging )
+    warning( "Solution actually diverging, iteration=%d, norm2=%f", iteration, norm2 ) ;
+}
@@ -0,0 +1,43 @@
+#ifndef ITERATIVE_SOLVER_PARALLEL_JACOBI_H
+#define ITERATIVE_SOLVER_PARALLEL_JACOBI_H
+
+#include "IterativeSolver.h"
+
+class IterativeSolver ;
+
+/// Jacobi, with each sweep cut into blocks of rows
+/// that run on the thread pool.  Jacobi only ever reads
+/// last sweep's x, so the rows don't care what order
+/// (or what thread) they're done in and the answer is the
+/// same as IterativeSolverJacobi's.
+class IterativeSolverParallelJacobi : public IterativeSolver
+{
+  Eigen::VectorXf *xNext ;
+
+  /// rows in each job of a sweep
+  int rowsPerJob ;
+
+public:
+  IterativeSolverParallelJacobi(
+    const RadiositySystem *A_System,
+    const Eigen::VectorXf *b_solution,
+    Eigen::VectorXf * xVariable,
+    real iTolerance
+    ) ;
+  virtual ~IterativeSolverParallelJacobi() ;
+
+  void solve() ;
+
+  void preIterate() ;
+
+  /// One whole sweep.  The residual of the
+  /// x it started from comes out of the same
+  /// pass over A (r = A x - b, and then
+  /// the Jacobi update is just x - r/A_ii).
+  void iterate() ;
+
+  void postIterate() ;
+
+} ;
+
+#endif
@@ -0,0 +1,108 @@
+#include "IterativeSolverParallelSeidel.h"
+#include "../threading/ThreadPool.h"
+#include <algorithm>
+
+IterativeSolverParallelSeidel::IterativeSolverParallelSeidel(
+  const RadiositySystem *A_System,
+  const Eigen::VectorXf *b_solution,
+  Eigen::VectorXf * xVariable,
+  real iTolerance
+  ) : IterativeSolver( A_System, b_solution, xVariable, iTolerance )
+{
+  // one block per thread (counting the one calling solve()).
+  // Bigger blocks are more Gauss-Seidel and less Jacobi, so
+  // don't cut it any finer than there are threads to run them.
+  int blocks = threadPool.getNumThreads() + 1 ;
+  rowsPerBlock = max( 1, ( N + blocks - 1 ) / blocks ) ;
+}
+
+IterativeSolverParallelSeidel::~IterativeSolverParallelSeidel()
+{
+  //don't delete xGuess
+}
+
+void IterativeSolverParallelSeidel::solve() // override
+{
+  xLast = new Eigen::VectorXf( N ) ;
+  xGuess->setConstant( 0.0 ) ; // start out with an initial xGuess of 0.
+
+  residual = new Eigen::VectorXf( N ) ;
+
+  updateResidual() ;
+  norm2 = lastNorm2 = residual->dot( *residual ) ;
+
+  if( !isDiagonallyDominant() )
+    info( "Your matrix A is not diagonally dominant.  A solution is not guaranteed, but I'll probably manage." ) ;
+
+  info( "Parallel block Gauss-Seidel, %d rows in blocks of %d", N, rowsPerBlock ) ;
+  Timer timer ;
+  iteration = 0 ;
+
+  while( solutionState != Converged &&
+          solutionState != Diverged )
+  {
+    IterativeSolverParallelSeidel::preIterate() ;
+    IterativeSolverParallelSeidel::iterate() ;
+    IterativeSolverParallelSeidel::postIterate() ;
+
+    info( "Parallel Gauss-Seidel sweep %lld, |r|^2=%g, %f s", iteration, norm2, timer.getTime() ) ;
+  }
+
+  info( "%d iterations, parallel block Gauss-Seidel method", iteration ) ;
+  DESTROY( xLast ) ;
+  DESTROY( residual ) ;
+}
+
+void IterativeSolverParallelSeidel::preIterate()
+{
+  iteration++ ;
+  *xLast = *xGuess ;
+}
+
+void IterativeSolverParallelSeidel::iterate() // override
+{
+  threadPool.parallelFor( "seidel blocks", N, rowsPerBlock, [this]( int begin, int end ){
+    relaxBlock( begin, end ) ;
+  } ) ;
+}
+
+void IterativeSolverParallelSeidel::relaxBlock( int begin, int end )
+{
+  const CSRMatrix *F = A->F ;
+  const int *cols = F->colData() ;
+
+  for( int i = begin ; i < end ; i++ )
+  {
+    F->streamRows( i, end ) ;
+
+    // The row's columns are sorted, so the ones in this block
+    // are one run [kb,ke) in the middle of it.  Those are read from
+    // xGuess (the ones before i already updated this sweep, the rest
+    // not yet, same as serial Gauss-Seidel), and everything outside
+    // it from xLast, which no one is writing to.
+    long long rb = F->rowBegin( i ), re = F->rowEnd( i ) ;
+    long long kb = lower_bound( cols + rb, cols + re, begin ) - cols ;
+    long long ke = lower_bound( cols + kb, cols + re, end ) - cols ;
+
+    real outside = A->dot( rb, kb, *xLast ) + A->dot( ke, re, *xLast ) ;
+    real insideLast = A->dot( kb, ke, *xLast ) ;
+    real insideNow = A->dot( kb, ke, *xGuess ) ;
+
+    // take the diagonal back out. x(i) itself hasn't changed yet.
+    real self = A->Fii( i ) * (*xLast)( i ) ;
+    real rho = (*A->rho)( i ) ;
+    real offLast = -rho * ( outside + insideLast - self ) ;
+    real offNow = -rho * ( outside + insideNow - self ) ;
+
+    (*residual)( i ) = A->diagonal( i ) * (*xLast)( i ) + offLast - (*b)( i ) ;
+    (*xGuess)( i ) = ( (*b)( i ) - offNow ) / A->diagonal( i ) ;
+  }
+}
+
+void IterativeSolverParallelSeidel::postIterate()
+{
+  checkConvergence() ;
+
+  if( solutionState == IsDiverging )
+    warning( "Solution actually diverging, iteration=%d, norm2=%f", iteration, norm2 ) ;
+}
@@ -0,0 +1,52 @@
+#ifndef ITERATIVE_SOLVER_PARALLEL_SEIDEL_H
+#define ITERATIVE_SOLVER_PARALLEL_SEIDEL_H
+
+#include "IterativeSolver.h"
+
+class IterativeSolver ;
+
+/// Block Gauss-Seidel:  the rows are cut into one block per
+/// thread, and each thread runs Gauss-Seidel down its own block
+/// (reading its own block's x as it updates it), while the other
+/// blocks' x are read as they were at the start of the sweep.
+///
+/// The usual way to run Gauss-Seidel in parallel is red-black (or
+/// multicolor) ordering, but that needs rows that don't couple.
+/// Almost every patch sees almost every other one, so radiosity's
+/// A would need about one color per patch.  Between blocks this is
+/// Jacobi, inside a block Gauss-Seidel, so it takes a few more sweeps
+/// than IterativeSolverSeidel, but each sweep is spread over every core.
+/// Every thread only writes x in its own block, so the answer doesn't
+/// depend on timing.
+class IterativeSolverParallelSeidel : public IterativeSolver
+{
+  /// x at the start of the sweep, what the other blocks are read from
+  Eigen::VectorXf *xLast ;
+
+  int rowsPerBlock ;
+
+public:
+  IterativeSolverParallelSeidel(
+    const RadiositySystem *A_System,
+    const Eigen::VectorXf *b_solution,
+    Eigen::VectorXf * xVariable,
+    real iTolerance
+    ) ;
+  virtual ~IterativeSolverParallelSeidel() ;
+
+  void solve() ;
+
+  void preIterate() ;
+
+  /// One whole sweep, the blocks in parallel.
+  /// Also leaves the residual of xLast.
+  void iterate() ;
+
+  void postIterate() ;
+
+private:
+  void relaxBlock( int begin, int end ) ;
+
+} ;
+
+#endif
@@ -1,7 +1,7 @@
 #include "IterativeSolverSeidel.h"
 
 IterativeSolverSeidel::IterativeSolverSeidel(
-  const Eigen::MatrixXf *A_System,
+  const RadiositySystem *A_System,
   const Eigen::VectorXf *b_solution,
   Eigen::VectorXf * xVariable,
   real iTolerance
@@ -30,7 +30,7 @@ void IterativeSolverSeidel::solve() // override
   norm2 = lastNorm2 = residual->dot( *residual ) ;
 
   // check first for diagonal dominance
-  if( !isDiagonallyDominant( A ) )
+  if( !isDiagonallyDominant() )
     info( "Your matrix A is not diagonally dominant.  A solution is not guaranteed, but I'll probably manage." ) ;
 
   iteration = 0 ;
@@ -70,24 +70,21 @@ void IterativeSolverSeidel::iterate() // override
   // now use that residual at each ROW i
   // (divided diagonal entry in Aii for that row)
   // to find the next "guess"
-  double sum = 0.0 ;
 
-  // do before i:  go from j=0 to (i-1)..
+  // before i:  j=0 to (i-1)..
   // in Gauss-Seidel, this uses the xNext vector
   // (because those values are available)
-  // and not the xGuess vector
-  for( int j = 0 ; j < curRow ; j++ )
-    sum += (*A)(curRow,j)*(*xNext)(j) ; // this line is the
+  // and not the xGuess vector.  This is the
   // only difference from the Jacobi method..
   // This small, small difference can almost
   // HALF the number of iterations required to solve.
+  // after i:  j=(i+1) to (N-1), xNext(j) hasn't been
+  // touched this sweep so it still IS xGuess(j), so
+  // one pass over the row's nonzeros in xNext does both.
+  A->F->streamRows( (int)curRow, N ) ;
+  double sum = A->offDiagonalDot( curRow, *xNext ) ;
 
-  // no check for if( j==i ),
-  // do after i:  go from j=(i+1) to (N-1)
-  for( int j = curRow+1 ; j < N ; j++ )
-    sum += (*A)(curRow,j)*(*xGuess)(j) ;
-
-  (*xNext)(curRow) = ( (*b)(curRow) - sum ) / (*A)( curRow, curRow ) ;
+  (*xNext)(curRow) = ( (*b)(curRow) - sum ) / A->diagonal( curRow ) ;
 
   // you don't need to update the residual
   // every step with Gauss Seidel
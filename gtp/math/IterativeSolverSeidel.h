@@ -11,7 +11,7 @@ class IterativeSolverSeidel : public IterativeSolver
 
 public:
   IterativeSolverSeidel(
-    const Eigen::MatrixXf *A_System,
+    const RadiositySystem *A_System,
     const Eigen::VectorXf *b_solution,
     Eigen::VectorXf * xVariable,
     real iTolerance
@@ -0,0 +1,195 @@
+#include "IterativeSolverSeidelRGB.h"
+#include "../threading/ThreadPool.h"
+#include <algorithm>
+
+// sum[c] += F's entries [kBegin,kEnd) times x's channel c.
+// Val is float or Half, whatever F stores.
+template <typename Val>
+static inline void dotRGB( const int *cols, const Val *vals, long long kBegin, long long kEnd,
+  const float *x, real sum[ 3 ] )
+{
+  real r = 0, g = 0, b = 0 ;
+  for( long long k = kBegin ; k < kEnd ; k++ )
+  {
+    float v = csrValue( vals[k] ) ;
+    const float *xc = x + 3*cols[k] ;
+    r += v * xc[0] ;
+    g += v * xc[1] ;
+    b += v * xc[2] ;
+  }
+  sum[0] += r ;  sum[1] += g ;  sum[2] += b ;
+}
+
+// the same, against 2 x's at once (one read of F for both)
+template <typename Val>
+static inline void dotRGB2( const int *cols, const Val *vals, long long kBegin, long long kEnd,
+  const float *x1, real sum1[ 3 ], const float *x2, real sum2[ 3 ] )
+{
+  real r1 = 0, g1 = 0, b1 = 0, r2 = 0, g2 = 0, b2 = 0 ;
+  for( long long k = kBegin ; k < kEnd ; k++ )
+  {
+    float v = csrValue( vals[k] ) ;
+    const float *xc1 = x1 + 3*cols[k] ;
+    const float *xc2 = x2 + 3*cols[k] ;
+    r1 += v * xc1[0] ;  g1 += v * xc1[1] ;  b1 += v * xc1[2] ;
+    r2 += v * xc2[0] ;  g2 += v * xc2[1] ;  b2 += v * xc2[2] ;
+  }
+  sum1[0] += r1 ;  sum1[1] += g1 ;  sum1[2] += b1 ;
+  sum2[0] += r2 ;  sum2[1] += g2 ;  sum2[2] += b2 ;
+}
+
+IterativeSolverSeidelRGB::IterativeSolverSeidelRGB( const CSRMatrix *iF,
+  const MatrixRGB *iRho,
+  const MatrixRGB *b_solution,
+  MatrixRGB *xVariable,
+  real iTolerance,
+  int blocks )
+{
+  F = iF ;
+  rho = iRho ;
+  b = b_solution ;
+  xGuess = xVariable ;
+  tolerance = iTolerance ;
+  N = F->N ;
+
+  solutionState = IterativeSolver::Indeterminate ;
+  iteration = 0 ;
+  for( int c = 0 ; c < 3 ; c++ )
+    norm2[ c ] = lastNorm2[ c ] = 0.0 ;
+
+  blocks = max( 1, blocks ) ;
+  rowsPerBlock = max( 1, ( N + blocks - 1 ) / blocks ) ;
+
+  Fii.resize( N ) ;
+  diag.resize( N, 3 ) ;
+  for( int i = 0 ; i < N ; i++ )
+  {
+    Fii( i ) = F->get( i, i ) ;
+    for( int c = 0 ; c < 3 ; c++ )
+      diag( i, c ) = 1.0f - (*rho)( i, c ) * Fii( i ) ;
+  }
+}
+
+void IterativeSolverSeidelRGB::solve()
+{
+  xGuess->setZero( N, 3 ) ;
+  xLast.resize( N, 3 ) ;
+  residual.resize( N, 3 ) ;
+
+  // x = 0, so r = -b
+  for( int c = 0 ; c < 3 ; c++ )
+    norm2[ c ] = lastNorm2[ c ] = b->col( c ).squaredNorm() ;
+
+  info( "Gauss-Seidel on r,g,b together, %d rows in %d block(s)", N, ( N + rowsPerBlock - 1 ) / rowsPerBlock ) ;
+  Timer timer ;
+  iteration = 0 ;
+
+  while( solutionState != IterativeSolver::Converged &&
+          solutionState != IterativeSolver::Diverged )
+  {
+    iteration++ ;
+    xLast = *xGuess ;
+
+    iterate() ;
+
+    checkConvergence() ;
+    if( solutionState == IterativeSolver::IsDiverging )
+      warning( "Solution actually diverging, iteration=%d, norm2=%f %f %f", iteration, norm2[0], norm2[1], norm2[2] ) ;
+
+    info( "RGB Gauss-Seidel sweep %lld, |r|^2=%g %g %g, %f s", iteration, norm2[0], norm2[1], norm2[2], timer.getTime() ) ;
+  }
+
+  info( "%d iterations, Gauss-Seidel method (rgb together)", iteration ) ;
+}
+
+void IterativeSolverSeidelRGB::iterate()
+{
+  if( rowsPerBlock >= N )
+    relaxBlock( 0, N ) ; // one block, don't bother with the pool
+  else
+    threadPool.parallelFor( "rgb seidel blocks", N, rowsPerBlock, [this]( int begin, int end ){
+      relaxBlock( begin, end ) ;
+    } ) ;
+}
+
+void IterativeSolverSeidelRGB::relaxBlock( int begin, int end )
+{
+  // picked once a block, not per entry
+  if( F->halfValues )
+    relaxBlock( begin, end, F->halfData() ) ;
+  else
+    relaxBlock( begin, end, F->valData() ) ;
+}
+
+template <typename Val>
+void IterativeSolverSeidelRGB::relaxBlock( int begin, int end, const Val *vals )
+{
+  const int *cols = F->colData() ;
+  const float *xl = xLast.data() ;
+  float *xg = xGuess->data() ;
+
+  for( int i = begin ; i < end ; i++ )
+  {
+    F->streamRows( i, end ) ;
+
+    // same split as IterativeSolverParallelSeidel: this block's
+    // columns [kb,ke) read xGuess as it's being updated, the other
+    // blocks' columns read xLast.  For one block, that's the whole row.
+    long long rb = F->rowBegin( i ), re = F->rowEnd( i ) ;
+    long long kb = lower_bound( cols + rb, cols + re, begin ) - cols ;
+    long long ke = lower_bound( cols + kb, cols + re, end ) - cols ;
+
+    real outside[ 3 ] = { 0, 0, 0 } ;
+    real insideLast[ 3 ] = { 0, 0, 0 } ;
+    real insideNow[ 3 ] = { 0, 0, 0 } ;
+    dotRGB( cols, vals, rb, kb, xl, outside ) ;
+    dotRGB( cols, vals, ke, re, xl, outside ) ;
+    dotRGB2( cols, vals, kb, ke, xl, insideLast, xg, insideNow ) ;
+
+    for( int c = 0 ; c < 3 ; c++ )
+    {
+      // take the diagonal back out.  x(i) hasn't changed yet.
+      real xi = xl[ 3*i + c ] ;
+      real self = Fii( i ) * xi ;
+      real offLast = -(*rho)( i, c ) * ( outside[c] + insideLast[c] - self ) ;
+      real offNow = -(*rho)( i, c ) * ( outside[c] + insideNow[c] - self ) ;
+
+      residual( i, c ) = diag( i, c ) * xi + offLast - (*b)( i, c ) ;
+      xg[ 3*i + c ] = ( (*b)( i, c ) - offNow ) / diag( i, c ) ;
+    }
+  }
+}
+
+IterativeSolver::SolutionState IterativeSolverSeidelRGB::checkConvergence()
+{
+  // same tests as IterativeSolver::checkConvergence, on
+  // the worst of the 3 channels
+  bool converged = true, converging = false, stuck = true ;
+  for( int c = 0 ; c < 3 ; c++ )
+  {
+    norm2[ c ] = residual.col( c ).squaredNorm() ;
+    if( IsNaN( norm2[ c ] ) )
+    {
+      error( "Gauss-Seidel (rgb) failed to solve on iteration %d with NaN", iteration ) ;
+      return solutionState = IterativeSolver::Diverged ;
+    }
+
+    if( !IsNear( norm2[ c ], 0, tolerance ) )
+    {
+      converged = false ;
+      if( norm2[ c ] < lastNorm2[ c ] )  converging = true ;
+      if( norm2[ c ] != lastNorm2[ c ] )  stuck = false ;
+    }
+    lastNorm2[ c ] = norm2[ c ] ;
+  }
+
+  if( converged )
+    solutionState = IterativeSolver::Converged ;
+  else if( converging )
+    solutionState = IterativeSolver::IsConverging ;
+  else if( stuck )
+    solutionState = IterativeSolver::Indeterminate ;
+  else
+    solutionState = IterativeSolver::IsDiverging ;
+  return solutionState ;
+}
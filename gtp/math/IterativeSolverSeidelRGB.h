@@ -0,0 +1,73 @@
+#ifndef ITERATIVE_SOLVER_SEIDEL_RGB_H
+#define ITERATIVE_SOLVER_SEIDEL_RGB_H
+
+#include "IterativeSolver.h"
+
+/// Gauss-Seidel on the r, g and b systems at the same time.
+///
+/// The 3 channels' systems only differ by rho,
+///   A_c = I - diag( rho_c ) F
+/// and the solve is bound by reading F out of memory, not by the
+/// multiplies.  Solving the channels one after another streams all
+/// of F 3 times a sweep (6 with the residual), this reads each row
+/// once and relaxes all 3 channels with it, applying each channel's
+/// rho as it goes.  x, b and rho are rgb interleaved (N x 3 row major)
+/// so each column of F fetches all 3 channels in one go.
+///
+/// With blocks > 1 the sweep is block Gauss-Seidel over the thread
+/// pool, same as IterativeSolverParallelSeidel.
+class IterativeSolverSeidelRGB
+{
+public:
+  typedef Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> MatrixRGB ;
+
+  IterativeSolver::SolutionState solutionState ;
+
+private:
+  const CSRMatrix *F ;
+  const MatrixRGB *rho ;
+  const MatrixRGB *b ;
+
+  /// F_ii and A_c(i,i) = 1 - rho_c(i) F_ii
+  Eigen::VectorXf Fii ;
+  MatrixRGB diag ;
+
+  /// x at the start of the sweep, and the residual there
+  MatrixRGB xLast ;
+  MatrixRGB residual ;
+
+  int rowsPerBlock ;
+
+public:
+  int N ;
+  long long iteration ;
+  real tolerance ;
+
+  MatrixRGB *xGuess ;
+
+  /// |r|^2 of each channel.  Converged once all 3 are in tolerance.
+  real norm2[ 3 ], lastNorm2[ 3 ] ;
+
+  IterativeSolverSeidelRGB( const CSRMatrix *iF,
+    const MatrixRGB *iRho,
+    const MatrixRGB *b_solution,
+    MatrixRGB *xVariable,
+    real iTolerance,
+    int blocks ) ;
+
+  void solve() ;
+
+  /// one whole sweep, all 3 channels
+  void iterate() ;
+
+  IterativeSolver::SolutionState checkConvergence() ;
+
+private:
+  void relaxBlock( int begin, int end ) ;
+
+  // vals is F's float or Half values
+  template <typename Val>
+  void relaxBlock( int begin, int end, const Val *vals ) ;
+} ;
+
+#endif
@@ -1,7 +1,7 @@
 #include "IterativeSolverSouthwell.h"
 
 IterativeSolverSouthwell::IterativeSolverSouthwell(
-  const Eigen::MatrixXf *A_System,
+  const RadiositySystem *A_System,
   const Eigen::VectorXf *b_solution,
   Eigen::VectorXf *xVariable,
   real iTolerance
@@ -16,8 +16,16 @@ void IterativeSolverSouthwell::solve() // override
 
   residual = new Eigen::VectorXf( N ) ;
 
-  updateResidual() ; // find the starting error
-  norm2 = lastNorm2 = residual->dot( *residual ) ;
+  // the columns of A, for updating the residual
+  A->F->transpose( FT ) ;
+  info( "Southwell: F transposed for its columns, another %lld MB%s",
+    FT.sizeInBytes()/(1<<20), FT.isOutOfCore() ? " on disk" : " of RAM" ) ;
+
+  r.resize( N ) ;
+  heap.resize( N ) ;
+  heapPos.resize( N ) ;
+  resync() ; // find the starting error
+  lastNorm2 = norm2 ;
 
   iteration = 0 ;
 
@@ -33,7 +41,7 @@ void IterativeSolverSouthwell::solve() // override
   }
 
   info( "%d iterations, Southwell element method", iteration );
-  //DESTROY( residual );
+  DESTROY( residual ) ;
 }
 
 void IterativeSolverSouthwell::preIterate()
@@ -41,45 +49,36 @@ void IterativeSolverSouthwell::preIterate()
   // major iteration increment
   iteration++ ;
 
-  // Update the residual.  you have to update the
-  // whole residual since xGuess(i) is "dirty".
-  updateResidual() ;
+  // the residual is kept up to date as rows are relaxed,
+  // there's nothing to redo here.
 }
 
 void IterativeSolverSouthwell::iterate() // override  "'override' cannot be used with 'inline'
 {
-  // Search for the largest residue value.
+  // The largest residue is on top of the heap.
   // That is the element to relax.
-  // use ABSOLUTE VALUE of residue values
-  
-  // Southwell has a bit more
-  // recomputing of the residual vector,
-  // because it HAS TO look for the largest
-  // present residual on each iteration.
-  curRow = 0 ; // index of row with max err
-  double maxVal = 0.0 ;
-  for( int i = 0 ; i < N ; i++ )
-  {
-    if( fabs( (*residual)( i ) ) > maxVal )
-    {
-      maxVal = fabs( (*residual)(i) ) ;
-      curRow = i ; // max index occurs @k
-    }
-  }
+  curRow = heap[ 0 ] ;
+  int p = (int)curRow ;
 
-  double sum = 0.0 ;
+  // Setting x(p) so row p's residual is 0 means moving it
+  // by -r(p)/A(p,p).  (Same x(p) as (b - off diagonal)/A(p,p).)
+  real delta = -r[ p ] / A->diagonal( p ) ;
+  (*xGuess)( p ) += delta ;
 
-  // for j!=i:
-  for( int j = 0 ; j < curRow ; j++ )
-    sum += (*A)(curRow,j)*(*xGuess)(j) ;
-    
-  for( int j = curRow+1 ; j < N ; j++ )
-    sum += (*A)(curRow,j)*(*xGuess)(j) ;
-
-  // update xGuess(i).  Each call to this function
-  // only does ONE (i) UPDATE though, because (i)
-  // is found each time as the row with the largest error.
-  (*xGuess)(curRow) = ( (*b)(curRow) - sum ) / (*A)( curRow, curRow ) ;
+  // only column p of A multiplies x(p).
+  // A(i,p) = -rho_i F(i,p) off the diagonal.
+  for( long long k = FT.rowBegin( p ) ; k < FT.rowEnd( p ) ; k++ )
+  {
+    int i = FT.colData()[ k ] ;
+    if( i == p )  continue ;
+    real old = r[ i ] ;
+    r[ i ] -= (*A->rho)( i ) * FT.val( k ) * delta ;
+    norm2 += r[ i ]*r[ i ] - old*old ;
+    heapUpdate( i ) ;
+  }
+  norm2 -= r[ p ]*r[ p ] ;
+  r[ p ] = 0 ;
+  heapUpdate( p ) ;
 
 #if ITERATIVE_SOLVERS_SHOW_PROGRESS_CONSOLE
   if( ! (iteration % 10) )
@@ -90,7 +89,69 @@ void IterativeSolverSouthwell::iterate() // override  "'override' cannot be used
 
 void IterativeSolverSouthwell::postIterate()
 {
+  // The running norm2 drifts (lots of small adds to a big number),
+  // so once a sweep's worth of rows have been relaxed, or when it
+  // looks converged, recompute r from scratch and check that.
+  if( iteration % N && !IsNear( norm2, 0, tolerance ) )
+    return ;
+
+  resync() ;
   checkConvergence() ;
   if( solutionState == IsDiverging )
     warning( "Solution actually diverging, iteration=%d, norm2=%f", iteration, norm2 ) ;
 }
+
+void IterativeSolverSouthwell::resync()
+{
+  updateResidual() ;
+  norm2 = 0 ;
+  for( int i = 0 ; i < N ; i++ )
+  {
+    r[ i ] = (*residual)( i ) ;
+    norm2 += r[ i ]*r[ i ] ;
+    heap[ i ] = heapPos[ i ] = i ;
+  }
+
+  // heapify
+  for( int i = N/2 - 1 ; i >= 0 ; i-- )
+    heapSiftDown( i ) ;
+}
+
+void IterativeSolverSouthwell::heapUpdate( int row )
+{
+  int i = heapPos[ row ] ;
+  heapSiftUp( i ) ;
+  heapSiftDown( heapPos[ row ] ) ;
+}
+
+void IterativeSolverSouthwell::heapSiftUp( int i )
+{
+  while( i > 0 )
+  {
+    int parent = ( i - 1 ) / 2 ;
+    if( key( parent ) >= key( i ) )  break ;
+    heapSwap( i, parent ) ;
+    i = parent ;
+  }
+}
+
+void IterativeSolverSouthwell::heapSiftDown( int i )
+{
+  for( ;; )
+  {
+    int biggest = i ;
+    int left = 2*i + 1, right = left + 1 ;
+    if( left < N && key( left ) > key( biggest ) )  biggest = left ;
+    if( right < N && key( right ) > key( biggest ) )  biggest = right ;
+    if( biggest == i )  break ;
+    heapSwap( i, biggest ) ;
+    i = biggest ;
+  }
+}
+
+void IterativeSolverSouthwell::heapSwap( int i, int j )
+{
+  swap( heap[ i ], heap[ j ] ) ;
+  heapPos[ heap[ i ] ] = i ;
+  heapPos[ heap[ j ] ] = j ;
+}
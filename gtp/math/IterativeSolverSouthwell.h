@@ -5,11 +5,41 @@
 
 class IterativeSolver ;
 
+/// Southwell relaxes one row per iteration: the row
+/// with the biggest residual.
+///
+/// Relaxing row p only changes x(p), so the only residuals
+/// that change are the rows with a nonzero in column p of A.
+/// Those get updated in place (reading column p from a transposed
+/// copy of F), and the rows are kept in an indexed max heap on
+/// |residual|, so finding the next row is the top of the heap,
+/// not a scan.  An iteration costs O( k log N ) for the k patches
+/// in column p, instead of a whole A*x.
+///
+/// Memory: FT is a whole second copy of the form factors, so Southwell
+/// needs twice the form factor memory of the other solvers.  When F is
+/// out of core (memory mapped, "radiosity::form factor directory"), FT
+/// is made out of core next to it by CSRMatrix::transpose, so it's twice
+/// the disk, not RAM.  An in memory F gets an in memory FT: if 2 copies
+/// don't fit, use one of the other solvers, or put the form factors
+/// out of core.
 class IterativeSolverSouthwell : public IterativeSolver
 {
+  /// F transposed: row p of FT is column p of F.
+  /// Same size as F, and out of core if F is.
+  CSRMatrix FT ;
+
+  /// the residual kept in doubles, because it's only ever
+  /// added to.  The float *residual gets copied out of this.
+  vector<real> r ;
+
+  /// heap of rows, largest |r| on top.  heapPos[ row ] is
+  /// where row is in the heap
+  vector<int> heap, heapPos ;
+
 public:
   IterativeSolverSouthwell(
-    const Eigen::MatrixXf *A_System,
+    const RadiositySystem *A_System,
     const Eigen::VectorXf *b_solution,
     Eigen::VectorXf *xVariable,
     real iTolerance
@@ -23,7 +53,16 @@ public:
 
   void postIterate() ;
 
-  
+private:
+  /// r = A x - b from scratch, and the heap rebuilt
+  void resync() ;
+
+  /// row's |r| changed, move it up or down the heap
+  void heapUpdate( int row ) ;
+  void heapSiftUp( int i ) ;
+  void heapSiftDown( int i ) ;
+  void heapSwap( int i, int j ) ;
+  inline real key( int i ) const { return fabs( r[ heap[ i ] ] ) ; }
 } ;
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,120 @@
+#include "RadiositySystem.h"
+#include "../threading/ThreadPool.h"
+
+RadiositySystem::RadiositySystem( const CSRMatrix *iF, const Eigen::VectorXf *iRho )
+{
+  F = iF ;
+  rho = iRho ;
+
+  diag.resize( F->N ) ;
+  Fii.resize( F->N ) ;
+  for( int i = 0 ; i < F->N ; i++ )
+  {
+    Fii( i ) = F->get( i, i ) ;
+    diag( i ) = 1.0f - (*rho)( i ) * Fii( i ) ;
+  }
+}
+
+real RadiositySystem::offDiagonalDot( int i, const Eigen::VectorXf& x ) const
+{
+  real sum = dot( F->rowBegin( i ), F->rowEnd( i ), x ) - Fii( i ) * x( i ) ;
+  return -(*rho)( i ) * sum ;
+}
+
+real RadiositySystem::dot( long long kBegin, long long kEnd, const Eigen::VectorXf& x ) const
+{
+  if( F->halfValues )
+    return dotHalf( kBegin, kEnd, x ) ;
+
+  const int *cols = F->colData() ;
+  const float *vals = F->valData() ;
+  const float *xs = x.data() ;
+
+  // SSE2, so no cpu check: 8 entries a time, 2 loads of 4 vals and
+  // 2 gathers of x (_mm_set_ps, same as dotHalf.  A hardware gather would
+  // need AVX2 and a cpuid check like F16C's, and isn't faster than
+  // 4 scalar loads before Skylake anyway).  The products are floats, as
+  // they always were, but they're summed in 4 double lanes so a long row
+  // doesn't lose the small form factors.
+  __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd() ;
+  __m128d acc2 = _mm_setzero_pd(), acc3 = _mm_setzero_pd() ;
+  long long k = kBegin ;
+  for( ; k + 8 <= kEnd ; k += 8 )
+  {
+    __m128 p0 = _mm_mul_ps( _mm_loadu_ps( vals + k ),
+      _mm_set_ps( xs[ cols[k+3] ], xs[ cols[k+2] ], xs[ cols[k+1] ], xs[ cols[k] ] ) ) ;
+    __m128 p1 = _mm_mul_ps( _mm_loadu_ps( vals + k + 4 ),
+      _mm_set_ps( xs[ cols[k+7] ], xs[ cols[k+6] ], xs[ cols[k+5] ], xs[ cols[k+4] ] ) ) ;
+    acc0 = _mm_add_pd( acc0, _mm_cvtps_pd( p0 ) ) ;
+    acc1 = _mm_add_pd( acc1, _mm_cvtps_pd( _mm_movehl_ps( p0, p0 ) ) ) ;
+    acc2 = _mm_add_pd( acc2, _mm_cvtps_pd( p1 ) ) ;
+    acc3 = _mm_add_pd( acc3, _mm_cvtps_pd( _mm_movehl_ps( p1, p1 ) ) ) ;
+  }
+  double lanes[ 2 ] ;
+  _mm_storeu_pd( lanes, _mm_add_pd( _mm_add_pd( acc0, acc1 ), _mm_add_pd( acc2, acc3 ) ) ) ;
+  real sum = lanes[0] + lanes[1] ;
+  for( ; k < kEnd ; k++ )
+    sum += vals[k] * xs[ cols[k] ] ;
+  return sum ;
+}
+
+real RadiositySystem::dotHalf( long long kBegin, long long kEnd, const Eigen::VectorXf& x ) const
+{
+  const int *cols = F->colData() ;
+  const Half *halfs = F->halfData() ;
+  const float *xs = x.data() ;
+
+  // 4 halfs at a time: one 8 byte load, one F16C convert to 4 floats.
+  // The sum is kept scaled by CSR_HALF_SCALE and that's taken out once
+  // at the end, not per entry.  Float lanes are fine here, the values
+  // only had 11 bits to begin with.
+  __m128 acc = _mm_setzero_ps() ;
+  long long k = kBegin ;
+  for( ; k + 4 <= kEnd ; k += 4 )
+  {
+    __m128 v = _mm_cvtph_ps( _mm_loadl_epi64( (const __m128i*)( halfs + k ) ) ) ;
+    __m128 xv = _mm_set_ps( xs[ cols[k+3] ], xs[ cols[k+2] ], xs[ cols[k+1] ], xs[ cols[k] ] ) ;
+    acc = _mm_add_ps( acc, _mm_mul_ps( v, xv ) ) ;
+  }
+  float lanes[ 4 ] ;
+  _mm_storeu_ps( lanes, acc ) ;
+  real sum = ( (real)lanes[0] + lanes[1] ) + ( (real)lanes[2] + lanes[3] ) ;
+  for( ; k < kEnd ; k++ )
+    sum += _cvtsh_ss( halfs[k] ) * xs[ cols[k] ] ;
+  return sum / CSR_HALF_SCALE ;
+}
+
+real RadiositySystem::offDiagonalAbsSum( int i ) const
+{
+  const int *cols = F->colData() ;
+  real sum = 0 ;
+  for( long long k = F->rowBegin( i ) ; k < F->rowEnd( i ) ; k++ )
+    if( cols[k] != i )
+      sum += fabs( F->val( k ) ) ;
+  return fabs( (*rho)( i ) ) * sum ;
+}
+
+void RadiositySystem::multiply( const Eigen::VectorXf& x, Eigen::VectorXf& y ) const
+{
+  // the rows are independent, so they go over the thread pool.
+  // The Krylov solvers do nothing but this.
+  y.resize( F->N ) ;
+  threadPool.parallelFor( "A*x", F->N, 256, [this,&x,&y]( int begin, int end ){
+    for( int i = begin ; i < end ; i++ )
+    {
+      F->streamRows( i, end ) ;
+      y( i ) = diag( i ) * x( i ) + offDiagonalDot( i, x ) ;
+    }
+  } ) ;
+}
+
+void RadiositySystem::toDense( Eigen::MatrixXf& A ) const
+{
+  A.setZero( F->N, F->N ) ;
+  for( int i = 0 ; i < F->N ; i++ )
+  {
+    for( long long k = F->rowBegin( i ) ; k < F->rowEnd( i ) ; k++ )
+      A( i, F->colData()[k] ) = -(*rho)( i ) * F->val( k ) ;
+    A( i, i ) = diag( i ) ;
+  }
+}
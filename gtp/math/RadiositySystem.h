@@ -0,0 +1,57 @@
+#ifndef RADIOSITY_SYSTEM_H
+#define RADIOSITY_SYSTEM_H
+
+#ifdef real
+#undef real
+#endif
+#include <Eigen/Eigen>
+#define real double
+
+#include "CSRMatrix.h"
+
+/// The system the IterativeSolvers solve, A x = b with
+///   A = I - diag( rho ) F
+/// F is the sparse form factor matrix, rho the reflectivity of
+/// each row's patch.  A itself is never stored: it would be a
+/// second copy of F per color channel.  The solvers read it
+/// a row at a time through here.
+struct RadiositySystem
+{
+  const CSRMatrix *F ;
+  const Eigen::VectorXf *rho ;
+
+  /// A(i,i) = 1 - rho_i F_ii, cached because every relaxation divides by it
+  Eigen::VectorXf diag ;
+
+  /// F_ii.  The off diagonal sums run over the whole row and
+  /// take this back out, instead of a compare on every entry
+  Eigen::VectorXf Fii ;
+
+  RadiositySystem( const CSRMatrix *iF, const Eigen::VectorXf *iRho ) ;
+
+  inline int size() const { return F->N ; }
+
+  inline real diagonal( int i ) const { return diag( i ) ; }
+
+  /// sum over j != i of A(i,j) x(j)
+  real offDiagonalDot( int i, const Eigen::VectorXf& x ) const ;
+
+  /// sum of F's stored entries k in [kBegin,kEnd) times x(col).  No rho,
+  /// no diagonal handling: the block solvers split rows into pieces with this.
+  real dot( long long kBegin, long long kEnd, const Eigen::VectorXf& x ) const ;
+
+  /// sum over j != i of |A(i,j)|
+  real offDiagonalAbsSum( int i ) const ;
+
+  /// y = A x
+  void multiply( const Eigen::VectorXf& x, Eigen::VectorXf& y ) const ;
+
+  /// writes A out in full, for the direct (LU, inverse) solvers
+  void toDense( Eigen::MatrixXf& A ) const ;
+
+private:
+  /// dot() for a matrix of half values
+  real dotHalf( long long kBegin, long long kEnd, const Eigen::VectorXf& x ) const ;
+} ;
+
+#endif
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <emmintrin.h>
 
 #include "../geometry/Model.h"
 #include "../window/GTPWindow.h"
@@ -185,6 +186,137 @@ double PerlinGenerator::noise3(double vec[3])
   return perlin_lerp(sz, c, d);
 }
 
+// The batch kernels do 2 points at a time, one per half of an SSE2
+// double register.  Only the p[]/g[] table lookups stay scalar; the
+// setup, s_curve, gradient dots and lerps all run on both lanes at once.
+// Every op is done in the same order the scalar macros do it, so the
+// results are bit for bit what noise2/noise3 give.  A short last block
+// just repeats its last point.
+#define perlin_LANES 2
+
+// same as setup(): b0 = (int)(v+N) & BM, r0 = (v+N) - (int)(v+N)
+static inline __m128d perlinSetup2( double v0, double v1, int b0[4] )
+{
+  __m128d t = _mm_add_pd( _mm_set_pd( v1, v0 ), _mm_set1_pd( perlin_N ) ) ;
+  __m128i it = _mm_cvttpd_epi32( t ) ;
+  _mm_storeu_si128( (__m128i*)b0, _mm_and_si128( it, _mm_set1_epi32( perlin_BM ) ) ) ;
+  return _mm_sub_pd( t, _mm_cvtepi32_pd( it ) ) ;
+}
+
+// s_curve(t)
+static inline __m128d perlinSCurve2( __m128d t )
+{
+  return _mm_mul_pd( _mm_mul_pd( t, t ), _mm_sub_pd( _mm_set1_pd( 3. ), _mm_mul_pd( _mm_set1_pd( 2. ), t ) ) ) ;
+}
+
+// perlin_lerp(t,a,b)
+static inline __m128d perlinLerp2( __m128d t, __m128d a, __m128d b )
+{
+  return _mm_add_pd( a, _mm_mul_pd( t, _mm_sub_pd( b, a ) ) ) ;
+}
+
+// at2(rx,ry) with lane k's gradient in q[k]
+static inline __m128d perlinAt2( __m128d rx, __m128d ry, const double *q0, const double *q1 )
+{
+  return _mm_add_pd( _mm_mul_pd( rx, _mm_set_pd( q1[0], q0[0] ) ),
+                     _mm_mul_pd( ry, _mm_set_pd( q1[1], q0[1] ) ) ) ;
+}
+
+// at3(rx,ry,rz) with lane k's gradient in q[k]
+static inline __m128d perlinAt3( __m128d rx, __m128d ry, __m128d rz, const double *q0, const double *q1 )
+{
+  return _mm_add_pd( _mm_add_pd( _mm_mul_pd( rx, _mm_set_pd( q1[0], q0[0] ) ),
+                                 _mm_mul_pd( ry, _mm_set_pd( q1[1], q0[1] ) ) ),
+                     _mm_mul_pd( rz, _mm_set_pd( q1[2], q0[2] ) ) ) ;
+}
+
+void PerlinGenerator::noise2Batch( const double* x, const double* y, double* out, int n )
+{
+  const __m128d one = _mm_set1_pd( 1. ) ;
+  for( int base = 0 ; base < n ; base += perlin_LANES )
+  {
+    int lanes = min( perlin_LANES, n-base ) ;
+    int i0 = base, i1 = base + lanes-1 ;
+    int bx0[4], by0[4] ;
+    __m128d rx0 = perlinSetup2( x[i0], x[i1], bx0 ) ;
+    __m128d ry0 = perlinSetup2( y[i0], y[i1], by0 ) ;
+    __m128d rx1 = _mm_sub_pd( rx0, one ) ;
+    __m128d ry1 = _mm_sub_pd( ry0, one ) ;
+    __m128d sx = perlinSCurve2( rx0 ) ;
+    __m128d sy = perlinSCurve2( ry0 ) ;
+
+    // gradient table lookups for each corner, per lane
+    double *q[4][perlin_LANES] ; // indexed by yx bits
+    for( int k = 0 ; k < perlin_LANES ; k++ )
+    {
+      int bx1 = (bx0[k]+1) & perlin_BM, by1 = (by0[k]+1) & perlin_BM ;
+      int i = p[ bx0[k] ], j = p[ bx1 ] ;
+      q[0][k] = g2[ p[ i + by0[k] ] ] ;
+      q[1][k] = g2[ p[ j + by0[k] ] ] ;
+      q[2][k] = g2[ p[ i + by1 ] ] ;
+      q[3][k] = g2[ p[ j + by1 ] ] ;
+    }
+
+    __m128d a = perlinLerp2( sx, perlinAt2( rx0, ry0, q[0][0], q[0][1] ), perlinAt2( rx1, ry0, q[1][0], q[1][1] ) ) ;
+    __m128d b = perlinLerp2( sx, perlinAt2( rx0, ry1, q[2][0], q[2][1] ), perlinAt2( rx1, ry1, q[3][0], q[3][1] ) ) ;
+
+    double res[perlin_LANES] ;
+    _mm_storeu_pd( res, perlinLerp2( sy, a, b ) ) ;
+    for( int k = 0 ; k < lanes ; k++ )
+      out[ base+k ] = res[k] ;
+  }
+}
+
+void PerlinGenerator::noise3Batch( const double* x, const double* y, const double* z, double* out, int n )
+{
+  const __m128d one = _mm_set1_pd( 1. ) ;
+  for( int base = 0 ; base < n ; base += perlin_LANES )
+  {
+    int lanes = min( perlin_LANES, n-base ) ;
+    int i0 = base, i1 = base + lanes-1 ;
+    int bx0[4], by0[4], bz0[4] ;
+    __m128d rx0 = perlinSetup2( x[i0], x[i1], bx0 ) ;
+    __m128d ry0 = perlinSetup2( y[i0], y[i1], by0 ) ;
+    __m128d rz0 = perlinSetup2( z[i0], z[i1], bz0 ) ;
+    __m128d rx1 = _mm_sub_pd( rx0, one ) ;
+    __m128d ry1 = _mm_sub_pd( ry0, one ) ;
+    __m128d rz1 = _mm_sub_pd( rz0, one ) ;
+    __m128d sx = perlinSCurve2( rx0 ) ;
+    __m128d sy = perlinSCurve2( ry0 ) ;
+    __m128d sz = perlinSCurve2( rz0 ) ;
+
+    // gradient table lookups for each corner, per lane
+    double *q[8][perlin_LANES] ; // indexed by zyx bits
+    for( int k = 0 ; k < perlin_LANES ; k++ )
+    {
+      int bx1 = (bx0[k]+1) & perlin_BM, by1 = (by0[k]+1) & perlin_BM, bz1 = (bz0[k]+1) & perlin_BM ;
+      int i = p[ bx0[k] ], j = p[ bx1 ] ;
+      int b00 = p[ i + by0[k] ], b10 = p[ j + by0[k] ], b01 = p[ i + by1 ], b11 = p[ j + by1 ] ;
+      q[0][k] = g3[ b00 + bz0[k] ] ;
+      q[1][k] = g3[ b10 + bz0[k] ] ;
+      q[2][k] = g3[ b01 + bz0[k] ] ;
+      q[3][k] = g3[ b11 + bz0[k] ] ;
+      q[4][k] = g3[ b00 + bz1 ] ;
+      q[5][k] = g3[ b10 + bz1 ] ;
+      q[6][k] = g3[ b01 + bz1 ] ;
+      q[7][k] = g3[ b11 + bz1 ] ;
+    }
+
+    // trilinear blend, in the same order noise3 does it
+    __m128d a = perlinLerp2( sx, perlinAt3( rx0, ry0, rz0, q[0][0], q[0][1] ), perlinAt3( rx1, ry0, rz0, q[1][0], q[1][1] ) ) ;
+    __m128d b = perlinLerp2( sx, perlinAt3( rx0, ry1, rz0, q[2][0], q[2][1] ), perlinAt3( rx1, ry1, rz0, q[3][0], q[3][1] ) ) ;
+    __m128d c = perlinLerp2( sy, a, b ) ;
+    a = perlinLerp2( sx, perlinAt3( rx0, ry0, rz1, q[4][0], q[4][1] ), perlinAt3( rx1, ry0, rz1, q[5][0], q[5][1] ) ) ;
+    b = perlinLerp2( sx, perlinAt3( rx0, ry1, rz1, q[6][0], q[6][1] ), perlinAt3( rx1, ry1, rz1, q[7][0], q[7][1] ) ) ;
+    __m128d d = perlinLerp2( sy, a, b ) ;
+
+    double res[perlin_LANES] ;
+    _mm_storeu_pd( res, perlinLerp2( sz, c, d ) ) ;
+    for( int k = 0 ; k < lanes ; k++ )
+      out[ base+k ] = res[k] ;
+  }
+}
+
 void PerlinGenerator::normalize2(double v[2])
 {
   double s;
@@ -206,6 +338,9 @@ void PerlinGenerator::normalize3(double v[3])
 
 void PerlinGenerator::reset( int seed )
 {
+  static int resets = 0 ;
+  generation = ++resets ;
+
   srand( seed ) ;
   int i, j, k;
 
@@ -281,6 +416,87 @@ double PerlinGenerator::PerlinNoise2D( double x, double y, double divisionFactor
   return sum ;
 }
 
+// scratch block size for the octave sums, small enough to stay in L1
+#define perlin_BATCH_BLOCK 256
+
+void PerlinGenerator::PerlinNoise2DBatch( const double* x, const double* y, double* out, int n,
+  double divisionFactor, double freqMult, int numFreqs )
+{
+  double px[perlin_BATCH_BLOCK], py[perlin_BATCH_BLOCK], octave[perlin_BATCH_BLOCK] ;
+  for( int base = 0 ; base < n ; base += perlin_BATCH_BLOCK )
+  {
+    int m = min( perlin_BATCH_BLOCK, n-base ) ;
+    double *sum = out + base ;
+    for( int i = 0 ; i < m ; i++ )
+    {
+      px[i] = x[base+i] ;
+      py[i] = y[base+i] ;
+      sum[i] = 0 ;
+    }
+
+    double scale = 1 ;
+    for( int f = 0 ; f < numFreqs ; f++ )
+    {
+      noise2Batch( px, py, octave, m ) ;
+      for( int i = 0 ; i < m ; i++ )
+      {
+        sum[i] += octave[i] / scale ;
+        px[i] *= freqMult ;
+        py[i] *= freqMult ;
+      }
+      scale *= divisionFactor ;
+    }
+  }
+
+#ifdef _DEBUG
+  // the SSE2 kernel has to give exactly what the scalar noise2 does
+  for( int i = 0 ; i < n ; i += max( 1, n/16 ) )
+    if( out[i] != PerlinNoise2D( x[i], y[i], divisionFactor, freqMult, numFreqs ) )
+      error( "PerlinNoise2DBatch point %d is %f, PerlinNoise2D says %f", i, out[i],
+        PerlinNoise2D( x[i], y[i], divisionFactor, freqMult, numFreqs ) ) ;
+#endif
+}
+
+void PerlinGenerator::PerlinNoise3DBatch( const double* x, const double* y, const double* z, double* out, int n,
+  double divisionFactor, double freqMult, int numFreqs )
+{
+  double px[perlin_BATCH_BLOCK], py[perlin_BATCH_BLOCK], pz[perlin_BATCH_BLOCK], octave[perlin_BATCH_BLOCK] ;
+  for( int base = 0 ; base < n ; base += perlin_BATCH_BLOCK )
+  {
+    int m = min( perlin_BATCH_BLOCK, n-base ) ;
+    double *sum = out + base ;
+    for( int i = 0 ; i < m ; i++ )
+    {
+      px[i] = x[base+i] ;
+      py[i] = y[base+i] ;
+      pz[i] = z[base+i] ;
+      sum[i] = 0 ;
+    }
+
+    double scale = 1 ;
+    for( int f = 0 ; f < numFreqs ; f++ )
+    {
+      noise3Batch( px, py, pz, octave, m ) ;
+      for( int i = 0 ; i < m ; i++ )
+      {
+        sum[i] += octave[i] / scale ;
+        px[i] *= freqMult ;
+        py[i] *= freqMult ;
+        pz[i] *= freqMult ;
+      }
+      scale *= divisionFactor ;
+    }
+  }
+
+#ifdef _DEBUG
+  // the SSE2 kernel has to give exactly what the scalar noise3 does
+  for( int i = 0 ; i < n ; i += max( 1, n/16 ) )
+    if( out[i] != PerlinNoise3D( x[i], y[i], z[i], divisionFactor, freqMult, numFreqs ) )
+      error( "PerlinNoise3DBatch point %d is %f, PerlinNoise3D says %f", i, out[i],
+        PerlinNoise3D( x[i], y[i], z[i], divisionFactor, freqMult, numFreqs ) ) ;
+#endif
+}
+
 double PerlinGenerator::PerlinNoise3D(double x, double y, double z, double divisionFactor, double freqMult, int numFreqs )
 {
   double sum = 0;
@@ -413,6 +629,17 @@ Vector PerlinGenerator::sky( double x, double y, double z, const Vector& skyColo
   
 }
 
+void PerlinGenerator::skyBatch( const double* x, const double* y, const double* z, Vector* out, int n,
+  const Vector& skyColor, const Vector& cloud )
+{
+  if( n <= 0 )  return ;
+
+  vector<double> val( n ) ;
+  PerlinNoise3DBatch( x,y,z, &val[0], n, 1.5, 2, 12 ) ; // same "very good" cloud as sky()
+  for( int i = 0 ; i < n ; i++ )
+    out[i] = quadraticSpline( (1+val[i])/2.0, cloud, .6, skyColor ) ;
+}
+
 Vector PerlinGenerator::marble( double x, double y, double z, double grainVariable )
 {
   return marble( x,y,z,grainVariable,32,16, MARBLE1,MARBLE4 ) ;
@@ -452,33 +679,89 @@ Vector PerlinGenerator::at( const Vector& pos )
   //return sky( pos.x,pos.y,pos.z, SKY_BLUE, CLOUD_WHITE ) ;
   Vector n = pos/worldNormalizer ;
 
+  double divisionFactor, freqMult ;
+  int numFreqs ;
+  getOctaveParams( divisionFactor, freqMult, numFreqs ) ;
+  return colorFromNoise( n, PerlinNoise3D( n.x,n.y,n.z, divisionFactor, freqMult, numFreqs ) ) ;
+}
+
+void PerlinGenerator::atBatch( const Vector* pos, Vector* out, int n )
+{
+  if( n <= 0 )  return ;
+
+  vector<double> x( n ), y( n ), z( n ), val( n ) ;
+  for( int i = 0 ; i < n ; i++ )
+  {
+    Vector np = pos[i]/worldNormalizer ;
+    x[i] = np.x ;
+    y[i] = np.y ;
+    z[i] = np.z ;
+  }
+
+  double divisionFactor, freqMult ;
+  int numFreqs ;
+  getOctaveParams( divisionFactor, freqMult, numFreqs ) ;
+  PerlinNoise3DBatch( &x[0], &y[0], &z[0], &val[0], n, divisionFactor, freqMult, numFreqs ) ;
+
+  for( int i = 0 ; i < n ; i++ )
+    out[i] = colorFromNoise( Vector( x[i], y[i], z[i] ), val[i] ) ;
+}
+
+void PerlinGenerator::getOctaveParams( double& divisionFactor, double& freqMult, int& numFreqs )
+{
   switch( noiseType )
   {
     case PerlinNoiseType::Sky:
-      return sky( n.x, n.y, n.z, SKY_BLUE, CLOUD_WHITE ) ;
+      // same as sky()
+      divisionFactor = 1.5, freqMult = 2, numFreqs = 12 ;
+      break ;
+
+    case PerlinNoiseType::Wood:
+    case PerlinNoiseType::Marble:
+    default:
+      // marble() with 32 freckling
+      divisionFactor = 2, freqMult = 2, numFreqs = 32 ;
+      break ;
+
+    case PerlinNoiseType::CustomLinear:
+    case PerlinNoiseType::CustomQuadratic:
+    case PerlinNoiseType::CustomCubic:
+    case PerlinNoiseType::CustomQuartic:
+    case PerlinNoiseType::CustomQuintic:
+      divisionFactor = persistence, freqMult = lacunarity, numFreqs = octaves ;
+      break ;
+  }
+}
+
+Vector PerlinGenerator::colorFromNoise( const Vector& n, real noiseVal )
+{
+  switch( noiseType )
+  {
+    case PerlinNoiseType::Sky:
+      return quadraticSpline( (1+noiseVal)/2.0, CLOUD_WHITE, .6, SKY_BLUE ) ;
       
     case PerlinNoiseType::Wood:
-      return wood( n.x, n.y, n.z ) ;
+      // wood() is marble() with x^2+y^2 as the grain
+      return cubicSpline( (1 + sin( 40*(n.x*n.x + n.y*n.y + noiseVal) ))/2.0, WOOD1, WOOD2, WOOD3, WOOD4 ) ;
       
     case PerlinNoiseType::Marble:
     default:
-      return marble( n.x,n.y,n.z, n.x ) ;
+      return linearSpline( (1 + sin( 16*(n.x + noiseVal) ))/2.0, MARBLE1, MARBLE4 ) ;
 
     case PerlinNoiseType::CustomLinear:
-      return linearSpline( PerlinNoise3D( n.x,n.y,n.z, persistence, lacunarity, octaves ) ) ;
+      return linearSpline( noiseVal ) ;
       
     case PerlinNoiseType::CustomQuadratic:
-      return quadraticSpline( PerlinNoise3D( n.x,n.y,n.z, persistence, lacunarity, octaves ) ) ;
+      return quadraticSpline( noiseVal ) ;
 
     case PerlinNoiseType::CustomCubic:
-      return cubicSpline( PerlinNoise3D( n.x,n.y,n.z, persistence, lacunarity, octaves ) ) ;
+      return cubicSpline( noiseVal ) ;
 
     case PerlinNoiseType::CustomQuartic:
-      return quarticSpline( PerlinNoise3D( n.x,n.y,n.z, persistence, lacunarity, octaves ) ) ;
+      return quarticSpline( noiseVal ) ;
 
     case PerlinNoiseType::CustomQuintic:
-      return quinticSpline( PerlinNoise3D( n.x,n.y,n.z, persistence, lacunarity, octaves ) ) ;
-
+      return quinticSpline( noiseVal ) ;
   }
 }
 
@@ -488,6 +771,11 @@ real PerlinGenerator::mountainHeight( real u, real v )
   return PerlinNoise2D( u, v, 2, 2, 4 ) ;
 }
 
+void PerlinGenerator::mountainHeightBatch( const double* u, const double* v, double* out, int n )
+{
+  PerlinNoise2DBatch( u, v, out, n, 2, 2, 4 ) ; // same sum as mountainHeight
+}
+
 Model* PerlinGenerator::heightmapNonindexed( int udivs, int vdivs, real uSize, real vSize, real normalFindStepRadians )
 {
   Model* model = new Model( "heightmap" ) ;
@@ -600,17 +888,24 @@ Model* PerlinGenerator::heightmapIndexed( int udivs, int vdivs, real uSize, real
 
   real us = 1.0 / udivs ;
 
+  // heights for a whole row of v at a time
+  vector<double> fus( vdivs ), fvs( vdivs ), heights( vdivs ) ;
+  for( int v = 0 ; v < vdivs ; v++ )
+    fvs[v] = (real)v/vdivs ;
+
   // u and v must be normalized to sample the perlin noise function properly
   for( int u = 0 ; u < udivs ; u++ ) //x
   {
+    real fu = (real)u/udivs ;
+    for( int v = 0 ; v < vdivs ; v++ )
+      fus[v] = fu ;
+    mountainHeightBatch( &fus[0], &fvs[0], &heights[0], vdivs ) ;
+
     for( int v = 0 ; v < vdivs ; v++ ) //z
     {
-      real fu = (real)u/udivs ;
-      real fv = (real)v/vdivs ;
-      
-      Vector p(fu,0,fv), c=1, n;
+      Vector p(fu,0,fvs[v]), c=1, n;
       
-      p.y = mountainHeight( p.x, p.z ) ;
+      p.y = heights[v] ;
       
       p.x *= uSize ;
       p.z *= vSize ;
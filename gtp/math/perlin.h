@@ -41,6 +41,10 @@ struct PerlinGenerator
 
   PerlinNoiseType noiseType ;
 
+  // bumped (to a value no other generator has had) every reset(),
+  // so anything cached from this generator's noise can tell it's stale.
+  int generation ;
+
   // my predefined color values
   static Vector CLOUD_WHITE,SKY_BLUE,
     WOOD1,WOOD2,WOOD3,WOOD4,
@@ -84,6 +88,11 @@ struct PerlinGenerator
   double noise1(double);
   double noise2(double *);
   double noise3(double *);
+
+  // Batch versions: SoA coordinate arrays in, one value per point out.
+  // Results are identical to calling noise2/noise3 point by point.
+  void noise2Batch( const double* x, const double* y, double* out, int n ) ;
+  void noise3Batch( const double* x, const double* y, const double* z, double* out, int n ) ;
   void normalize2(double *);
   void normalize3(double *);
   void reset( int seed );
@@ -108,6 +117,12 @@ struct PerlinGenerator
   // divisionFactor aka persistence, freqMult aka lacunarity, numFreqs aka octaves
   double PerlinNoise3D( double x, double y, double z, double divisionFactor, double freqMult, int numFreqs ) ;
 
+  // All octaves for n points at once.  Same sums as PerlinNoise2D/3D.
+  void PerlinNoise2DBatch( const double* x, const double* y, double* out, int n,
+    double divisionFactor, double freqMult, int numFreqs ) ;
+  void PerlinNoise3DBatch( const double* x, const double* y, const double* z, double* out, int n,
+    double divisionFactor, double freqMult, int numFreqs ) ;
+
   Vector linearSpline( real t ) ;
   Vector linearSpline( real t, const Vector& c1, const Vector& c2 ) ;
   Vector quadraticSpline( real t ) ;
@@ -121,6 +136,8 @@ struct PerlinGenerator
 
   Vector wood( double x, double y, double z ) ;
   Vector sky( double x, double y, double z, const Vector& skyColor, const Vector& cloud ) ;
+  void skyBatch( const double* x, const double* y, const double* z, Vector* out, int n,
+    const Vector& skyColor, const Vector& cloud ) ;
 
   // Use internal variable parameters
   Vector marble( double x, double y, double z, double grainVariable ) ;
@@ -142,8 +159,16 @@ struct PerlinGenerator
 
   // use internally stored parameters to generate noise
   Vector at( const Vector& pos ) ;
+  void atBatch( const Vector* pos, Vector* out, int n ) ;
+
+  // the octave sum at() uses for noiseType, and how at() turns
+  // its value into a color.  at(pos) == colorFromNoise( n, PerlinNoise3D( n, params ) )
+  // for n = pos/worldNormalizer.
+  void getOctaveParams( double& divisionFactor, double& freqMult, int& numFreqs ) ;
+  Vector colorFromNoise( const Vector& n, real noiseVal ) ;
 
   real mountainHeight( real u, real v ) ;
+  void mountainHeightBatch( const double* u, const double* v, double* out, int n ) ;
 
   // defaults to using (x,z) for floor plane and
   // y for height, you can rotate the model after generation
@@ -0,0 +1,57 @@
+#include "AreaLightSampler.h"
+#include "../scene/Scene.h"
+#include "../geometry/MeshGroup.h"
+#include "../geometry/Mesh.h"
+#include <algorithm>
+
+AreaLightSampler::AreaLightSampler( Scene *scene )
+{
+  totalArea = 0 ;
+  for( int i = 0 ; i < scene->lights.size() ; i++ )
+  {
+    MeshGroup *mg = scene->lights[i]->meshGroup ;
+    if( !mg )  continue ; // a far light, nothing to land on
+    bool emits = false ;
+    for( int m = 0 ; m < mg->meshes.size() ; m++ )
+    {
+      Mesh *mesh = mg->meshes[m] ;
+      for( int t = 0 ; t < mesh->tris.size() ; t++ )
+      {
+        const Triangle& tri = mesh->tris[t] ;
+        real area = tri.area() ;
+        if( area <= 0 || !tri.getAverageColor( ColorIndex::Emissive ).nonzero() )  continue ;
+        tris.push_back( &tri ) ;
+        totalArea += area ;
+        areaCdf.push_back( totalArea ) ;
+        emits = true ;
+      }
+    }
+    if( emits )
+      shapes.push_back( scene->lights[i] ) ;
+  }
+
+  if( !isValid() )
+    warning( "AreaLightSampler: no emitting triangles in the scene, nothing to sample" ) ;
+}
+
+Vector AreaLightSampler::sample( real r1, real r2, real r3, Vector& normal ) const
+{
+  int ti = (int)( upper_bound( areaCdf.begin(), areaCdf.end(), r1*totalArea ) - areaCdf.begin() ) ;
+  if( ti >= tris.size() )  ti = (int)tris.size() - 1 ;
+  const Triangle& tri = *tris[ ti ] ;
+  normal = tri.normal ;
+
+  // sqrt warp of the barycentrics, uniform over the triangle
+  real su = sqrt( r2 ) ;
+  real b0 = 1 - su, b1 = r3*su ;
+  return tri.a*b0 + tri.b*b1 + tri.c*( 1 - b0 - b1 ) ;
+}
+
+bool AreaLightSampler::isLight( const Shape *shape ) const
+{
+  // there's only ever a handful of lights
+  for( int i = 0 ; i < shapes.size() ; i++ )
+    if( shapes[i] == shape )
+      return true ;
+  return false ;
+}
@@ -0,0 +1,44 @@
+#ifndef AREALIGHTSAMPLER_H
+#define AREALIGHTSAMPLER_H
+
+#include "../math/Vector.h"
+
+struct Scene ;
+struct Shape ;
+struct Triangle ;
+
+// Picks points uniformly by area over every emitting triangle of
+// scene->lights.  getRandomPointFacing() picks a light first and then a
+// point on it, so its pdf depends on which light you're at and MIS can't
+// use it.  This one's pdf wrt area is just 1/totalArea everywhere on the
+// lights, which makes the conversion to solid angle
+//   pdf_w = pdf_A * dist^2 / |cos_light|
+// cheap for both strategies.
+struct AreaLightSampler
+{
+  // the triangles, and the running sum of their areas
+  vector<const Triangle*> tris ;
+  vector<real> areaCdf ;
+  real totalArea ;
+
+  // built from scene->lights.  Far lights have no geometry and are skipped.
+  AreaLightSampler( Scene *scene ) ;
+
+  inline bool isValid() const { return totalArea > 0 ; }
+
+  // a point on the lights.  r1 picks the triangle, r2,r3 place the
+  // point inside it, all uniform in [0,1).  normal is the triangle's.
+  Vector sample( real r1, real r2, real r3, Vector& normal ) const ;
+
+  // pdf wrt area of sample() landing on any point of the lights
+  inline real areaPdf() const { return 1.0/totalArea ; }
+
+  // true if sample() can land on shape, so a BRDF ray that hit it
+  // could have been a light sample
+  bool isLight( const Shape *shape ) const ;
+
+private:
+  vector<const Shape*> shapes ;
+} ;
+
+#endif
@@ -0,0 +1,82 @@
+#include "BakedSky.h"
+#include "../math/perlin.h"
+#include "../threading/ParallelizableBatch.h"
+
+BakedSky::BakedSky( int iWidth )
+{
+  width = iWidth ;
+  height = max( 1, width/2 ) ;
+  texels.resize( width*height ) ;
+
+  bakedPerlin = 0 ;
+  bakedGeneration = -1 ;
+}
+
+bool BakedSky::isStale( const PerlinGenerator& perlin, const Vector& skyColor, const Vector& cloudColor ) const
+{
+  return bakedPerlin != &perlin ||
+         bakedGeneration != perlin.generation ||
+         bakedSkyColor != skyColor ||
+         bakedCloudColor != cloudColor ;
+}
+
+void BakedSky::queueBake( PerlinGenerator& perlin, const Vector& skyColor, const Vector& cloudColor )
+{
+  info( "Baking the perlin sky, %d x %d", width, height ) ;
+  bakedPerlin = &perlin ;
+  bakedGeneration = perlin.generation ;
+  bakedSkyColor = skyColor ;
+  bakedCloudColor = cloudColor ;
+
+  ParallelBatch *batch = new ParallelBatch( "sky bake", NULL ) ;
+  for( int row = 0 ; row < height ; row += 8 )
+    batch->addJob( new CallbackObject2<BakedSky*, void (BakedSky::*)( int, int ), int,int>(
+      this, &BakedSky::bakeRows, row, min( row+8, height ) ) ) ;
+  threadPool.addBatch( batch ) ;
+}
+
+void BakedSky::bakeRows( int startRow, int endRow )
+{
+  // evaluate at texel centers:  row runs pole to pole (tElevation 0 at +y),
+  // col runs around the y axis starting at -x.
+  // A row at a time through the batch noise kernel.
+  vector<double> x( width ), y( width ), z( width ) ;
+  for( int row = startRow ; row < endRow ; row++ )
+  {
+    real theta = PI*( row + .5 )/height ;
+    real cosTheta = cos( theta ), sinTheta = sin( theta ) ;
+    for( int col = 0 ; col < width ; col++ )
+    {
+      real phi = 2*PI*( col + .5 )/width - PI ;
+      x[col] = sinTheta*cos( phi ) ;
+      y[col] = cosTheta ;
+      z[col] = sinTheta*sin( phi ) ;
+    }
+    bakedPerlin->skyBatch( &x[0], &y[0], &z[0], &texels[ row*width ], width,
+      bakedSkyColor, bakedCloudColor ) ;
+  }
+}
+
+Vector BakedSky::lookup( const Vector& dir ) const
+{
+  real theta = acos( clampedCopy<real>( dir.y, -1, 1 ) ) ;
+  real phi = atan2( dir.z, dir.x ) ;
+
+  // fractional texel coordinates, texel centers on whole numbers
+  real r = height*theta/PI - .5 ;
+  real c = width*( phi + PI )/( 2*PI ) - .5 ;
+
+  int r0 = (int)floor( r ), c0 = (int)floor( c ) ;
+  real fr = r - r0, fc = c - c0 ;
+
+  // clamp at the poles, wrap around the seam
+  int r1 = min( r0+1, height-1 ) ;
+  r0 = max( r0, 0 ) ;
+  int c1 = c0+1 ;
+  if( c0 < 0 )  c0 += width ;
+  if( c1 >= width )  c1 -= width ;
+
+  Vector top = texel( r0, c0 )*(1-fc) + texel( r0, c1 )*fc ;
+  Vector bottom = texel( r1, c0 )*(1-fc) + texel( r1, c1 )*fc ;
+  return top*(1-fr) + bottom*fr ;
+}
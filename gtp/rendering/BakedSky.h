@@ -0,0 +1,44 @@
+#ifndef BAKEDSKY_H
+#define BAKEDSKY_H
+
+#include "../math/Vector.h"
+
+struct PerlinGenerator ;
+
+// The perlin sky, baked into a lat-long table.
+//
+// PerlinGenerator::sky is 12 octaves of noise3 per call, and every
+// ray that misses the scene calls it, which in an open scene is most
+// of the secondary rays.  So I evaluate it once per texel at the start
+// of a trace and every miss after that is just a bilinear lookup.
+// It only gets rebaked if the generator was reset (new seed) or the
+// sky colors changed since the last bake.
+struct BakedSky
+{
+  int width, height ; // texels around the equator, and pole to pole (width/2)
+  vector<Vector> texels ;
+
+  BakedSky( int iWidth ) ;
+
+  // true if the table doesn't hold this generator's sky with these colors
+  bool isStale( const PerlinGenerator& perlin, const Vector& skyColor, const Vector& cloudColor ) const ;
+
+  // Queues a ParallelBatch of row jobs that fill the table.  Batches
+  // run in order, so queue this BEFORE the raytracing batch that reads it.
+  void queueBake( PerlinGenerator& perlin, const Vector& skyColor, const Vector& cloudColor ) ;
+
+  // bilinear lookup, dir must be unit length
+  Vector lookup( const Vector& dir ) const ;
+
+private:
+  // what's baked in right now
+  PerlinGenerator *bakedPerlin ;
+  int bakedGeneration ;
+  Vector bakedSkyColor, bakedCloudColor ;
+
+  void bakeRows( int startRow, int endRow ) ;
+
+  inline const Vector& texel( int row, int col ) const { return texels[ row*width + col ] ; }
+} ;
+
+#endif
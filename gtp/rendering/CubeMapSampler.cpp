@@ -0,0 +1,138 @@
+#include "CubeMapSampler.h"
+#include "../geometry/CubeMap.h"
+
+// Rec. 709 luminance, so a blue sky doesn't outweigh a white sun
+static inline real luminance( const Vector& c )
+{
+  return 0.2126*c.x + 0.7152*c.y + 0.0722*c.z ;
+}
+
+real CubeMapSampler::texelSolidAngleFactor( real u, real v )
+{
+  real r2 = 1 + u*u + v*v ;
+  return 1.0 / ( r2*sqrt( r2 ) ) ;
+}
+
+CubeMapSampler::CubeMapSampler( CubeMap* iCubeMap )
+{
+  cubeMap = iCubeMap ;
+  pixelsPerSide = cubeMap->pixelsPerSide ;
+  numTexels = 6*pixelsPerSide*pixelsPerSide ;
+  totalWeight = 0 ;
+
+  if( !cubeMap->currentSource || cubeMap->currentSource->size() < numTexels )
+  {
+    error( "CubeMapSampler: cubemap has no source to sample" ) ;
+    numTexels = 0 ;
+    return ;
+  }
+
+  texelPdf.resize( numTexels ) ;
+  prob.resize( numTexels ) ;
+  alias.resize( numTexels ) ;
+
+  // weigh each texel by its luminance times the solid angle it subtends
+  for( int FACE = 0 ; FACE < 6 ; FACE++ )
+  {
+    for( int row = 0 ; row < pixelsPerSide ; row++ )
+    {
+      real v = -1 + 2.0*(row + 0.5)/pixelsPerSide ;
+      for( int col = 0 ; col < pixelsPerSide ; col++ )
+      {
+        real u = -1 + 2.0*(col + 0.5)/pixelsPerSide ;
+        int idx = cubeMap->dindex( FACE, row, col ) ;
+        real w = luminance( (*cubeMap->currentSource)[ idx ] ) * texelSolidAngleFactor( u, v ) ;
+        if( w < 0 )  w = 0 ; // negative lobes from compression ringing aren't light
+        texelPdf[ idx ] = w ;
+        totalWeight += w ;
+      }
+    }
+  }
+
+  if( totalWeight <= 0 )
+  {
+    warning( "CubeMapSampler: cubemap is black, nothing to importance sample" ) ;
+    return ;
+  }
+
+  // Vose's alias method.  Scale so the average bucket holds exactly 1.
+  vector<int> small, large ;
+  vector<real> scaled( numTexels ) ;
+  for( int i = 0 ; i < numTexels ; i++ )
+  {
+    texelPdf[i] /= totalWeight ;
+    scaled[i] = texelPdf[i] * numTexels ;
+    if( scaled[i] < 1 )  small.push_back( i ) ;
+    else  large.push_back( i ) ;
+  }
+
+  while( small.size() && large.size() )
+  {
+    int s = small.back() ;  small.pop_back() ;
+    int l = large.back() ;  large.pop_back() ;
+
+    prob[s] = scaled[s] ;
+    alias[s] = l ;
+
+    // l donated (1-scaled[s]) of its mass to fill up s's bucket
+    scaled[l] = ( scaled[l] + scaled[s] ) - 1 ;
+    if( scaled[l] < 1 )  small.push_back( l ) ;
+    else  large.push_back( l ) ;
+  }
+
+  // whatever is left over is 1 up to roundoff
+  for( int i = 0 ; i < large.size() ; i++ )
+  {
+    prob[ large[i] ] = 1 ;
+    alias[ large[i] ] = large[i] ;
+  }
+  for( int i = 0 ; i < small.size() ; i++ )
+  {
+    prob[ small[i] ] = 1 ;
+    alias[ small[i] ] = small[i] ;
+  }
+}
+
+Vector CubeMapSampler::sample( real r1, real r2, real r3, real& oPdf ) const
+{
+  // pick the bucket with r1, and use the fractional part as the coin flip
+  real scaledR = r1 * numTexels ;
+  int idx = (int)scaledR ;
+  if( idx >= numTexels )  idx = numTexels-1 ;
+  real coin = scaledR - idx ;
+  if( coin >= prob[ idx ] )
+    idx = alias[ idx ] ;
+
+  int face, row, col ;
+  cubeMap->getFaceRowCol( idx, face, row, col ) ;
+
+  // jitter uniformly inside the texel
+  real u = -1 + 2.0*(col + r2)/pixelsPerSide ;
+  real v = -1 + 2.0*(row + r3)/pixelsPerSide ;
+
+  Vector dir = cubeFaceBaseConvertingFwd[face] +
+          u*cubeFaceBaseConvertingRight[face] +
+          v*cubeFaceBaseConvertingUp[face] ;
+  dir.normalize() ;
+
+  // uniform on the texel's face area dA, converted to solid angle
+  real dA = SQUARE( 2.0/pixelsPerSide ) ;
+  oPdf = texelPdf[ idx ] / ( dA * texelSolidAngleFactor( u, v ) ) ;
+  return dir ;
+}
+
+real CubeMapSampler::pdf( const Vector& dir ) const
+{
+  if( !numTexels )  return 0 ;
+
+  int face ;
+  real row, col ;
+  cubeMap->getFaceRowCol( dir, face, row, col ) ;
+  int irow = clampedCopy<int>( (int)row, 0, pixelsPerSide-1 ) ;
+  int icol = clampedCopy<int>( (int)col, 0, pixelsPerSide-1 ) ;
+
+  real u = -1 + 2.0*col/pixelsPerSide ;
+  real v = -1 + 2.0*row/pixelsPerSide ;
+  real dA = SQUARE( 2.0/pixelsPerSide ) ;
+  return texelPdf[ cubeMap->dindex( face, irow, icol ) ] / ( dA * texelSolidAngleFactor( u, v ) ) ;
+}
@@ -0,0 +1,53 @@
+#ifndef CUBEMAPSAMPLER_H
+#define CUBEMAPSAMPLER_H
+
+#include "../math/Vector.h"
+
+struct CubeMap ;
+
+// Importance samples a cubemap by (luminance x texel solid angle).
+// The old cubemap lighting loop shot a ray at every skip'th texel,
+// which wastes almost all its rays on dark sky when the cubemap
+// has a small bright sun in it.  Instead I build an alias table
+// (Walker/Vose) over all 6*pps*pps texels once per trace, and each
+// shading point draws a fixed number of directions from it in O(1).
+//
+// Texel solid angle on a unit cube face at (u,v) is
+//   dw = dA / (1+u^2+v^2)^(3/2),   dA = (2/pps)^2
+// so corner texels get less weight than face centers.
+struct CubeMapSampler
+{
+  int pixelsPerSide ;
+  int numTexels ;
+
+  // alias table: texel i is accepted with prob[i], else alias[i] is taken.
+  vector<real> prob ;
+  vector<int> alias ;
+
+  // discrete probability of choosing each texel (sums to 1)
+  vector<real> texelPdf ;
+
+  // the sum of luminance*solid angle over the whole sphere.
+  // 0 means the cubemap is black and can't be sampled.
+  real totalWeight ;
+
+  // builds from cubeMap->currentSource, so setSource BEFORE you call this.
+  CubeMapSampler( CubeMap* cubeMap ) ;
+
+  inline bool isValid() const { return totalWeight > 0 ; }
+
+  // draws a direction.  r1 picks the texel, r2,r3 jitter inside it.
+  // all 3 are uniform in [0,1).  pdf is returned wrt solid angle.
+  Vector sample( real r1, real r2, real r3, real& pdf ) const ;
+
+  // pdf (wrt solid angle) of the sampler producing direction dir.
+  real pdf( const Vector& dir ) const ;
+
+private:
+  // keeps a pointer to the cubemap only to look up face/row/col for pdf()
+  CubeMap* cubeMap ;
+
+  static real texelSolidAngleFactor( real u, real v ) ;
+} ;
+
+#endif
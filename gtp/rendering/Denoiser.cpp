@@ -0,0 +1,142 @@
+#include "Denoiser.h"
+#include "RaytracingCore.h"
+#include "../threading/ParallelizableBatch.h"
+#include <emmintrin.h>
+
+// 1D B3 spline, the 5x5 kernel is the outer product
+static const real B3[5] = { 1/16., 1/4., 3/8., 1/4., 1/16. } ;
+
+ATrousDenoiser::ATrousDenoiser( int iPasses, real iSigmaColor, real iSigmaNormal, real iSigmaDepth )
+{
+  passes = iPasses ;
+  sigmaColor = iSigmaColor ;
+  sigmaNormal = iSigmaNormal ;
+  sigmaDepth = iSigmaDepth ;
+  fb = 0 ;
+}
+
+void ATrousDenoiser::queuePasses( FrameBuffer* iFrameBuffer, Callback* onDone )
+{
+  fb = iFrameBuffer ;
+  buf[0].resize( fb->colors.size() ) ;
+  buf[1].resize( fb->colors.size() ) ;
+
+  for( int pass = 0 ; pass < passes ; pass++ )
+  {
+    Callback *doneJob = 0 ;
+    if( pass == passes-1 )
+    {
+      // swap the result in (cheap, vs copying every pixel) then finish up
+      doneJob = new Callback0( [this,pass,onDone](){
+        fb->colors.swap( buf[ pass&1 ] ) ;
+        onDone->exec() ;
+        delete onDone ;
+      } ) ;
+    }
+
+    ParallelBatch *batch = new ParallelBatch( "denoising", doneJob ) ;
+
+    // same 2 row strips the raytracer uses
+    for( int row = 0 ; row < fb->rows ; row+=2 )
+      batch->addJob( new CallbackObject3<ATrousDenoiser*, void (ATrousDenoiser::*)( int, int, int ),
+        int,int,int>( this, &ATrousDenoiser::filterRows, pass, row, min( row+2, fb->rows ) ) ) ;
+
+    threadPool.addBatch( batch ) ;
+  }
+}
+
+void ATrousDenoiser::filterRows( int pass, int startRow, int endRow )
+{
+  const vector<Vector>& src = pass ? buf[ (pass-1)&1 ] : fb->colors ;
+  vector<Vector>& dst = buf[ pass&1 ] ;
+  const vector<Vector>& normals = fb->normals ;
+  const vector<real>& depths = fb->depths ;
+
+  int rows = fb->rows, cols = fb->cols ;
+  int step = 1 << pass ;
+
+  // fold the sigmas into reciprocals once, the inner loop is 25 taps a pixel
+  real invSigmaColor2 = 1.0 / SQUARE( sigmaColor / step ) ;
+  real invSigmaNormal2 = 1.0 / SQUARE( sigmaNormal ) ;
+  real invSigmaDepth = 1.0 / sigmaDepth ;
+
+  // SSE2 (the x64 baseline, so no cpu check, same as RadiositySystem::dot).
+  // A Vector is 4 doubles, so its x,y and z,w are one __m128d each: a tap's
+  // color & normal differences and its weighted color are 4 packed ops
+  // instead of 12 scalar ones.  w isn't part of either, zMask zeros it.
+  // The exp stays scalar, there's no SSE2 exp.
+  const __m128d zMask = _mm_castsi128_pd( _mm_set_epi64x( 0, -1 ) ) ;
+  const __m128d invSigmas = _mm_set1_pd( invSigmaColor2 ) ;
+  const __m128d invSigmaNs = _mm_set1_pd( invSigmaNormal2 ) ;
+
+  for( int row = startRow ; row < endRow ; row++ )
+  {
+    for( int col = 0 ; col < cols ; col++ )
+    {
+      int p = row*cols + col ;
+      const Vector& cp = src[p] ;
+      real zp = depths[p] ;
+
+      // Background pixels are a direct lookup of the sky/cubemap,
+      // they aren't noisy and blurring them would just smear the cubemap.
+      if( zp <= 0 )
+      {
+        dst[p] = cp ;
+        continue ;
+      }
+
+      const Vector& np = normals[p] ;
+      real depthScale = invSigmaDepth / ( zp*step ) ;
+
+      __m128d cpXY = _mm_loadu_pd( &cp.x ), cpZ = _mm_and_pd( _mm_loadu_pd( &cp.z ), zMask ) ;
+      __m128d npXY = _mm_loadu_pd( &np.x ), npZ = _mm_and_pd( _mm_loadu_pd( &np.z ), zMask ) ;
+      __m128d sumRG = _mm_setzero_pd(), sumB = _mm_setzero_pd() ;
+      real sumW = 0 ;
+      for( int j = -2 ; j <= 2 ; j++ )
+      {
+        int qrow = row + j*step ;
+        if( qrow < 0 || qrow >= rows )  continue ;
+
+        for( int i = -2 ; i <= 2 ; i++ )
+        {
+          int qcol = col + i*step ;
+          if( qcol < 0 || qcol >= cols )  continue ;
+
+          int q = qrow*cols + qcol ;
+          real zq = depths[q] ;
+          if( zq <= 0 )  continue ; // don't bleed sky into geometry
+
+          __m128d cqXY = _mm_loadu_pd( &src[q].x ), cqZ = _mm_and_pd( _mm_loadu_pd( &src[q].z ), zMask ) ;
+          __m128d nqXY = _mm_loadu_pd( &normals[q].x ), nqZ = _mm_and_pd( _mm_loadu_pd( &normals[q].z ), zMask ) ;
+
+          // lanes ( dx^2 + dz^2, dy^2 ), summed across below:
+          //   dColor*invSigmaColor2 + dNormal*invSigmaNormal2
+          __m128d dc0 = _mm_sub_pd( cpXY, cqXY ), dc1 = _mm_sub_pd( cpZ, cqZ ) ;
+          __m128d dn0 = _mm_sub_pd( npXY, nqXY ), dn1 = _mm_sub_pd( npZ, nqZ ) ;
+          __m128d dColor = _mm_add_pd( _mm_mul_pd( dc0, dc0 ), _mm_mul_pd( dc1, dc1 ) ) ;
+          __m128d dNormal = _mm_add_pd( _mm_mul_pd( dn0, dn0 ), _mm_mul_pd( dn1, dn1 ) ) ;
+          __m128d e = _mm_add_pd( _mm_mul_pd( dColor, invSigmas ), _mm_mul_pd( dNormal, invSigmaNs ) ) ;
+          real edge = _mm_cvtsd_f64( _mm_add_sd( e, _mm_unpackhi_pd( e, e ) ) ) ;
+
+          // depth changes linearly across a slanted plane, so
+          // compare it per pixel of distance to the tap
+          int tapDist = max( abs( i ), abs( j ) ) ;
+          real dDepth = tapDist ? fabs( zp-zq ) * depthScale / tapDist : 0 ;
+
+          real w = B3[i+2]*B3[j+2] * exp( -edge - dDepth ) ;
+          __m128d wv = _mm_set1_pd( w ) ;
+          sumRG = _mm_add_pd( sumRG, _mm_mul_pd( wv, cqXY ) ) ;
+          sumB = _mm_add_pd( sumB, _mm_mul_pd( wv, cqZ ) ) ;
+          sumW += w ;
+        }
+      }
+
+      // the center tap always has weight B3[2]^2, so sumW > 0.
+      // keep the center's alpha.
+      real rgb[ 4 ] ;
+      _mm_storeu_pd( rgb, sumRG ) ;
+      _mm_storeu_pd( rgb+2, sumB ) ;
+      dst[p] = Vector( rgb[0]/sumW, rgb[1]/sumW, rgb[2]/sumW, cp.w ) ;
+    }
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "../math/Vector.h"
+
+struct FrameBuffer ;
+struct Callback ;
+
+// Edge avoiding a-trous wavelet filter (Dammertz et al, HPG 2010)
+// over the raytracer's colors, guided by the first hit normal and
+// depth AOVs in the FrameBuffer.
+//
+// Each pass is a 5x5 B3 spline blur "with holes": pass i takes its
+// 25 taps 2^i pixels apart, so 5 passes cover a 125 pixel wide
+// footprint for only 125 taps per pixel.  A tap is weighed down when
+// its color, normal or depth differs from the center pixel's, so
+// silhouettes and creases survive and the noise inside surfaces
+// gets averaged away.  Good enough to preview at 64 rpp instead of 3500.
+struct ATrousDenoiser
+{
+  int passes ;
+
+  // edge stopping falloffs.  sigmaColor gets halved every pass,
+  // since each pass leaves less noise to tell apart from real edges.
+  real sigmaColor ;
+  real sigmaNormal ;
+  real sigmaDepth ;  // relative: depth differences are divided by the center pixel's depth
+
+  ATrousDenoiser( int iPasses, real iSigmaColor, real iSigmaNormal, real iSigmaDepth ) ;
+
+  // Queues one ParallelBatch of row strip jobs per pass.
+  // Batches run one after another, so queue this right after
+  // the raytracing batch and it'll run when traceRectangle is all done.
+  // onDone is run (and deleted) when the last pass finishes.
+  void queuePasses( FrameBuffer* iFrameBuffer, Callback* onDone ) ;
+
+private:
+  FrameBuffer *fb ;
+
+  // ping pong.  pass 0 reads fb->colors, pass i writes buf[i&1],
+  // and the last one gets swapped into fb->colors.
+  vector<Vector> buf[2] ;
+
+  // filters rows [startRow,endRow) for pass
+  void filterRows( int pass, int startRow, int endRow ) ;
+} ;
+
+#endif
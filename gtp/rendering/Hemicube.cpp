@@ -67,7 +67,7 @@ Hemicube::Hemicube( D3D11Window* iWin, real iSideLen, int iPixelsPerSide ) :
   H = Vector(  s,  s, s ) ;
   //*/
 
-  computeFormFactorCosines() ;
+  computeFormFactorCosines( pixelsPerSide, formFactorCosines ) ;
 }
 
 ////Vector& Hemicube::formFactorDirectionVector( int face, int row, int col )
@@ -75,7 +75,7 @@ Hemicube::Hemicube( D3D11Window* iWin, real iSideLen, int iPixelsPerSide ) :
 ////  ///////return formFactorDirectionVectors[ face ][ row*pixelsPerSide + col ] ;
 ////}
 
-void Hemicube::computeFormFactorCosines()
+void Hemicube::computeFormFactorCosines( int pixelsPerSide, Eigen::MatrixXf formFactorCosines[ 2 ] )
 {
   info( "Computing form factor cosines.." ) ;
 
@@ -235,11 +235,23 @@ void Hemicube::renderToSurfaces( Scene *scene, const Vector& eye, const Vector&
 
 /// Trigger a render to the Hemicube face surfaces,
 // from the vantage point "eye", in direction "forward"
-void Hemicube::formFactors( Scene *scene, const Triangle& tri, Eigen::MatrixXf* FFs )
+void Hemicube::formFactors( Scene *scene, const Triangle& tri, CSRMatrix* FFs )
 {
   UINT sender = tri.getId() ; // this patch is the sender
   if( every( sender, 10 ) )
-    printf( "Positioning patch %d/%d\r", sender, FFs->rows() ) ; // rows in FFS is total patches.
+    printf( "Positioning patch %d/%d\r", sender, FFs->N ) ; // rows in FFS is total patches.
+  ffRow.reset( FFs->N ) ;
+  formFactorRow( scene, tri, ffRow ) ;
+
+  // that's the whole row
+  if( sender < FFs->N )
+    FFs->setRow( sender, ffRow ) ;
+}
+
+void Hemicube::formFactorRow( Scene *scene, const Triangle& tri, CSRRowBuilder& ffRow )
+{
+  UINT sender = tri.getId() ;
+  UINT numPatches = ffRow.dense.size() ;
   //printf( ".. computing form factor .. %c\r", spinner = nextSpin( spinner, true ) ) ;
 
   Vector eye = tri.getCentroid() ;
@@ -331,8 +343,8 @@ void Hemicube::formFactors( Scene *scene, const Triangle& tri, Eigen::MatrixXf*
         {
           white++ ;   /// LOST ENERGY
         }
-        else if( sender > FFs->rows() ||
-                 receiver > FFs->rows() )
+        else if( sender >= numPatches ||
+                 receiver >= numPatches )
         {
           // this is where patches that "see nothing" (look into space)
           // go. (would see 0x00ffffff, (w/alpha off mask))
@@ -347,7 +359,7 @@ void Hemicube::formFactors( Scene *scene, const Triangle& tri, Eigen::MatrixXf*
           /// "top" determined form factors.. symmetry
           //FFs( sender, receiver ) += formFactorCosines[ ffCosIndex ]( pixel ) ;
 
-          (*FFs)( sender, receiver ) += formFactorCosines[ ffFaceIndex ]( row,col ) ;
+          ffRow.add( receiver, formFactorCosines[ ffFaceIndex ]( row,col ) ) ;
         }
       } // foreach col
     } // foreach row
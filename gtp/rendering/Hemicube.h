@@ -33,6 +33,7 @@ class Window ;
 
 #include "../window/D3DDrawingVertex.h"
 #include "../math/EigenUtil.h"
+#include "../math/CSRMatrix.h"
 #include "VizFunc.h"
 
 extern char* SidesNames[] ;
@@ -91,6 +92,10 @@ struct Hemicube
   Eigen::MatrixXf formFactorCosines[ 2 ] ;
   ////vector< real > formFactorCosines[ 2 ] ;
 
+  /// the row of form factors being read off the
+  /// surfaces, handed to the sparse FFs when it's done
+  CSRRowBuilder ffRow ;
+
   // 1d array but will be indexed by (row,col) as 
   // (row*pixelsPerSide + col).
   // Going to store the entire thing (cache it)
@@ -115,12 +120,13 @@ struct Hemicube
   // never got used
   ////Vector& formFactorDirectionVector( int face, int row, int col ) ;
 
-private:
   /// Pre-computes form factor cosines
   /// for a hemicube of (pixelsPerSide)
-  /// Called once on hemicube construction
-  void computeFormFactorCosines() ;
+  /// Called once on hemicube construction,
+  /// and by the SoftwareHemicube so both read the same table
+  static void computeFormFactorCosines( int pixelsPerSide, Eigen::MatrixXf formFactorCosines[ 2 ] ) ;
 
+private:
   /// Positions the hemicube over the
   /// patch desired
   /// A Hemicube is positioned and oriented around
@@ -154,7 +160,12 @@ public:
   // and all other patches in the scene
   /// Trigger a render to the hemicube face surfaces,
   /// and write the form factors discovered into the ffs matrix.
-  void formFactors( Scene *scene, const Triangle& tri, Eigen::MatrixXf* FFs ) ;
+  void formFactors( Scene *scene, const Triangle& tri, CSRMatrix* FFs ) ;
+
+  /// Same, but just accumulates tri's row into ffRow
+  /// (reset to the number of patches), for solvers that
+  /// use a row and throw it away
+  void formFactorRow( Scene *scene, const Triangle& tri, CSRRowBuilder& ffRow ) ;
 
   /// there are problems with AO from hemicube,
   /// because of depth buffer problems
@@ -0,0 +1,383 @@
+#include "HierarchicalRadiosity.h"
+#include "../scene/Scene.h"
+#include "../scene/Octree.h"
+#include "../geometry/Triangle.h"
+#include "../geometry/Intersection.h"
+#include "../util/Sampler.h"
+#include "../Globals.h"
+
+// links get re-refined against the solved radiosities this many times
+#define HRAD_REFINE_PASSES 3
+#define HRAD_MAX_ITERATIONS 100
+
+// A cluster has no one normal.  Averaged over every direction, a one
+// sided patch facing a random way has max(cos,0) = 1/4, so that's what
+// a cluster end of a link uses.
+#define HRAD_CLUSTER_COSINE 0.25
+
+HierarchicalRadiosity::HierarchicalRadiosity( real iEpsilon, int iVisibilityRays, real iTolerance )
+{
+  epsilon = iEpsilon ;
+  visibilityRays = iVisibilityRays ;
+  tolerance = iTolerance ;
+  scene = 0 ;
+  tris = 0 ;
+  sampler = 0 ;
+  root = -1 ;
+  minTransfer = maxEmission = 0 ;
+  numLinks = 0 ;
+}
+
+HierarchicalRadiosity::~HierarchicalRadiosity()
+{
+  DESTROY( sampler ) ;
+}
+
+void HierarchicalRadiosity::solve( Scene *iScene, const vector<Triangle*>& iTris )
+{
+  scene = iScene ;
+  tris = &iTris ;
+  DESTROY( sampler ) ;
+  sampler = new RandomSampler( 0, 0 ) ;
+  nodes.clear() ;
+  order.clear() ;
+  patchNode.assign( tris->size(), -1 ) ;
+  numLinks = 0 ;
+
+  // Cluster the patches the same way the space partition splits
+  // the scene.  Tris that straddle a split stay in the parent, so a
+  // cluster is the tris that stayed with it plus its child clusters.
+  OctreeNode<Triangle*>* oroot = new OctreeNode<Triangle*>() ;
+  for( int i = 0 ; i < tris->size() ; i++ )
+    oroot->add( (*tris)[i] ) ;
+  if( Octree<PhantomTriangle*>::useKDDivisions )
+    oroot->splitAsKdtree( 0, 0 ) ;
+  else
+    oroot->splitAsOctree( 0 ) ;
+  root = build( oroot ) ;
+  DESTROY( oroot ) ; // doesn't touch the tris
+
+  // what the lights put out sets the scale for the error oracle
+  real emittedPower = 0 ;
+  maxEmission = 0 ;
+  for( int i = 0 ; i < tris->size() ; i++ )
+  {
+    const Node& leaf = nodes[ patchNode[i] ] ;
+    emittedPower += ( leaf.E.x + leaf.E.y + leaf.E.z )/3 * leaf.area ;
+    maxEmission = max( maxEmission, leaf.E.max() ) ;
+  }
+  if( IsNear( emittedPower, 0.0, EPS_MIN ) )
+    warning( "No light source patches in scene" ) ;
+  minTransfer = epsilon * emittedPower ;
+
+  info( "Hierarchical radiosity: %d patches, %d nodes", (int)tris->size(), (int)nodes.size() ) ;
+
+  // first links are made against the emission alone
+  for( int i = 0 ; i < nodes.size() ; i++ )
+    if( nodes[i].patch != -1 )
+      nodes[i].B = nodes[i].E ;
+  pull( root ) ;
+
+  refineSelf( root ) ;
+  info( "Hierarchical radiosity: %lld links (%lld form factors full matrix)", numLinks,
+    (long long)tris->size()*(long long)tris->size() ) ;
+  solveLinks() ;
+
+  // now that the reflectors have a radiosity, the links
+  // off the bright ones may have been made too coarse
+  for( int pass = 0 ; pass < HRAD_REFINE_PASSES ; pass++ )
+  {
+    if( !refineLinks() )
+      break ;
+    info( "Hierarchical radiosity: refined to %lld links", numLinks ) ;
+    solveLinks() ;
+  }
+}
+
+int HierarchicalRadiosity::addPatch( int patch )
+{
+  Triangle *tri = (*tris)[ patch ] ;
+
+  int n = nodes.size() ;
+  nodes.push_back( Node() ) ;
+  Node& node = nodes[n] ;
+  node.patch = patch ;
+  node.first = order.size() ;
+  node.count = 1 ;
+  order.push_back( patch ) ;
+  patchNode[ patch ] = n ;
+
+  node.center = tri->getCentroid() ;
+  node.radius = max( ( tri->a - node.center ).len(), max( ( tri->b - node.center ).len(), ( tri->c - node.center ).len() ) ) ;
+  node.normal = tri->normal ;
+  node.area = tri->area() ;
+  node.E = tri->getAverageColor( ColorIndex::Emissive ) ;
+  for( int ch = 0 ; ch < 3 ; ch++ )
+    node.rho.e[ch] = tri->getAverageColor( ColorIndex::DiffuseMaterial, ch ) * SURFACE_REFLECTIVITIES ;
+  return n ;
+}
+
+int HierarchicalRadiosity::build( OctreeNode<Triangle*>* onode )
+{
+  int n = nodes.size() ;
+  nodes.push_back( Node() ) ;
+  nodes[n].patch = -1 ;
+  nodes[n].first = order.size() ;
+
+  // the vector grows in here, so no references to nodes[n] until after
+  vector<int> kids ;
+  for( list<Triangle*>::iterator iter = onode->items.begin() ; iter != onode->items.end() ; ++iter )
+    kids.push_back( addPatch( (*iter)->getId() ) ) ;
+  for( int i = 0 ; i < onode->children.size() ; i++ )
+    kids.push_back( build( onode->children[i] ) ) ;
+
+  Node& node = nodes[n] ;
+  node.children = kids ;
+  node.count = order.size() - node.first ;
+  node.area = 0 ;
+  for( int i = 0 ; i < kids.size() ; i++ )
+    node.area += nodes[ kids[i] ].area ;
+
+  // bounding sphere around the children's spheres
+  AABB bounds ;
+  for( int i = 0 ; i < kids.size() ; i++ )
+  {
+    const Node& kid = nodes[ kids[i] ] ;
+    for( int ax = 0 ; ax < 3 ; ax++ )
+    {
+      bounds.min.e[ax] = min( bounds.min.e[ax], kid.center.e[ax] - kid.radius ) ;
+      bounds.max.e[ax] = max( bounds.max.e[ax], kid.center.e[ax] + kid.radius ) ;
+    }
+  }
+  node.center = bounds.mid() ;
+  node.radius = 0 ;
+  for( int i = 0 ; i < kids.size() ; i++ )
+    node.radius = max( node.radius, ( nodes[ kids[i] ].center - node.center ).len() + nodes[ kids[i] ].radius ) ;
+  return n ;
+}
+
+real HierarchicalRadiosity::formFactor( const Node& q, const Node& p ) const
+{
+  // q's center to a disk the size of p (Wallace et al 89),
+  // cosines at both ends.  This is what q gathers from p.
+  Vector d = p.center - q.center ;
+  real r2 = d % d ;
+  if( r2 <= 0 )  return 0 ;
+  d /= sqrt( r2 ) ;
+
+  real cosQ = q.patch == -1 ? HRAD_CLUSTER_COSINE : max( 0.0, q.normal % d ) ;
+  real cosP = p.patch == -1 ? HRAD_CLUSTER_COSINE : max( 0.0, -( p.normal % d ) ) ;
+  return p.area * cosQ * cosP / ( PI*r2 + p.area ) ;
+}
+
+real HierarchicalRadiosity::formFactorBound( const Node& q, const Node& p ) const
+{
+  Vector d = p.center - q.center ;
+  real r = d.len() ;
+
+  // a patch can't see anything wholly behind it
+  if( q.patch != -1 && d % q.normal < -( q.radius + p.radius ) )  return 0 ;
+  if( p.patch != -1 && -( d % p.normal ) < -( q.radius + p.radius ) )  return 0 ;
+
+  // the closest the 2 spheres get, both cosines 1.
+  // Overlapping spheres can't be bounded, call it 1.
+  real gap = r - q.radius - p.radius ;
+  if( gap <= 0 )  return 1 ;
+  return p.area / ( PI*gap*gap + p.area ) ;
+}
+
+bool HierarchicalRadiosity::needsRefine( int q, int p ) const
+{
+  const Node& Q = nodes[q] ;
+  const Node& P = nodes[p] ;
+  if( Q.patch != -1 && P.patch != -1 )  return false ; // as fine as it goes
+
+  // the most power that could go over this link
+  real B = ( P.B.x + P.B.y + P.B.z )/3 ;
+  return formFactorBound( Q, P ) * B * Q.area > minTransfer ;
+}
+
+void HierarchicalRadiosity::refine( int q, int p )
+{
+  if( formFactorBound( nodes[q], nodes[p] ) <= 0 )
+    return ; // they can't see each other at all
+
+  if( !needsRefine( q, p ) )
+  {
+    link( q, p ) ;
+    return ;
+  }
+
+  // split the bigger one (a patch can't be split)
+  if( nodes[q].patch != -1 || ( nodes[p].patch == -1 && nodes[p].area > nodes[q].area ) )
+  {
+    for( int i = 0 ; i < nodes[p].children.size() ; i++ )
+      refine( q, nodes[p].children[i] ) ;
+  }
+  else
+  {
+    for( int i = 0 ; i < nodes[q].children.size() ; i++ )
+      refine( nodes[q].children[i], p ) ;
+  }
+}
+
+void HierarchicalRadiosity::refineSelf( int n )
+{
+  // what a cluster passes to itself is what its children pass
+  // to each other (a flat patch doesn't see itself)
+  const vector<int>& kids = nodes[n].children ;
+  for( int i = 0 ; i < kids.size() ; i++ )
+  {
+    refineSelf( kids[i] ) ;
+    for( int j = 0 ; j < kids.size() ; j++ )
+      if( i != j )
+        refine( kids[i], kids[j] ) ;
+  }
+}
+
+bool HierarchicalRadiosity::refineLinks()
+{
+  long long refined = 0 ;
+  for( int q = 0 ; q < nodes.size() ; q++ )
+  {
+    // refine() may add links to q itself, so take its list first
+    vector<Link> links ;
+    links.swap( nodes[q].links ) ;
+    vector<int> toRefine ;
+    for( int k = 0 ; k < links.size() ; k++ )
+    {
+      if( needsRefine( q, links[k].from ) )
+        toRefine.push_back( links[k].from ) ;
+      else
+        nodes[q].links.push_back( links[k] ) ;
+    }
+
+    numLinks -= toRefine.size() ;
+    refined += toRefine.size() ;
+    for( int k = 0 ; k < toRefine.size() ; k++ )
+      refine( q, toRefine[k] ) ;
+  }
+  return refined > 0 ;
+}
+
+void HierarchicalRadiosity::link( int q, int p )
+{
+  real F = formFactor( nodes[q], nodes[p] ) ;
+  if( F <= 0 )  return ;
+  F *= visibility( nodes[q], nodes[p] ) ;
+  if( F <= 0 )  return ;
+
+  Link l ;
+  l.from = p ;
+  l.F = F ;
+  nodes[q].links.push_back( l ) ;
+  numLinks++ ;
+}
+
+Vector HierarchicalRadiosity::randomPointIn( const Node& n, Vector& normal )
+{
+  // a random patch under n, then a uniform point on it
+  int which = n.first + min( (int)( sampler->next1D() * n.count ), n.count-1 ) ;
+  Triangle *tri = (*tris)[ order[ which ] ] ;
+  real u, v ;
+  sampler->next2D( u, v ) ;
+  if( u + v > 1 )
+  {
+    u = 1 - u ;
+    v = 1 - v ;
+  }
+  normal = tri->normal ;
+  return tri->a + u*( tri->b - tri->a ) + v*( tri->c - tri->a ) ;
+}
+
+real HierarchicalRadiosity::visibility( const Node& q, const Node& p )
+{
+  int visible = 0 ;
+  for( int i = 0 ; i < visibilityRays ; i++ )
+  {
+    Vector nq, np ;
+    Vector x = randomPointIn( q, nq ) ;
+    Vector y = randomPointIn( p, np ) ;
+
+    // step off both surfaces, towards each other
+    Vector d = y - x ;
+    x += nq * ( d % nq > 0 ? EPS_MIN : -EPS_MIN ) ;
+    y += np * ( d % np < 0 ? EPS_MIN : -EPS_MIN ) ;
+
+    Ray ray( x, y ) ;
+    MeshIntersection mi ;
+    if( !scene->getClosestIntnMesh( ray, &mi ) ||
+        ( mi.point - x ).len() >= ray.length*( 1 - 1e-4 ) )
+      visible++ ;
+  }
+  return (real)visible / visibilityRays ;
+}
+
+void HierarchicalRadiosity::pull( int n )
+{
+  Node& node = nodes[n] ;
+  if( node.patch != -1 )  return ;
+
+  Vector B( 0, 0, 0 ) ;
+  for( int i = 0 ; i < node.children.size() ; i++ )
+  {
+    pull( node.children[i] ) ;
+    B += nodes[ node.children[i] ].B * nodes[ node.children[i] ].area ;
+  }
+  if( node.area > 0 )
+    B /= node.area ;
+  node.B = B ;
+}
+
+real HierarchicalRadiosity::pushPull( int n, const Vector& Hdown )
+{
+  // H coming down from the clusters above, plus what n gathered itself
+  Node& node = nodes[n] ;
+  Vector H = Hdown + node.H ;
+
+  if( node.patch != -1 )
+  {
+    Vector B = node.E + node.rho * H ;
+    real change = max( fabs( B.x - node.B.x ), max( fabs( B.y - node.B.y ), fabs( B.z - node.B.z ) ) ) ;
+    node.B = B ;
+    return change ;
+  }
+
+  real change = 0 ;
+  Vector B( 0, 0, 0 ) ;
+  for( int i = 0 ; i < node.children.size() ; i++ )
+  {
+    int c = node.children[i] ;
+    change = max( change, pushPull( c, H ) ) ;
+    B += nodes[c].B * nodes[c].area ;
+  }
+  if( node.area > 0 )
+    B /= node.area ;
+  node.B = B ;
+  return change ;
+}
+
+void HierarchicalRadiosity::solveLinks()
+{
+  real stop = tolerance * max( maxEmission, EPS_MIN ) ;
+  int iter ;
+  for( iter = 0 ; iter < HRAD_MAX_ITERATIONS ; iter++ )
+  {
+    // gather over every link, with the radiosities of the last pass
+    for( int q = 0 ; q < nodes.size() ; q++ )
+    {
+      Vector H( 0, 0, 0 ) ;
+      for( int k = 0 ; k < nodes[q].links.size() ; k++ )
+        H += nodes[ nodes[q].links[k].from ].B * nodes[q].links[k].F ;
+      nodes[q].H = H ;
+    }
+
+    if( pushPull( root, Vector( 0, 0, 0 ) ) < stop )
+      break ;
+  }
+
+  if( iter == HRAD_MAX_ITERATIONS )
+    warning( "Hierarchical radiosity: push-pull didn't converge in %d iterations", iter ) ;
+  else
+    info( "Hierarchical radiosity: push-pull converged in %d iterations", iter+1 ) ;
+}
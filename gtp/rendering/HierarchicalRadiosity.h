@@ -0,0 +1,100 @@
+#ifndef HIERARCHICALRADIOSITY_H
+#define HIERARCHICALRADIOSITY_H
+
+#include "../math/Vector.h"
+
+class Scene ;
+struct Triangle ;
+class Sampler ;
+template <typename T> struct OctreeNode ;
+
+// Hierarchical radiosity with clustering (Hanrahan et al 91, Smits et al 94).
+//
+// Every patch is a leaf, and the patches are grouped into clusters by
+// splitting them up the same way the scene's space partition splits
+// the scene (octree or kd).  Instead of a form factor between every pair of
+// patches, two nodes get linked at the coarsest level where the energy that
+// could go over the link is below epsilon of what the lights put out.  A big
+// wall far away is one link, not one per patch on it.  That's roughly
+// O(N log N) links instead of N^2 form factors.
+//
+// Solving is Jacobi-like: every node gathers over its links, then
+// push-pull: what a cluster gathered gets pushed down to its patches,
+// and the patches' radiosities get area-averaged back up.
+// After a solve, links that now carry too much (the sources they read from
+// turned out bright) get refined, and it solves again.
+struct HierarchicalRadiosity
+{
+  real epsilon ;       // refine a link that could carry more than this fraction of the emitted power
+  int visibilityRays ; // rays between the 2 nodes when a link is made
+  real tolerance ;     // push-pull stops when no patch moves by more than this (relative to the brightest light)
+
+  HierarchicalRadiosity( real iEpsilon, int iVisibilityRays, real iTolerance ) ;
+  ~HierarchicalRadiosity() ;
+
+  // tris[i] is patch i.  Builds the hierarchy, links it and solves.
+  // Casts rays, so run it off the main thread.
+  void solve( Scene *iScene, const vector<Triangle*>& iTris ) ;
+
+  // patch i's radiosity (rgb), after solve
+  inline const Vector& radiosity( int patch ) const { return nodes[ patchNode[ patch ] ].B ; }
+
+  inline long long getNumLinks() const { return numLinks ; }
+
+private:
+  // node q gathers F*B[from] over each of its links
+  struct Link
+  {
+    int from ;
+    real F ; // form factor times visibility
+  } ;
+
+  struct Node
+  {
+    int patch ;             // the patch, or -1 for a cluster
+    vector<int> children ;
+    int first, count ;      // the patches under it are order[ first .. first+count )
+    Vector center ;
+    real radius ;           // bounding sphere around center
+    Vector normal ;         // patches only
+    real area ;
+    Vector E, rho ;         // patches only
+    Vector B ;              // radiosity (area averaged for a cluster)
+    Vector H ;              // what it gathered over its links, before rho
+    vector<Link> links ;
+  } ;
+
+  Scene *scene ;
+  const vector<Triangle*>* tris ;
+  Sampler *sampler ;
+
+  vector<Node> nodes ;
+  vector<int> order ;      // patches, each cluster's are contiguous
+  vector<int> patchNode ;  // patch -> its leaf node
+  int root ;
+
+  real minTransfer ;       // epsilon * emitted power
+  real maxEmission ;
+  long long numLinks ;
+
+  int build( OctreeNode<Triangle*>* onode ) ;
+  int addPatch( int patch ) ;
+
+  // links q (receiving) and p, or their children
+  void refine( int q, int p ) ;
+  void refineSelf( int n ) ;
+  bool refineLinks() ;
+  bool needsRefine( int q, int p ) const ;
+  void link( int q, int p ) ;
+
+  real formFactor( const Node& q, const Node& p ) const ;
+  real formFactorBound( const Node& q, const Node& p ) const ;
+  real visibility( const Node& q, const Node& p ) ;
+  Vector randomPointIn( const Node& n, Vector& normal ) ;
+
+  void solveLinks() ;
+  real pushPull( int n, const Vector& Hdown ) ;
+  void pull( int n ) ;
+} ;
+
+#endif
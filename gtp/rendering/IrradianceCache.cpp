@@ -0,0 +1,169 @@
+#include "IrradianceCache.h"
+
+#define IRRCACHE_MAX_DEPTH 20
+
+IrradianceCache::Node::Node( const Vector& iCenter, real iHalfSize )
+{
+  center = iCenter ;
+  halfSize = iHalfSize ;
+  for( int i = 0 ; i < 8 ; i++ )
+    children[i] = 0 ;
+  records = 0 ;
+}
+
+IrradianceCache::Node::~Node()
+{
+  for( int i = 0 ; i < 8 ; i++ )
+    DESTROY( children[i] ) ;
+  for( Link *l = records ; l ; )
+  {
+    Link *next = l->next ;
+    delete l ;
+    l = next ;
+  }
+}
+
+IrradianceCache::IrradianceCache( real iA )
+{
+  a = iA ;
+  minSpacing = 0 ;
+  maxSpacing = HUGE ;
+  root = 0 ;
+  owned = 0 ;
+  numRecords = 0 ;
+}
+
+IrradianceCache::~IrradianceCache()
+{
+  clear() ;
+}
+
+void IrradianceCache::clear()
+{
+  DESTROY( root ) ;
+  for( IrradianceRecord *r = owned ; r ; )
+  {
+    IrradianceRecord *next = r->nextOwned ;
+    delete r ;
+    r = next ;
+  }
+  owned = 0 ;
+  numRecords = 0 ;
+}
+
+void IrradianceCache::reset( const Vector& boundsMin, const Vector& boundsMax )
+{
+  if( numRecords )
+    info( "Irradiance cache: dropping %d records", (int)numRecords ) ;
+  clear() ;
+
+  Vector extent = boundsMax - boundsMin ;
+  real size = max( extent.x, max( extent.y, extent.z ) ) ;
+  if( size <= 0 )  size = 1 ;
+
+  // a little slack so points on the bounds aren't on the root's faces
+  root = new Node( ( boundsMin + boundsMax )/2, 0.51*size ) ;
+
+  // R clamps relative to the scene size, so tiny gaps between
+  // objects don't make records with no reach at all
+  minSpacing = 0.001*size ;
+  maxSpacing = 0.1*size ;
+}
+
+IrradianceCache::Node* IrradianceCache::getChild( Node *node, int i )
+{
+  Node *c = node->children[i] ;
+  if( c )  return c ;
+
+  real h = node->halfSize/2 ;
+  Vector center( node->center.x + ( i&1 ? h : -h ),
+                 node->center.y + ( i&2 ? h : -h ),
+                 node->center.z + ( i&4 ? h : -h ) ) ;
+  Node *made = new Node( center, h ) ;
+
+  // if another thread made it first, use theirs
+  c = (Node*)InterlockedCompareExchangePointer( (PVOID volatile*)&node->children[i], made, 0 ) ;
+  if( c )
+  {
+    delete made ;
+    return c ;
+  }
+  return made ;
+}
+
+void IrradianceCache::insert( IrradianceRecord *rec )
+{
+  // own it first, so it gets freed even if it ends up in no node
+  do {
+    rec->nextOwned = owned ;
+  } while( InterlockedCompareExchangePointer( (PVOID volatile*)&owned, rec, rec->nextOwned ) != rec->nextOwned ) ;
+  InterlockedIncrement( &numRecords ) ;
+
+  real radius = a*rec->R ;
+  insert( root, rec, rec->point - Vector( radius, radius, radius ), rec->point + Vector( radius, radius, radius ), radius, 0 ) ;
+}
+
+void IrradianceCache::insert( Node *node, IrradianceRecord *rec, const Vector& lo, const Vector& hi, real radius, int depth )
+{
+  // stop at the level where the nodes are about as big as the record's reach.
+  // Its bounding box then overlaps at most 2 nodes per axis.
+  if( node->halfSize <= 2*radius || depth == IRRCACHE_MAX_DEPTH )
+  {
+    Link *l = new Link ;
+    l->rec = rec ;
+    do {
+      l->next = node->records ;
+    } while( InterlockedCompareExchangePointer( (PVOID volatile*)&node->records, l, l->next ) != l->next ) ;
+    return ;
+  }
+
+  for( int i = 0 ; i < 8 ; i++ )
+  {
+    // does the record's box overlap child i's half of each axis?
+    if( ( i&1 ? hi.x < node->center.x : lo.x > node->center.x ) ||
+        ( i&2 ? hi.y < node->center.y : lo.y > node->center.y ) ||
+        ( i&4 ? hi.z < node->center.z : lo.z > node->center.z ) )
+      continue ;
+    insert( getChild( node, i ), rec, lo, hi, radius, depth+1 ) ;
+  }
+}
+
+bool IrradianceCache::lookup( const Vector& p, const Vector& n, Vector& E ) const
+{
+  Vector sumE( 0,0,0,0 ) ;
+  real sumW = 0 ;
+
+  for( const Node *node = root ; node ; )
+  {
+    for( const Link *l = node->records ; l ; l = l->next )
+    {
+      const IrradianceRecord *r = l->rec ;
+      Vector d = p - r->point ;
+
+      // p is behind the record's surface (Ward's d_i test): it
+      // sees something different than what the record gathered
+      if( d % ( n + r->normal ) < -0.02*r->R )  continue ;
+
+      real err = d.len()/r->R + sqrt( max( 0.0, 1.0 - n % r->normal ) ) ;
+      if( err >= a )  continue ;
+
+      // first order extrapolation to p
+      Vector Ei = r->E ;
+      Vector turn = r->normal << n ;
+      for( int ch = 0 ; ch < 3 ; ch++ )
+        Ei.e[ch] = max( 0.0, Ei.e[ch] + turn % r->rotGrad[ch] + d % r->transGrad[ch] ) ;
+
+      real w = 1.0/max( err, 1e-6 ) ;
+      sumE += Ei*w ;
+      sumW += w ;
+    }
+
+    // only the child p is in can hold more records valid at p
+    int i = ( p.x > node->center.x ) | ( p.y > node->center.y ) << 1 | ( p.z > node->center.z ) << 2 ;
+    node = node->children[i] ;
+  }
+
+  if( sumW <= 0 )  return false ;
+  E = sumE/sumW ;
+  return true ;
+}
@@ -0,0 +1,76 @@
+#ifndef IRRADIANCECACHE_H
+#define IRRADIANCECACHE_H
+
+#include "../math/Vector.h"
+
+// One cached irradiance sample (Ward, Rubinstein & Clear 1988),
+// with the rotational and translational gradients of Ward & Heckbert 1992
+// so it can be extrapolated a bit instead of just averaged.
+struct IrradianceRecord
+{
+  Vector point, normal ;
+  Vector E ;             // irradiance at point
+  real R ;               // harmonic mean distance to what the gather rays hit, clamped
+  Vector rotGrad[3] ;    // dE/d(rotation of the normal), one per color channel
+  Vector transGrad[3] ;  // dE/d(position), one per color channel
+
+  IrradianceRecord *nextOwned ; // every record, for deletion
+} ;
+
+// The records live in an octree over the scene.  Each one is linked into
+// every node at the level about its size that its sphere of influence
+// overlaps, so a lookup only walks the one path from the root down to p.
+//
+// Worker threads look up and insert at the same time without locks: child
+// nodes and record links get published with a compare-and-swap, and a
+// record is never changed after it's published.  Two threads can end up
+// computing records at about the same spot, that just costs a bit of time.
+struct IrradianceCache
+{
+  real a ; // error tolerance.  A record is used out to a*R from where it was made.
+  real minSpacing, maxSpacing ; // R is clamped to these
+
+  IrradianceCache( real iA ) ;
+  ~IrradianceCache() ;
+
+  // empties the cache and fits the octree around the scene bounds.
+  // Not thread safe, call it before the trace starts.
+  void reset( const Vector& boundsMin, const Vector& boundsMax ) ;
+
+  // weighted average of the gradient-extrapolated records valid at (p,n).
+  // false if there aren't any, then the caller should make one.
+  bool lookup( const Vector& p, const Vector& n, Vector& E ) const ;
+
+  // takes ownership of rec.  Safe to call from any number of threads.
+  void insert( IrradianceRecord *rec ) ;
+
+  inline int getNumRecords() const { return numRecords ; }
+
+private:
+  struct Link
+  {
+    IrradianceRecord *rec ;
+    Link *next ;
+  } ;
+
+  struct Node
+  {
+    Vector center ;
+    real halfSize ;
+    Node * volatile children[8] ;
+    Link * volatile records ;
+
+    Node( const Vector& iCenter, real iHalfSize ) ;
+    ~Node() ; // deletes the children and the links (not the records)
+  } ;
+
+  Node *root ;
+  IrradianceRecord * volatile owned ;
+  volatile LONG numRecords ;
+
+  void clear() ;
+  Node* getChild( Node *node, int i ) ;
+  void insert( Node *node, IrradianceRecord *rec, const Vector& lo, const Vector& hi, real radius, int depth ) ;
+} ;
+
+#endif
@@ -0,0 +1,322 @@
+#include "PhotonMap.h"
+#include "../scene/Scene.h"
+#include "../geometry/AABB.h"
+#include "../geometry/Intersection.h"
+#include "../geometry/MeshGroup.h"
+#include "../geometry/Mesh.h"
+#include "../util/Sampler.h"
+#include "../threading/ParallelizableBatch.h"
+#include <algorithm>
+
+// tracing jobs per build, and how many levels of the kd-tree get
+// split serially before the rest is handed out (2^levels subtree jobs)
+#define PHOTON_TRACE_JOBS 64
+#define PHOTON_SPLIT_LEVELS 3
+
+static inline real mean( const Vector& v ) { return ( v.x + v.y + v.z )/3 ; }
+
+PhotonMap::PhotonMap( int iPhotonsToEmit, int iK, real iRadiusFraction, int iMaxBounces )
+{
+  photonsToEmit = iPhotonsToEmit ;
+  k = max( 1, iK ) ;
+  radiusFraction = iRadiusFraction ;
+  maxBounces = iMaxBounces ;
+
+  scene = 0 ;
+  buildSeed = 0 ;
+  maxDist = 0 ;
+  totalFlux = 0 ;
+}
+
+void PhotonMap::queueBuild( Scene *iScene, unsigned int seed )
+{
+  scene = iScene ;
+  buildSeed = seed ;
+  photons.clear() ;
+  subtrees.clear() ;
+
+  AABB bounds( scene ) ;
+  Vector extent = bounds.max - bounds.min ;
+  maxDist = radiusFraction * max( extent.x, max( extent.y, extent.z ) ) ;
+
+  // collect the emitting triangles of every light that has geometry
+  emitters.clear() ;
+  emitterCdf.clear() ;
+  totalFlux = 0 ;
+  for( int i = 0 ; i < scene->lights.size() ; i++ )
+  {
+    MeshGroup *mg = scene->lights[i]->meshGroup ;
+    if( !mg )  continue ; // a far light, nothing to shoot from
+    for( int m = 0 ; m < mg->meshes.size() ; m++ )
+    {
+      Mesh *mesh = mg->meshes[m] ;
+      for( int t = 0 ; t < mesh->tris.size() ; t++ )
+      {
+        Emitter e ;
+        e.tri = &mesh->tris[t] ;
+        e.Le = mesh->tris[t].getAverageColor( ColorIndex::Emissive ) ;
+        e.flux = PI * e.tri->area() * mean( e.Le ) ;
+        if( e.flux <= 0 )  continue ;
+        emitters.push_back( e ) ;
+        totalFlux += e.flux ;
+        emitterCdf.push_back( totalFlux ) ;
+      }
+    }
+  }
+
+  if( !emitters.size() || photonsToEmit <= 0 )
+  {
+    warning( "Caustic photons: no emitting triangles in the scene, photon map is empty" ) ;
+    return ;
+  }
+
+  info( "Caustic photons: shooting %d photons from %d light triangles", photonsToEmit, (int)emitters.size() ) ;
+
+  jobPhotons.assign( PHOTON_TRACE_JOBS, vector<Photon>() ) ;
+  ParallelBatch *traceBatch = new ParallelBatch( "photon trace",
+    new CallbackObject0<PhotonMap*, void (PhotonMap::*)()>( this, &PhotonMap::doneTracing ) ) ;
+  for( int j = 0 ; j < PHOTON_TRACE_JOBS ; j++ )
+  {
+    int count = photonsToEmit/PHOTON_TRACE_JOBS + ( j < photonsToEmit%PHOTON_TRACE_JOBS ) ;
+    traceBatch->addJob( new CallbackObject2<PhotonMap*, void (PhotonMap::*)( int, int ), int,int>(
+      this, &PhotonMap::traceJob, j, count ) ) ;
+  }
+  threadPool.addBatch( traceBatch ) ;
+
+  // the subtree ranges aren't known until the tracing is done,
+  // a job with no range left for it just returns
+  ParallelBatch *buildBatch = new ParallelBatch( "photon kd-tree", NULL ) ;
+  for( int i = 0 ; i < (1<<PHOTON_SPLIT_LEVELS) ; i++ )
+    buildBatch->addJob( new CallbackObject1<PhotonMap*, void (PhotonMap::*)( int ), int>(
+      this, &PhotonMap::buildSubtree, i ) ) ;
+  threadPool.addBatch( buildBatch ) ;
+}
+
+void PhotonMap::traceJob( int job, int count )
+{
+  // its own stream, well clear of the ones the trace jobs use
+  Sampler* sampler = Sampler::create( RandomSampling, buildSeed, (1ULL<<40) + job ) ;
+  real invEmitted = 1.0/photonsToEmit ;
+  for( int i = 0 ; i < count ; i++ )
+    tracePhoton( *sampler, invEmitted, jobPhotons[ job ] ) ;
+  delete sampler ;
+}
+
+void PhotonMap::tracePhoton( Sampler& sampler, real invEmitted, vector<Photon>& out )
+{
+  // pick a light triangle by flux
+  real u = sampler.randFloat()*totalFlux ;
+  int ei = (int)( upper_bound( emitterCdf.begin(), emitterCdf.end(), u ) - emitterCdf.begin() ) ;
+  if( ei >= emitters.size() )  ei = (int)emitters.size() - 1 ;
+  const Emitter& e = emitters[ ei ] ;
+  const Triangle& tri = *e.tri ;
+
+  // uniform point on it (sqrt warp of the barycentrics)
+  real r1, r2 ;
+  sampler.next2D( r1, r2 ) ;
+  real su = sqrt( r1 ) ;
+  real b0 = 1 - su, b1 = r2*su ;
+  Vector point = tri.a*b0 + tri.b*b1 + tri.c*( 1 - b0 - b1 ) ;
+
+  // cosine weighted direction off the front face
+  Vector n = tri.normal ;
+  Vector tu = n.getPerpendicular().normalize() ;
+  Vector tv = n << tu ;
+  sampler.next2D( r1, r2 ) ;
+  real sinTheta = sqrt( r1 ), phi = 2*PI*r2 ;
+  Vector dir = tu*( sinTheta*cos( phi ) ) + tv*( sinTheta*sin( phi ) ) + n*sqrt( 1 - r1 ) ;
+
+  // flux/pdf: the triangle was picked with probability e.flux/totalFlux,
+  // and a cosine weighted direction cancels the cos in the flux
+  Vector power = e.Le * ( PI * tri.area() * totalFlux/e.flux * invEmitted ) ;
+
+  Ray ray( point + EPS_MIN*n, dir, 1000, scene->mediaEta, power, 0 ) ;
+  bool specular = false ;
+
+  // bounce = specular bounces so far.  covers() is this same rule.
+  for( int bounce = 0 ; bounce < maxBounces ; bounce++ )
+  {
+    Intersection *intn ;
+    if( !scene->getClosestIntn( ray, &intn ) )  return ;
+
+    // only light that went through a specular bounce is a caustic,
+    // the raytracer finds the rest on its own.  The photon's stored
+    // with all its power, the density estimate applies kd.
+    if( specular && intn->getColor( ColorIndex::DiffuseMaterial ).nonzero() )
+    {
+      Photon ph ;
+      ph.pos = intn->point ;
+      ph.dir = ray.direction ;
+      ph.power = ray.power ;
+      ph.axis = 0 ;
+      out.push_back( ph ) ;
+    }
+
+    Vector ks = intn->getColor( ColorIndex::SpecularMaterial ) ;
+    Vector kt = intn->getColor( ColorIndex::Transmissive ) ;
+    real ps = mean( ks ), pt = mean( kt ) ;
+
+    // russian roulette between reflect, transmit, and absorb.
+    // A diffuse surface with some ks/kt goes on along that lobe
+    // too: the raytracer follows its mirror ray, and drops what
+    // that ray brings back from a light, so it has to be here.
+    // (Purely diffuse, ps+pt = 0, always stops.)
+    real total = max( 1.0, ps + pt ) ;
+    real choice = sampler.randFloat()*total ;
+    if( choice >= ps + pt )
+    {
+      DESTROY( intn ) ;
+      return ;
+    }
+
+    if( choice < ps )
+    {
+      // reflect off the side the photon came from
+      Vector rn = intn->normal ;
+      if( ray.direction % rn > 0 )  rn = -rn ;
+      ray = ray.reflect( rn, intn->point, ks*( total/ps ) ) ;
+    }
+    else
+    {
+      Vector toEta ;
+      if( ray.direction.obtuse( intn->normal ) ) // enter new media
+        toEta = intn->shape->material.eta ;
+      else
+        toEta = scene->mediaEta ;
+
+      if( toEta.allEqual() )
+        ray = ray.refract( intn->normal, toEta.x, intn->point, kt*( total/pt ) ) ;
+      else
+      {
+        // dispersion: the photon goes on in one band only
+        int ch = sampler.randInt( 0, 3 ) ;
+        ray = ray.refract( intn->normal, ch, toEta.e[ch], intn->point, kt*( 3*total/pt ) ) ;
+      }
+    }
+    specular = true ;
+    DESTROY( intn ) ;
+  }
+}
+
+bool PhotonMap::covers( const Ray& ray ) const
+{
+  // tracePhoton lands on the diffuse surface after k specular
+  // bounces for 1 <= k < maxBounces
+  return ray.causticPath && ray.specularBounces >= 1 && ray.specularBounces < maxBounces ;
+}
+
+void PhotonMap::doneTracing()
+{
+  size_t total = 0 ;
+  for( int j = 0 ; j < jobPhotons.size() ; j++ )
+    total += jobPhotons[j].size() ;
+  photons.reserve( total ) ;
+  for( int j = 0 ; j < jobPhotons.size() ; j++ )
+    photons.insert( photons.end(), jobPhotons[j].begin(), jobPhotons[j].end() ) ;
+  jobPhotons.clear() ;
+
+  info( "Caustic photons: stored %d of %d", (int)photons.size(), photonsToEmit ) ;
+
+  // split the top of the tree here, the build batch does the subtrees
+  split( 0, (int)photons.size(), PHOTON_SPLIT_LEVELS ) ;
+}
+
+void PhotonMap::split( int lo, int hi, int levels )
+{
+  if( hi <= lo )  return ;
+  if( !levels )
+  {
+    Range r = { lo, hi } ;
+    subtrees.push_back( r ) ;
+    return ;
+  }
+  if( hi - lo == 1 )
+  {
+    photons[ lo ].axis = 0 ;
+    return ;
+  }
+
+  // split on the longest axis of the photons in this range
+  Vector lower = photons[ lo ].pos, upper = photons[ lo ].pos ;
+  for( int i = lo+1 ; i < hi ; i++ )
+  {
+    for( int a = 0 ; a < 3 ; a++ )
+    {
+      lower.e[a] = min( lower.e[a], photons[i].pos.e[a] ) ;
+      upper.e[a] = max( upper.e[a], photons[i].pos.e[a] ) ;
+    }
+  }
+  Vector extent = upper - lower ;
+  int axis = 0 ;
+  if( extent.y > extent.e[axis] )  axis = 1 ;
+  if( extent.z > extent.e[axis] )  axis = 2 ;
+
+  int mid = ( lo + hi )/2 ;
+  nth_element( photons.begin() + lo, photons.begin() + mid, photons.begin() + hi,
+    [axis]( const Photon& p1, const Photon& p2 ) { return p1.pos.e[axis] < p2.pos.e[axis] ; } ) ;
+  photons[ mid ].axis = axis ;
+
+  split( lo, mid, levels - 1 ) ;
+  split( mid+1, hi, levels - 1 ) ;
+}
+
+void PhotonMap::buildSubtree( int i )
+{
+  if( i >= subtrees.size() )  return ;
+  split( subtrees[i].lo, subtrees[i].hi, -1 ) ; // never reaches 0 levels, so builds all the way down
+}
+
+void PhotonMap::locate( int lo, int hi, const Vector& p, real& maxD2, vector< pair<real,int> >& heap ) const
+{
+  if( hi <= lo )  return ;
+  int mid = ( lo + hi )/2 ;
+  const Photon& ph = photons[ mid ] ;
+
+  // near side first, so maxD2 shrinks before the far side gets looked at
+  real d = p.e[ ph.axis ] - ph.pos.e[ ph.axis ] ;
+  if( d < 0 )
+  {
+    locate( lo, mid, p, maxD2, heap ) ;
+    if( d*d < maxD2 )  locate( mid+1, hi, p, maxD2, heap ) ;
+  }
+  else
+  {
+    locate( mid+1, hi, p, maxD2, heap ) ;
+    if( d*d < maxD2 )  locate( lo, mid, p, maxD2, heap ) ;
+  }
+
+  real d2 = ( ph.pos - p ).len2() ;
+  if( d2 >= maxD2 )  return ;
+
+  // max-heap on distance: the front is the farthest of the k kept so far
+  if( heap.size() == k )
+  {
+    pop_heap( heap.begin(), heap.end() ) ;
+    heap.pop_back() ;
+  }
+  heap.push_back( make_pair( d2, mid ) ) ;
+  push_heap( heap.begin(), heap.end() ) ;
+  if( heap.size() == k )
+    maxD2 = heap.front().first ;
+}
+
+Vector PhotonMap::irradiance( const Vector& p, const Vector& n ) const
+{
+  if( photons.empty() )  return Vector( 0,0,0,0 ) ;
+
+  vector< pair<real,int> > heap ;
+  heap.reserve( k ) ;
+  real maxD2 = maxDist*maxDist ;
+  locate( 0, (int)photons.size(), p, maxD2, heap ) ;
+  if( heap.empty() )  return Vector( 0,0,0,0 ) ;
+
+  // if fewer than k were in range, they all fit in the max radius disc
+  Vector E( 0,0,0,0 ) ;
+  for( int i = 0 ; i < heap.size() ; i++ )
+  {
+    const Photon& ph = photons[ heap[i].second ] ;
+    if( ph.dir % n < 0 )  // only what arrived at this side of the surface
+      E += ph.power ;
+  }
+  return E / ( PI*maxD2 ) ;
+}
@@ -0,0 +1,99 @@
+#ifndef PHOTONMAP_H
+#define PHOTONMAP_H
+
+#include "../math/Vector.h"
+
+struct Scene ;
+struct Triangle ;
+struct Ray ;
+class Sampler ;
+
+// A photon that came off a light, bounced off at least one
+// specular/transmissive surface, and landed on a diffuse one.
+struct Photon
+{
+  Vector pos ;
+  Vector dir ;   // the direction it was travelling when it landed
+  Vector power ; // flux it carries
+  int axis ;     // the axis this photon splits its kd-tree node on
+} ;
+
+// Caustic photon map (Jensen 1996).
+//
+// Paths that go light -> specular -> diffuse -> eye are almost impossible
+// for the path tracer to find from the eye end: a gather ray has to hit
+// the light through the glass.  So before the trace I shoot photons out of
+// scene->lights, keep the ones that hit a specular surface first, and
+// store them where they land on something diffuse.  At a diffuse hit the
+// raytracer then estimates the caustic irradiance from the k nearest photons.
+//
+// A photon is stored at every diffuse surface it lands on after 1 to
+// maxBounces-1 specular bounces, and carries on off a surface that is
+// diffuse AND specular/transmissive by the same russian roulette as off a
+// purely specular one.  The raytracer must drop exactly the light the
+// photons carry, no more (it'd be lost) and no less (it'd count twice),
+// so it asks covers() instead of having its own idea of a caustic.
+//
+// The photons live in a balanced kd-tree stored implicitly in the array:
+// the median of [lo,hi) sits at (lo+hi)/2, its left subtree in [lo,mid),
+// its right subtree in (mid,hi).
+struct PhotonMap
+{
+  int photonsToEmit ; // total over all the lights, per trace
+  int k ;             // photons in a density estimate
+  real radiusFraction ; // max search radius, as a fraction of the scene size
+  int maxBounces ;
+
+  PhotonMap( int iPhotonsToEmit, int iK, real iRadiusFraction, int iMaxBounces ) ;
+
+  // Queues a ParallelBatch that traces the photons and one that builds
+  // the kd-tree.  Batches run in order, so queue these BEFORE the raytracing
+  // batch that reads the map.
+  void queueBuild( Scene *iScene, unsigned int seed ) ;
+
+  // Caustic irradiance at p, on a surface facing n.
+  // Safe from any number of threads once the build batches are done.
+  Vector irradiance( const Vector& p, const Vector& n ) const ;
+
+  // ray (from the eye end) hit a light: true if tracePhoton could
+  // have made that path, so its light is in the map already
+  bool covers( const Ray& ray ) const ;
+
+  inline int getNumPhotons() const { return (int)photons.size() ; }
+
+private:
+  Scene *scene ;
+  unsigned int buildSeed ;
+  real maxDist ;
+  vector<Photon> photons ;
+
+  // every triangle of every light, picked with probability
+  // proportional to its flux
+  struct Emitter
+  {
+    const Triangle *tri ;
+    Vector Le ;  // radiance it emits
+    real flux ;  // pi * area * mean(Le)
+  } ;
+  vector<Emitter> emitters ;
+  vector<real> emitterCdf ;
+  real totalFlux ;
+
+  // each tracing job fills its own list, merged when they're all done
+  vector< vector<Photon> > jobPhotons ;
+
+  // the top of the tree is split serially, the subtrees below it are
+  // built by the jobs of the second batch
+  struct Range { int lo, hi ; } ;
+  vector<Range> subtrees ;
+
+  void traceJob( int job, int count ) ;
+  void tracePhoton( Sampler& sampler, real invEmitted, vector<Photon>& out ) ;
+  void doneTracing() ;
+  void split( int lo, int hi, int depth ) ;
+  void buildSubtree( int i ) ;
+
+  void locate( int lo, int hi, const Vector& p, real& maxD2, vector< pair<real,int> >& heap ) const ;
+} ;
+
+#endif
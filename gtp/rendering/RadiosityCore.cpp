@@ -6,6 +6,7 @@
 #include "../geometry/Mesh.h"
 #include "../threading/ParallelizableBatch.h"
 #include "Raycaster.h"
+#include "HierarchicalRadiosity.h"
 
 int RadiosityCore::currentId = -1 ;
 
@@ -23,7 +24,16 @@ char* SolutionMethodName[] =
   /// Iterative techniques below
   "Jacobi",
   "GaussSeidel",
-  "Southwell"
+  "Southwell",
+
+  "ProgressiveRefinement",
+  "Hierarchical",
+
+  "ParallelJacobi",
+  "ParallelGaussSeidel",
+
+  "BiCGSTAB",
+  "GMRES"
 } ;
 
 RadiosityCore::RadiosityCore( D3D11Window* iWin, int iHemicubePixelsPerSide )
@@ -38,7 +48,20 @@ RadiosityCore::RadiosityCore( D3D11Window* iWin, int iHemicubePixelsPerSide )
   matrixSolverMethod = MatrixSolverMethod::GaussSeidel ;
 
   iterativeTolerance = ITERATIVETOLERANCE ;
+  gmresRestart = 30 ;
   vectorOccludersTex = 0 ;
+  FFs = 0 ;
+  formFactorThreshold = 0 ;
+  halfFormFactors = false ;
+  shotsPerUpdate = 200 ;
+  hierarchicalEpsilon = 1e-4 ;
+  hierarchicalVisibilityRays = 4 ;
+  useSoftwareHemicube = false ;
+  solveChannelsTogether = false ;
+  hemicube = 0 ;
+  softHemicube = 0 ;
+  prFaces = 0 ;
+  hrad = 0 ;
 }
 
 int RadiosityCore::getNextId()
@@ -90,6 +113,7 @@ void RadiosityCore::assignIds( Scene * scene )
   }
 
   NUMPATCHES = tris.size() ;
+  smoothStart.clear() ; // the tris changed, regroup on the next solve
   //info( "%d tris have been assigned ids", NUMPATCHES ) ;
 }
 
@@ -121,12 +145,30 @@ void RadiosityCore::radiosity( Scene* scene, FormFactorDetermination iFormFactor
     return ;
   }
 
-  FFsSizeInBytes = NUMPATCHES*NUMPATCHES*sizeof(float) ;
-  info( "Allocating matrix space for %d patches.. (%d MB)", NUMPATCHES, FFsSizeInBytes/(1<<20) ) ;
-
   formFactorDetType = iFormFactorDetType ;
   matrixSolverMethod = iMatrixSolverMethod ;
+  // no device when headless, so the hemicube has to be the software one
+  if( formFactorDetType == FormFactorsHemicube && ( useSoftwareHemicube || win->headless ) )
+    formFactorDetType = FormFactorsSoftwareHemicube ;
   
+  buildSmoothingGroups() ;
+
+  // shooting never needs the whole matrix
+  if( matrixSolverMethod == ProgressiveRefinement )
+  {
+    progressiveRefinement( scene ) ;
+    return ;
+  }
+
+  // neither does the hierarchy
+  if( matrixSolverMethod == Hierarchical )
+  {
+    hierarchical( scene ) ;
+    return ;
+  }
+
+  info( "Form factors for %d patches, sparse rows (dense would be %lld MB)", NUMPATCHES,
+    NUMPATCHES*NUMPATCHES*(long long)sizeof(float)/(1<<20) ) ;
 
   // get ffs.  supposedly this is 90% of the processing time.
   // by the time you're done, you will have a
@@ -134,11 +176,13 @@ void RadiosityCore::radiosity( Scene* scene, FormFactorDetermination iFormFactor
   // relationship between any two patches in
   // the scene completely.
   // you have an NXN matrix for the form factors that we are just about to compute
+  // each patch's row is filled in as its hemicube/rays are done,
+  // and the rows get packed into one CSR block in solve().
+  DESTROY( FFs ) ;
   try
   {
-    FFs = new Eigen::MatrixXf() ;
-    FFs->resize( NUMPATCHES, NUMPATCHES ) ;
-    //info( "Allocated %d MB for form factors matrix", FFsSizeInBytes/( 1 << 20 ) ) ;
+    FFs = new CSRMatrix() ;
+    FFs->begin( NUMPATCHES, formFactorThreshold, formFactorDirectory, halfFormFactors ) ;
   }
   catch(...)
   {
@@ -146,8 +190,6 @@ void RadiosityCore::radiosity( Scene* scene, FormFactorDetermination iFormFactor
     DESTROY( FFs ) ;
     return ;
   }
-  FFs->setZero( NUMPATCHES, NUMPATCHES ) ;
-  //FFs->setConstant( 0.0 ) ; // same as above
 
   // HACKTUALLY, depending on the solution type selected, you need to handle this differently.
   // so now we decide on how to launch the solver.
@@ -162,6 +204,10 @@ void RadiosityCore::radiosity( Scene* scene, FormFactorDetermination iFormFactor
     calculateFormFactorsHemicubes( scene ) ; // NOT MT
     solve() ;   // boot solver when done
   }
+  else if( formFactorDetType == FormFactorsSoftwareHemicube )
+  {
+    calculateFormFactorsSoftwareHemicube( scene ) ; // MT, will boot solver when done
+  }
   else
   {
     calculateFormFactorsRaytraced( scene ) ; // MT, will boot solver when done
@@ -171,7 +217,8 @@ void RadiosityCore::radiosity( Scene* scene, FormFactorDetermination iFormFactor
 void RadiosityCore::calculateFormFactorsHemicubes( Scene* scene )
 {
   info( "Using a hemicube" ) ;
-  Hemicube* hemicube = new Hemicube( win, 0.5, hemicubePixelsPerSide ) ;
+  if( !hemicube )
+    hemicube = new Hemicube( win, 0.5, hemicubePixelsPerSide ) ;
 
   // VISIT EACH PATCH
   info( "Calculating form factors.. there are %d patches", NUMPATCHES ) ;
@@ -199,6 +246,41 @@ void RadiosityCore::calculateFormFactorsRaytraced( Scene* scene )
   threadPool.addBatch( pb ) ;
 }
 
+void RadiosityCore::calculateFormFactorsSoftwareHemicube( Scene* scene )
+{
+  info( "Using a software hemicube, %d px per side", hemicubePixelsPerSide ) ;
+  if( !softHemicube )
+    softHemicube = new SoftwareHemicube( hemicubePixelsPerSide ) ;
+
+  ParallelBatch *pb = new ParallelBatch( "radiosity software hemicube ffs",
+    new CallbackObject0< RadiosityCore*, void(RadiosityCore::*)() >( this, &RadiosityCore::solve )
+  ) ;
+
+  // same size jobs as the raycaster's
+  for( int i = 0 ; i < tris.size() ; i += 120 )
+  {
+    int endPt = min<int>( i+120, tris.size() ) ;
+    pb->addJob( new Callback0( [this,i,endPt](){
+      softwareHemicubeFormFactors( i, endPt ) ;
+    } ) ) ;
+  }
+
+  threadPool.addBatch( pb ) ;
+}
+
+void RadiosityCore::softwareHemicubeFormFactors( int startIndex, int endIndex )
+{
+  // this job's own z-buffers and row
+  SoftwareHemicube::Faces faces( softHemicube->pixelsPerSide ) ;
+  CSRRowBuilder row ;
+  row.reset( FFs->N ) ;
+  for( int i = startIndex ; i < endIndex ; i++ )
+  {
+    softHemicube->formFactorRow( tris, *tris[i], faces, row ) ;
+    FFs->setRow( tris[i]->getId(), row ) ;
+  }
+}
+
 Texcoording RadiosityCore::createVectorOccludersTex( int size )
 {
   Texcoording ctex( size ) ;
@@ -227,6 +309,13 @@ void RadiosityCore::parkAll( Scene* scene )
 {
   smoothVectorOccludersData( scene ) ;
 
+  if( win->headless )
+  {
+    // nowhere to park it.  The vo vectors just stay on the vertices.
+    info( "Headless, not writing the VO texture" ) ;
+    return ;
+  }
+
   Texcoording ctex = createVectorOccludersTex( VOTextureSize ) ;
   for( int i = 0 ; i < scene->shapes.size() ; i++ )
     for( int j = 0 ; j < scene->shapes[i]->meshGroup->meshes.size() ; j++ )
@@ -346,6 +435,11 @@ void RadiosityCore::vectorOccluders( Scene* scene, FormFactorDetermination iForm
     voVectorsWCReqd, VOTextureSize,VOTextureSize ) ;
 
   formFactorDetType = iFormFactorDetType ;
+  if( formFactorDetType == FormFactorDetermination::FormFactorsHemicube && win->headless )
+  {
+    warning( "Headless, no hemicube for vector occluders, raycasting instead" ) ;
+    formFactorDetType = FormFactorDetermination::FormFactorsRaycast ;
+  }
 
   // I MUST DO 2 PASSES to factor AO into diffuse interreflection.
   ParallelBatch* pb = new ParallelBatch( "ao", new Callback0( [](){ 
@@ -401,7 +495,8 @@ void RadiosityCore::calculateVectorOccludersHemicubes( Scene *scene )
   }
 
   // only supports hemicubes
-  Hemicube* hemicube = new Hemicube( win, 0.5, hemicubePixelsPerSide ) ; // probably want to keep pow2 to avoid texture problems
+  if( !hemicube )
+    hemicube = new Hemicube( win, 0.5, hemicubePixelsPerSide ) ; // probably want to keep pow2 to avoid texture problems
 
   // define a super-rough approximation to radiosity as follows:
   // for each vertex in scene:
@@ -572,50 +667,313 @@ void RadiosityCore::qVectorOccludersRaytraced( Scene * scene )
   threadPool.addBatch( pb ) ;
 }
 
-void RadiosityCore::setAveragePatchColor( int channel, AllVertex* vertex, Eigen::VectorXf* fEx, Triangle *patchOwner )
+void RadiosityCore::buildSmoothingGroups()
 {
-  //vertex->color[ ColorIndex::RadiosityComp ] = getPatchColor( patchOwner->getId() ) ;
-  vertex->color[ ColorIndex::RadiosityComp ].e[ channel ] = 0 ; //init @ 0
-  
-  // this is fast enough
-  int count = 0 ;
-  
-  // find all tris that use this vertex
+  // A vertex's smoothed color is the average of every patch that
+  // has a corner at the same place (usesVertex).  Searching all the tris
+  // for every vertex was O(N^2), which took longer than the solve on big
+  // scenes.  Instead sort the corners on x, then the corners Near() each
+  // other are within EPS_MIN of each other in the sorted order.
+  struct Corner
+  {
+    Vector pos ;
+    AllVertex* vertex ;
+    int patch ;
+    int group ;
+  } ;
+  vector<Corner> corners( 3*tris.size() ) ;
   for( int i = 0 ; i < tris.size() ; i++ )
   {
-    Triangle *tri = tris[i];
-
-    if( tri->usesVertex(vertex->pos) )
+    AllVertex* verts[3] = { tris[i]->vA(), tris[i]->vB(), tris[i]->vC() } ;
+    const Vector* pos[3] = { &tris[i]->a, &tris[i]->b, &tris[i]->c } ;
+    for( int c = 0 ; c < 3 ; c++ )
     {
-      // add in it's patch color
-      vertex->color[ ColorIndex::RadiosityComp ].e[channel] += (*fEx)( i ) ;
-      count++;
+      Corner& corner = corners[ 3*i + c ] ;
+      corner.pos = *pos[c] ;
+      corner.vertex = verts[c] ;
+      corner.patch = i ;
+      corner.group = -1 ;
     }
   }
+  sort( corners.begin(), corners.end(), []( const Corner& a, const Corner& b ){
+    return a.pos.x < b.pos.x ;
+  } ) ;
 
-  // avg
-  vertex->color[ ColorIndex::RadiosityComp ].e[ channel ] /= count ;
+  int numGroups = 0 ;
+  for( int i = 0 ; i < corners.size() ; i++ )
+  {
+    if( corners[i].group != -1 )  continue ;
+    corners[i].group = numGroups ;
+    for( int j = i+1 ; j < corners.size() && corners[j].pos.x - corners[i].pos.x < EPS_MIN ; j++ )
+      if( corners[j].group == -1 && corners[j].pos.Near( corners[i].pos ) )
+        corners[j].group = numGroups ;
+    numGroups++ ;
+  }
+
+  // lay the groups out end to end (counting sort on group)
+  smoothStart.assign( numGroups+1, 0 ) ;
+  for( int i = 0 ; i < corners.size() ; i++ )
+    smoothStart[ corners[i].group+1 ]++ ;
+  for( int g = 0 ; g < numGroups ; g++ )
+    smoothStart[ g+1 ] += smoothStart[ g ] ;
+
+  smoothVerts.resize( corners.size() ) ;
+  smoothPatches.resize( corners.size() ) ;
+  vector<int> next( smoothStart.begin(), smoothStart.end()-1 ) ;
+  for( int i = 0 ; i < corners.size() ; i++ )
+  {
+    int k = next[ corners[i].group ]++ ;
+    smoothVerts[ k ] = corners[i].vertex ;
+    smoothPatches[ k ] = corners[i].patch ;
+  }
 }
 
 void RadiosityCore::updatePatchRadiosities( int channel, Eigen::VectorXf* fEx )
 {
+  #if 0
+  // FLAT
+  // Using their patch numbers, add their patch colors
+  // sets the 3 vertices to have the same color
   for( int i = 0 ; i < tris.size() ; i++ )
-  {
-    #if 0
-    // FLAT
-    // Using their patch numbers, add their patch colors
-    // sets the 3 vertices to have the same color
     tris[ i ]->vA()->color[ ColorIndex::RadiosityComp ].e[ channel ] = 
     tris[ i ]->vB()->color[ ColorIndex::RadiosityComp ].e[ channel ] = 
     tris[ i ]->vC()->color[ ColorIndex::RadiosityComp ].e[ channel ] = 
       (*fEx)( i ) ;
-    #else
-    // SMOOTH/averaged
-    setAveragePatchColor( channel, tris[ i ]->vA(), fEx, tris[i] ) ;
-    setAveragePatchColor( channel, tris[ i ]->vB(), fEx, tris[i] ) ;
-    setAveragePatchColor( channel, tris[ i ]->vC(), fEx, tris[i] ) ;
-    #endif
+  #else
+  // SMOOTH/averaged over the patches that meet at each vertex
+  if( smoothStart.empty() )
+    buildSmoothingGroups() ;
+
+  for( int g = 0 ; g+1 < smoothStart.size() ; g++ )
+  {
+    real sum = 0 ;
+    for( int k = smoothStart[g] ; k < smoothStart[g+1] ; k++ )
+      sum += (*fEx)( smoothPatches[k] ) ;
+    sum /= smoothStart[g+1] - smoothStart[g] ;
+
+    for( int k = smoothStart[g] ; k < smoothStart[g+1] ; k++ )
+      smoothVerts[k]->color[ ColorIndex::RadiosityComp ].e[ channel ] = sum ;
+  }
+  #endif
+}
+
+void RadiosityCore::progressiveRefinement( Scene* scene )
+{
+  if( formFactorDetType == FormFactorsHemicube )
+  {
+    if( ! threadPool.onMainThread() )
+    {
+      error( "I cannot run gpu form factor determination on other than main thread." );
+      return ;
+    }
+    if( !hemicube )
+      hemicube = new Hemicube( win, 0.5, hemicubePixelsPerSide ) ;
+  }
+  else if( formFactorDetType == FormFactorsSoftwareHemicube )
+  {
+    if( !softHemicube )
+      softHemicube = new SoftwareHemicube( hemicubePixelsPerSide ) ;
+    if( !prFaces )
+      prFaces = new SoftwareHemicube::Faces( softHemicube->pixelsPerSide ) ;
+  }
+
+  info( "Progressive refinement over %d patches, %d shots per update. "
+    "No form factor matrix, each shooter's row is computed then dropped", NUMPATCHES, shotsPerUpdate ) ;
+
+  // everything starts out unshot: the lights have their emission,
+  // everything else has nothing
+  prRadiosity.resize( NUMPATCHES ) ;
+  prUnshot.resize( NUMPATCHES ) ;
+  prRho.resize( NUMPATCHES ) ;
+  prArea.resize( NUMPATCHES ) ;
+  real emitted = 0 ;
+  for( int i = 0 ; i < NUMPATCHES ; i++ )
+  {
+    Vector e = tris[i]->getAverageColor( ColorIndex::Emissive ) ;
+    for( int ch = 0 ; ch < 3 ; ch++ )
+    {
+      prRadiosity[i].e[ch] = prUnshot[i].e[ch] = e.e[ch] ;
+      prRho[i].e[ch] = tris[i]->getAverageColor( ColorIndex::DiffuseMaterial, ch ) * SURFACE_REFLECTIVITIES ;
+    }
+    prArea[i] = tris[i]->area() ;
+    emitted += ( e.x + e.y + e.z )/3 * prArea[i] ;
+  }
+
+  if( IsNear( emitted, 0.0, EPS_MIN ) )
+    warning( "No light source patches in scene" ) ;
+
+  // Stop when the biggest shooter left would add less than
+  // iterativeTolerance of what the lights put out.  Every shot
+  // gets rid of that patch's unshot energy and passes on at most
+  // (max reflectivity) of it, but a closed bright room can take many
+  // passes over the patches, so cap it.
+  prStopEnergy = iterativeTolerance * emitted ;
+  prShots = 0 ;
+  prMaxShots = 20*NUMPATCHES ;
+  prDone = false ;
+  prRow.reset( NUMPATCHES ) ;
+
+  queueProgressiveShots() ;
+}
+
+void RadiosityCore::queueProgressiveShots()
+{
+  if( formFactorDetType == FormFactorsHemicube )
+  {
+    // the hemicube draws, so it has to shoot on the main thread.
+    // A round per job lets the window draw in between.
+    threadPool.createJobForMainThread( "progressive shots", new Callback0( [](){
+      window->radCore->progressiveShots() ;
+      window->radCore->progressiveUpdate() ;
+    } ) ) ;
+  }
+  else
+  {
+    // Each shot depends on the one before (it picks the patch with the most
+    // unshot energy), so a round is one job.  The vertex colors get
+    // updated on the main thread after it.
+    ParallelBatch *pb = new ParallelBatch( "progressive shots", new Callback0( [](){
+      threadPool.createJobForMainThread( "progressive update", new Callback0( [](){
+        window->radCore->progressiveUpdate() ;
+      } ) ) ;
+    } ) ) ;
+    pb->addJob( new CallbackObject0< RadiosityCore*, void(RadiosityCore::*)() >( this, &RadiosityCore::progressiveShots ) ) ;
+    threadPool.addBatch( pb ) ;
+  }
+}
+
+void RadiosityCore::progressiveShots()
+{
+  for( int s = 0 ; s < shotsPerUpdate ; s++ )
+  {
+    // the patch with the most unshot energy goes next.
+    // O(N), but that's nothing next to computing its row.
+    int shooter = -1 ;
+    real most = prStopEnergy ;
+    for( int i = 0 ; i < NUMPATCHES ; i++ )
+    {
+      real energy = ( prUnshot[i].x + prUnshot[i].y + prUnshot[i].z )/3 * prArea[i] ;
+      if( energy > most )
+      {
+        most = energy ;
+        shooter = i ;
+      }
+    }
+
+    if( shooter == -1 || prShots >= prMaxShots )
+    {
+      prDone = true ;
+      return ;
+    }
+
+    shoot( shooter ) ;
+    prShots++ ;
+  }
+}
+
+void RadiosityCore::shoot( int i )
+{
+  // row i, what patch i sees.  I don't keep it.
+  if( formFactorDetType == FormFactorsHemicube )
+    hemicube->formFactorRow( window->scene, *tris[i], prRow ) ;
+  else if( formFactorDetType == FormFactorsSoftwareHemicube )
+    softHemicube->formFactorRow( tris, *tris[i], *prFaces, prRow ) ;
+  else
+  {
+    // a patch that shoots again casts a different set of rays
+    RandomSampler sampler( 0, i ) ;
+    sampler.startSample( i, (int)prShots ) ;
+    window->raycaster->formFactorRow( tris[i], prRow, sampler ) ;
   }
+
+  // i sends dB_i*A_i.  F_ij of that lands on j, spread over j's area,
+  // and j reflects rho_j of it:
+  //   dB_j = rho_j F_ij dB_i A_i/A_j
+  // which is the same as the gathering B_j = E_j + rho_j sum F_ji B_i
+  // by reciprocity (A_i F_ij = A_j F_ji).
+  Vector sent = prUnshot[i] * prArea[i] ;
+  for( int k = 0 ; k < prRow.touched.size() ; k++ )
+  {
+    int j = prRow.touched[k] ;
+    real F = prRow.dense[j] ;
+    prRow.dense[j] = 0 ; // clear the row as I go
+
+    if( j == i || prArea[j] <= 0 )  continue ;
+    for( int ch = 0 ; ch < 3 ; ch++ )
+    {
+      real dB = prRho[j].e[ch] * F * sent.e[ch] / prArea[j] ;
+      prRadiosity[j].e[ch] += dB ;
+      prUnshot[j].e[ch] += dB ;
+    }
+  }
+  prRow.touched.clear() ;
+
+  prUnshot[i] = Vector( 0, 0, 0 ) ;
+}
+
+void RadiosityCore::progressiveUpdate()
+{
+  // show what's been gathered so far
+  Eigen::VectorXf fEx( NUMPATCHES ) ;
+  for( int ch = 0 ; ch < 3 ; ch++ )
+  {
+    for( int i = 0 ; i < NUMPATCHES ; i++ )
+      fEx( i ) = prRadiosity[i].e[ch] ;
+    updatePatchRadiosities( ch, &fEx ) ;
+  }
+  window->updateVertexBuffers() ;
+
+  if( !prDone )
+  {
+    info( "Progressive refinement: %lld shots", prShots ) ;
+    queueProgressiveShots() ;
+    return ;
+  }
+
+  if( prShots >= prMaxShots )
+    warning( "Progressive refinement stopped at %lld shots with energy still unshot", prShots ) ;
+  info( "Done progressive refinement, %lld shots, %f seconds", prShots, window->timer.getTime() ) ;
+  window->programState = ProgramState::Idle ; // Done computation.
+}
+
+void RadiosityCore::hierarchical( Scene* scene )
+{
+  if( formFactorDetType != FormFactorsRaycast )
+    info( "Hierarchical radiosity estimates its own form factors and casts rays for visibility, not using the hemicube" ) ;
+
+  DESTROY( hrad ) ;
+  hrad = new HierarchicalRadiosity( hierarchicalEpsilon, hierarchicalVisibilityRays, iterativeTolerance ) ;
+
+  // The linking is recursive and the solve is cheap, so it's one job.
+  // It just has to be off the main thread, it casts a lot of rays.
+  ParallelBatch *pb = new ParallelBatch( "hierarchical radiosity", new Callback0( [](){
+    threadPool.createJobForMainThread( "hierarchical update", new Callback0( [](){
+      window->radCore->hierarchicalDone() ;
+    } ) ) ;
+  } ) ) ;
+  pb->addJob( new CallbackObject0< RadiosityCore*, void(RadiosityCore::*)() >( this, &RadiosityCore::hierarchicalSolve ) ) ;
+  threadPool.addBatch( pb ) ;
+}
+
+void RadiosityCore::hierarchicalSolve()
+{
+  hrad->solve( window->scene, tris ) ;
+}
+
+void RadiosityCore::hierarchicalDone()
+{
+  Eigen::VectorXf fEx( NUMPATCHES ) ;
+  for( int ch = 0 ; ch < 3 ; ch++ )
+  {
+    for( int i = 0 ; i < NUMPATCHES ; i++ )
+      fEx( i ) = hrad->radiosity( i ).e[ch] ;
+    updatePatchRadiosities( ch, &fEx ) ;
+  }
+
+  info( "Done hierarchical radiosity, %lld links, %f seconds", hrad->getNumLinks(), window->timer.getTime() ) ;
+  DESTROY( hrad ) ; // the links are done with
+  window->updateVertexBuffers() ;
+  window->programState = ProgramState::Idle ; // Done computation.
 }
 
 void RadiosityCore::checkFFs()
@@ -626,9 +984,9 @@ void RadiosityCore::checkFFs()
 
   int goodRows=0, zeroRows=0 ;
   real avgRowSum = 0.0 ;
-  for( int row = 0 ; row < FFs->rows() ; row++ )
+  for( int row = 0 ; row < FFs->N ; row++ )
   {
-    real rowSum = FFs->row( row ).sum() ;
+    real rowSum = FFs->rowSum( row ) ;
     avgRowSum += rowSum ;
     //for( int col = 0 ; col < FFs->cols() ; col++ )
     //  rowSum += FFs( row, col ) ;
@@ -645,7 +1003,7 @@ void RadiosityCore::checkFFs()
       ;//info( "row %d - ok", row ) ;
   }
 
-  avgRowSum /= FFs->rows() ;
+  avgRowSum /= FFs->N ;
   info( "Check FFS: %d good rows (equal to 1.0), avg=%f", goodRows, avgRowSum ) ;
 
   //printMat( *FFs ) ;
@@ -658,6 +1016,11 @@ void RadiosityCore::solve()
     error( "Nothing to solve" ) ;
     return ;
   }
+
+  // every row is in
+  if( !FFs->isPacked() )
+    FFs->pack() ;
+  FFsSizeInBytes = FFs->sizeInBytes() ;
   checkFFs() ;
 
   #if MULTITHREADED_RADIOSITY_SOLUTION
@@ -686,8 +1049,15 @@ void RadiosityCore::solve()
     }
   ) ) ;
   #else
-  for( int i = 0 ; i < 3 ; i++ )
-    solveRadiosity( i ) ;
+  if( solveChannelsTogether && ( matrixSolverMethod == GaussSeidel || matrixSolverMethod == ParallelGaussSeidel ) )
+    solveRadiosityRGB() ;
+  else
+  {
+    if( solveChannelsTogether )
+      info( "%s solves the channels one at a time", SolutionMethodName[ matrixSolverMethod ] ) ;
+    for( int i = 0 ; i < 3 ; i++ )
+      solveRadiosity( i ) ;
+  }
 
   // after done, you don't need FFs anymore
   DESTROY( FFs ) ;
@@ -698,14 +1068,33 @@ void RadiosityCore::solve()
   #endif
 }
 
+string RadiosityCore::droppedFFsPath()
+{
+  return ( formFactorDirectory.empty() ? string( "." ) : formFactorDirectory ) + "/formfactors.dat" ;
+}
+
 void RadiosityCore::dropFFsToDisk()
 {
   if( !FFs ) { error( "FFs not declared, cannot drop" ) ; return ; }
+  if( !FFs->isPacked() ) { error( "FFs not packed yet (still being computed?), cannot drop" ) ; return ; }
+  if( FFs->isOutOfCore() ) { info( "FFs are out of core already, not dropping them" ) ; return ; }
 
   info( "Dropping FFs to disk" ) ;
-  FILE* out = fopen( "C:/formfactors.dat", "wb" ) ;
-
-  fwrite( (void*)FFs->data(), FFsSizeInBytes, 1, out ) ;
+  FILE* out = fopen( droppedFFsPath().c_str(), "wb" ) ;
+  if( !out ) { error( "Couldn't open %s to drop FFs", droppedFFsPath().c_str() ) ; return ; }
+
+  // N, nnz, whether the values are halfs, then the 3 CSR arrays
+  long long nnz = FFs->nnz() ;
+  int half = FFs->halfValues ;
+  fwrite( &FFs->N, sizeof(int), 1, out ) ;
+  fwrite( &nnz, sizeof(long long), 1, out ) ;
+  fwrite( &half, sizeof(int), 1, out ) ;
+  fwrite( FFs->rowStart.data(), sizeof(long long), FFs->N+1, out ) ;
+  fwrite( FFs->cols.data(), sizeof(int), nnz, out ) ;
+  if( half )
+    fwrite( FFs->halfVals.data(), sizeof(Half), nnz, out ) ;
+  else
+    fwrite( FFs->vals.data(), sizeof(float), nnz, out ) ;
   fclose( out ) ;  //flush
 
   DESTROY( FFs ) ; //save memory
@@ -716,20 +1105,45 @@ void RadiosityCore::recoverFFsFromDisk()
   if( FFs ) { info( "FFs already loaded" ) ; return ; }
   
   info( "Loading FFs from disk.." ) ;
-  FILE* in = fopen( "C:/formfactors.dat", "rb" ) ;
-
-  FFs = new Eigen::MatrixXf() ;
-  FFs->resize( NUMPATCHES, NUMPATCHES ) ;
-
-  fread( (BYTE*)FFs->data(), FFsSizeInBytes, 1, in ) ;
+  FILE* in = fopen( droppedFFsPath().c_str(), "rb" ) ;
+  if( !in ) { error( "Couldn't open %s to recover FFs", droppedFFsPath().c_str() ) ; return ; }
+
+  FFs = new CSRMatrix() ;
+  long long nnz ;
+  int half ;
+  fread( &FFs->N, sizeof(int), 1, in ) ;
+  fread( &nnz, sizeof(long long), 1, in ) ;
+  fread( &half, sizeof(int), 1, in ) ;
+  FFs->halfValues = half != 0 ;
+  FFs->rowStart.resize( FFs->N+1 ) ;
+  FFs->cols.resize( nnz ) ;
+  fread( FFs->rowStart.data(), sizeof(long long), FFs->N+1, in ) ;
+  fread( FFs->cols.data(), sizeof(int), nnz, in ) ;
+  if( half )
+  {
+    FFs->halfVals.resize( nnz ) ;
+    fread( FFs->halfVals.data(), sizeof(Half), nnz, in ) ;
+  }
+  else
+  {
+    FFs->vals.resize( nnz ) ;
+    fread( FFs->vals.data(), sizeof(float), nnz, in ) ;
+  }
   // you can delete FFs from disk now
 
   fclose( in ) ;
 
+  // dropped by a machine with F16C, picked up by one without
+  if( FFs->halfValues && !cpuHasF16C() )
+  {
+    warning( "No F16C on this cpu, decoding the half form factors to floats" ) ;
+    FFs->toFloatValues() ;
+  }
+
   puts( "Loaded." ) ;
 
   puts( "Deleting file.." ) ;
-  DeleteFileA( "C:/formfactors.dat" ) ;
+  DeleteFileA( droppedFFsPath().c_str() ) ;
   puts( "Deleted." ) ;
   
 }
@@ -767,10 +1181,6 @@ void RadiosityCore::solveRadiosity( int channel )
     warning( "No %s light source patches in scene", ColorChannelIndexName[ channel ] ) ;
 
     
-  // Form A: Will be destroying A by solving it,
-  // so need to declare it here.  Each
-  // RGB channel has it's own A.
-
   // A is the matrix to solve, by inversion or by
   // LU decomposition, or by an iterative method such as
   // Gauss-Seidel.
@@ -782,73 +1192,53 @@ void RadiosityCore::solveRadiosity( int channel )
   // all other colors.
 
   // A = I - REFLECTIVITIES .* FFs
-  // Can compute by:
-  // a)  A = - FFs
-  // b)  for( each Patch ) A( patchRow ) *= RED REFLECTIVITY
-  // c)  for( diagonal )  A(d,d) += 1 ;
-  // D)  SOLVE RED
-  // Repeat for Green, Blue
-  
-  //recoverFFsFromDisk() ;
-
-  // THIS IS APPARENTLY NOT ALLOWED IN EIGEN WHEN FFs IS A POINTER
-  ///Eigen::MatrixXf A = -(*FFs) ; //a) EIGENBUG: this screws up and A is a zero matrix
-  
-  // Explicit copy because the above line makes A a zero matrix. I hate Eigen.
-  Eigen::MatrixXf A( NUMPATCHES, NUMPATCHES ) ;
-  for( int row = 0 ; row < NUMPATCHES ; row++ )
-    for( int col = 0 ; col < NUMPATCHES ; col++ )
-      A( row, col ) = - ( (*FFs)( row, col ) ) ;
-
-  //plainFile( "--FFS********************" ) ;
-  //printMat( *FFs ) ;
-  //plainFile( "--A %d******************* ",channel ) ;
-  //printMat( A ) ;
-  //dropFFsToDisk() ; // I don't need FFs here
+  // A is never formed:  the RadiositySystem reads row p of the
+  // sparse FFs and scales it by patch p's reflectivity as it goes,
+  // so there's no second NxN copy per channel.
   
   /// EXTRACT THE REFLECTIVITIES FROM THE SCENE GEOMETRY
   // 2 KD IS THE REFLECTIVITY
+  Eigen::VectorXf rho( NUMPATCHES ) ;
   for( int p = 0 ; p < tris.size() ; p++ )
   {
     // diffuse color multiplied by this
     // surface reflectivity damping coeff.
     // REFLECTIVITY MULTIPLIES THE ROWS OF FFs
-    // the reflectivity in RGB is going to multiply
-    // the form factors
-    real rflect = tris[ p ]->getAverageColor( ColorIndex::DiffuseMaterial, channel ) * SURFACE_REFLECTIVITIES ;
-    A.row(p) *= rflect ; //b)
-    
-    // Add 1 to that row's diagonal.
-    A( p,p ) += 1.0 ; //c)
+    rho( p ) = tris[ p ]->getAverageColor( ColorIndex::DiffuseMaterial, channel ) * SURFACE_REFLECTIVITIES ;
   }
-
-  ////plainFile( "\n\n********* A=\n" );
-  ////printMat( A ) ;
-  ////plainFile( "END OF A\n" ) ;
+  RadiositySystem A( FFs, &rho ) ;
 
   info( "SOLVING channel %s", ColorChannelIndexName[channel] ) ;
   IterativeSolver* iSolver ;
   ///////////window->stopWatch.start() ;
-  if( matrixSolverMethod == LUDecomposition )
+  if( matrixSolverMethod == LUDecomposition || matrixSolverMethod == AInverse )
   {
-    info( "Solve by LU decomposition" ) ;
-    Eigen::FullPivLU<Eigen::MatrixXf> lu = A.fullPivLu() ;        // e3
-    fEx = lu.solve( exitance ) ;         // e3
-  }
-  else if( matrixSolverMethod == AInverse )
-  {
-    // Now you can use the inverse of A to compute the final light at each
-    // patch, GIVEN some initial conditions starting emittance vector
-    // post multiplying the inverse matrix by
-    // the initial exitances vector..
-    info( "Solve A^-1" ) ;
-    Eigen::MatrixXf AInverse = A.inverse() ;
+    // the direct methods need all of A
+    info( "Expanding A to dense for a direct solve (%lld MB)", NUMPATCHES*NUMPATCHES*(long long)sizeof(float)/(1<<20) ) ;
+    Eigen::MatrixXf denseA ;
+    A.toDense( denseA ) ;
 
-    // Ax = b
-    // so
-    // A^-1 * Ax = A^-1 * b8
-    // x = A^-1 * b
-    fEx = AInverse * exitance ;
+    if( matrixSolverMethod == LUDecomposition )
+    {
+      info( "Solve by LU decomposition" ) ;
+      Eigen::FullPivLU<Eigen::MatrixXf> lu = denseA.fullPivLu() ;        // e3
+      fEx = lu.solve( exitance ) ;         // e3
+    }
+    else
+    {
+      // Now you can use the inverse of A to compute the final light at each
+      // patch, GIVEN some initial conditions starting emittance vector
+      // post multiplying the inverse matrix by
+      // the initial exitances vector..
+      info( "Solve A^-1" ) ;
+      Eigen::MatrixXf AInverse = denseA.inverse() ;
+
+      // Ax = b
+      // so
+      // A^-1 * Ax = A^-1 * b8
+      // x = A^-1 * b
+      fEx = AInverse * exitance ;
+    }
   }
   else
   {
@@ -856,15 +1246,38 @@ void RadiosityCore::solveRadiosity( int channel )
       iSolver = new IterativeSolverJacobi( &A, &exitance, &fEx, iterativeTolerance ) ;
     else if( matrixSolverMethod == GaussSeidel )
       iSolver = new IterativeSolverSeidel( &A, &exitance, &fEx, iterativeTolerance ) ;
+    else if( matrixSolverMethod == ParallelJacobi )
+      iSolver = new IterativeSolverParallelJacobi( &A, &exitance, &fEx, iterativeTolerance ) ;
+    else if( matrixSolverMethod == ParallelGaussSeidel )
+      iSolver = new IterativeSolverParallelSeidel( &A, &exitance, &fEx, iterativeTolerance ) ;
+    else if( matrixSolverMethod == BiCGSTAB )
+      iSolver = new IterativeSolverBiCGSTAB( &A, &exitance, &fEx, iterativeTolerance ) ;
+    else if( matrixSolverMethod == GMRES )
+      iSolver = new IterativeSolverGMRES( &A, &exitance, &fEx, iterativeTolerance, gmresRestart ) ;
     else
       iSolver = new IterativeSolverSouthwell( &A, &exitance, &fEx, iterativeTolerance ) ;
 
     iSolver->solve() ;
+    DESTROY( iSolver ) ;
   }
 
   //window->stopWatch.stop() ;
   info( "Solution complete" ) ;
 
+  checkSolution( A, exitance, fEx ) ;
+
+  //// Now we need to pass back
+  // the patch radiosities,
+  // will sit in TEXCOORD1 of
+  // the GeneralVertex format.
+  // So the result of the radiosity
+  // computation is considered a texture.
+
+  updatePatchRadiosities( channel, &fEx ) ;
+} //A, exitances, fEx die
+
+void RadiosityCore::checkSolution( const RadiositySystem& A, const Eigen::VectorXf& exitance, Eigen::VectorXf& fEx )
+{
   #pragma region solution accuracy/num stability check
   // check the solution vector,
   // by multiplying
@@ -873,7 +1286,8 @@ void RadiosityCore::solveRadiosity( int channel )
   // x = fEx
 
   // so compute B, and you should get the original "exitance" vector
-  Eigen::VectorXf B = A * fEx ;
+  Eigen::VectorXf B ;
+  A.multiply( fEx, B ) ;
   int correct = 0 ;
   for( int i = 0 ; i < B.size() ; i++ )
   {
@@ -889,13 +1303,45 @@ void RadiosityCore::solveRadiosity( int channel )
   }
   info( "%d / %d correct exitance values", correct, NUMPATCHES ) ;
   #pragma endregion
+}
 
-  //// Now we need to pass back
-  // the patch radiosities,
-  // will sit in TEXCOORD1 of
-  // the GeneralVertex format.
-  // So the result of the radiosity
-  // computation is considered a texture.
+// The 3 channels in one solve.  They only differ by rho, so each
+// row of FFs gets read once a sweep and relaxes r,g,b together
+void RadiosityCore::solveRadiosityRGB()
+{
+  IterativeSolverSeidelRGB::MatrixRGB exitance( NUMPATCHES, 3 ) ;
+  IterativeSolverSeidelRGB::MatrixRGB rho( NUMPATCHES, 3 ) ;
+  IterativeSolverSeidelRGB::MatrixRGB fEx( NUMPATCHES, 3 ) ;
 
-  updatePatchRadiosities( channel, &fEx ) ;
-} //A, exitances, fEx die
+  info( "Getting initial exitances and reflectivities for r,g,b from tris.." ) ;
+  for( int i = 0 ; i < NUMPATCHES ; i++ )
+  {
+    Vector e = tris[i]->getAverageColor( ColorIndex::Emissive ) ;
+    for( int c = 0 ; c < 3 ; c++ )
+    {
+      exitance( i, c ) = e.e[ c ] ;
+      rho( i, c ) = tris[ i ]->getAverageColor( ColorIndex::DiffuseMaterial, c ) * SURFACE_REFLECTIVITIES ;
+    }
+  }
+
+  for( int c = 0 ; c < 3 ; c++ )
+    if( IsNear( exitance.col( c ).sum(), 0.0, EPS_MIN ) )
+      warning( "No %s light source patches in scene", ColorChannelIndexName[ c ] ) ;
+
+  // serial Gauss-Seidel is 1 block
+  int blocks = matrixSolverMethod == ParallelGaussSeidel ? threadPool.getNumThreads() + 1 : 1 ;
+  IterativeSolverSeidelRGB solver( FFs, &rho, &exitance, &fEx, iterativeTolerance, blocks ) ;
+  solver.solve() ;
+
+  for( int c = 0 ; c < 3 ; c++ )
+  {
+    // same B = Ax check the one channel solve makes, on each channel's own A
+    Eigen::VectorXf rhoC = rho.col( c ) ;
+    Eigen::VectorXf exitanceC = exitance.col( c ) ;
+    Eigen::VectorXf channel = fEx.col( c ) ;
+    RadiositySystem A( FFs, &rhoC ) ;
+    info( "Checking channel %s", ColorChannelIndexName[ c ] ) ;
+    checkSolution( A, exitanceC, channel ) ; // (also makes them positive)
+    updatePatchRadiosities( c, &channel ) ;
+  }
+}
@@ -3,6 +3,7 @@
 
 #include "VectorOccludersData.h"
 #include "../math/EigenUtil.h"  //this file needs eigen.
+#include "SoftwareHemicube.h"
 #include <D3D11.h>
 
 class D3D11Window ;
@@ -11,9 +12,11 @@ struct VizFunc ;
 struct Triangle ;
 class Scene ;
 struct Hemicube ;
+struct RadiositySystem ;
 struct Shape ;
 struct AllVertex ;
 struct Texcoording ;
+struct HierarchicalRadiosity ;
 
 /// Enumeration of available
 /// solver methods.
@@ -25,7 +28,26 @@ enum MatrixSolverMethod
   /// Iterative techniques below
   Jacobi          = 2,
   GaussSeidel     = 3,
-  Southwell       = 4
+  Southwell       = 4,
+
+  /// Shooting, never stores the form factor matrix:
+  /// computes the row of the patch with the most
+  /// unshot energy, distributes it, throws the row away
+  ProgressiveRefinement = 5,
+
+  /// Links clusters of patches instead of
+  /// forming every form factor, see HierarchicalRadiosity
+  Hierarchical    = 6,
+
+  /// Jacobi and block Gauss-Seidel with
+  /// each sweep spread over the thread pool
+  ParallelJacobi  = 7,
+  ParallelGaussSeidel = 8,
+
+  /// Krylov methods, diagonally preconditioned.  Far
+  /// fewer iterations than the above for bright scenes
+  BiCGSTAB        = 9,
+  GMRES           = 10
 } ;
 
 /// RadCore can either rasterize the solution,
@@ -34,7 +56,8 @@ enum FormFactorDetermination
 {
   FormFactorsHemicube,
   ////RasterizedTetrahedron, // I don't even intend to provide this, hemicubes are fast enough
-  FormFactorsRaycast
+  FormFactorsRaycast,
+  FormFactorsSoftwareHemicube // the hemicube rasterized on the cpu, all cores
 } ;
 
 enum VisibilityDetermination
@@ -68,6 +91,14 @@ public:
   // use this many hemi px per side
   int hemicubePixelsPerSide ;
 
+  // FormFactorsHemicube rasterizes on the cpu instead
+  // of the gpu ("radiosity::software hemicube")
+  bool useSoftwareHemicube ;
+
+  // GaussSeidel and ParallelGaussSeidel solve r,g,b in the
+  // same pass over FFs ("radiosity::solve rgb together")
+  bool solveChannelsTogether ;
+
   /// Acceptable tolerance to solve
   /// for iterative solvers before
   /// stopping iteration.
@@ -75,6 +106,10 @@ public:
   /// norm squared of the residue vector
   real iterativeTolerance ;
 
+  /// GMRES keeps this many basis vectors before
+  /// it restarts ("radiosity::gmres restart")
+  int gmresRestart ;
+
   D3D11Window* win ;
 
 
@@ -85,8 +120,35 @@ public:
   /// There is only ONE form factor matrix
   /// (and not 3) because it has strictly
   /// to do with geometry and not material
-  /// properties
-  Eigen::MatrixXf* FFs ;
+  /// properties.
+  /// Sparse: a patch only sees a small
+  /// fraction of the others, so each row
+  /// only keeps the patches it actually saw.
+  CSRMatrix* FFs ;
+
+  /// form factors smaller than this are dropped
+  /// as their rows come in ("radiosity::form factor threshold")
+  real formFactorThreshold ;
+
+  /// If not empty, FFs live in a memory mapped file in this
+  /// directory instead of in RAM ("radiosity::form factor directory").
+  /// dropFFsToDisk() also writes there.
+  string formFactorDirectory ;
+
+  /// Keeps FFs as fp16 instead of floats, 6 bytes an entry instead
+  /// of 8 ("radiosity::half form factors").  ~3 significant digits,
+  /// which doesn't show in the solution.
+  bool halfFormFactors ;
+
+  /// ProgressiveRefinement shoots this many patches between
+  /// updates of the vertex colors ("radiosity::shots per update")
+  int shotsPerUpdate ;
+
+  /// Hierarchical links nodes when they'd carry less than this fraction of
+  /// the emitted power ("radiosity::hierarchical epsilon"), checking
+  /// visibility with this many rays ("radiosity::hierarchical visibility rays")
+  real hierarchicalEpsilon ;
+  int hierarchicalVisibilityRays ;
 
   /// light emission of patches,
   /// initial scene
@@ -104,10 +166,9 @@ public:
 
 private:
   // size of the matrix.  using LONG LONG is just showing off, really.
-  // you can't solve 13,000x13,000 without running out of memory.
-  // with 8gb ram, max is about 45k tris
-  // sqrt( ( 8 * 2^30 ) / 4 )
-  // 16gb it's 65k tris
+  // Dense, you couldn't solve 13,000x13,000 without running out of memory
+  // (with 8gb ram, max was about 45k tris, sqrt( ( 8 * 2^30 ) / 4 )).
+  // Sparse it's 12 bytes per form factor a patch actually sees.
   long long NUMPATCHES ;
   long long FFsSizeInBytes ;
 
@@ -120,12 +181,45 @@ private:
   // the next triangle that needs to be assigned an id.
   static int currentId ;
 
+  // Every tri corner, grouped by position: group g's vertices are
+  // smoothVerts[ smoothStart[g] .. smoothStart[g+1] ), and the patches
+  // that meet there are smoothPatches over the same range.
+  // Built once per solve, so smoothing patch radiosities onto the
+  // vertices is O(N) instead of searching every tri for every vertex.
+  vector<AllVertex*> smoothVerts ;
+  vector<int> smoothPatches ;
+  vector<int> smoothStart ;
+
+  // the hemicube, reused by every solve on the main thread
+  Hemicube* hemicube ;
+
+  // the cpu one, shared by every job (each has its own Faces)
+  SoftwareHemicube* softHemicube ;
+
+  #pragma region progressive refinement
+  // Per patch, O(N) total.  rgb in each Vector.
+  vector<Vector> prRadiosity ;  // B, what's been gathered so far (plus emission)
+  vector<Vector> prUnshot ;     // dB, gathered but not passed on yet
+  vector<Vector> prRho ;        // reflectivity
+  vector<real> prArea ;
+  real prStopEnergy ;           // done when no patch has more unshot energy than this
+  long long prShots, prMaxShots ;
+  bool prDone ;
+  CSRRowBuilder prRow ;         // the shooter's form factors, reused every shot
+  SoftwareHemicube::Faces* prFaces ; // when shooting with the software hemicube
+  #pragma endregion
+
+  // only alive during a Hierarchical solve
+  HierarchicalRadiosity* hrad ;
+
 public:
   /// Creates the radiosity core.
   RadiosityCore( D3D11Window* iWin, int iHemicubePixelsPerSide ) ;
 
   int getNextId() ;
 
+  inline long long getNumPatches() { return NUMPATCHES ; }
+
   Shape* getShapeOwner( int id ) ;
 
   // assign ids to every patch in the scene
@@ -137,6 +231,7 @@ public:
   void radiosity( Scene* scene, FormFactorDetermination iFormFactorDetType, MatrixSolverMethod iMatrixSolverMethod ) ;
   void calculateFormFactorsHemicubes( Scene* scene ) ;
   void calculateFormFactorsRaytraced( Scene* scene ) ;
+  void calculateFormFactorsSoftwareHemicube( Scene* scene ) ;
 
   // 1024 means 1M vectors, 2048 means 4M vectors, 4096 means 16M vectors, 8192 means 67M vectors
   Texcoording createVectorOccludersTex( int size ) ;
@@ -151,14 +246,34 @@ public:
   void qVectorOccludersRaytraced( Scene * scene ) ;
 
 private:
-  void setAveragePatchColor( int channel, AllVertex* vertex, Eigen::VectorXf* fEx, Triangle *patchOwner ) ;
+  void buildSmoothingGroups() ;
+
+  // one job's worth of software hemicube rows [startIndex,endIndex)
+  void softwareHemicubeFormFactors( int startIndex, int endIndex ) ;
 
   void updatePatchRadiosities( int channel, Eigen::VectorXf* fEx ) ;
 
+  // Progressive refinement (Cohen et al. 88).  Starts the shooting,
+  // then alternates a round of shotsPerUpdate shots with a vertex color
+  // update on the main thread, so the image is usable early.
+  void progressiveRefinement( Scene* scene ) ;
+  void progressiveShots() ;
+  void progressiveUpdate() ;
+  void queueProgressiveShots() ;
+  void shoot( int patch ) ;
+
+  // Hierarchical: links and solves on a worker, then
+  // writes the patch radiosities on the main thread
+  void hierarchical( Scene* scene ) ;
+  void hierarchicalSolve() ;
+  void hierarchicalDone() ;
+
   void checkFFs() ;
 
   void solve() ;
 
+  string droppedFFsPath() ;
+
   void dropFFsToDisk() ;
 
   void recoverFFsFromDisk() ;
@@ -169,6 +284,13 @@ private:
   /// and the individual surface reflectivities.
   void solveRadiosity( int channel ) ;
 
+  /// All 3 channels in one solve, see IterativeSolverSeidelRGB
+  void solveRadiosityRGB() ;
+
+  /// B = Ax check of a solved channel: B should come back as the
+  /// exitances.  Flips negative results positive.
+  void checkSolution( const RadiositySystem& A, const Eigen::VectorXf& exitance, Eigen::VectorXf& fEx ) ;
+
 } ;
 
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define RAYCOLLECTION_H
 
 #include "../math/Vector.h"
+#include "../util/Sampler.h"
 
 // keeps both the cartesian and spherical vectors cached
 struct VectorPair
@@ -82,6 +83,22 @@ struct RayCollection
     return randomDirs[ idx%n ].c ;
   }
 
+  // Same as above, but the start position comes from the calling
+  // thread's own sampler stream instead of the shared global MT.
+  inline int randomIndex( Sampler& sampler ) { return sampler.randInt( 0, n ) ; }
+
+  inline Vector vAbout( const Vector& normal, Sampler& sampler ) {
+    int idx = randomIndex( sampler ) ;
+    while( randomDirs[ idx%n ].c % normal < 0 )  idx++;
+    return randomDirs[ idx%n ].c ;
+  }
+
+  inline Vector& vAboutAddr( const Vector& normal, Sampler& sampler ) {
+    int idx = randomIndex( sampler ) ;
+    while( randomDirs[ idx%n ].c % normal < 0 )  idx++;
+    return randomDirs[ idx%n ].c ;
+  }
+
   inline Vector vAbout( int & idx, const Vector& normal ) {
     // advance idx until you reach one that is 90 degrees about the normal.
     // idx is advanced (pass by ref) so that if you are iterating here,
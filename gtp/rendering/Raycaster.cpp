@@ -18,6 +18,14 @@ Raycaster::Raycaster( int iNumRays )
 {
   setNumRays( iNumRays ) ;
   shTex = 0 ;
+  passNumber = 0 ;
+  passSeed = 0 ;
+}
+
+void Raycaster::newPass()
+{
+  // every pass gets fresh streams, unless we're keying by vertex only
+  passSeed = Sampler::deterministic ? 0 : ++passNumber ;
 }
 
 void Raycaster::setNumRays( int iNumRays )
@@ -53,7 +61,9 @@ void Raycaster::setNumRays( int iNumRays )
 void Raycaster::QAO( ParallelBatch* pb1, Scene *scene, int vertsPerJob )
 {
   info( "Running AO using %d rays", numRaysToUse ) ;
+  newPass() ;
 
+  int vertexBase = 0 ; // scene wide index of this mesh's first vertex
   for( int i = 0 ; i < scene->shapes.size() ; i++ )
   {
     for( int j = 0 ; j < scene->shapes[i]->meshGroup->meshes.size() ; j++ )
@@ -66,9 +76,10 @@ void Raycaster::QAO( ParallelBatch* pb1, Scene *scene, int vertsPerJob )
         clamp<int>( endPt, 0, mesh->verts.size() ) ;
       
         // call shProject_Stage1 on this vertex range.
-        pb1->addJob( new CallbackObject3< Raycaster*, void(Raycaster::*)(vector<AllVertex>*,int,int), vector<AllVertex>*,int,int >
-          ( this, &Raycaster::ambientOcclusion, &mesh->verts, k, endPt ) ) ;
+        pb1->addJob( new CallbackObject4< Raycaster*, void(Raycaster::*)(vector<AllVertex>*,int,int,int), vector<AllVertex>*,int,int,int >
+          ( this, &Raycaster::ambientOcclusion, &mesh->verts, k, endPt, vertexBase ) ) ;
       }
+      vertexBase += mesh->verts.size() ;
     } // foreach mesh in meshgroup
   }
 }
@@ -158,6 +169,9 @@ void Raycaster::QSHPrecomputation_Stage2_Interreflection_Only( ParallelBatch* pb
 
 void Raycaster::QWavelet_Stage2_Interreflection_Only( ParallelBatch* pb, Scene *scene, int vertsPerJob ) 
 {
+  newPass() ;
+
+  int vertexBase = 0 ;
   for( int i = 0 ; i < scene->shapes.size() ; i++ )
   {
     for( int j = 0 ; j < scene->shapes[i]->meshGroup->meshes.size() ; j++ )
@@ -171,15 +185,20 @@ void Raycaster::QWavelet_Stage2_Interreflection_Only( ParallelBatch* pb, Scene *
         int endPt = i+vertsPerJob ;
         clamp<int>( endPt, 0, mesh->verts.size() ) ;
       
-        pb->addJob( new CallbackObject3< Raycaster*, void(Raycaster::*)(vector<AllVertex>*,int,int), vector<AllVertex>*,int,int >
-          ( this, &Raycaster::wavelet_Stage2_Interreflection, &mesh->verts, i, endPt ) ) ;
+        pb->addJob( new CallbackObject4< Raycaster*, void(Raycaster::*)(vector<AllVertex>*,int,int,int), vector<AllVertex>*,int,int,int >
+          ( this, &Raycaster::wavelet_Stage2_Interreflection, &mesh->verts, i, endPt, vertexBase ) ) ;
       }
+      vertexBase += mesh->verts.size() ;
     } // foreach mesh in meshgroup
   }
 }
 
 void Raycaster::createSHTexcoords( Scene * scene )
 {
+  // the sh coefficients stay on the vertices when headless, there's nothing to upload them to
+  if( window->headless )
+    return ;
+
   // 1024 means 1M vectors, 2048 means 4M vectors, 4096 means 16M vectors, 8192 means 67M vectors
   // I need (bands*bands) coefficients per vertex
   int verts = scene->countVertices() ;
@@ -217,15 +236,22 @@ void Raycaster::createSHTexcoords( Scene * scene )
   shTex->close() ;
 }
 
-void Raycaster::ambientOcclusion( vector<AllVertex>* verts, int startIndex, int endIndex )
+void Raycaster::ambientOcclusion( vector<AllVertex>* verts, int startIndex, int endIndex, int vertexBase )
 {
   if( endIndex > verts->size() ) { error( "OOB error" ) ;  endIndex = verts->size() ; }
 
+  // this job's own stream, so the job threads don't share the global MT
+  RandomSampler sampler( passSeed, vertexBase + startIndex ) ;
+  sampler.bindToThread() ;
   for( int i = startIndex ; i < endIndex ; i++ )
-    ambientOcclusion( (*verts)[ i ] ) ;
+  {
+    sampler.startSample( vertexBase + i, 0 ) ; // keyed by vertex in deterministic mode
+    ambientOcclusion( (*verts)[ i ], sampler ) ;
+  }
+  Sampler::unbindThread() ;
 }
 
-void Raycaster::ambientOcclusion( AllVertex& vertex )
+void Raycaster::ambientOcclusion( AllVertex& vertex, Sampler& sampler )
 {
   //real dotSum=0.0 ;
 
@@ -234,7 +260,7 @@ void Raycaster::ambientOcclusion( AllVertex& vertex )
   real CUTOFFDIST = 25.0 ;
   vertex.ambientOcclusion = 0 ; // start by assuming it's blocked
   
-  int startRay = randInt( 0, rc->n ) ;
+  int startRay = rc->randomIndex( sampler ) ;
   for( int i = 0 ; i < numRaysToUse ; i++ )
   {
     int idx = (startRay + i)%rc->n ;
@@ -272,15 +298,21 @@ void Raycaster::ambientOcclusion( AllVertex& vertex )
   vertex.texcoord[ TexcoordIndex::VectorOccludersIndex ].w = vertex.ambientOcclusion ;
 }
 
-void Raycaster::vectorOccluders( vector<AllVertex>* verts, int startIndex, int endIndex )
+void Raycaster::vectorOccluders( vector<AllVertex>* verts, int startIndex, int endIndex, int vertexBase )
 {
   if( endIndex > verts->size() ) { error( "OOB error" ) ;  endIndex = verts->size() ; }
 
+  RandomSampler sampler( passSeed, vertexBase + startIndex ) ;
+  sampler.bindToThread() ;
   for( int i = startIndex ; i < endIndex ; i++ )
-    vectorOccluders( (*verts)[ i ] ) ;
+  {
+    sampler.startSample( vertexBase + i, 0 ) ;
+    vectorOccluders( (*verts)[ i ], sampler ) ;
+  }
+  Sampler::unbindThread() ;
 }
 
-void Raycaster::vectorOccluders( AllVertex& vertex )
+void Raycaster::vectorOccluders( AllVertex& vertex, Sampler& sampler )
 {
   // cast rays in every which direction, looking for specular reflectors
   // taht are unblocked in the reflection dirctino, and diffuse surfaces
@@ -288,7 +320,7 @@ void Raycaster::vectorOccluders( AllVertex& vertex )
   vertex.voData = new VectorOccludersData() ;
   //real ffSum = 0.0 ;
 
-  int startRay = randInt( 0, rc->n ) ;
+  int startRay = rc->randomIndex( sampler ) ;
   for( int i = 0 ; i < numRaysToUse ; i++ )
   {
     // Grab ray and make sure it's valid
@@ -685,16 +717,22 @@ void Raycaster::writeSHTexcoords( Texcoording & ctex, AllVertex& vertex )
   ) ;
 }
 
-void Raycaster::wavelet_Stage2_Interreflection( vector<AllVertex>* verts, int startIndex, int endIndex )
+void Raycaster::wavelet_Stage2_Interreflection( vector<AllVertex>* verts, int startIndex, int endIndex, int vertexBase )
 {
+  RandomSampler sampler( passSeed, vertexBase + startIndex ) ;
+  sampler.bindToThread() ;
   for( int i = startIndex ; i < endIndex ; i++ )
-    wavelet_Stage2_Interreflection( (*verts)[ i ] ) ;
+  {
+    sampler.startSample( vertexBase + i, 0 ) ;
+    wavelet_Stage2_Interreflection( (*verts)[ i ], sampler ) ;
+  }
+  Sampler::unbindThread() ;
 }
 
-void Raycaster::wavelet_Stage2_Interreflection( AllVertex& vertex )
+void Raycaster::wavelet_Stage2_Interreflection( AllVertex& vertex, Sampler& sampler )
 {
   // at each vertex, shoot rays and see what other polygons you hit.
-  int si = randInt( 0, rc->n ) ;
+  int si = rc->randomIndex( sampler ) ;
   for( int j = 0 ; j < window->shSamps->nU ; j++ )
   {
     Vector &sampdir = rc->vAddr( si+j ) ;
@@ -777,9 +815,10 @@ void Raycaster::wavelet_Stage2_Interreflection( AllVertex& vertex )
 }
 
 void Raycaster::QFormFactors( ParallelBatch* pb, Scene *scene,
-  vector<Triangle*>* iTris, int trisPerJob, Eigen::MatrixXf* FFs )
+  vector<Triangle*>* iTris, int trisPerJob, CSRMatrix* FFs )
 {
   info( "Running formfactor computation using %d rays", numRaysToUse ) ;
+  newPass() ;
   
   tris = iTris ;
   
@@ -791,7 +830,7 @@ void Raycaster::QFormFactors( ParallelBatch* pb, Scene *scene,
     clamp<int>( endPt, 0, tris->size() ) ;
 
     // Create jobs of trisPerJob each.
-    pb->addJob( new CallbackObject3< Raycaster*, void(Raycaster::*)(int,int, Eigen::MatrixXf*), int,int, Eigen::MatrixXf* >
+    pb->addJob( new CallbackObject3< Raycaster*, void(Raycaster::*)(int,int, CSRMatrix*), int,int, CSRMatrix* >
         ( this, &Raycaster::formFactors, i, i+trisPerJob, FFs ) ) ;
   }
 
@@ -803,7 +842,9 @@ void Raycaster::QVectorOccluders( ParallelBatch* pb, Scene *scene, int vertsPerJ
 
   // set up the raycaster to use aoRays
   setNumRays( numRaysToUse ) ;
+  newPass() ;
 
+  int vertexBase = 0 ;
   for( int i = 0 ; i < scene->shapes.size() ; i++ )
   {
     for( int j = 0 ; j < scene->shapes[i]->meshGroup->meshes.size() ; j++ )
@@ -816,26 +857,35 @@ void Raycaster::QVectorOccluders( ParallelBatch* pb, Scene *scene, int vertsPerJ
         clamp<int>( endPt, 0, mesh->verts.size() ) ;
       
         // call shProject_Stage1 on this vertex range.
-        pb->addJob( new CallbackObject3< Raycaster*, void(Raycaster::*)(vector<AllVertex>*,int,int), vector<AllVertex>*,int,int >
-          ( this, &Raycaster::vectorOccluders, &mesh->verts, k, endPt ) ) ;
+        pb->addJob( new CallbackObject4< Raycaster*, void(Raycaster::*)(vector<AllVertex>*,int,int,int), vector<AllVertex>*,int,int,int >
+          ( this, &Raycaster::vectorOccluders, &mesh->verts, k, endPt, vertexBase ) ) ;
       }
+      vertexBase += mesh->verts.size() ;
     } // foreach mesh in meshgroup
   }
 }
 
-void Raycaster::formFactors( int startIndex, int endIndex, Eigen::MatrixXf* FFs )
+void Raycaster::formFactors( int startIndex, int endIndex, CSRMatrix* FFs )
 {
   if( startIndex > tris->size() ){ error( "OOB startIndex" ) ; return ; }
   if( endIndex > tris->size() ) { error( "OOB endIndex" ) ; endIndex = tris->size() ; } ;
 
+  RandomSampler sampler( passSeed, startIndex ) ;
+  sampler.bindToThread() ; // anything under the intersection code that still calls randFloat
+  CSRRowBuilder row ; // this job's scratch row
+  row.reset( FFs->N ) ;
   for( int i = startIndex ; i < endIndex ; i++ )
-    formFactors( i, FFs ) ; // actually compute
+  {
+    sampler.startSample( i, 0 ) ; // keyed by patch in deterministic mode
+    formFactorRow( (*tris)[ i ], row, sampler ) ; // actually compute
+    FFs->setRow( (*tris)[ i ]->getId(), row ) ;
+  }
+  Sampler::unbindThread() ;
 }
 
 // Finds the form factors for 1 tri.
-void Raycaster::formFactors( int indexOfTri, Eigen::MatrixXf* FFs )
+void Raycaster::formFactorRow( Triangle *tri, CSRRowBuilder& row, Sampler& sampler )
 {
-  Triangle *tri = (*tris)[ indexOfTri ] ;
   ///printf( "form factors tri %d            \r", tri->getId() ) ;
   // to find the formfactors for a triangle using raycasting,
   // situate yourself on the tri and just shoot rays, seeing what patches you hit (by id).
@@ -843,10 +893,9 @@ void Raycaster::formFactors( int indexOfTri, Eigen::MatrixXf* FFs )
   // shoot rays,
   Vector eye = tri->getCentroid() + tri->normal*EPS_MIN ;  // start eye rays slightly off surface
   
-  int row = tri->getId() ;
   //real dotSum = 0 ;
 
-  int startRay = randInt( 0, rc->n ) ;
+  int startRay = rc->randomIndex( sampler ) ;
   for( int i = 0 ; i < numRaysToUse ; i++ )
   {
     int idx = (startRay + i)%rc->n ;
@@ -867,7 +916,7 @@ void Raycaster::formFactors( int indexOfTri, Eigen::MatrixXf* FFs )
       
       // INCREMENT THAT PATCHES' RELATION WITH (this patch) BY
       // SOLIDANGLE SUBTENDED BY EACH RAY I SHOOT!
-      (*FFs)( row, col ) += dot * dotScaleFactor ; //!! Is this right?
+      row.add( col, dot * dotScaleFactor ) ; //!! Is this right?
     }
     //else { } // the scene is not closed, so energy is lost.
   }
@@ -876,10 +925,10 @@ void Raycaster::formFactors( int indexOfTri, Eigen::MatrixXf* FFs )
 
 
 /*
-void sphericalWavelet()
+void sphericalWavelet( Sampler& sampler )
 {
   // shoot rays around and see what's around you
-  int startRay = randInt( 0, rc->n ) ;
+  int startRay = rc->randomIndex( sampler ) ;
   
   for( int i = 0 ; i < numRays ; i++ )
   {
@@ -3,6 +3,7 @@
 
 #include "../math/Vector.h"
 #include "../math/EigenUtil.h"
+#include "../math/CSRMatrix.h"
 #include "../geometry/Triangle.h"
 #include "RayCollection.h"
 
@@ -17,6 +18,9 @@ struct Texcoording ;
 // radiosity (if raytraced).
 struct Raycaster
 {
+  // farm workers queue ambientOcclusion ranges themselves
+  friend struct RenderFarm ;
+
   static RayCollection* rc ;
   
   // the current number of rays to use
@@ -31,6 +35,13 @@ struct Raycaster
   //
   D3D11Surface* shTex ;
 
+  // bumped by every queued pass (AO, VO, wavelet, form factors).  The job
+  // streams are seeded from passSeed and the scene wide vertex (or patch) index,
+  // so reruns differ but nothing depends on where the vertex arrays live.
+  // passSeed stays 0 in "ray::deterministic" mode.
+  unsigned int passNumber ;
+  unsigned long long passSeed ;
+
   Raycaster( int iNumRays );
 
   void setNumRays( int iNumRays ) ;
@@ -50,14 +61,18 @@ struct Raycaster
 
 private:
 
-  // just finds the ambient occlusion at a vertex by raycasting, nothing more
-  void ambientOcclusion( vector<AllVertex>* verts, int startIndex, int endIndex ) ;
+  // starts a new pass: fresh passSeed
+  void newPass() ;
+
+  // just finds the ambient occlusion at a vertex by raycasting, nothing more.
+  // vertexBase is the scene wide index of (*verts)[0].
+  void ambientOcclusion( vector<AllVertex>* verts, int startIndex, int endIndex, int vertexBase ) ;
 
-  void ambientOcclusion( AllVertex& vertex ) ;
+  void ambientOcclusion( AllVertex& vertex, Sampler& sampler ) ;
 
-  void vectorOccluders( vector<AllVertex>* verts, int startIndex, int endIndex ) ;
+  void vectorOccluders( vector<AllVertex>* verts, int startIndex, int endIndex, int vertexBase ) ;
 
-  void vectorOccluders( AllVertex& vertex ) ;
+  void vectorOccluders( AllVertex& vertex, Sampler& sampler ) ;
 
   // I must be given the array of vertices (which resides in a SHAPE, in a MESHGROUP, in a MESH.)
   void shPrecomputation_Stage1_Ambient( vector<AllVertex>* verts, int startIndex, int endIndex ) ;
@@ -70,9 +85,9 @@ private:
 
   void writeSHTexcoords( Texcoording & ctex, AllVertex& vertex ) ;
 
-  void wavelet_Stage2_Interreflection( vector<AllVertex>* verts, int startIndex, int endIndex ) ;
+  void wavelet_Stage2_Interreflection( vector<AllVertex>* verts, int startIndex, int endIndex, int vertexBase ) ;
   
-  void wavelet_Stage2_Interreflection( AllVertex& vertex ) ;
+  void wavelet_Stage2_Interreflection( AllVertex& vertex, Sampler& sampler ) ;
 
 
 
@@ -82,23 +97,25 @@ public:
   // scene: the scene
   // tris: list of tris
   // ffs: the form factors
-  void QFormFactors( ParallelBatch* pb, Scene *scene, vector<Triangle*>* iTris, int trisPerJob, Eigen::MatrixXf* FFs ) ;
+  void QFormFactors( ParallelBatch* pb, Scene *scene, vector<Triangle*>* iTris, int trisPerJob, CSRMatrix* FFs ) ;
 
   void QVectorOccluders( ParallelBatch* pb, Scene *scene, int vertsPerJob ) ;
 
+  // Finds the form factors for a single tri (one row of FFs) into row
+  // (reset to the number of patches). meat.
+  // sampler is the job's own stream (picks the start ray).
+  void formFactorRow( Triangle *tri, CSRRowBuilder& row, Sampler& sampler ) ;
+
 private:
 
   // So, this finds formFactors FOR A SECTION of the tris array.
   // Finding formFactors for only a section of the tris at a time
   // is needed to make the task parallelizable.
-  void formFactors( int startIndex, int endIndex, Eigen::MatrixXf* FFs ) ;
-
-  // Finds the form factors for a single tri. meat.
-  void formFactors( int indexOfTri, Eigen::MatrixXf* FFs ) ;
+  void formFactors( int startIndex, int endIndex, CSRMatrix* FFs ) ;
 
 
 public:
-  // void sphericalWavelet();
+  // void sphericalWavelet( Sampler& sampler );
 
 } ;
 
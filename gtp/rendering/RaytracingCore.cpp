@@ -6,6 +6,15 @@
 #include "../geometry/Mesh.h"
 #include "../threading/ParallelizableBatch.h"
 #include "../math/SHVector.h"
+#include "CubeMapSampler.h"
+#include "Denoiser.h"
+#include "TemporalReprojector.h"
+#include "BakedSky.h"
+#include "IrradianceCache.h"
+#include "PhotonMap.h"
+#include "AreaLightSampler.h"
+#include "../geometry/AABB.h"
+#include <algorithm> // sort, for binning wavefront rays
 
 Fragment Fragment::Zero ;
 
@@ -21,6 +30,10 @@ const char* TraceTypeName[] = {
   "Whitted", "Distributed", "Path"
 } ;
 
+const char* MISHeuristicName[] = {
+  "off", "balance", "power"
+} ;
+
 
 RaytracingCore::RaytracingCore( int iNumRows, int iNumCols,
     int iRaysPerPixel,
@@ -29,10 +42,31 @@ RaytracingCore::RaytracingCore( int iNumRows, int iNumCols,
     int iRaysDistributed,
     int iRaysCubeMapLighting,
     int iMaxBounces, real iInterreflectionThreshold,
-    bool iShowBg
+    bool iShowBg,
+    string iSamplerType
   )
 {
   cubeMap = 0 ;
+  cubeMapSampler = 0 ;
+  lightSampler = 0 ;
+  misHeuristic = MISOff ;
+  denoiser = 0 ;
+  temporal = 0 ;
+  temporalFrame = false ;
+  bakedSky = 0 ;
+  waveSize = 0 ;
+  checkpointSeconds = 0 ;
+  resumeNext = false ;
+  topUpTo = 0 ;
+  budgetSeconds = 0 ;
+  passNumber = 0 ;
+  passRpp = 16 ;
+  traceRowStart = traceRowEnd = 0 ;
+  sameFrame = false ;
+  irradianceCache = 0 ;
+  irradianceRays = 256 ;
+  photonMap = 0 ;
+  accumMutex = CreateMutexA( 0, 0, 0 ) ;
   realTimeMode = false ;
   rows = iNumRows ;
   cols = iNumCols ;
@@ -60,12 +94,16 @@ RaytracingCore::RaytracingCore( int iNumRows, int iNumCols,
       raysDistributed, rc->n, rc->n/8 ) ;
     raysDistributed = rc->n/8 ;
   }
-  raysCubeMapLighting = iRaysCubeMapLighting ;  // BOOLEAN whether to use cubemap or not. need roughly 200,000 directions for 256x256 cubemap
+  raysCubeMapLighting = iRaysCubeMapLighting ;  // # directions drawn from the cubemap per diffuse hit (0 = off)
   maxBounces = iMaxBounces ;
   interreflectionThreshold² = SQUARE( iInterreflectionThreshold ) ; // light must have 10% energy left.
   
   showBg = iShowBg ;
 
+  samplerType = Sampler::parseType( iSamplerType ) ;
+  traceNumber = 0 ;
+  info( "%s sampler", SamplerTypeName[samplerType] ) ;
+
   //pixels.resize( rows*cols ) ;
   frameBuffer = new FrameBuffer( rows, cols ) ;
   bytePixels.resize( rows*cols ) ;
@@ -76,6 +114,13 @@ RaytracingCore::RaytracingCore( int iNumRows, int iNumCols,
 RaytracingCore::~RaytracingCore()
 {
   DESTROY( viewingPlane ) ;
+  DESTROY( denoiser ) ;
+  DESTROY( temporal ) ;
+  DESTROY( bakedSky ) ;
+  DESTROY( irradianceCache ) ;
+  DESTROY( photonMap ) ;
+  DESTROY( lightSampler ) ;
+  CloseHandle( accumMutex ) ;
 }
 
 void RaytracingCore::clear( Vector color )
@@ -137,6 +182,267 @@ void RaytracingCore::writePixelsToByteArray()
 }
 
 
+Vector RaytracingCore::perlinSky( const Vector& dir, Scene *scene )
+{
+  if( bakedSky )
+    return bakedSky->lookup( dir ) ; // raytrace() made sure it's current
+  
+  return scene->perlin.sky( dir.x, dir.y, dir.z,
+                         PerlinGenerator::SKY_BLUE,
+                         PerlinGenerator::CLOUD_WHITE ) ;
+}
+
+Vector RaytracingCore::missColor( const Ray& ray, Scene *scene )
+{
+  if( cubeMap )
+    return ray.power * cubeMap->px( ray.direction ) ;
+  else if( scene->perlinSkyOn ) // perlin sky
+    return ray.power*perlinSky( ray.direction, scene ) ; // sample the perlin sky!
+  else
+    return scene->bgColor ; // use the lame bg color
+}
+
+Vector RaytracingCore::cachedIrradiance( Intersection *intn, const Ray& ray, Scene *scene, Sampler& sampler )
+{
+  // cast()'s path gather averages dot*L over uniformly distributed
+  // directions, which comes out to E/2pi.  The cache stores real
+  // irradiance, so scale it the same way.
+  Vector E ;
+  if( irradianceCache->lookup( intn->point, intn->normal, E ) )
+    return E/(2*PI) ;
+
+  // Nothing valid here, gather a new record: M x N cosine weighted
+  // strata (M in theta, N = pi M in phi, like Ward & Heckbert).
+  int M = max( 2, (int)sqrt( irradianceRays/PI ) ) ;
+  int N = max( 3, irradianceRays/M ) ;
+
+  const Vector& n = intn->normal ;
+  Vector u = n.getPerpendicular().normalize() ;
+  Vector v = n << u ;
+
+  vector<Vector> L( M*N ) ;
+  vector<real> dist( M*N ), sinTheta( M*N ), cosTheta( M*N ) ;
+  real invDistSum = 0 ;
+  Vector white( 1,1,1 ) ;
+
+  for( int j = 0 ; j < M ; j++ )
+  {
+    for( int k = 0 ; k < N ; k++ )
+    {
+      int s = j*N + k ;
+      real ju, jv ;
+      sampler.next2D( ju, jv ) ;
+      real sin2 = ( j + ju )/M ;
+      sinTheta[s] = sqrt( sin2 ) ;
+      cosTheta[s] = sqrt( 1 - sin2 ) ;
+      real phi = 2*PI*( k + jv )/N ;
+      Vector dir = u*( sinTheta[s]*cos( phi ) ) + v*( sinTheta[s]*sin( phi ) ) + n*cosTheta[s] ;
+
+      // white, so the record doesn't depend on this surface's color
+      Ray gatherRay( intn->point + EPS_MIN*n, dir, 1000.0, ray.eta, white, ray.bounceNum+1 ) ;
+      gatherRay.afterDiffuse = true ;
+
+      // the gradients need the distance to what each ray hits.
+      // cast() doesn't hand that back, so it's one extra intersection per ray.
+      Intersection *hit ;
+      if( scene->getClosestIntn( gatherRay, &hit ) )
+      {
+        dist[s] = max( distanceBetween( hit->point, intn->point ), EPS_MIN ) ;
+        invDistSum += 1/dist[s] ;
+        DESTROY( hit ) ;
+      }
+      else
+        dist[s] = HUGE ;
+
+      L[s] = cast( gatherRay, scene, sampler ) ;
+    }
+  }
+
+  IrradianceRecord *rec = new IrradianceRecord ;
+  rec->point = intn->point ;
+  rec->normal = n ;
+  rec->E = Vector( 0,0,0,0 ) ;
+  for( int s = 0 ; s < M*N ; s++ )
+    rec->E += L[s] ;
+  rec->E *= PI/(M*N) ;
+
+  // harmonic mean distance, clamped so records in corners still reach
+  // a little and ones out in the open don't reach across the scene
+  rec->R = invDistSum > 0 ? M*N/invDistSum : HUGE ;
+  rec->R = clampedCopy<real>( rec->R, irradianceCache->minSpacing, irradianceCache->maxSpacing ) ;
+
+  for( int ch = 0 ; ch < 3 ; ch++ )
+    rec->rotGrad[ch] = rec->transGrad[ch] = Vector( 0,0,0,0 ) ;
+
+  for( int k = 0 ; k < N ; k++ )
+  {
+    // u_k points at the middle of column k, vk its tangent.
+    // vMinus is the tangent at the boundary between columns k-1 and k.
+    real phi = 2*PI*( k + .5 )/N ;
+    real phiMinus = 2*PI*k/N ;
+    Vector uk = u*cos( phi ) + v*sin( phi ) ;
+    Vector vk = u*-sin( phi ) + v*cos( phi ) ;
+    Vector vMinus = u*-sin( phiMinus ) + v*cos( phiMinus ) ;
+    int kPrev = ( k + N - 1 ) % N ;
+
+    for( int j = 0 ; j < M ; j++ )
+    {
+      int s = j*N + k ;
+
+      // rotational: -tan(theta) L along vk
+      real rot = -sinTheta[s]/max( cosTheta[s], 0.01 ) * PI/(M*N) ;
+
+      // translational, across the ring boundary below cell (j,k)
+      real ringTerm = 0 ;
+      if( j > 0 )
+      {
+        real sinMinus = sqrt( (real)j/M ), cos2Minus = 1 - (real)j/M ;
+        ringTerm = 2*PI/N * sinMinus*cos2Minus / min( dist[s], dist[s-N] ) ;
+      }
+
+      // ..and across the boundary between columns k-1 and k
+      real cosMinus = sqrt( 1 - (real)j/M ), cosPlus = sqrt( 1 - (real)(j+1)/M ) ;
+      real colTerm = ( cosMinus - cosPlus ) / ( max( sinTheta[s], 0.01 ) * min( dist[s], dist[ j*N + kPrev ] ) ) ;
+
+      for( int ch = 0 ; ch < 3 ; ch++ )
+      {
+        rec->rotGrad[ch] += vk * ( rot * L[s].e[ch] ) ;
+        if( j > 0 )
+          rec->transGrad[ch] += uk * ( ringTerm * ( L[s].e[ch] - L[s-N].e[ch] ) ) ;
+        rec->transGrad[ch] += vMinus * ( colTerm * ( L[s].e[ch] - L[ j*N + kPrev ].e[ch] ) ) ;
+      }
+    }
+  }
+
+  E = rec->E ;
+  irradianceCache->insert( rec ) ;
+  return E/(2*PI) ;
+}
+
+bool RaytracingCore::misGlossy( Intersection *intn, const Ray& ray ) const
+{
+  // a perfect mirror can't hit a point on a light by light sampling,
+  // so its reflection ray keeps bringing the emitters back as usual
+  return lightSampler && traceType != Whitted && !ray.isShadowRay &&
+    intn->shape->material.specularJitter > 0 ;
+}
+
+Vector RaytracingCore::emitterAlong( Intersection *intn, const Vector& dir, const Ray& ray, Scene *scene, real& lightPdf, real& hitDist )
+{
+  lightPdf = 0 ;
+  hitDist = HUGE ;
+
+  Ray probe( intn->point + EPS_MIN*intn->normal, dir, 1000, ray.eta, Vector(1,1,1,1), ray.bounceNum+1 ) ;
+  probe.isShadowRay = true ;
+  Intersection *hit = 0 ;
+  if( !scene->getClosestIntn( probe, &hit ) )  return 0 ;
+
+  hitDist = distanceBetween( probe.startPos, hit->point ) ;
+  Vector Le = hit->getColor( ColorIndex::Emissive ) ;
+  if( Le.nonzero() && lightSampler->isLight( hit->shape ) )
+  {
+    // area pdf -> solid angle pdf
+    real cosY = fabs( hit->normal % dir ) ;
+    if( cosY > 0 )
+      lightPdf = lightSampler->areaPdf() * SQUARE( hitDist ) / cosY ;
+  }
+  DESTROY( hit ) ;
+  return Le ;
+}
+
+Vector RaytracingCore::misDirect( Intersection *intn, const Ray& ray, const Vector& kd, const Vector& ks,
+  int numSamples, Scene *scene, Sampler& sampler )
+{
+  // The two integrals, both over the hemisphere at intn:
+  //   diffuse:  kd/(2 PI) * Le cos   (the same 1/(2 PI) the path gather has)
+  //   glossy:   ks * Le * pCone      inside the cone of half angle specularJitter
+  //             about the mirror direction, which is what the jittered
+  //             reflection ray averages over.
+  // Each is estimated with numSamples light samples and numSamples BRDF samples,
+  // a sample weighted by how likely its own strategy was to draw it.
+  Vector direct ;
+  if( numSamples < 1 )  numSamples = 1 ;
+  const Vector& n = intn->normal ;
+  bool doDiffuse = kd.nonzero(), doGlossy = ks.nonzero() ;
+
+  Vector lobe ;
+  real cosA = 1, pCone = 0 ;
+  if( doGlossy )
+  {
+    lobe = ray.direction.reflectedCopy( n ).normalize() ;
+    cosA = cos( min<real>( intn->shape->material.specularJitter, PI ) ) ;
+    pCone = 1.0/( 2*PI*( 1 - cosA ) ) ;
+  }
+
+  real r1, r2, r3, lightPdf, hitDist ;
+
+  // 1. points on the lights
+  for( int i = 0 ; i < numSamples ; i++ )
+  {
+    r1 = sampler.next1D() ;
+    sampler.next2D( r2, r3 ) ;
+    Vector lightNormal ;
+    Vector toLight = lightSampler->sample( r1, r2, r3, lightNormal ) - intn->point ;
+    real dist = toLight.len() ;
+    if( dist <= 0 )  continue ;
+    toLight /= dist ;
+
+    real cosX = n % toLight ;
+    if( cosX <= 0 || !( lightNormal % toLight ) )  continue ; // below the surface, or edge on
+
+    Vector Le = emitterAlong( intn, toLight, ray, scene, lightPdf, hitDist ) ;
+    if( hitDist < dist*0.999 - EPS_MIN || lightPdf <= 0 )  continue ; // something's in the way
+
+    if( doDiffuse )
+      direct += kd * Le * ( misWeight( numSamples*lightPdf, numSamples*cosX/PI ) * cosX/( 2*PI*lightPdf ) ) ;
+    if( doGlossy && toLight % lobe >= cosA )
+      direct += ks * Le * ( misWeight( numSamples*lightPdf, numSamples*pCone ) * pCone/lightPdf ) ;
+  }
+
+  // 2. directions off the diffuse lobe, cosine weighted (pdf cos/PI)
+  if( doDiffuse )
+  {
+    Vector tu = n.getPerpendicular().normalize() ;
+    Vector tv = n << tu ;
+    for( int i = 0 ; i < numSamples ; i++ )
+    {
+      sampler.next2D( r1, r2 ) ;
+      real sinTheta = sqrt( r1 ), phi = 2*PI*r2, cosX = sqrt( 1 - r1 ) ;
+      if( cosX <= 0 )  continue ;
+      Vector dir = tu*( sinTheta*cos( phi ) ) + tv*( sinTheta*sin( phi ) ) + n*cosX ;
+
+      Vector Le = emitterAlong( intn, dir, ray, scene, lightPdf, hitDist ) ;
+      if( !Le.nonzero() )  continue ;
+
+      // f cos/pdf = ( kd/(2 PI) cos )/( cos/PI ) = kd/2
+      direct += kd * Le * ( misWeight( numSamples*cosX/PI, numSamples*lightPdf ) / 2 ) ;
+    }
+  }
+
+  // 3. directions uniform in the glossy cone (pdf pCone)
+  if( doGlossy )
+  {
+    Vector gu = lobe.getPerpendicular().normalize() ;
+    Vector gv = lobe << gu ;
+    for( int i = 0 ; i < numSamples ; i++ )
+    {
+      sampler.next2D( r1, r2 ) ;
+      real cosTheta = 1 - r1*( 1 - cosA ) ;
+      real sinTheta = sqrt( max<real>( 0, 1 - cosTheta*cosTheta ) ), phi = 2*PI*r2 ;
+      Vector dir = gu*( sinTheta*cos( phi ) ) + gv*( sinTheta*sin( phi ) ) + lobe*cosTheta ;
+      if( dir % n <= 0 )  continue ; // into the surface
+
+      Vector Le = emitterAlong( intn, dir, ray, scene, lightPdf, hitDist ) ;
+      if( !Le.nonzero() )  continue ;
+
+      // f cos/pdf = ks pCone/pCone
+      direct += ks * Le * misWeight( numSamples*pCone, numSamples*lightPdf ) ;
+    }
+  }
+
+  return direct/numSamples ;
+}
+
 // ray traced spherical harmonic solution
 Vector RaytracingCore::castRTSH( Ray& ray, Scene *scene )
 {
@@ -155,9 +461,7 @@ Vector RaytracingCore::castRTSH( Ray& ray, Scene *scene )
     else if( scene->perlinSkyOn ) // perlin sky
     {
       // sample the perlin sky!
-      finalColor = ray.power*scene->perlin.sky( ray.direction.x, ray.direction.y, ray.direction.z,
-                         PerlinGenerator::SKY_BLUE,
-                         PerlinGenerator::CLOUD_WHITE ) ;
+      finalColor = ray.power*perlinSky( ray.direction, scene ) ;
     }
     else
       finalColor = scene->bgColor ; // use the lame bg color
@@ -207,7 +511,7 @@ Vector RaytracingCore::castRTSH( Ray& ray, Scene *scene )
 //   2.  Illumination or  Shadow rays - carry light from a light source directly to an object surface
 //   3.  Reflection rays  - carry light reflected by an object
 //   4.  Transparency rays - carry light passing thru an object
-Vector RaytracingCore::cast( Ray& ray, Scene *scene )
+Vector RaytracingCore::cast( Ray& ray, Scene *scene, Sampler& sampler )
 {
   // RECURSION TERMINATION:
   // If the bounceNum is 1 and you allowed 0 bounces, then you get 0 back.
@@ -232,19 +536,7 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
     // a 0-bounce ray hits the background.
     if( !showBg && !ray.bounceNum )  return 0 ; // 0 alpha too
     
-    if( cubeMap )
-    {
-      finalColor = ray.power * cubeMap->px( ray.direction ) ;
-    }
-    else if( scene->perlinSkyOn ) // perlin sky
-    {
-      // sample the perlin sky!
-      finalColor = ray.power*scene->perlin.sky( ray.direction.x, ray.direction.y, ray.direction.z,
-                         PerlinGenerator::SKY_BLUE,
-                         PerlinGenerator::CLOUD_WHITE ) ;
-    }
-    else
-      finalColor = scene->bgColor ; // use the lame bg color
+    finalColor = missColor( ray, scene ) ;
 
     return finalColor ;  // if this was a "total miss" 
     // (missed all scene geometry), then w is 0 and 
@@ -258,7 +550,10 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
   // DID WE HIT A LIGHT SOURCE WITH OUR RAY?
   // In this program light sources are Shapes.
   // So sample the light source at the location we hit it (the color it sends).
-  Vector emittedColor = intn->getColor( ColorIndex::Emissive ) ;
+  Vector emittedColor ;
+  if( !( photonMap && photonMap->covers( ray ) ) && // the photon map already has this light
+      !ray.directCounted ) // so did misDirect() at the surface this ray came from
+    emittedColor = intn->getColor( ColorIndex::Emissive ) ;
   
   Vector diffuseColor ;
   
@@ -285,10 +580,11 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
         // cast ray towards the light.  no change in eta, just a power loss due to diffuse reflection.
         Ray shadowRay( intn->point + EPS_MIN*intn->normal, toLight, 1000, ray.eta, ray.power*diffuseColorAtIntn, ray.bounceNum+1 ) ;
         shadowRay.isShadowRay = true ; // flag it as a shadow ray, so it can't reflect
-        diffuseColor += dot * cast( shadowRay, scene ) ;
+        shadowRay.afterDiffuse = true ;
+        diffuseColor += dot * cast( shadowRay, scene, sampler ) ;
       }
     }
-    else if( traceType == Distributed )
+    else if( traceType == Distributed && !lightSampler ) // (with MIS on, misDirect() does this below)
     {
       for( int i=0 ; i < scene->lights.size() ; i++ )
       {
@@ -303,7 +599,8 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
           // cast ray towards the light.  no change in eta, just a power loss due to diffuse reflection.
           Ray shadowRay( intn->point + EPS_MIN*intn->normal, toLight, 1000, ray.eta, ray.power*diffuseColorAtIntn, ray.bounceNum+1 ) ;
           shadowRay.isShadowRay = true ; // flag it as a shadow ray, so it can't reflect
-          diffuseColor += dot * cast( shadowRay, scene ) ;
+          shadowRay.afterDiffuse = true ;
+          diffuseColor += dot * cast( shadowRay, scene, sampler ) ;
         } // end each light, i
       }
 
@@ -315,35 +612,32 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
     #pragma region cubemap lighting
     // be sure to limit bounce number to 1 or 2 if you DON'T want
     // this to take forever.
-    if( raysCubeMapLighting && cubeMap )
+    if( raysCubeMapLighting && cubeMapSampler )
     {
-      int skip = cubeMap->pixelsPerSide/raysCubeMapLighting ;
-
-      // Consider each cube map pixel as a point light.
-      real dotSum = 0.0 ;
-      for( int FACE = 0 ; FACE < 6 ; FACE++ )
+      // Draw raysCubeMapLighting directions with probability
+      // proportional to (luminance x solid angle), so the rays go
+      // where the light actually is.  Each sample is weighted by cos/pdf,
+      // and dividing by PI gives the same normalization the old
+      // dot-weighted average over every texel had (integral of cos over the hemisphere is PI).
+      Vector cubeColor ;
+      for( int i = 0 ; i < raysCubeMapLighting ; i++ )
       {
-        for( int row = 0 ; row < cubeMap->pixelsPerSide ; row+=skip )
-        {
-          for( int col = 0 ; col < cubeMap->pixelsPerSide ; col+=skip )
-          {
-            // form a vector that points to the face
-            Vector rayCubeDir = cubeMap->getDirectionConvertedLHToRH( FACE, row, col ) ;
-            rayCubeDir.normalize();
-
-            real dot = intn->normal % rayCubeDir ;
-            if( dot < 0 )  continue ; // can't use this ray, because it's going to hit own face anyway.
-
-            dotSum += dot ;
-            Ray cubeRay( intn->point + intn->normal * EPS_MIN, rayCubeDir, 1000, ray.eta, ray.power*diffuseColorAtIntn, ray.bounceNum+1 ) ;
-            
-            // cast the ray towards that cubemap direction
-            diffuseColor += dot * cast( cubeRay, scene ) ;
-          } //each col
-        } // each row
-      } // end each face
+        real pdf ;
+        real r1 = sampler.next1D(), r2, r3 ;
+        sampler.next2D( r2, r3 ) ;
+        Vector rayCubeDir = cubeMapSampler->sample( r1, r2, r3, pdf ) ;
+
+        real dot = intn->normal % rayCubeDir ;
+        if( dot <= 0 || pdf <= 0 )  continue ; // below the surface, counts as a 0 sample
+
+        Ray cubeRay( intn->point + intn->normal * EPS_MIN, rayCubeDir, 1000, ray.eta, ray.power*diffuseColorAtIntn, ray.bounceNum+1 ) ;
+        cubeRay.afterDiffuse = true ;
+        
+        // cast the ray towards that cubemap direction
+        cubeColor += ( dot / pdf ) * cast( cubeRay, scene, sampler ) ;
+      }
     
-      diffuseColor /= dotSum ;
+      diffuseColor += cubeColor / ( PI * raysCubeMapLighting ) ;
     }
     #pragma endregion
 
@@ -352,20 +646,27 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
     {
       // shows caustics, only looks good with immense (>200) number of rays
       // and high (>4) rays per pixel
-      if( raysDistributed == 1 )
+      if( irradianceCache && !ray.bounceNum )
+      {
+        // eye ray hit: reuse the smooth indirect light of nearby pixels
+        diffuseColor += diffuseColorAtIntn * cachedIrradiance( intn, ray, scene, sampler ) ;
+      }
+      else if( raysDistributed == 1 )
       {
         // "path tracing"
         // get random direction 
-        Vector& dir = rc->vAboutAddr( intn->normal ) ; // retrieves a ray that doesn't shoot into the surface
+        Vector& dir = rc->vAboutAddr( intn->normal, sampler ) ; // retrieves a ray that doesn't shoot into the surface
         real dot = dir % intn->normal ;
 
         // shoot a diffuse ray feeler out.
         Ray pathRay( intn->point + EPS_MIN*intn->normal, dir, 1000.0, ray.eta, ray.power*diffuseColorAtIntn, ray.bounceNum+1 ) ;
+        pathRay.afterDiffuse = true ;
+        pathRay.directCounted = misDiffuse( ray ) ;
       
         // cast a ray off and retrieve the color.
         // You have to hit a LIGHT SOURCE to actually
         // add some color.
-        diffuseColor += dot * cast( pathRay, scene ) ;
+        diffuseColor += dot * cast( pathRay, scene, sampler ) ;
 
         ////Vector dColor = cast( pathRay, scene ) ;
         ////diffuseColor += dot * dColor * (dColor.w > 0) ; // if dColor.w is 0, DON'T COUNT IT
@@ -376,7 +677,7 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
         Vector gatheredColor ;
         real dotSum = 0.0 ;
 
-        int startSamp = randInt( 0, rc->n ) ;
+        int startSamp = rc->randomIndex( sampler ) ;
 
         // shoot "raysDistributed" rays in random directions
         // to estimate the color at pixel.
@@ -397,17 +698,35 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
           }
           
           Ray distRay( intn->point + EPS_MIN*intn->normal, dir, 1000.0, ray.eta, ray.power*diffuseColorAtIntn, ray.bounceNum+1 ) ;  // eta stays the same as where ray came from.
-          diffuseColor += dot * cast( distRay, scene ) ;
+          distRay.afterDiffuse = true ;
+          distRay.directCounted = misDiffuse( ray ) ;
+          diffuseColor += dot * cast( distRay, scene, sampler ) ;
         }
 
         diffuseColor /= raysDistributed ;
       }
     }
     #pragma endregion
+
+    // caustics: light that came off a light through specular surfaces.
+    // Same 1/(2 PI) normalization as the path gather.
+    if( photonMap )
+      diffuseColor += diffuseColorAtIntn * photonMap->irradiance( intn->point, intn->normal ) / ( 2*PI ) ;
   }// end diffuse lighting
   
-  Vector specularColor ;
   Vector specularColorAtIntn = intn->getColor( ColorIndex::SpecularMaterial ) ;
+
+  // Direct light by multiple importance sampling, for both lobes at once.
+  // The diffuse gather and glossy reflection rays below then skip
+  // the emission of whatever they hit first.
+  Vector directColor ;
+  bool diffuseMIS = diffuseColorAtIntn.nonzero() && misDiffuse( ray ) ;
+  bool glossyMIS = specularColorAtIntn.nonzero() && misGlossy( intn, ray ) ;
+  if( diffuseMIS || glossyMIS )
+    directColor = misDirect( intn, ray, diffuseMIS ? diffuseColorAtIntn : Vector(0,0,0,0),
+      glossyMIS ? specularColorAtIntn : Vector(0,0,0,0), raysDistributed, scene, sampler ) ;
+
+  Vector specularColor ;
   if( specularColorAtIntn.nonzero() && !ray.isShadowRay ) // shadow rays can't reflect.
   {
     // 3. Reflection Ray.
@@ -415,11 +734,12 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
     //for( int i = 0 ; i < a ; i++ )
     {
       Ray reflRay = ray.reflect( intn->normal, intn->point, specularColorAtIntn ) ;
+      reflRay.directCounted = glossyMIS ;
 
       // jitter only for distributed ray tracing.
       if( traceType!=Whitted && intn->shape->material.specularJitter )
         reflRay.direction.jitter( intn->shape->material.specularJitter ) ; // jitter it.
-      specularColor += cast( reflRay, scene ) ;
+      specularColor += cast( reflRay, scene, sampler ) ;
     }
     //specularColor /= a ;
   }
@@ -457,7 +777,7 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
       Ray refractedRay = ray.refract( intn->normal, toEta.x, intn->point, ray.power*txColorAtIntn ) ;
       if( traceType!=Whitted && intn->shape->material.transmissiveJitter )
         refractedRay.direction.jitter( intn->shape->material.transmissiveJitter ) ;
-      transmittedColor += cast( refractedRay, scene ) ;   
+      transmittedColor += cast( refractedRay, scene, sampler ) ;   
     }
   }
   else for( int i = 0 ; i < 3 ; i++ ) // SPLIT 3
@@ -470,7 +790,7 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
       Ray refractedRay = ray.refract( intn->normal, i, toEta.e[i], intn->point, ray.power*txP ) ;
       if( traceType!=Whitted && intn->shape->material.transmissiveJitter )
         refractedRay.direction.jitter( intn->shape->material.transmissiveJitter ) ;
-      transmittedColor += cast( refractedRay, scene ) ;   
+      transmittedColor += cast( refractedRay, scene, sampler ) ;   
     }
   }
   #pragma endregion
@@ -479,6 +799,7 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
   // final result
   Vector finalColor = ray.power * (
       emittedColor +
+      directColor +
       diffuseColor +
       specularColor +
       transmittedColor
@@ -505,7 +826,7 @@ Vector RaytracingCore::cast( Ray& ray, Scene *scene )
 
 
 /// THIS IS INCOMPLETE
-Vector RaytracingCore::brdfCast( Ray& ray, Scene *scene )
+Vector RaytracingCore::brdfCast( Ray& ray, Scene *scene, Sampler& sampler )
 {
   warning( "BRDFCast incomplete, go work on it" ) ;
 
@@ -530,9 +851,7 @@ Vector RaytracingCore::brdfCast( Ray& ray, Scene *scene )
     else if( scene->perlinSkyOn ) // perlin sky
     {
       // sample the perlin sky!
-      finalColor = ray.power*scene->perlin.sky( ray.direction.x, ray.direction.y, ray.direction.z,
-                         PerlinGenerator::SKY_BLUE,
-                         PerlinGenerator::CLOUD_WHITE ) ;
+      finalColor = ray.power*perlinSky( ray.direction, scene ) ;
     }
     else
       finalColor = scene->bgColor ; // use the lame bg color
@@ -559,7 +878,7 @@ Vector RaytracingCore::brdfCast( Ray& ray, Scene *scene )
   // the INPUT direction is the random direction we are gathering from.
   
   // choose a start pos
-  int soff = randInt( 0, rc->n ) ;
+  int soff = rc->randomIndex( sampler ) ;
   
   for( int i = 0 ; i < raysDistributed ; i++ )
   {
@@ -585,15 +904,447 @@ Vector RaytracingCore::brdfCast( Ray& ray, Scene *scene )
     Ray newRay( intn.point+intn.normal*EPS_MIN, in, 1000, ray.eta, ray.power, ray.bounceNum+1 ) ;
 
     // Cast again, looking for the base case to return a final color.
-    finalColor += brdfCast( newRay, scene ) ;
+    finalColor += brdfCast( newRay, scene, sampler ) ;
   }
   
   return finalColor/raysDistributed ;
 }
 
+// The c'th of this trace's eye rays through pixel (row,col), jittered
+// by the sampler, full juice on it's 0th bounce.  sampleNo is which
+// sample that is over the pixel's whole life (more than c when resuming).
+Ray RaytracingCore::getEyeRay( int row, int col, int c, int sampleNo, int sqrtRpp, Sampler& sampler, Scene *scene )
+{
+  sampler.startSample( row*cols+col, sampleNo ) ;
+
+  Ray r ;
+  if( stratified )
+  {
+    // stratified sampling: jitter the rays evenly
+    int nbins = sqrtRpp * sqrtRpp ;
+
+    // subrow and subcol are the mini bins within the pixel
+    int subrow,subcol ;
+    
+    if( c < nbins )
+    {
+      // cast nbins rays at least 1 per bin
+      subrow = c / sqrtRpp ;
+      subcol = c % sqrtRpp ;
+    }
+    else // for nbins to rpp
+    {
+      // cast the rest in random bins
+      subrow = sampler.randInt( 0, sqrtRpp ) ;
+      subcol = sampler.randInt( 0, sqrtRpp ) ;
+    }
+
+    real ju, jv ;
+    sampler.next2D( ju, jv ) ;
+    r = viewingPlane->getRay( row, col,
+      -1 + (subrow+ju)*(2./sqrtRpp),
+      -1 + (subcol+jv)*(2./sqrtRpp)
+    ) ;
+  }
+  else
+  {
+    // NOT stratified
+    // jitters randomly
+    real ju, jv ;
+    sampler.next2D( ju, jv ) ;
+    r = viewingPlane->getRay( row, col, ju - .5, jv - .5 ) ;
+  }
+
+  r.eta = scene->mediaEta ;
+  r.power = 1 ;
+  r.bounceNum = 0 ;
+  return r ;
+}
+
+// One ray in flight in wavefront mode.  Instead of cast() multiplying
+// the color a child brings back by its parent's power (and the cos
+// factor etc) on the way back up the recursion, the child carries that
+// product along as weight and adds weight*(what it sees) straight into its pixel.
+struct WaveRay
+{
+  Ray ray ;
+  Vector weight ;
+  int pixel ; // index into the tile's colors
+  Sampler::State sample ; // its own sampler state (see Sampler::child)
+  int children ; // rays queued off it so far, numbers its children's states
+  Intersection *intn ;
+} ;
+
+// spreads the low 9 bits of v out to every 3rd bit, for interleaving
+static inline unsigned int spreadBits3( unsigned int v )
+{
+  unsigned int r = 0 ;
+  for( int i = 0 ; i < 9 ; i++ )
+    r |= ( (v >> i) & 1 ) << (3*i) ;
+  return r ;
+}
+
+unsigned int RaytracingCore::waveKey( const Ray& ray ) const
+{
+  // 512^3 cells over the scene bounds.  The eye and anything else
+  // outside gets clamped into the border cells.
+  unsigned int cell[3] ;
+  for( int i = 0 ; i < 3 ; i++ )
+  {
+    real t = sceneExtent.e[i] > 0 ? ( ray.startPos.e[i] - sceneMin.e[i] ) / sceneExtent.e[i] : 0 ;
+    cell[i] = (unsigned int)clampedCopy<real>( t*512, 0, 511 ) ;
+  }
+
+  unsigned int octant = ( ray.direction.x < 0 ) | ( ray.direction.y < 0 ) << 1 | ( ray.direction.z < 0 ) << 2 ;
+
+  return octant << 27 | spreadBits3( cell[0] ) | spreadBits3( cell[1] ) << 1 | spreadBits3( cell[2] ) << 2 ;
+}
+
+void RaytracingCore::queueWaveRay( vector<WaveRay>& next, const Ray& ray, const Vector& weight, WaveRay& parent, Sampler& sampler )
+{
+  // numbered even if it's dropped, so a child's state doesn't
+  // depend on whether the siblings before it survived
+  int childIndex = parent.children++ ;
+
+  // same termination test as the top of cast()
+  if( ray.bounceNum > maxBounces || ray.power.len2() < interreflectionThreshold² )
+    return ;
+
+  WaveRay child ;
+  child.ray = ray ;
+  child.weight = weight ;
+  child.pixel = parent.pixel ;
+  child.sample = sampler.child( childIndex ) ;
+  child.children = 0 ;
+  child.intn = 0 ;
+  next.push_back( child ) ;
+}
+
+void RaytracingCore::traceWavefront( int startRow, int endRow, int startCol, int endCol, Scene *scene,
+  Sampler& sampler, int rpp, int sqrtRpp, vector<Vector>& colors )
+{
+  int tileCols = endCol - startCol ;
+  int numPixels = ( endRow - startRow ) * tileCols ;
+  colors.assign( numPixels, Vector( 0,0,0,0 ) ) ;
+
+  vector<WaveRay> wave ;
+  vector< vector<WaveRay> > levels ; // rays waiting to be traced, by generation
+  vector< pair<unsigned int,int> > order ; // ( key, index into wave )
+
+  // The samples go out a few per pixel at a time, so one wave
+  // is about waveSize eye rays no matter how high rpp is.
+  int samplesPerWave = max( 1, waveSize / max( 1, numPixels ) ) ;
+  for( int c0 = 0 ; c0 < rpp ; c0 += samplesPerWave )
+  {
+    int c1 = min( c0 + samplesPerWave, rpp ) ;
+
+    wave.clear() ;
+    for( int row = startRow ; row < endRow ; row++ )
+    {
+      for( int col = startCol ; col < endCol ; col++ )
+      {
+        int pxRpp = samplesToTake( row*cols+col, rpp ) ;
+        for( int c = c0 ; c < c1 && c < pxRpp ; c++ )
+        {
+          WaveRay wr ;
+          wr.ray = getEyeRay( row, col, c, frameBuffer->sampleCounts[ row*cols+col ] + c, sqrtRpp, sampler, scene ) ;
+          wr.weight = 1 ;
+          wr.pixel = ( row - startRow ) * tileCols + ( col - startCol ) ;
+          // the eye ray is the sample's first child too, so shading it
+          // never draws from the job's stream the next eye rays come off
+          wr.sample = sampler.child( 0 ) ;
+          wr.children = 0 ;
+          wr.intn = 0 ;
+          wave.push_back( wr ) ;
+        }
+      }
+    }
+
+    // shading restores each ray's own state, put the job's back after
+    Sampler::State jobState = sampler.save() ;
+
+    // levels[d] holds the rays d generations down from the eye rays.
+    // Every ray can queue raysDistributed more, so shading a whole generation
+    // at once would hold waveSize*raysDistributed^bounces rays by the last bounce.
+    // Instead, take at most waveSize rays at a time off the deepest level
+    // that has any: its children get shaded before we go back up for more of
+    // their parents' generation, so no level ever holds more than one
+    // chunk's children (plus what's left of its own).
+    levels.resize( 1 ) ;
+    levels[0].swap( wave ) ;
+    int depth = 0 ;
+    while( depth >= 0 )
+    {
+      if( levels[ depth ].empty() )
+      {
+        depth-- ;
+        continue ;
+      }
+
+      int chunk = min( (int)levels[ depth ].size(), max( 1, waveSize ) ) ;
+      wave.assign( levels[ depth ].end() - chunk, levels[ depth ].end() ) ;
+      levels[ depth ].resize( levels[ depth ].size() - chunk ) ;
+
+      // bin the rays: sort by direction octant, then by where they start.
+      // Ties keep their wave order, so the result doesn't depend on the sort.
+      order.resize( wave.size() ) ;
+      for( int i = 0 ; i < wave.size() ; i++ )
+        order[i] = make_pair( waveKey( wave[i].ray ), i ) ;
+      sort( order.begin(), order.end() ) ;
+
+      // intersect the whole wave before shading any of it, so rays that
+      // walk the same nodes of the tree go one after the other while
+      // those nodes are still in cache
+      for( int i = 0 ; i < order.size() ; i++ )
+      {
+        WaveRay& wr = wave[ order[i].second ] ;
+        if( !scene->getClosestIntn( wr.ray, &wr.intn ) )
+          wr.intn = 0 ;
+      }
+
+      if( levels.size() < depth+2 )
+        levels.resize( depth+2 ) ;
+      vector<WaveRay>& next = levels[ depth+1 ] ;
+      for( int i = 0 ; i < order.size() ; i++ )
+        shadeWaveRay( wave[ order[i].second ], scene, sampler, colors, next ) ;
+      if( next.size() )
+        depth++ ;
+    }
+
+    sampler.restore( jobState ) ;
+  }
+}
+
+// adds c into acc without touching acc.w (the sample count)
+static inline void addColor( Vector& acc, const Vector& c )
+{
+  acc.x += c.x ;
+  acc.y += c.y ;
+  acc.z += c.z ;
+}
+
+// This is cast() after the getClosestIntn, with every recursive
+// cast() call turned into a queued child ray.
+void RaytracingCore::shadeWaveRay( WaveRay& wr, Scene *scene, Sampler& sampler, vector<Vector>& colors, vector<WaveRay>& next )
+{
+  Ray& ray = wr.ray ;
+  Vector& acc = colors[ wr.pixel ] ;
+  sampler.restore( wr.sample ) ;
+
+  if( !wr.intn )
+  {
+    // a 0-bounce bg hit doesn't count towards the pixel when not showing bg
+    if( !showBg && !ray.bounceNum )  return ;
+    if( !ray.bounceNum )  acc.w++ ;
+    addColor( acc, wr.weight * missColor( ray, scene ) ) ;
+    return ;
+  }
+
+  if( !ray.bounceNum )  acc.w++ ;
+
+  Intersection *intn = wr.intn ;
+
+  // what the color at this surface gets multiplied by on its way to the pixel
+  Vector weight = wr.weight * ray.power ;
+
+  if( !( photonMap && photonMap->covers( ray ) ) && !ray.directCounted )
+    addColor( acc, weight * intn->getColor( ColorIndex::Emissive ) ) ;
+
+  Vector diffuseColorAtIntn = intn->getColor( ColorIndex::DiffuseMaterial ) ;
+  if( diffuseColorAtIntn.nonzero() )
+  {
+    if( traceType == Whitted )
+    {
+      for( int i=0 ; i < scene->lights.size() ; i++ )
+      {
+        Vector lightPos = scene->lights[i]->getCentroid() ;
+        Vector toLight = ( lightPos - intn->point ).normalize() ;
+        real dot = intn->normal % toLight ;
+        if( dot < 0 )  continue ;
+
+        Ray shadowRay( intn->point + EPS_MIN*intn->normal, toLight, 1000, ray.eta, ray.power*diffuseColorAtIntn, ray.bounceNum+1 ) ;
+        shadowRay.isShadowRay = true ;
+        shadowRay.afterDiffuse = true ;
+        queueWaveRay( next, shadowRay, weight*dot, wr, sampler ) ;
+      }
+    }
+    else if( traceType == Distributed && !lightSampler )
+    {
+      for( int i=0 ; i < scene->lights.size() ; i++ )
+      {
+        for( int li = 0 ; li < raysDistributed ; li++ )
+        {
+          Vector lightPos = scene->lights[i]->getRandomPointFacing( intn->normal ) ;
+          Vector toLight = ( lightPos - intn->point ).normalize() ;
+          real dot = intn->normal % toLight ;
+          if( dot < 0 )  continue ;
+
+          Ray shadowRay( intn->point + EPS_MIN*intn->normal, toLight, 1000, ray.eta, ray.power*diffuseColorAtIntn, ray.bounceNum+1 ) ;
+          shadowRay.isShadowRay = true ;
+          shadowRay.afterDiffuse = true ;
+          queueWaveRay( next, shadowRay, weight*( dot/raysDistributed ), wr, sampler ) ;
+        }
+      }
+    }
+
+    // cast() divides the whole diffuse sum by raysDistributed after the
+    // path gather, and that includes the cubemap samples.  An eye ray hit
+    // that reads the irradiance cache skips that gather (and the divide).
+    bool cachedHit = irradianceCache && !ray.bounceNum ;
+    real pathScale = ( traceType == Path && raysDistributed > 1 && !cachedHit ) ? 1.0/raysDistributed : 1 ;
+
+    if( raysCubeMapLighting && cubeMapSampler )
+    {
+      for( int i = 0 ; i < raysCubeMapLighting ; i++ )
+      {
+        real pdf ;
+        real r1 = sampler.next1D(), r2, r3 ;
+        sampler.next2D( r2, r3 ) ;
+        Vector rayCubeDir = cubeMapSampler->sample( r1, r2, r3, pdf ) ;
+
+        real dot = intn->normal % rayCubeDir ;
+        if( dot <= 0 || pdf <= 0 )  continue ;
+
+        Ray cubeRay( intn->point + intn->normal * EPS_MIN, rayCubeDir, 1000, ray.eta, ray.power*diffuseColorAtIntn, ray.bounceNum+1 ) ;
+        cubeRay.afterDiffuse = true ;
+        queueWaveRay( next, cubeRay, weight*( pathScale * dot / ( pdf * PI * raysCubeMapLighting ) ), wr, sampler ) ;
+      }
+    }
+
+    if( traceType == Path )
+    {
+      if( cachedHit )
+      {
+        // a new record's gather rays go depth first through cast()
+        addColor( acc, weight * diffuseColorAtIntn * cachedIrradiance( intn, ray, scene, sampler ) ) ;
+      }
+      else if( raysDistributed == 1 )
+      {
+        Vector& dir = rc->vAboutAddr( intn->normal, sampler ) ;
+        real dot = dir % intn->normal ;
+
+        Ray pathRay( intn->point + EPS_MIN*intn->normal, dir, 1000.0, ray.eta, ray.power*diffuseColorAtIntn, ray.bounceNum+1 ) ;
+        pathRay.afterDiffuse = true ;
+        pathRay.directCounted = misDiffuse( ray ) ;
+        queueWaveRay( next, pathRay, weight*dot, wr, sampler ) ;
+      }
+      else
+      {
+        int startSamp = rc->randomIndex( sampler ) ;
+        for( int i = 0 ; i < raysDistributed ; i++ )
+        {
+          Vector& dir = rc->vAddr( startSamp+i ) ;
+          real dot = intn->normal % dir ;
+          if( dot < 0 )
+          {
+            i-- ; // didn't count, see cast()
+            startSamp = (startSamp+1) % rc->n ;
+            continue ;
+          }
+
+          Ray distRay( intn->point + EPS_MIN*intn->normal, dir, 1000.0, ray.eta, ray.power*diffuseColorAtIntn, ray.bounceNum+1 ) ;
+          distRay.afterDiffuse = true ;
+          distRay.directCounted = misDiffuse( ray ) ;
+          queueWaveRay( next, distRay, weight*( dot*pathScale ), wr, sampler ) ;
+        }
+      }
+    }
+
+    if( photonMap )
+      addColor( acc, weight * diffuseColorAtIntn * photonMap->irradiance( intn->point, intn->normal ) / ( 2*PI ) ) ;
+  }
+
+  Vector specularColorAtIntn = intn->getColor( ColorIndex::SpecularMaterial ) ;
+  bool diffuseMIS = diffuseColorAtIntn.nonzero() && misDiffuse( ray ) ;
+  bool glossyMIS = specularColorAtIntn.nonzero() && misGlossy( intn, ray ) ;
+  if( diffuseMIS || glossyMIS )
+    addColor( acc, weight * misDirect( intn, ray, diffuseMIS ? diffuseColorAtIntn : Vector(0,0,0,0),
+      glossyMIS ? specularColorAtIntn : Vector(0,0,0,0), raysDistributed, scene, sampler ) ) ;
+
+  if( specularColorAtIntn.nonzero() && !ray.isShadowRay )
+  {
+    Ray reflRay = ray.reflect( intn->normal, intn->point, specularColorAtIntn ) ;
+    reflRay.directCounted = glossyMIS ;
+    if( traceType!=Whitted && intn->shape->material.specularJitter )
+      reflRay.direction.jitter( intn->shape->material.specularJitter ) ;
+    queueWaveRay( next, reflRay, weight, wr, sampler ) ;
+  }
+
+  Vector txColorAtIntn = intn->getColor( ColorIndex::Transmissive ) ;
+  Vector toEta ;
+  if( ray.direction.obtuse( intn->normal ) ) // enter new media
+    toEta = intn->shape->material.eta ;
+  else // exit the surface, enter free space
+    toEta = scene->mediaEta ;
+
+  if( toEta.allEqual() )
+  {
+    if( txColorAtIntn.notAll( 0 ) )
+    {
+      Ray refractedRay = ray.refract( intn->normal, toEta.x, intn->point, ray.power*txColorAtIntn ) ;
+      if( traceType!=Whitted && intn->shape->material.transmissiveJitter )
+        refractedRay.direction.jitter( intn->shape->material.transmissiveJitter ) ;
+      queueWaveRay( next, refractedRay, weight, wr, sampler ) ;
+    }
+  }
+  else for( int i = 0 ; i < 3 ; i++ ) // SPLIT 3
+  {
+    if( txColorAtIntn.e[i] > 0 )
+    {
+      Vector txP ;
+      txP.e[i] = txColorAtIntn.e[i] ;
+      Ray refractedRay = ray.refract( intn->normal, i, toEta.e[i], intn->point, ray.power*txP ) ;
+      if( traceType!=Whitted && intn->shape->material.transmissiveJitter )
+        refractedRay.direction.jitter( intn->shape->material.transmissiveJitter ) ;
+      queueWaveRay( next, refractedRay, weight, wr, sampler ) ;
+    }
+  }
+
+  DESTROY( wr.intn ) ;
+}
+
 // traces a rectangle of pixels
 void RaytracingCore::traceRectangle( int startRow, int endRow, int startCol, int endCol, Scene * scene )
 {
+  // out of time: leave these pixels with what earlier passes gave them
+  if( budgetSeconds && passNumber && budgetTimer.getTime() >= budgetSeconds )
+  {
+    doneSingleJob() ;
+    return ;
+  }
+
+  // real time frames only take a few new rays, the reprojected history does the rest
+  int rpp = temporalFrame ? temporal->raysPerPixel : raysPerPixel ;
+  int sqrtRpp = temporalFrame ? (int)sqrt( (float)rpp ) : sqrtRaysPerPixel ;
+  if( budgetSeconds )
+  {
+    rpp = passRpp ;
+    sqrtRpp = (int)sqrt( (float)rpp ) ;
+  }
+
+  // this job's own stream: the first pixel's index is unique per job, and
+  // a time budgeted trace's later passes get streams of their own.
+  // The seed (which the low discrepancy scrambles come from) stays the same
+  // all frame, so pass k's samples carry on the sequence where pass k-1 left off
+  // (the sample numbers count on from sampleCounts) instead of starting a freshly
+  // scrambled one.  Deterministic renders always use the same seed, so frame N
+  // matches any other run's frame N.
+  unsigned long long stream = ( (unsigned long long)passNumber << 40 ) + startRow*cols + startCol ;
+  Sampler* sampler = Sampler::create( samplerType, Sampler::deterministic ? 0 : traceNumber, stream ) ;
+  sampler->setSamplesPerPixel( rpp ) ;
+  sampler->bindToThread() ; // light sampling & jitter inside cast() use randFloat()
+
+  // wavefront mode traces all the tile's samples up front, a bounce at a time
+  vector<Vector> waveColors ;
+  if( waveSize )
+    traceWavefront( startRow, endRow, startCol, endCol, scene, *sampler, rpp, sqrtRpp, waveColors ) ;
+
+  // this strip's new running sums, folded into the frameBuffer all at once
+  // at the end so a checkpoint never sees a pixel's sum without its count
+  int stripCols = endCol - startCol ;
+  vector<Vector> stripSums( (endRow-startRow)*stripCols ) ;
+  vector<int> stripCounts( (endRow-startRow)*stripCols ) ;
+
   // for each pixel, fill the frame buffer
   for( int row = startRow ; row < endRow ; row++ )
   {
@@ -601,6 +1352,7 @@ void RaytracingCore::traceRectangle( int startRow, int endRow, int startCol, int
     {
       Vector pxColor(0) ;
       int idx = row*cols+col ;
+      int pxRpp = samplesToTake( idx, rpp ) ;
 
       #if 0
       // RTSH
@@ -615,82 +1367,126 @@ void RaytracingCore::traceRectangle( int startRow, int endRow, int startCol, int
       pxColor = castRTSH( ra, scene ) ;
       #else
 
-      // try an adaptive method
-      // first do RPP, then do more until you converge on a color.
-      if( stratified )
+      if( waveSize )
+        pxColor = waveColors[ (row-startRow)*(endCol-startCol) + (col-startCol) ] ;
+      else
       {
-        // stratified sampling: jitter the rays evenly
-        int nbins = sqrtRaysPerPixel * sqrtRaysPerPixel ;
-
-        for( int c = 0 ; c < raysPerPixel ; c++ )
+        // try an adaptive method
+        // first do RPP, then do more until you converge on a color.
+        for( int c = 0 ; c < pxRpp ; c++ )
         {
-          // subrow and subcol are the mini bins within the pixel
-          int subrow,subcol ;
-          
-          if( c < nbins )
-          {
-            // cast nbins rays at least 1 per bin
-            subrow = c / sqrtRaysPerPixel ;
-            subcol = c % sqrtRaysPerPixel ;
-          }
-          else // for nbins to rpp
-          {
-            // cast the rest in random bins
-            subrow = rand() % sqrtRaysPerPixel ;
-            subcol = rand() % sqrtRaysPerPixel ;
-          }
-
-          Ray r = viewingPlane->getRay( row, col,
-            randFloat( -1 + subrow*(2./sqrtRaysPerPixel), -1 + (subrow+1)*(2./sqrtRaysPerPixel) ),
-            randFloat( -1 + subcol*(2./sqrtRaysPerPixel), -1 + (subcol+1)*(2./sqrtRaysPerPixel) )
-          ) ;
-
-          ///window->addDebugRayLock( r, Vector(1,0,0), Vector(1,1,1) ) ;
-          r.eta = scene->mediaEta ;
-          r.power = 1 ;
-          r.bounceNum = 0 ;
-
           // RETURN COLORS FROM CAST AND THEN STORE THEM (OR NOT)
           // cast a full-juice ray on it's 0th bounce
-          pxColor.AddMe4( cast( r, scene ) ) ;
+          Ray r = getEyeRay( row, col, c, frameBuffer->sampleCounts[ idx ] + c, sqrtRpp, *sampler, scene ) ;
+          ///window->addDebugRayLock( r, Vector(1,0,0), Vector(1,1,1) ) ;
+          pxColor.AddMe4( cast( r, scene, *sampler ) ) ;
           //pxColor += cast( r, scene ) ;
           ////pxColor += brdfCast( r, scene ) ;
         }
       }
-      else
+      #endif
+
+      // add to what the pixel had (nothing unless resuming) and average over all of it
+      int s = (row-startRow)*stripCols + (col-startCol) ;
+      stripSums[ s ] = frameBuffer->sums[ idx ] ;
+      stripSums[ s ].AddMe4( pxColor ) ;
+      stripCounts[ s ] = frameBuffer->sampleCounts[ idx ] + pxRpp ;
+
+      //pxColor /= raysPerPixel ; // 
+      pxColor = stripSums[ s ] ;
+      if( stripCounts[ s ] )
+        pxColor.DivMe4( stripCounts[ s ] ) ;
+
+      // first hit through the pixel center, for the denoiser's edge stopping
+      // and temporal reprojection.  one extra ray per pixel, vs rpp*bounces for the color.
+      if( denoiser || temporalFrame )
       {
-        // NOT stratified
-        // jitters randomly
-        for( int ray = 0 ; ray < raysPerPixel ; ray++ )
+        Ray centerRay = viewingPlane->getRay( row, col, 0, 0 ) ;
+        Intersection *intn ;
+        if( scene->getClosestIntn( centerRay, &intn ) )
         {
-          // cast a full-juice ray on it's 0th bounce
-          Ray r = viewingPlane->getRay( row, col, randFloat( -.5, .5 ), randFloat( -.5, .5 ) ) ;
-          ///////window->addDebugRayLock( r, Vector(1,0,0), Vector(1,1,1) ) ;
-          r.eta = scene->mediaEta ;
-          r.power = 1 ;
-          r.bounceNum = 0 ;
-          //pxColor += cast( r, scene ) ;
-          pxColor.AddMe4( cast( r, scene ) ) ;
-          ////pxColor += brdfCast( r, scene ) ;
+          frameBuffer->normals[ idx ] = intn->normal ;
+          frameBuffer->depths[ idx ] = distanceBetween( intn->point, centerRay.startPos ) ;
+          DESTROY( intn ) ;
+        }
+        else
+        {
+          frameBuffer->normals[ idx ] = 0 ;
+          frameBuffer->depths[ idx ] = 0 ; // bg
         }
       }
-      #endif
 
-      //pxColor /= raysPerPixel ; // 
-      pxColor.DivMe4( raysPerPixel ) ;
+      if( temporalFrame )
+        pxColor = temporal->resolve( row, col, pxColor, frameBuffer->normals[ idx ], frameBuffer->depths[ idx ], viewingPlane ) ;
+
       frameBuffer->colors[ idx ] = pxColor ;
 
     }//for col
   }//for row
 
+  {
+    MutexLock lock( accumMutex, INFINITE ) ;
+    for( int row = startRow ; row < endRow ; row++ )
+      for( int col = startCol ; col < endCol ; col++ )
+      {
+        int s = (row-startRow)*stripCols + (col-startCol) ;
+        frameBuffer->sums[ row*cols+col ] = stripSums[ s ] ;
+        frameBuffer->sampleCounts[ row*cols+col ] = stripCounts[ s ] ;
+      }
+  }
+
+  Sampler::unbindThread() ;
+  DESTROY( sampler ) ;
   doneSingleJob() ; // call done to increment completed threads count
 }
 
 void RaytracingCore::doneSingleJob()
 {
+  checkpointIfDue() ;
+
   numJobsDone++ ;
   
-  if( numJobs == numJobsDone )
+  // with a denoiser, its last pass calls doneCompletely instead,
+  // and time budgeted passes go through donePass
+  if( numJobs == numJobsDone && !denoising() && !budgetSeconds )
+    doneCompletely() ;
+}
+
+void RaytracingCore::donePass( Scene *scene )
+{
+  real elapsed = budgetTimer.getTime() ;
+  if( elapsed < budgetSeconds )
+  {
+    passNumber++ ; // fresh rng streams.  Same scramble, so the passes stay stratified together
+    topUpTo = 0 ; // a resumed checkpoint's pixels are all caught up after the first pass
+    threadPool.addBatch( makeTraceBatch( scene ) ) ;
+    return ;
+  }
+
+  info( "Time's up, %d passes of %d rpp in %.2f of %.2f seconds", passNumber+1, passRpp, elapsed, budgetSeconds ) ;
+  if( denoising() )
+    denoiser->queuePasses( frameBuffer,
+      new CallbackObject0<RaytracingCore*, void (RaytracingCore::*)()>( this, &RaytracingCore::doneCompletely ) ) ;
+  else
+    doneCompletely() ;
+}
+
+void RaytracingCore::finishGathered()
+{
+  {
+    MutexLock lock( accumMutex, INFINITE ) ;
+    for( int i = 0 ; i < frameBuffer->sums.size() ; i++ )
+    {
+      frameBuffer->colors[ i ] = frameBuffer->sums[ i ] ;
+      if( frameBuffer->sampleCounts[ i ] )
+        frameBuffer->colors[ i ].DivMe4( frameBuffer->sampleCounts[ i ] ) ;
+    }
+  }
+
+  if( denoiser )
+    denoiser->queuePasses( frameBuffer,
+      new CallbackObject0<RaytracingCore*, void (RaytracingCore::*)()>( this, &RaytracingCore::doneCompletely ) ) ;
+  else
     doneCompletely() ;
 }
 
@@ -698,12 +1494,20 @@ void RaytracingCore::doneCompletely()
 {
   // COMPLETELY done here.
   info( Green, "Done RT, %.2f seconds", window->timer.getTime() ) ;
+  if( irradianceCache )
+    info( "Irradiance cache: %d records", irradianceCache->getNumRecords() ) ;
+  if( temporalFrame )
+    temporal->endFrame( viewingPlane ) ;
+  else if( checkpointFile.size() )
+    saveCheckpoint( checkpointFile.c_str() ) ; // so the finished render can be resumed with more samples
   window->programState = ProgramState::Idle ;
+  DESTROY( cubeMapSampler ) ;
+  DESTROY( lightSampler ) ;
   DESTROY( cubeMap ) ; //!!BUG kill this now
 }
 
 // actual raytracing algorithm
-void RaytracingCore::raytrace( const Vector& eye, const Vector& look, const Vector& up, Scene * scene )
+void RaytracingCore::raytrace( const Vector& eye, const Vector& look, const Vector& up, Scene * scene, real seconds )
 {
   clear( Vector( .5,.5,.5,.25 ) ) ;
 
@@ -716,6 +1520,53 @@ void RaytracingCore::raytrace( const Vector& eye, const Vector& look, const Vect
     raysDistributed,
     maxBounces, interreflectionThreshold² ) ;
 
+  if( !sameFrame )
+    traceNumber++ ; // new streams for every frame
+
+  // decided once per frame, so toggling realTimeMode mid trace can't mix rpp's
+  temporalFrame = realTimeMode && temporal ;
+  if( temporalFrame )
+    info( "Real time frame, %d new rpp", temporal->raysPerPixel ) ;
+
+  // real time frames have their own budget (a few rpp)
+  budgetSeconds = temporalFrame ? 0 : seconds ;
+  passNumber = 0 ;
+  if( budgetSeconds )
+    info( "Time budget %.2f seconds, passes of %d rpp", budgetSeconds, passRpp ) ;
+
+  // start the sums over, unless this trace continues a loaded checkpoint
+  topUpTo = 0 ;
+  if( resumeNext && !temporalFrame )
+  {
+    int fewest = frameBuffer->sampleCounts[0], most = fewest ;
+    for( int i = 1 ; i < frameBuffer->sampleCounts.size() ; i++ )
+    {
+      fewest = min( fewest, frameBuffer->sampleCounts[i] ) ;
+      most = max( most, frameBuffer->sampleCounts[i] ) ;
+    }
+
+    if( fewest < most )
+    {
+      // it got cut off partway.  finish the pixels it didn't get to.
+      topUpTo = most ;
+      info( "Resuming, topping pixels up to %d samples", topUpTo ) ;
+    }
+    else
+      info( "Resuming, adding %d rpp to the checkpoint's %d", raysPerPixel, most ) ;
+  }
+  else
+  {
+    if( resumeNext )
+      warning( "Real time frame, not resuming the checkpoint" ) ;
+    MutexLock lock( accumMutex, INFINITE ) ;
+    for( int i = 0 ; i < frameBuffer->sums.size() ; i++ )
+    {
+      frameBuffer->sums[i] = Vector( 0,0,0,0 ) ;
+      frameBuffer->sampleCounts[i] = 0 ;
+    }
+  }
+  resumeNext = false ;
+  checkpointTimer.reset() ;
   viewingPlane->persp( RADIANS(45), (real)cols / rows, 1, 1000 ) ;
   viewingPlane->orient( eye, look, up ) ;
 
@@ -780,6 +1631,15 @@ void RaytracingCore::raytrace( const Vector& eye, const Vector& look, const Vect
       // rotate it according to window
       cubeMap->rotate( window->rotationMatrix ) ;
       cubeMap->setSource( cubeMap->rotatedColorValues ) ; // use the rotated color values
+
+      // build the importance sampling table from the ROTATED values, since that's what gets sampled
+      if( raysCubeMapLighting )
+      {
+        DESTROY( cubeMapSampler ) ;
+        cubeMapSampler = new CubeMapSampler( cubeMap ) ;
+        if( !cubeMapSampler->isValid() )
+          DESTROY( cubeMapSampler ) ;
+      }
     }
   }
   
@@ -798,14 +1658,72 @@ void RaytracingCore::raytrace( const Vector& eye, const Vector& look, const Vect
 
   }
 
+  // the light points misDirect() samples, for this trace's light positions
+  DESTROY( lightSampler ) ;
+  if( misHeuristic != MISOff && traceType != Whitted )
+  {
+    lightSampler = new AreaLightSampler( scene ) ;
+    if( !lightSampler->isValid() )
+      DESTROY( lightSampler ) ;
+    else
+      info( "MIS: %s heuristic, %d light triangles", MISHeuristicName[misHeuristic], (int)lightSampler->tris.size() ) ;
+  }
+
+  if( waveSize || irradianceCache )
+  {
+    AABB bounds( scene ) ;
+    sceneMin = bounds.min ;
+    sceneExtent = bounds.max - bounds.min ;
+
+    // records are only good for this scene & lighting
+    if( irradianceCache && !sameFrame )
+      irradianceCache->reset( bounds.min, bounds.max ) ;
+  }
+
   window->timer.reset() ;
+  budgetTimer.reset() ;
+
+  // rebake the perlin sky if the noise or colors changed.
+  // Its batch finishes before the raytracing batch starts.
+  if( bakedSky && scene->perlinSkyOn && !cubeMap &&
+      bakedSky->isStale( scene->perlin, PerlinGenerator::SKY_BLUE, PerlinGenerator::CLOUD_WHITE ) )
+    bakedSky->queueBake( scene->perlin, PerlinGenerator::SKY_BLUE, PerlinGenerator::CLOUD_WHITE ) ;
+
+  // shoot the caustic photons & build their kd-tree, also ahead of the trace.
+  // Real time frames keep the last map, and so do later bands of a frame.
+  // Bands always shoot the same photons, so every farm worker has the same map.
+  if( photonMap && !temporalFrame && !sameFrame )
+    photonMap->queueBuild( scene, Sampler::deterministic || traceRowEnd > 0 ? 0 : traceNumber ) ;
+
+  threadPool.addBatch( makeTraceBatch( scene ) ) ;
+
+  // batches run in order, so the denoise passes start when every strip is traced.
+  // (time budgeted traces queue them from donePass after the last pass)
+  if( denoising() && !budgetSeconds )
+    denoiser->queuePasses( frameBuffer,
+      new CallbackObject0<RaytracingCore*, void (RaytracingCore::*)()>( this, &RaytracingCore::doneCompletely ) ) ;
+  
+}
+
+ParallelBatch* RaytracingCore::makeTraceBatch( Scene *scene )
+{
+  int firstRow = 0, lastRow = rows ;
+  if( traceRowEnd > 0 )
+  {
+    firstRow = traceRowStart ;
+    lastRow = min( traceRowEnd, rows ) ;
+  }
 
-  for( int row = 0 ; row < rows ; row+=2 )
+  numJobs=numJobsDone=0;
+  for( int row = firstRow ; row < lastRow ; row+=2 )
     numJobs++ ;
 
   ParallelBatch *rtBatch = new ParallelBatch( "raytracing", NULL ) ;
+  if( budgetSeconds )
+    rtBatch->doneJob = new CallbackObject1<RaytracingCore*, void (RaytracingCore::*)( Scene * ), Scene*>(
+      this, &RaytracingCore::donePass, scene ) ;
   
-  for( int row = 0 ; row < rows ; row+=2 )
+  for( int row = firstRow ; row < lastRow ; row+=2 )
   {
     //for( int col = 0 ; col < cols ; col++ )
     {
@@ -813,7 +1731,7 @@ void RaytracingCore::raytrace( const Vector& eye, const Vector& look, const Vect
       Callback *cb = new CallbackObject5<RaytracingCore*, void (RaytracingCore::*)( int, int, int, int, Scene * ), // This is readable, right?
         int,int,int,int,Scene*>( this, &RaytracingCore::traceRectangle,
         
-        row, row+2,  // 2 rows
+        row, min( row+2, lastRow ),  // 2 rows
         
         0, cols,     // all cols
         
@@ -823,9 +1741,8 @@ void RaytracingCore::raytrace( const Vector& eye, const Vector& look, const Vect
       // threadPool.createJob( "rt tile", cb ) ; // don't add immediately
     }
   }
-  
-  threadPool.addBatch( rtBatch ) ;
-  
+
+  return rtBatch ;
 }
 
 void RaytracingCore::copyToSurface( D3D11Surface * surf )
@@ -860,3 +1777,182 @@ void RaytracingCore::copyToSurface( D3D11Surface * surf )
   surf->close() ;
 }
 
+bool RaytracingCore::savePFM( const char* filename )
+{
+  FILE *f = fopen( filename, "wb" ) ;
+  if( !f )
+  {
+    error( "RTCORE couldn't open %s for writing", filename ) ;
+    return false ;
+  }
+
+  // negative scale means little endian.
+  fprintf( f, "PF\n%d %d\n-1.0\n", cols, rows ) ;
+
+  // PFM scanlines go bottom to top
+  vector<float> scanline( 3*cols ) ;
+  for( int row = rows-1 ; row >= 0 ; row-- )
+  {
+    for( int col = 0 ; col < cols ; col++ )
+    {
+      const Vector& c = frameBuffer->colors[ row*cols + col ] ;
+      scanline[ 3*col ]   = (float)c.x ;
+      scanline[ 3*col+1 ] = (float)c.y ;
+      scanline[ 3*col+2 ] = (float)c.z ;
+    }
+    fwrite( &scanline[0], sizeof(float), scanline.size(), f ) ;
+  }
+
+  fclose( f ) ;
+  info( "Wrote %s", filename ) ;
+  return true ;
+}
+
+bool RaytracingCore::savePPM( const char* filename )
+{
+  FILE *f = fopen( filename, "wb" ) ;
+  if( !f )
+  {
+    error( "RTCORE couldn't open %s for writing", filename ) ;
+    return false ;
+  }
+
+  fprintf( f, "P6\n%d %d\n255\n", cols, rows ) ;
+
+  vector<unsigned char> scanline( 3*cols ) ;
+  for( int row = 0 ; row < rows ; row++ )
+  {
+    for( int col = 0 ; col < cols ; col++ )
+    {
+      Vector c = frameBuffer->colors[ row*cols + col ] ;
+      c.clamp( 0, 1 ) ;
+      scanline[ 3*col ]   = (unsigned char)( c.x*255 + .5 ) ;
+      scanline[ 3*col+1 ] = (unsigned char)( c.y*255 + .5 ) ;
+      scanline[ 3*col+2 ] = (unsigned char)( c.z*255 + .5 ) ;
+    }
+    fwrite( &scanline[0], 1, scanline.size(), f ) ;
+  }
+
+  fclose( f ) ;
+  info( "Wrote %s", filename ) ;
+  return true ;
+}
+
+void RaytracingCore::checkpointIfDue()
+{
+  if( checkpointFile.empty() || checkpointSeconds <= 0 || temporalFrame )  return ;
+
+  // checked under the lock so only one of the jobs finishing together writes it
+  MutexLock lock( accumMutex, INFINITE ) ;
+  if( checkpointTimer.getTime() < checkpointSeconds )  return ;
+  saveCheckpoint( checkpointFile.c_str() ) ;
+  checkpointTimer.reset() ;
+}
+
+bool RaytracingCore::saveCheckpoint( const char* filename )
+{
+  string tmpName = string( filename ) + ".tmp" ;
+  FILE *f = fopen( tmpName.c_str(), "wb" ) ;
+  if( !f )
+  {
+    error( "RTCORE couldn't open %s for writing", tmpName.c_str() ) ;
+    return false ;
+  }
+
+  // the jobs write these strip at a time under the same lock
+  MutexLock lock( accumMutex, INFINITE ) ;
+
+  int n = rows*cols ;
+  vector<float> sums( 4*n ) ;
+  long long totalSamples = 0 ;
+  for( int i = 0 ; i < n ; i++ )
+  {
+    const Vector& c = frameBuffer->sums[ i ] ;
+    sums[ 4*i ]   = (float)c.x ;
+    sums[ 4*i+1 ] = (float)c.y ;
+    sums[ 4*i+2 ] = (float)c.z ;
+    sums[ 4*i+3 ] = (float)c.w ;
+    totalSamples += frameBuffer->sampleCounts[ i ] ;
+  }
+
+  fwrite( "GTPCKPT1", 1, 8, f ) ;
+  fwrite( &rows, sizeof(int), 1, f ) ;
+  fwrite( &cols, sizeof(int), 1, f ) ;
+  fwrite( &traceNumber, sizeof(unsigned int), 1, f ) ;
+  fwrite( &sums[0], sizeof(float), sums.size(), f ) ;
+  fwrite( &frameBuffer->sampleCounts[0], sizeof(int), n, f ) ;
+  bool ok = !ferror( f ) ;
+  fclose( f ) ;
+
+  if( !ok || !MoveFileExA( tmpName.c_str(), filename, MOVEFILE_REPLACE_EXISTING ) )
+  {
+    error( "RTCORE couldn't write checkpoint %s", filename ) ;
+    return false ;
+  }
+
+  info( "Checkpointed %s, %.1f samples per pixel", filename, (double)totalSamples/n ) ;
+  return true ;
+}
+
+bool RaytracingCore::loadCheckpoint( const char* filename )
+{
+  FILE *f = fopen( filename, "rb" ) ;
+  if( !f )
+  {
+    error( "RTCORE couldn't open checkpoint %s", filename ) ;
+    return false ;
+  }
+
+  char magic[8] ;
+  int fRows, fCols ;
+  unsigned int fTraceNumber ;
+  if( fread( magic, 1, 8, f ) != 8 || memcmp( magic, "GTPCKPT1", 8 ) ||
+      fread( &fRows, sizeof(int), 1, f ) != 1 ||
+      fread( &fCols, sizeof(int), 1, f ) != 1 ||
+      fread( &fTraceNumber, sizeof(unsigned int), 1, f ) != 1 )
+  {
+    error( "RTCORE %s isn't a checkpoint", filename ) ;
+    fclose( f ) ;
+    return false ;
+  }
+  if( fRows != rows || fCols != cols )
+  {
+    error( "RTCORE checkpoint %s is %d x %d, but the raytracer is %d x %d", filename, fCols, fRows, cols, rows ) ;
+    fclose( f ) ;
+    return false ;
+  }
+
+  int n = rows*cols ;
+  vector<float> sums( 4*n ) ;
+  vector<int> counts( n ) ;
+  bool ok = fread( &sums[0], sizeof(float), sums.size(), f ) == sums.size() &&
+            fread( &counts[0], sizeof(int), n, f ) == n ;
+  fclose( f ) ;
+  if( !ok )
+  {
+    error( "RTCORE checkpoint %s is truncated", filename ) ;
+    return false ;
+  }
+
+  MutexLock lock( accumMutex, INFINITE ) ;
+  long long totalSamples = 0 ;
+  for( int i = 0 ; i < n ; i++ )
+  {
+    frameBuffer->sums[ i ] = Vector( sums[ 4*i ], sums[ 4*i+1 ], sums[ 4*i+2 ], sums[ 4*i+3 ] ) ;
+    frameBuffer->sampleCounts[ i ] = counts[ i ] ;
+    totalSamples += counts[ i ] ;
+
+    // show it
+    if( counts[ i ] )
+    {
+      frameBuffer->colors[ i ] = frameBuffer->sums[ i ] ;
+      frameBuffer->colors[ i ].DivMe4( counts[ i ] ) ;
+    }
+  }
+
+  // the next trace draws from streams after the ones that made this
+  traceNumber = fTraceNumber ;
+  resumeNext = true ;
+  info( "Loaded checkpoint %s, %.1f samples per pixel", filename, (double)totalSamples/n ) ;
+  return true ;
+}
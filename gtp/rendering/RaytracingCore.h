@@ -7,10 +7,20 @@
 #include "../geometry/Ray.h"
 #include "../window/ISurface.h"
 #include "../util/StopWatch.h"
+#include "../util/Sampler.h"
 
 class Scene ;
 struct D3D11Surface ;
 struct RayCollection ;
+struct CubeMapSampler ;
+struct ATrousDenoiser ;
+struct TemporalReprojector ;
+struct BakedSky ;
+struct IrradianceCache ;
+struct PhotonMap ;
+struct AreaLightSampler ;
+struct WaveRay ;
+class ParallelBatch ;
 
 // The raytracer should accept:
 //   1)  a scene to trace
@@ -222,6 +232,17 @@ struct FrameBuffer
   // write colors directly in here
   vector< Vector > colors ; // intermediate colorbuffer, for storing averaged fragment colors (or depths as colors or whatever you want to viz.)
 
+  // AOVs: normal and eye distance of the first hit through each pixel's center.
+  // depth 0 means the pixel sees background.  The denoiser uses these as edge guides.
+  vector< Vector > normals ;
+  vector< real > depths ;
+
+  // Every sample each pixel has taken so far, summed (w counts the ones that
+  // weren't skipped bg), and how many that was.  colors = sums/sampleCounts.
+  // Kept across traces only when resuming from a checkpoint.
+  vector< Vector > sums ;
+  vector< int > sampleCounts ;
+
   static int fogMode ;
   static Vector fogColor ;
   static real fogFurthestDistance ; // REALLY_FAR.
@@ -235,6 +256,10 @@ struct FrameBuffer
     cols = iCols ;
     fragmentGroups.resize( rows*cols ) ;
     colors.resize( rows*cols ) ;
+    normals.resize( rows*cols ) ;
+    depths.resize( rows*cols ) ;
+    sums.resize( rows*cols ) ;
+    sampleCounts.resize( rows*cols ) ;
 
     // setup fog defaults
     fogMode = FogLinear ;
@@ -376,6 +401,13 @@ enum TraceType{
 
 extern const char* TraceTypeName[] ;
 
+// how the light and BRDF samples of misDirect() are weighted
+enum MISHeuristic{
+  MISOff, MISBalance, MISPower
+} ;
+
+extern const char* MISHeuristicName[] ;
+
 class RaytracingCore
 {
   /// The number of bounces to use
@@ -398,6 +430,13 @@ private:
   // and use it throughout the trace.
   CubeMap* cubeMap ;
 
+  // Built from cubeMap when the trace starts, so cubemap lighting
+  // can importance sample bright texels instead of striding the grid.
+  CubeMapSampler* cubeMapSampler ;
+
+  // Built from scene->lights when the trace starts if misHeuristic is on.
+  AreaLightSampler* lightSampler ;
+
   // A cached set of the view rays used to create
   // the scene, these only have to be reconstructed
   // if the viewing angle changes OR if you really want
@@ -417,15 +456,98 @@ private:
   TraceType traceType ;
   int raysDistributed ;
   
-  int raysCubeMapLighting ;
+  int raysCubeMapLighting ; // # importance sampled cubemap directions per diffuse hit
+
+  bool temporalFrame ; // this trace is a real time frame being reprojected (set in raytrace())
+
+  // Each traceRectangle job makes its own sampler of this type,
+  // on its own stream, so jobs don't fight over the global MT state.
+  SamplerType samplerType ;
+  unsigned int traceNumber ; // bumped every raytrace(), seeds the streams so frames differ
   //StopWatch stopWatch ;
   
   int numJobs ;
   int numJobsDone ;
 
+  // guards frameBuffer->sums/sampleCounts between the jobs folding
+  // their finished strips in and the checkpoint writer reading them
+  HANDLE accumMutex ;
+  Timer checkpointTimer ;
+  bool resumeNext ; // loadCheckpoint was called: next raytrace() adds to the sums instead of zeroing them
+  int topUpTo ; // resuming a render that got cut off: pixels only trace up to this many samples. 0 = rpp more each
+
+  // Time budgeted traces (raytrace() given seconds > 0) go over the whole
+  // image in passes of passRpp samples per pixel until the time is up.
+  real budgetSeconds ; // 0 for a normal trace of raysPerPixel
+  Timer budgetTimer ;
+  int passNumber ;
+
+  // how many new samples pixel idx takes this trace
+  inline int samplesToTake( int idx, int rpp ) const {
+    return topUpTo ? max( 0, topUpTo - frameBuffer->sampleCounts[ idx ] ) : rpp ;
+  }
+
+  // scene bounds, for binning wavefront rays by where they start (set in raytrace())
+  Vector sceneMin, sceneExtent ;
+
 public:
   bool showBg ; // toggles whether the bg renders
 
+  // runs over the finished frame when not NULL ("ray::denoise passes" > 0).
+  // traceRectangle only fills the normal/depth AOVs when there's one.
+  ATrousDenoiser *denoiser ;
+
+  // In realTimeMode, each frame traces temporal->raysPerPixel new rays
+  // and blends them with the previous frame reprojected to the new camera.
+  TemporalReprojector *temporal ;
+
+  // the perlin sky as a lookup table ("ray::sky bake size" > 0),
+  // else rays that miss evaluate the noise directly.
+  BakedSky *bakedSky ;
+
+  // "ray::wavefront": when nonzero, traceRectangle traces its tile a bounce
+  // at a time in waves of about this many eye rays, each wave sorted by
+  // origin cell and direction octant before it's intersected.  0 = depth first cast().
+  int waveSize ;
+
+  // Checkpointing for long offline renders.  When checkpointFile is set,
+  // the accumulated sums and per pixel sample counts get written there
+  // every checkpointSeconds (and when the trace finishes), so a killed
+  // render can pick up where it left off with loadCheckpoint.
+  string checkpointFile ;
+  real checkpointSeconds ;
+
+  // samples per pixel per progressive pass in a time budgeted trace ("ray::progressive pass rpp")
+  int passRpp ;
+
+  // Rows [traceRowStart,traceRowEnd) are all a trace covers when traceRowEnd > 0.
+  // A render farm worker traces just the band of rows it was handed, and
+  // a band is never denoised on its own (the coordinator does the whole image).
+  int traceRowStart, traceRowEnd ;
+
+  // Set for a farm worker's second and later bands of one frame.  raytrace()
+  // then keeps the streams, photon map and irradiance cache the frame's first band set up,
+  // instead of re-shooting the photons and throwing the cache away every band.
+  bool sameFrame ;
+
+  // Path tracing only ("ray::irradiance cache" > 0).  Eye ray hits take their
+  // diffuse gather from cached records instead of raysDistributed fresh rays,
+  // and only gather a new record (irradianceRays stratified rays) where none are valid.
+  IrradianceCache *irradianceCache ;
+  int irradianceRays ;
+
+  // "ray::caustic photons" > 0:  rebuilt at the start of every (non real time)
+  // trace, or frame of bands (see sameFrame).  Every diffuse hit adds the caustic light from the photons around it,
+  // and a ray that reaches a light along a path the photons
+  // cover (photonMap->covers) adds nothing (it'd count twice).
+  PhotonMap *photonMap ;
+
+  // "ray::mis" balance or power:  Distributed and Path traces take the direct
+  // light at every diffuse or glossy hit from misDirect() instead of the
+  // light-only (Distributed) or BRDF-only (Path) rays, and the rays that
+  // carry on from that hit don't count the emitters they reach again.
+  MISHeuristic misHeuristic ;
+
   ViewingPlane *viewingPlane ;
   //vector<Vector> pixels ; //switch to floating point colors until buffer flip
   FrameBuffer *frameBuffer ;
@@ -435,6 +557,7 @@ public:
   inline int getWidth() {return cols;}  
   inline int getHeight() {return rows;}  
   inline int getNumPixels() {return rows*cols;}
+  inline int getRaysPerPixel() {return raysPerPixel;}
   
   RaytracingCore( int iNumRows, int iNumCols,
     int iRaysPerPixel,
@@ -443,7 +566,8 @@ public:
     int iRaysDistributed,
     int iRaysCubeMapLighting,
     int iMaxBounces, real iInterreflectionThreshold,
-    bool iShowBg
+    bool iShowBg,
+    string iSamplerType
   ) ;
   ~RaytracingCore() ;
 
@@ -454,6 +578,43 @@ public:
 
   Vector castRTSH( Ray& ray, Scene *scene ) ;
 
+  // color of the perlin sky in direction dir, from bakedSky if there is one
+  Vector perlinSky( const Vector& dir, Scene *scene ) ;
+
+  // what a ray that hits nothing brings back (cubemap, perlin sky or bg color)
+  Vector missColor( const Ray& ray, Scene *scene ) ;
+
+  // the diffuse gather at intn from the irradiance cache, in the
+  // same units as cast()'s path gather (before the diffuse color).
+  // Computes and inserts a new record if none are valid here.
+  Vector cachedIrradiance( Intersection *intn, const Ray& ray, Scene *scene, Sampler& sampler ) ;
+
+  // Direct light at intn: samples light points AND the BRDF lobes,
+  // numSamples of each, and weights every sample by misHeuristic.
+  // kd and ks are the diffuse and glossy lobes to do (pass 0 to skip one),
+  // the result is in cast()'s units, before ray.power.
+  Vector misDirect( Intersection *intn, const Ray& ray, const Vector& kd, const Vector& ks,
+    int numSamples, Scene *scene, Sampler& sampler ) ;
+
+  // weight of a sample drawn by the strategy with n*pdf = a,
+  // when the other strategy would draw it with n*pdf = b
+  inline real misWeight( real a, real b ) const {
+    if( misHeuristic == MISPower ) { a *= a ; b *= b ; }
+    return a/( a + b ) ;
+  }
+
+  // the emission seen along dir from intn, if the first hit is on a light.
+  // lightPdf gets the solid angle pdf lightSampler would pick it with,
+  // hitDist how far along dir the first hit is (HUGE for a miss).
+  Vector emitterAlong( Intersection *intn, const Vector& dir, const Ray& ray, Scene *scene, real& lightPdf, real& hitDist ) ;
+
+  // does misDirect() take the diffuse or glossy direct light at intn?
+  inline bool misDiffuse( const Ray& ray ) const {
+    // the irradiance cache's gather rays already bring the direct light with them
+    return lightSampler && traceType != Whitted && !( traceType == Path && irradianceCache && !ray.bounceNum ) ;
+  }
+  bool misGlossy( Intersection *intn, const Ray& ray ) const ;
+
   // ray is the ray along which you are casting
   // scene is the scene to cast the ray into
   // rgbJuice is the red,green,blue "strength" left in the ray
@@ -462,22 +623,92 @@ public:
   // fragments: every time a fragment is generated it is added to the list
   // for post-processing.
   // Original (if statemented) function.
-  Vector cast( Ray& ray, Scene *scene ) ;
+  // sampler is the calling job's own random/low discrepancy stream
+  Vector cast( Ray& ray, Scene *scene, Sampler& sampler ) ;
 
   // uses russian roulette style sampling
   //Vector castRoulette( Ray& ray, Scene *scene ) ;
 
   // brdf
-  Vector brdfCast( Ray& ray, Scene *scene ) ;
+  Vector brdfCast( Ray& ray, Scene *scene, Sampler& sampler ) ;
+
+  // the c'th jittered eye ray through pixel (row,col) this trace, starts
+  // the pixel's sample sampleNo (its c'th this trace) on the sampler
+  Ray getEyeRay( int row, int col, int c, int sampleNo, int sqrtRpp, Sampler& sampler, Scene *scene ) ;
 
   void traceRectangle( int startRow, int endRow, int startCol, int endCol, Scene *scene ) ;
 
+  // Wavefront version of traceRectangle's pixel loop.  colors gets the
+  // sum of the rpp samples of each pixel in the tile (w = # samples that count),
+  // same as the cast() loop accumulates.
+  void traceWavefront( int startRow, int endRow, int startCol, int endCol, Scene *scene,
+    Sampler& sampler, int rpp, int sqrtRpp, vector<Vector>& colors ) ;
+
+private:
+  // sort key for a wavefront ray: direction octant in the top 3 bits,
+  // then the morton code of the scene grid cell it starts in
+  unsigned int waveKey( const Ray& ray ) const ;
+
+  // shades one intersected wavefront ray, adding what it sees to its pixel
+  // and queueing the rays cast() would have recursed on into next
+  void shadeWaveRay( WaveRay& wr, Scene *scene, Sampler& sampler, vector<Vector>& colors, vector<WaveRay>& next ) ;
+  void queueWaveRay( vector<WaveRay>& next, const Ray& ray, const Vector& weight, WaveRay& parent, Sampler& sampler ) ;
+
+public:
+
   void doneSingleJob() ;
   void doneCompletely() ;
-  void raytrace( const Vector& eye, const Vector& look, const Vector& up, Scene *scene ) ;
+
+  // seconds > 0 makes it a time budgeted trace: instead of raysPerPixel
+  // samples each, it keeps making progressive passes of passRpp over the whole
+  // image until the seconds are up.  The first pass always finishes, after
+  // that strips that start past the deadline are skipped, and every pixel
+  // is averaged over however many samples it actually got.
+  void raytrace( const Vector& eye, const Vector& look, const Vector& up, Scene *scene, real seconds=0 ) ;
+
+private:
+  // the strip jobs for one pass over the image
+  ParallelBatch* makeTraceBatch( Scene *scene ) ;
+
+  // a time budgeted pass finished: go again, or wrap up
+  void donePass( Scene *scene ) ;
+
+  // true if this trace ends with the denoiser passes (not a band)
+  inline bool denoising() const { return denoiser && traceRowEnd <= 0 ; }
+
+public:
+  // The frameBuffer's sums, counts and AOVs got filled in by someone other
+  // than raytrace() (the render farm's workers).  Averages them into colors,
+  // then denoises and finishes just like a trace would.
+  void finishGathered() ;
+
+public:
 
   void copyToSurface( D3D11Surface *surf ) ;
 
+  // writes frameBuffer->colors out.  PFM keeps the linear float colors,
+  // PPM is clamped to [0,1] just like writePixelsToByteArray.
+  bool savePFM( const char* filename ) ;
+  bool savePPM( const char* filename ) ;
+
+  // Binary checkpoint: rows, cols, the trace number (so resumed samples
+  // come off fresh streams), then the float sums and int sample counts.
+  // Written to filename.tmp then renamed over filename, so getting killed
+  // mid-write leaves the last good checkpoint intact.
+  bool saveCheckpoint( const char* filename ) ;
+
+  // Loads the sums and counts back and shows them.  The next raytrace()
+  // then carries on from them instead of starting over: if the checkpointed
+  // render got cut off, the pixels it didn't finish get topped up to the
+  // count the finished ones have, else every pixel gets rpp more samples.
+  bool loadCheckpoint( const char* filename ) ;
+
+private:
+  // writes checkpointFile if one is due.  Called as each strip finishes.
+  void checkpointIfDue() ;
+
+public:
+
   
 } ;
 
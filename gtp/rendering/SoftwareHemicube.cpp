@@ -0,0 +1,186 @@
+#include "SoftwareHemicube.h"
+#include "Hemicube.h"
+#include "../geometry/Triangle.h"
+#include <algorithm>
+
+// Anything closer to the eye than this (along a face's look
+// direction) is clipped.  The d3d hemicube uses HEMI_NEAR=1 to save
+// its depth buffer, the cpu one interpolates 1/depth in doubles.
+#define SOFTHEMI_NEAR 1e-5
+
+SoftwareHemicube::Faces::Faces( int pixelsPerSide )
+{
+  ids[ Hemicube::FRONT ].resize( pixelsPerSide*pixelsPerSide ) ;
+  invDepth[ Hemicube::FRONT ].resize( pixelsPerSide*pixelsPerSide ) ;
+  for( int side = 1 ; side < 5 ; side++ )
+  {
+    ids[ side ].resize( pixelsPerSide*pixelsPerSide/2 ) ;
+    invDepth[ side ].resize( pixelsPerSide*pixelsPerSide/2 ) ;
+  }
+}
+
+SoftwareHemicube::SoftwareHemicube( int iPixelsPerSide )
+{
+  pixelsPerSide = iPixelsPerSide ;
+  Hemicube::computeFormFactorCosines( pixelsPerSide, formFactorCosines ) ;
+}
+
+void SoftwareHemicube::formFactorRow( const vector<Triangle*>& tris, const Triangle& tri, Faces& faces, CSRRowBuilder& ffRow ) const
+{
+  int sender = tri.getId() ;
+  int N = pixelsPerSide ;
+
+  // same frame as Hemicube::renderToSurfaces.  Which way is up
+  // doesn't matter, the cosines are symmetric.
+  Vector forward = tri.normal ;
+  if( forward.len2() == 0 )
+  {
+    error( "normal was 0" ) ;
+    forward = Vector(0,1,0) ;
+  }
+  Vector up = forward.getPerpendicular() ;
+  Vector right = forward << up ;
+  Vector eye = tri.getCentroid() + forward*1e-6 ;
+
+  // each face looks out along look, with the rows going along faceUp
+  // (for the sides that's forward, row 0 is the top, right under the front)
+  Vector look[ 5 ]    = { forward, up, right, -up, -right } ;
+  Vector faceUp[ 5 ]  = { up, forward, forward, forward, forward } ;
+  Vector faceRight[ 5 ] = { right, right, up, right, up } ;
+
+  for( int f = 0 ; f < 5 ; f++ )
+  {
+    fill( faces.ids[f].begin(), faces.ids[f].end(), -1 ) ;
+    fill( faces.invDepth[f].begin(), faces.invDepth[f].end(), 0.0f ) ;
+  }
+
+  for( int t = 0 ; t < tris.size() ; t++ )
+  {
+    const Triangle *other = tris[ t ] ;
+    int id = other->getId() ;
+    if( id == sender )  continue ;
+
+    Vector p[ 3 ] = { other->a - eye, other->b - eye, other->c - eye } ;
+
+    // wholly behind the patch
+    if( p[0] % forward <= 0 && p[1] % forward <= 0 && p[2] % forward <= 0 )
+      continue ;
+
+    for( int f = 0 ; f < 5 ; f++ )
+    {
+      // into the face's frame: x right, y up, z depth
+      Vector q[ 3 ] ;
+      int outL = 0, outR = 0, outB = 0, outT = 0, behind = 0 ;
+      for( int k = 0 ; k < 3 ; k++ )
+      {
+        q[k] = Vector( p[k] % faceRight[f], p[k] % faceUp[f], p[k] % look[f] ) ;
+        if( q[k].z <= SOFTHEMI_NEAR )  behind++ ;
+        if( q[k].x < -q[k].z )  outL++ ;
+        if( q[k].x >  q[k].z )  outR++ ;
+        if( q[k].y >  q[k].z )  outT++ ;
+        if( f == Hemicube::FRONT ? q[k].y < -q[k].z : q[k].y < 0 )  outB++ ;
+      }
+      // all 3 outside the same side of the frustum
+      if( behind == 3 || outL == 3 || outR == 3 || outB == 3 || outT == 3 )
+        continue ;
+
+      // clip against the near plane, leaves at most 4 vertices
+      Vector poly[ 4 ] ;
+      int n = 0 ;
+      for( int k = 0 ; k < 3 ; k++ )
+      {
+        const Vector& cur = q[k] ;
+        const Vector& next = q[ (k+1)%3 ] ;
+        bool curIn = cur.z > SOFTHEMI_NEAR ;
+        bool nextIn = next.z > SOFTHEMI_NEAR ;
+        if( curIn )
+          poly[ n++ ] = cur ;
+        if( curIn != nextIn )
+        {
+          real s = ( SOFTHEMI_NEAR - cur.z ) / ( next.z - cur.z ) ;
+          poly[ n++ ] = cur + ( next - cur )*s ;
+        }
+      }
+
+      // project.  front: u,v in [-1,1] over N px.
+      // sides: u in [-1,1] over N px, v from 1 (row 0) down to 0 (row N/2)
+      ScreenVertex sv[ 4 ] ;
+      for( int k = 0 ; k < n ; k++ )
+      {
+        real w = 1.0 / poly[k].z ;
+        sv[k].x = ( poly[k].x*w + 1 ) * 0.5 * N ;
+        if( f == Hemicube::FRONT )
+          sv[k].y = ( poly[k].y*w + 1 ) * 0.5 * N ;
+        else
+          sv[k].y = ( 1 - poly[k].y*w ) * 0.5 * N ;
+        sv[k].w = w ;
+      }
+
+      for( int k = 1 ; k+1 < n ; k++ )
+        rasterize( sv[0], sv[k], sv[k+1], id, f, faces ) ;
+    }
+  }
+
+  // now read the row straight off the id buffers
+  for( int f = 0 ; f < 5 ; f++ )
+  {
+    int rows = f == Hemicube::FRONT ? N : N/2 ;
+    const Eigen::MatrixXf& cosines = formFactorCosines[ f == Hemicube::FRONT ? 0 : 1 ] ;
+    const int *ids = &faces.ids[f][0] ;
+    for( int row = 0 ; row < rows ; row++ )
+      for( int col = 0 ; col < N ; col++ )
+      {
+        int receiver = ids[ row*N + col ] ;
+        if( receiver >= 0 && receiver < ffRow.dense.size() )
+          ffRow.add( receiver, cosines( row, col ) ) ;
+      }
+  }
+}
+
+void SoftwareHemicube::rasterize( const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c,
+  int id, int face, Faces& faces ) const
+{
+  int W = pixelsPerSide ;
+  int H = face == Hemicube::FRONT ? pixelsPerSide : pixelsPerSide/2 ;
+
+  real area = ( b.x - a.x )*( c.y - a.y ) - ( b.y - a.y )*( c.x - a.x ) ;
+  if( fabs( area ) < 1e-12 )  return ;
+  real invArea = 1.0 / area ;
+
+  // pixel centers inside the bounding box, clamped to the face
+  // (before the int cast, near clipped vertices land way off the face)
+  real minX = max( -1.0, min( a.x, min( b.x, c.x ) ) ) ;
+  real maxX = min( (real)W, max( a.x, max( b.x, c.x ) ) ) ;
+  real minY = max( -1.0, min( a.y, min( b.y, c.y ) ) ) ;
+  real maxY = min( (real)H, max( a.y, max( b.y, c.y ) ) ) ;
+  int col0 = max( 0, (int)ceil( minX - 0.5 ) ) ;
+  int col1 = min( W-1, (int)floor( maxX - 0.5 ) ) ;
+  int row0 = max( 0, (int)ceil( minY - 0.5 ) ) ;
+  int row1 = min( H-1, (int)floor( maxY - 0.5 ) ) ;
+
+  int *ids = &faces.ids[ face ][0] ;
+  float *depth = &faces.invDepth[ face ][0] ;
+  for( int row = row0 ; row <= row1 ; row++ )
+  {
+    real py = row + 0.5 ;
+    for( int col = col0 ; col <= col1 ; col++ )
+    {
+      real px = col + 0.5 ;
+
+      // barycentrics from the edge functions, same sign as area inside
+      real ba = ( ( b.x - px )*( c.y - py ) - ( b.y - py )*( c.x - px ) ) * invArea ;
+      real bb = ( ( c.x - px )*( a.y - py ) - ( c.y - py )*( a.x - px ) ) * invArea ;
+      real bc = 1 - ba - bb ;
+      if( ba < 0 || bb < 0 || bc < 0 )  continue ;
+
+      // 1/depth is linear in screen space
+      float w = (float)( ba*a.w + bb*b.w + bc*c.w ) ;
+      int pixel = row*W + col ;
+      if( w > depth[ pixel ] )
+      {
+        depth[ pixel ] = w ;
+        ids[ pixel ] = id ;
+      }
+    }
+  }
+}
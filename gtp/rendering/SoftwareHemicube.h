@@ -0,0 +1,52 @@
+#ifndef SOFTWAREHEMICUBE_H
+#define SOFTWAREHEMICUBE_H
+
+#include "../math/Vector.h"
+#include "../math/EigenUtil.h"
+#include "../math/CSRMatrix.h"
+
+struct Triangle ;
+
+// The hemicube, rasterized on the cpu.
+//
+// The d3d Hemicube can only render on the main thread, one patch at a
+// time, and then reads its 5 surfaces back a pixel at a time.  This one
+// z-buffers patch ids into plain arrays instead, so every core can be
+// working on its own patch (each job keeps its own Faces), and nothing
+// needs a window.  Same pixel layout and the same formFactorCosines table
+// as the d3d one, so the rows come out the same up to rasterization rules.
+struct SoftwareHemicube
+{
+  int pixelsPerSide ;
+
+  // [0] front, [1] the sides.  Read only once built, shared by every job.
+  Eigen::MatrixXf formFactorCosines[ 2 ] ;
+
+  // One job's id & depth buffers for the 5 faces.
+  // front is pixelsPerSide^2, each side the top half of one.
+  struct Faces
+  {
+    vector<int> ids[ 5 ] ;
+    vector<float> invDepth[ 5 ] ; // 1/depth, bigger is closer
+    Faces( int pixelsPerSide ) ;
+  } ;
+
+  SoftwareHemicube( int iPixelsPerSide ) ;
+
+  // Rasterizes every patch in tris (tris[i] has id i) onto a hemicube
+  // on tri, and adds the form factor of each one it sees to ffRow.
+  // Safe from any number of threads, each with its own faces & ffRow.
+  void formFactorRow( const vector<Triangle*>& tris, const Triangle& tri, Faces& faces, CSRRowBuilder& ffRow ) const ;
+
+private:
+  // a vertex on a face: x,y in pixels, w = 1/depth
+  struct ScreenVertex
+  {
+    real x, y, w ;
+  } ;
+
+  void rasterize( const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c,
+    int id, int face, Faces& faces ) const ;
+} ;
+
+#endif
@@ -0,0 +1,104 @@
+#include "TemporalReprojector.h"
+
+TemporalReprojector::TemporalReprojector( int iRows, int iCols, int iRaysPerPixel,
+    real iMinBlend, real iDepthTolerance, real iNormalTolerance ) :
+  prevPlane( iRows, iCols, iRaysPerPixel )
+{
+  rows = iRows ;
+  cols = iCols ;
+  raysPerPixel = iRaysPerPixel ;
+  minBlend = iMinBlend ;
+  depthTolerance = iDepthTolerance ;
+  normalTolerance = iNormalTolerance ;
+
+  for( int i = 0 ; i < 2 ; i++ )
+  {
+    history[i].colors.resize( rows*cols ) ;
+    history[i].normals.resize( rows*cols ) ;
+    history[i].depths.resize( rows*cols ) ;
+    history[i].lengths.resize( rows*cols ) ;
+  }
+  cur = 0 ;
+  valid = false ;
+}
+
+void TemporalReprojector::invalidate()
+{
+  valid = false ;
+}
+
+Vector TemporalReprojector::resolve( int row, int col, const Vector& newColor, const Vector& normal, real depth, ViewingPlane* vp )
+{
+  int idx = row*cols + col ;
+  History& now = history[ cur ] ;
+  const History& prev = history[ !cur ] ;
+
+  Vector result = newColor ;
+  real length = 1 ;
+
+  // Background (depth 0) is a direct sky/cubemap lookup, nothing to accumulate.
+  if( valid && depth > 0 )
+  {
+    // the surface point this pixel sees, and where it was last frame
+    Vector p = vp->eye + vp->getRay( row, col, 0, 0 ).direction*depth ;
+    real prevDepth = distanceBetween( p, prevPlane.eye ) ;
+    real pRow, pCol ;
+
+    if( prevPlane.project( p, pRow, pCol ) )
+    {
+      int r0 = (int)floor( pRow ), c0 = (int)floor( pCol ) ;
+      real fr = pRow - r0, fc = pCol - c0 ;
+
+      Vector histColor( 0,0,0,0 ) ;
+      real histLength = 0, sumW = 0 ;
+
+      // bilinear over the 4 nearest old pixels, keeping only
+      // the ones that saw the same surface
+      for( int j = 0 ; j < 2 ; j++ )
+      {
+        int r = r0 + j ;
+        if( r < 0 || r >= rows )  continue ;
+        for( int i = 0 ; i < 2 ; i++ )
+        {
+          int c = c0 + i ;
+          if( c < 0 || c >= cols )  continue ;
+
+          int q = r*cols + c ;
+          real qDepth = prev.depths[ q ] ;
+          if( qDepth <= 0 )  continue ; // was bg
+          if( fabs( qDepth - prevDepth ) > depthTolerance*prevDepth )  continue ; // something else was in front (or it was behind)
+          if( ( prev.normals[ q ] % normal ) < normalTolerance )  continue ;
+
+          real w = ( j ? fr : 1-fr ) * ( i ? fc : 1-fc ) ;
+          histColor.AddMe4( prev.colors[ q ] * w ) ;
+          histLength += prev.lengths[ q ] * w ;
+          sumW += w ;
+        }
+      }
+
+      // if hardly any of the footprint survived, it's a disocclusion
+      if( sumW > 0.01 )
+      {
+        histColor.DivMe4( sumW ) ;
+        length = histLength/sumW + 1 ;
+        real alpha = max( 1.0/length, minBlend ) ;
+        result = histColor + ( newColor - histColor )*alpha ;
+        result.w = newColor.w ;
+      }
+    }
+  }
+
+  now.colors[ idx ] = result ;
+  now.normals[ idx ] = normal ;
+  now.depths[ idx ] = depth ;
+  now.lengths[ idx ] = length ;
+
+  return result ;
+}
+
+void TemporalReprojector::endFrame( ViewingPlane* vp )
+{
+  prevPlane = *vp ;
+  cur = !cur ;
+  valid = true ;
+}
@@ -0,0 +1,63 @@
+#ifndef TEMPORALREPROJECTOR_H
+#define TEMPORALREPROJECTOR_H
+
+#include "ViewingPlane.h"
+
+// Keeps the last real time frame's colors around and reuses them.
+//
+// Every pixel of the new frame traces only a few rays.  Its first hit
+// point gets projected through LAST frame's ViewingPlane to find where
+// that same surface point was on screen, and the old color there
+// (bilinearly filtered) is blended with the new samples.  Taps whose
+// depth or normal don't match were something else last frame
+// (disocclusion, or it was off screen), so they're thrown out and the
+// pixel starts over from just its new samples.
+//
+// The blend weight of the new samples is 1/(#frames accumulated),
+// so a still camera converges like a progressive render, but it never
+// drops below minBlend so moving lights etc. still show up eventually.
+struct TemporalReprojector
+{
+  int raysPerPixel ; // new rays per pixel per real time frame
+  real minBlend ;
+  real depthTolerance ;  // relative difference in eye distance allowed
+  real normalTolerance ; // min dot product between old and new normal
+
+  TemporalReprojector( int iRows, int iCols, int iRaysPerPixel,
+    real iMinBlend, real iDepthTolerance, real iNormalTolerance ) ;
+
+  // forget the history, eg when real time mode gets switched on
+  // (the scene may have changed since the last real time frame)
+  void invalidate() ;
+
+  // Blends this frame's color for a pixel with the history.
+  // normal/depth are the first hit through the pixel center (depth 0 for bg),
+  // vp is the CURRENT frame's viewing plane.  Stores the result
+  // for next frame and returns it.  Safe to call from many threads at once
+  // as long as each pixel is only done by one.
+  Vector resolve( int row, int col, const Vector& newColor, const Vector& normal, real depth, ViewingPlane* vp ) ;
+
+  // current frame becomes the history.  Call once every pixel is resolved.
+  void endFrame( ViewingPlane* vp ) ;
+
+private:
+  int rows, cols ;
+  bool valid ;
+
+  // where the camera was for the history frame
+  ViewingPlane prevPlane ;
+
+  struct History
+  {
+    vector<Vector> colors ;
+    vector<Vector> normals ;
+    vector<real> depths ;
+    vector<real> lengths ; // # frames accumulated into each pixel
+  } ;
+
+  // history[cur] is being written this frame, history[!cur] is last frame's.
+  History history[2] ;
+  int cur ;
+} ;
+
+#endif
@@ -100,6 +100,31 @@ public:
     return Ray( eye, eyeToPixel, farPlane ) ;
   }
 
+  // The inverse of getPixelLocation: where does the line from the eye
+  // to world point p cross the viewing plane, in (fractional) pixel
+  // coordinates?  Pixel centers land on whole numbers.
+  // Returns false if p is behind the eye or off screen.
+  bool project( const Vector& p, real& pRow, real& pCol ) const
+  {
+    Vector ba = a - b ; // right
+    Vector bc = c - b ; // down
+    Vector n = ba << bc ;
+
+    Vector toP = p - eye ;
+    real den = toP % n ;
+    if( !den )  return false ;
+    real t = ( (b - eye) % n ) / den ;
+    if( t <= 0 )  return false ; // behind the eye
+
+    // ba and bc are perpendicular, so just project onto each
+    Vector onPlane = eye + toP*t - b ;
+    pRow = rows * ( onPlane % bc ) / ( bc % bc ) - .5 ;
+    pCol = cols * ( onPlane % ba ) / ( ba % ba ) - .5 ;
+
+    return pRow > -.5 && pRow < rows-.5 &&
+           pCol > -.5 && pCol < cols-.5 ;
+  }
+
   // Unlike rasterization, orienting the viewing plane is a 
   // FORWARD transformation.
   void orient( const Vector& iEye, const Vector& look, const Vector& up )
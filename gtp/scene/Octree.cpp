@@ -18,6 +18,12 @@ int  ONode<PhantomTriangle*>::maxItems = 15 ;
 int  ONode<PhantomTriangle*>::maxDepth = 7 ;
 bool ONode<PhantomTriangle*>::splitting = true ;
 
+// Hierarchical radiosity's patch clusters.  Smaller leaves than
+// the intersection trees, the clusters are what get linked.
+int  ONode<Triangle*>::maxItems = 4 ;
+int  ONode<Triangle*>::maxDepth = 16 ;
+bool ONode<Triangle*>::splitting = false ;
+
 
 
 #pragma region global functions
@@ -195,6 +195,63 @@ void ThreadPool::addBatch( ParallelBatch *batch )
   batchReady() ;
 }
 
+// What parallelFor's helper jobs share.  Helpers that only get
+// dequeued after the loop is done still touch it, so the
+// last one out (caller or helper) deletes it.
+struct ParallelForLoop
+{
+  function<void (int begin, int end)> body ;
+  int count, chunkSize, numChunks ;
+  volatile LONG nextChunk, chunksDone, refs ;
+
+  // claims chunks until there are none left
+  void run()
+  {
+    for( LONG chunk ; ( chunk = InterlockedIncrement( &nextChunk ) - 1 ) < numChunks ; )
+    {
+      int begin = chunk*chunkSize ;
+      body( begin, min( begin + chunkSize, count ) ) ;
+      InterlockedIncrement( &chunksDone ) ;
+    }
+  }
+
+  void release()
+  {
+    if( !InterlockedDecrement( &refs ) )
+      delete this ;
+  }
+} ;
+
+void ThreadPool::parallelFor( char *name, int count, int chunkSize, function<void (int begin, int end)> body )
+{
+  if( count <= 0 )  return ;
+  if( chunkSize < 1 )  chunkSize = 1 ;
+
+  ParallelForLoop *loop = new ParallelForLoop() ;
+  loop->body = body ;
+  loop->count = count ;
+  loop->chunkSize = chunkSize ;
+  loop->numChunks = ( count + chunkSize - 1 ) / chunkSize ;
+  loop->nextChunk = loop->chunksDone = 0 ;
+
+  // no point waking more helpers than there are chunks for them
+  int helpers = min( (int)threads.size(), loop->numChunks - 1 ) ;
+  loop->refs = helpers + 1 ;
+  for( int i = 0 ; i < helpers ; i++ )
+    createJob( name, new Callback0( [loop](){
+      loop->run() ;
+      loop->release() ;
+    } ), 0.0, i == helpers-1 ) ; // wake them all at once, after the last
+
+  loop->run() ;
+
+  // the chunks the helpers took might not be done yet
+  while( loop->chunksDone < loop->numChunks )
+    SwitchToThread() ;
+
+  loop->release() ;
+}
+
 void ThreadPool::lockQueues()
 {
   DWORD waitResult = WaitForSingleObject( mutexQueues, INFINITE ) ;
@@ -103,6 +103,15 @@ public:
   void createBatch( char *name, vector<Callback*>& theJobsToDoInParallel, Callback* batchDoneJob=NULL ) ;
   void addBatch( ParallelBatch *batch ) ;
 
+  // Cuts [0,count) into chunks of chunkSize, runs body( begin, end ) on
+  // each and only returns once they're all done.  For a loop INSIDE a job:
+  // a job can't wait on a ParallelBatch (only one runs at a time, and the
+  // job may well be part of it).  The calling thread works on the chunks too,
+  // so it finishes even if every other thread is busy or on hold.
+  void parallelFor( char *name, int count, int chunkSize, function<void (int begin, int end)> body ) ;
+
+  int getNumThreads() { return threads.size() ; }
+
 private:
   void lockQueues() ;
   void unlockQueues() ;
@@ -0,0 +1,198 @@
+#include "Sampler.h"
+
+bool Sampler::deterministic = false ;
+
+const char* SamplerTypeName[] = {
+  "Random", "Halton", "R2", "Sobol"
+} ;
+
+// splitmix64's finalizer.  Good avalanche, so consecutive
+// pixel/dimension numbers give unrelated scrambles.
+static inline unsigned long long mix64( unsigned long long z )
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL ;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL ;
+  return z ^ (z >> 31) ;
+}
+
+static inline real frac( real x )
+{
+  return x - floor( x ) ;
+}
+
+// reverses the bits of a 32 bit int, so 0.b0b1b2.. becomes the radical inverse base 2
+static inline unsigned int reverseBits( unsigned int n )
+{
+  n = (n << 16) | (n >> 16) ;
+  n = ((n & 0x00ff00ff) << 8) | ((n & 0xff00ff00) >> 8) ;
+  n = ((n & 0x0f0f0f0f) << 4) | ((n & 0xf0f0f0f0) >> 4) ;
+  n = ((n & 0x33333333) << 2) | ((n & 0xcccccccc) >> 2) ;
+  n = ((n & 0x55555555) << 1) | ((n & 0xaaaaaaaa) >> 1) ;
+  return n ;
+}
+
+Sampler::Sampler( unsigned long long iSeed, unsigned long long iStream )
+{
+  seedValue = iSeed ;
+  rng.seed( iSeed, iStream ) ;
+  pixel = sampleNo = dim = 0 ;
+  path = 0 ;
+  sampleMask = 0 ;
+}
+
+SamplerType Sampler::parseType( const string& name )
+{
+  if( name.empty() )  return RandomSampling ;
+  switch( name[0] )
+  {
+  case 'h': case 'H':  return HaltonSampling ;
+  case 's': case 'S':  return SobolSampling ;
+  case 'r': case 'R':
+    // "r2", but "random" also starts with r
+    if( name.size() > 1 && name[1]=='2' )  return R2Sampling ;
+    return RandomSampling ;
+  default:
+    warning( "Unknown sampler '%s', using random", name.c_str() ) ;
+    return RandomSampling ;
+  }
+}
+
+Sampler* Sampler::create( SamplerType type, unsigned long long seed, unsigned long long stream )
+{
+  switch( type )
+  {
+  case HaltonSampling:  return new HaltonSampler( seed, stream ) ;
+  case R2Sampling:      return new R2Sampler( seed, stream ) ;
+  case SobolSampling:   return new SobolSampler( seed, stream ) ;
+  case RandomSampling:
+  default:              return new RandomSampler( seed, stream ) ;
+  }
+}
+
+void Sampler::setSamplesPerPixel( int spp )
+{
+  unsigned int p = 1 ;
+  while( p < (unsigned int)spp && p < 0x80000000u )  p <<= 1 ;
+  sampleMask = p - 1 ;
+}
+
+void Sampler::startSample( int iPixel, int iSampleNo )
+{
+  pixel = iPixel ;
+  sampleNo = iSampleNo ;
+  dim = 0 ;
+  path = 0 ;
+
+  if( deterministic )
+    rng.seed( mix64( seedValue ^ (unsigned long long)(unsigned int)pixel ), (unsigned int)sampleNo ) ;
+}
+
+Sampler::State Sampler::child( int childIndex ) const
+{
+  State s ;
+  s.pixel = pixel ;
+  s.sampleNo = sampleNo ;
+  s.dim = 0 ;
+  s.path = mix64( path + 0x9e3779b97f4a7c15ULL * (unsigned long long)( childIndex + 1 ) ) ;
+  s.rng.seed( mix64( seedValue ^ (unsigned long long)(unsigned int)pixel ^ s.path ), (unsigned int)sampleNo ) ;
+  return s ;
+}
+
+unsigned int Sampler::scrambleFor( int dimension ) const
+{
+  // path is 0 on the eye ray's path, so that keeps the plain per pixel scramble
+  unsigned long long key = seedValue ^ ( (unsigned long long)(unsigned int)pixel << 20 ) ^ (unsigned long long)dimension ^ path ;
+  return (unsigned int)( mix64( key ) >> 32 ) ;
+}
+
+#pragma region Halton
+static const int NumHaltonPrimes = 32 ;
+static const int HaltonPrimes[ NumHaltonPrimes ] = {
+  2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+  59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131
+} ;
+
+static real radicalInverse( int base, unsigned int i )
+{
+  real invBase = 1.0 / base, invBi = invBase ;
+  real r = 0 ;
+  while( i )
+  {
+    r += (i % base) * invBi ;
+    i /= base ;
+    invBi *= invBase ;
+  }
+  return r ;
+}
+
+real HaltonSampler::next1D()
+{
+  int d = dim++ ;
+  if( d >= NumHaltonPrimes )  return rng.nextFloat() ;
+
+  // base 2 is just bit reversal
+  real h = ( d==0 ) ? reverseBits( sampleNo ) * (1.0/4294967296.0) : radicalInverse( HaltonPrimes[d], sampleNo ) ;
+  return frac( h + offsetFor( d ) ) ;
+}
+
+void HaltonSampler::next2D( real& u, real& v )
+{
+  u = next1D() ;
+  v = next1D() ;
+}
+#pragma endregion
+
+#pragma region R2
+// g is the plastic constant, the unique real root of x^3 = x + 1.
+static const real R2g = 1.32471795724474602596 ;
+static const real R2a1 = 1.0/R2g, R2a2 = 1.0/(R2g*R2g) ;
+static const real R1a = 0.61803398874989484820 ; // 1/golden ratio
+
+real R2Sampler::next1D()
+{
+  int d = dim++ ;
+  return frac( offsetFor( d ) + sampleNo*R1a ) ;
+}
+
+void R2Sampler::next2D( real& u, real& v )
+{
+  int d = dim ;
+  dim += 2 ;
+  u = frac( offsetFor( d ) + sampleNo*R2a1 ) ;
+  v = frac( offsetFor( d+1 ) + sampleNo*R2a2 ) ;
+}
+#pragma endregion
+
+#pragma region Sobol
+// the 2nd Sobol' dimension: direction numbers v_k = v_(k-1) ^ (v_(k-1)>>1)
+static inline unsigned int sobol2( unsigned int i, unsigned int scramble )
+{
+  for( unsigned int v = 1u << 31 ; i ; i >>= 1, v ^= v >> 1 )
+    if( i & 1 )
+      scramble ^= v ;
+  return scramble ;
+}
+
+unsigned int SobolSampler::shuffledIndex( int dimension ) const
+{
+  // xor with a per (pixel,dim) mask below sampleMask permutes
+  // [0,spp) onto itself, decorrelating dimension pairs from each other.
+  return (unsigned int)sampleNo ^ ( scrambleFor( dimension + 0x4000 ) & sampleMask ) ;
+}
+
+real SobolSampler::next1D()
+{
+  int d = dim++ ;
+  unsigned int i = shuffledIndex( d ) ;
+  return ( reverseBits( i ) ^ scrambleFor( d ) ) * (1.0/4294967296.0) ;
+}
+
+void SobolSampler::next2D( real& u, real& v )
+{
+  int d = dim ;
+  dim += 2 ;
+  unsigned int i = shuffledIndex( d ) ;
+  u = ( reverseBits( i ) ^ scrambleFor( d ) ) * (1.0/4294967296.0) ;
+  v = sobol2( i, scrambleFor( d+1 ) ) * (1.0/4294967296.0) ;
+}
+#pragma endregion
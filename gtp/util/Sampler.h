@@ -0,0 +1,198 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "StdWilUtil.h"
+
+// The MersenneTwister behind randFloat()/randInt() is ONE global state,
+// and every raytracing/raycasting job thread hammers it at once.  That's
+// a data race, and it serializes on the cache line anyway.
+// So each job owns its own small generator stream instead (PCG32: 16 bytes
+// of state, and the stream id picks an independent sequence), and wraps it
+// in a Sampler that can hand out low discrepancy points for the
+// dimensions that matter (pixel jitter, light/cubemap/bounce directions).
+
+// PCG32 by M.E. O'Neill (pcg-random.org), XSH RR variant.
+struct PCG32
+{
+  unsigned long long state, inc ;
+
+  PCG32() { seed( 0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL ) ; }
+  PCG32( unsigned long long initState, unsigned long long stream ) { seed( initState, stream ) ; }
+
+  // stream selects which of 2^63 independent sequences you get
+  void seed( unsigned long long initState, unsigned long long stream )
+  {
+    state = 0 ;
+    inc = (stream << 1) | 1 ;
+    next() ;
+    state += initState ;
+    next() ;
+  }
+
+  inline unsigned int next()
+  {
+    unsigned long long old = state ;
+    state = old * 6364136223846793005ULL + inc ;
+    unsigned int xorshifted = (unsigned int)( ((old >> 18) ^ old) >> 27 ) ;
+    unsigned int rot = (unsigned int)( old >> 59 ) ;
+    return (xorshifted >> rot) | (xorshifted << ((~rot + 1) & 31)) ;
+  }
+
+  // [0,1)
+  inline real nextFloat() { return next() * (1.0/4294967296.0) ; }
+} ;
+
+enum SamplerType
+{
+  RandomSampling, HaltonSampling, R2Sampling, SobolSampling
+} ;
+
+extern const char* SamplerTypeName[] ;
+
+class Sampler
+{
+protected:
+  PCG32 rng ;
+  unsigned long long seedValue ;
+
+  // What sample we're on: the pixel (or vertex, or patch) index,
+  // which of its samples this is, and how many dimensions of
+  // this sample have been consumed so far.
+  int pixel, sampleNo, dim ;
+
+  // Which ray of the sample's tree this is, 0 for the eye ray's path.
+  // See child().
+  unsigned long long path ;
+
+  // # samples each pixel takes, rounded up to a power of 2.
+  // Used to shuffle sample indices within a pixel.
+  unsigned int sampleMask ;
+
+public:
+  // Deterministic mode ("ray::deterministic"): the prng is re-keyed from
+  // ( seed, pixel, sampleNo ) at every startSample, so it acts as a
+  // counter based generator.  Every number a sample draws then depends
+  // only on which pixel/vertex and which sample it is, never on which
+  // job or thread got there first, so renders are bitwise identical
+  // for any thread count.
+  static bool deterministic ;
+
+  Sampler( unsigned long long iSeed, unsigned long long iStream ) ;
+  virtual ~Sampler(){}
+
+  // "ray::sampler" is "random", "halton", "r2" or "sobol"
+  static SamplerType parseType( const string& name ) ;
+
+  // named ctor.  Each job thread makes its own with a distinct stream.
+  static Sampler* create( SamplerType type, unsigned long long seed, unsigned long long stream ) ;
+
+  virtual SamplerType getType() const = 0 ;
+
+  void setSamplesPerPixel( int spp ) ;
+
+  // Call at the start of each pixel (vertex) sample.
+  // Resets the dimension counter so dimension k of every sample
+  // comes from the same low discrepancy sequence.
+  virtual void startSample( int iPixel, int iSampleNo ) ;
+
+  // next dimension(s) of the current sample, in [0,1)
+  virtual real next1D() = 0 ;
+  virtual void next2D( real& u, real& v ) = 0 ;
+
+  // Plain stream PRNG, for things that aren't sample dimensions
+  // (picking a start offset in the RayCollection, etc).
+  inline real randFloat() { return rng.nextFloat() ; }
+  inline real randFloat( real low, real high ) { return low + (high-low)*rng.nextFloat() ; }
+  inline int randInt( int low, int high ) { return low + (int)( rng.nextFloat()*(high-low) ) ; }
+
+  // Makes swu::randFloat()/randInt() on this thread draw from this sampler's
+  // stream, for code that doesn't take a Sampler.  Unbind before the job ends.
+  void bindToThread() { randBindThreadStream( &rng ) ; }
+  static void unbindThread() { randBindThreadStream( 0 ) ; }
+
+  // Everything the current sample has used up so far.  The wavefront
+  // tracer interleaves the bounces of many samples, so each ray in flight
+  // carries its sample's state and restores it before it gets shaded.
+  struct State
+  {
+    PCG32 rng ;
+    int pixel, sampleNo, dim ;
+    unsigned long long path ;
+  } ;
+  State save() const
+  {
+    State s ;
+    s.rng = rng ;  s.pixel = pixel ;  s.sampleNo = sampleNo ;  s.dim = dim ;  s.path = path ;
+    return s ;
+  }
+  void restore( const State& s )
+  {
+    rng = s.rng ;  pixel = s.pixel ;  sampleNo = s.sampleNo ;  dim = s.dim ;  path = s.path ;
+  }
+
+  // The state for the childIndex'th ray spawned from the current one.
+  // A saved copy of the parent's state won't do: the parent keeps drawing
+  // for the siblings after it, and restoring the copy would hand the child
+  // those same numbers.  So the child gets a path of its own, hashed from
+  // the parent's and childIndex, which re-keys its prng from
+  // ( seed, pixel, sampleNo, path ) and re-scrambles its low discrepancy
+  // dimensions (starting over at 0).  Nothing the parent or a sibling
+  // draws can show up in it, and it's the same whichever order the rays
+  // get shaded in.
+  State child( int childIndex ) const ;
+
+protected:
+  // a hash of ( seed, pixel, dimension ) used for per-pixel scrambling,
+  // so neighbouring pixels don't all use the same points (structured aliasing).
+  unsigned int scrambleFor( int dimension ) const ;
+  real offsetFor( int dimension ) const { return scrambleFor( dimension ) * (1.0/4294967296.0) ; }
+} ;
+
+// Independent uniform random numbers.  The cheap default.
+class RandomSampler : public Sampler
+{
+public:
+  RandomSampler( unsigned long long iSeed, unsigned long long iStream ) : Sampler( iSeed, iStream ) {}
+  SamplerType getType() const override { return RandomSampling ; }
+  real next1D() override { dim++ ; return rng.nextFloat() ; }
+  void next2D( real& u, real& v ) override { dim+=2 ; u = rng.nextFloat() ; v = rng.nextFloat() ; }
+} ;
+
+// Halton, a different prime base per dimension, Cranley-Patterson
+// rotated per pixel.  Past the prime table it falls back to the prng.
+class HaltonSampler : public Sampler
+{
+public:
+  HaltonSampler( unsigned long long iSeed, unsigned long long iStream ) : Sampler( iSeed, iStream ) {}
+  SamplerType getType() const override { return HaltonSampling ; }
+  real next1D() override ;
+  void next2D( real& u, real& v ) override ;
+} ;
+
+// Roberts' R2 (plastic constant) for 2D, golden ratio R1 for 1D.
+// Each dimension gets its own per pixel toroidal shift.
+class R2Sampler : public Sampler
+{
+public:
+  R2Sampler( unsigned long long iSeed, unsigned long long iStream ) : Sampler( iSeed, iStream ) {}
+  SamplerType getType() const override { return R2Sampling ; }
+  real next1D() override ;
+  void next2D( real& u, real& v ) override ;
+} ;
+
+// (0,2)-sequence (Sobol' dims 0,1) for every 2D request, padded across
+// dimensions with an independent random digit scramble and sample index
+// shuffle per (pixel, dimension), as in Kollig & Keller 2002.
+class SobolSampler : public Sampler
+{
+public:
+  SobolSampler( unsigned long long iSeed, unsigned long long iStream ) : Sampler( iSeed, iStream ) {}
+  SamplerType getType() const override { return SobolSampling ; }
+  real next1D() override ;
+  void next2D( real& u, real& v ) override ;
+
+private:
+  unsigned int shuffledIndex( int dimension ) const ;
+} ;
+
+#endif
@@ -1,6 +1,7 @@
 ﻿#include "StdWilUtil.h"
 #include "../window/WindowClass.h"
 #include "../math/Vector.h"
+#include "Sampler.h"
 
 namespace swu
 {
@@ -18,13 +19,28 @@ namespace swu
   // you're starting to get a 1/3 chance of repeating theta/phi independently.
   // I chose to use MT instead of cstdlib.  There is also a constant time
   // type called a "linear congruence" approach, and it's in "Realistic Ray Tracing".
+
+  // If a job bound its own stream to this thread, draw from that instead of MT.
+  static thread_local PCG32* threadStream = 0 ;
+
+  void randBindThreadStream( PCG32* stream )
+  {
+    threadStream = stream ;
+  }
+
+  static inline unsigned int randBits()
+  {
+    if( threadStream )  return threadStream->next() ;
+    return MersenneTwister::genrand_int32() ;
+  }
+
   real randFloat()
   {
     // <cstdlib>
     //return (real)rand() / RAND_MAX ;
 
     //mt
-    return MersenneTwister::genrand_int32()*(1.0/4294967295.0);  // same as genrand_real1();
+    return randBits()*(1.0/4294967295.0);  // same as genrand_real1();
   }
   
   real randFloat( real low, real high )
@@ -33,7 +49,7 @@ namespace swu
     //return lerp( low, high, randFloat() ) ;
 
     //mt
-    return low + MersenneTwister::genrand_int32()*((high-low)/4294967295.0);
+    return low + randBits()*((high-low)/4294967295.0);
   }
 
   int randInt( int low, int high )
@@ -44,7 +60,7 @@ namespace swu
     //  else return low + rand() % ( diff ) ;
 
     //mt
-    return low + ((int)(MersenneTwister::genrand_int32()>>1)) % (high - low);
+    return low + ((int)(randBits()>>1)) % (high - low);
   }
 
   int randSign()
@@ -232,7 +248,7 @@ namespace Console
     if( logOutputsForDebugStream & logLevel )
       OutputDebugStringA( msg ) ;
 
-    if( logOutputsForRichText & logLevel )
+    if( logRichText && (logOutputsForRichText & logLevel) )
     {
       //logRichText->setTextColor( richColor ) ;
       logRichText->append( msg, richColor, RGB(200,200,200 ) ) ;
@@ -395,7 +411,7 @@ namespace Console
 
   /// LOGGING
   // start up a logwindow AROUND a certain window.
-  void logStartup( char *outputFilename, char *runningProgramName, int windX, int windY, int windWidth, int windHeight )
+  void logStartup( char *outputFilename, char *runningProgramName, int windX, int windY, int windWidth, int windHeight, bool headless )
   {
     // KEEP copy of filename
     logOutputFilename = strdup( outputFilename ) ;
@@ -409,10 +425,14 @@ namespace Console
     //setSizeInPixels( 400, 200 ) ;
     //setRowsAndCols( 10, 120 ) ;
 
-    // create richtext window
-    logRichText = new RichEdit( windX+windWidth+8, windY ) ; // MUST BE CREATED/MESSAGED ON MAIN THREAD.
-    logRichText->show() ;
-    // IT DOESN'T WORK OTHERWISE.
+    // create richtext window.  Headless runs don't get one, the
+    // console and the log file are enough.
+    if( !headless )
+    {
+      logRichText = new RichEdit( windX+windWidth+8, windY ) ; // MUST BE CREATED/MESSAGED ON MAIN THREAD.
+      logRichText->show() ;
+      // IT DOESN'T WORK OTHERWISE.
+    }
 
     progname = runningProgramName ;
 
@@ -422,7 +442,7 @@ namespace Console
     logOutputsForConsole = ErrorLevel::Error | ErrorLevel::Warning | ErrorLevel::Info ;
     logOutputsForFile = ErrorLevel::Error | ErrorLevel::Warning | ErrorLevel::Info ;
     logOutputsForDebugStream = ErrorLevel::Error ;//| ErrorLevel::Warning ;
-    logOutputsForRichText = ErrorLevel::Error | ErrorLevel::Warning | ErrorLevel::Info ;
+    logOutputsForRichText = headless ? 0 : ErrorLevel::Error | ErrorLevel::Warning | ErrorLevel::Info ;
 
     mutexLog = CreateMutexA( 0, 0, "log mutex" ) ;
 
@@ -20,6 +20,7 @@ using namespace std;
 #include "RichEditCtrl.h" // for the rich text window
 class RichEdit ;
 union Vector ;
+struct PCG32 ;
 namespace swu
 {
   // FLOAT=SINGLE.  File reading will screw up
@@ -174,6 +175,13 @@ namespace swu
 
   void randSeed( UINT seed ) ;
 
+  /// Routes randFloat()/randInt() made on the CALLING thread
+  /// to stream instead of the shared MersenneTwister (0 unbinds).
+  /// Raytracing/raycasting jobs bind their Sampler's stream so the code
+  /// they call (jitter, getRandomPointFacing..) doesn't race on MT,
+  /// and so a deterministic render stays deterministic.
+  void randBindThreadStream( PCG32* stream ) ;
+
   real interpolateAngle( real t1, real t2 ) ;
 
   extern real *facs ;
@@ -494,7 +502,7 @@ namespace Console
   // mutex for log writing, to make it thread safe
   static HANDLE mutexLog ;
 
-  void logStartup( char *outputFilename, char *runningProgramName, int windX, int windY, int windWidth, int windHeight ) ;
+  void logStartup( char *outputFilename, char *runningProgramName, int windX, int windY, int windWidth, int windHeight, bool headless ) ;
   void logflush() ;
   void logShutdown() ;
 
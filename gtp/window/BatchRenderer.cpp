@@ -0,0 +1,373 @@
+#include "BatchRenderer.h"
+#include "GTPWindow.h"
+#include "Camera.h"
+#include "../rendering/RaytracingCore.h"
+#include "../rendering/RadiosityCore.h"
+#include "../rendering/Raycaster.h"
+#include "../threading/ParallelizableBatch.h"
+#include "RenderFarm.h"
+
+const char* BatchStepName[] = {
+  "rt", "rad", "vo", "sh", "ao", "wavecheck"
+} ;
+
+BatchRenderer::BatchRenderer()
+{
+  enabled = false ;
+  resume = false ;
+  budgetSeconds = 0 ;
+  numWorkers = 0 ;
+  farm = 0 ;
+  outBase = "batch" ;
+  hasEye = hasLook = hasUp = false ;
+}
+
+// "x,y,z" -> v.  false (and v untouched) if it isn't 3 numbers.
+static bool parseVector( const string& str, Vector& v )
+{
+  double x, y, z ;
+  if( sscanf( str.c_str(), "%lf,%lf,%lf", &x, &y, &z ) != 3 )
+  {
+    warning( "Batch: '%s' isn't a vector, expected x,y,z", str.c_str() ) ;
+    return false ;
+  }
+  v = Vector( x, y, z ) ;
+  return true ;
+}
+
+bool BatchRenderer::parseCommandLine( const char* cmdLine )
+{
+  if( !cmdLine )  return false ;
+
+  // tokenize on whitespace. No quoting, so keep paths space-free.
+  vector<string> args ;
+  char *str = strdup( cmdLine ) ;
+  for( char *p = strtok( str, " \t" ) ; p ; p = strtok( 0, " \t" ) )
+    args.push_back( p ) ;
+  free( str ) ;
+
+  for( int i = 0 ; i < args.size() ; i++ )
+  {
+    if( args[i] == "-batch" )
+      enabled = true ;
+    else if( args[i] == "-scene" && i+1 < args.size() )
+      sceneFile = args[++i] ;
+    else if( args[i] == "-out" && i+1 < args.size() )
+      outBase = args[++i] ;
+    else if( args[i] == "-eye" && i+1 < args.size() )
+      hasEye = parseVector( args[++i], eye ) ;
+    else if( args[i] == "-look" && i+1 < args.size() )
+      hasLook = parseVector( args[++i], look ) ;
+    else if( args[i] == "-up" && i+1 < args.size() )
+      hasUp = parseVector( args[++i], up ) ;
+    else if( args[i] == "-checkpoint" && i+1 < args.size() )
+      checkpointFile = args[++i] ;
+    else if( args[i] == "-resume" )
+      resume = true ;
+    else if( args[i] == "-seconds" && i+1 < args.size() )
+      budgetSeconds = atof( args[++i].c_str() ) ;
+    else if( args[i] == "-workers" && i+1 < args.size() )
+      numWorkers = atoi( args[++i].c_str() ) ;
+    else if( args[i] == "-worker" && i+1 < args.size() )
+      workerPipe = args[++i] ;
+    else if( args[i] == "-mode" && i+1 < args.size() )
+    {
+      // rt, rad, vo, sh, ao, wavecheck, joined with + to run several in order, eg "vo+rt"
+      string modes = args[++i] ;
+      int start = 0 ;
+      while( start <= modes.size() )
+      {
+        int end = modes.find( '+', start ) ;
+        if( end == string::npos )  end = modes.size() ;
+        string m = modes.substr( start, end-start ) ;
+
+        bool found = false ;
+        for( int s = 0 ; s <= BatchWavefrontCheck ; s++ )
+          if( m == BatchStepName[s] )
+          {
+            steps.push_back( (BatchStep)s ) ;
+            found = true ;
+          }
+        if( !found )
+          warning( "Batch: unknown mode '%s', expected rt, rad, vo, sh, ao or wavecheck", m.c_str() ) ;
+        start = end+1 ;
+      }
+    }
+    else
+      warning( "Batch: ignoring argument '%s'", args[i].c_str() ) ;
+  }
+
+  if( enabled && steps.empty() )
+    steps.push_back( BatchRaytrace ) ;
+
+  if( resume && checkpointFile.empty() )
+  {
+    warning( "Batch: -resume needs -checkpoint file, starting from scratch" ) ;
+    resume = false ;
+  }
+
+  if( numWorkers && ( resume || budgetSeconds ) )
+  {
+    warning( "Batch: -resume and -seconds don't work with -workers, ignoring them" ) ;
+    resume = false ;
+    budgetSeconds = 0 ;
+  }
+
+  return enabled ;
+}
+
+bool BatchRenderer::sceneIsMesh() const
+{
+  const char* ext = strrchr( sceneFile.c_str(), '.' ) ;
+  return ext && ( !strcmpi( ext, ".obj" ) || !strcmpi( ext, ".ply" ) ) ;
+}
+
+void BatchRenderer::applyCamera( Camera* camera ) const
+{
+  if( hasEye )  camera->eye = eye ;
+  if( hasUp )   camera->up = up ;
+
+  // setLook re-finds right & up from the new forward,
+  // so an -up alone still has to go through it
+  if( hasLook )
+    camera->setLook( look ) ;
+  else if( hasUp )
+    camera->setLook( camera->getLook() ) ;
+
+  if( hasEye || hasLook || hasUp )
+    info( "Batch: camera eye (%.2f %.2f %.2f) looking at (%.2f %.2f %.2f)",
+      camera->eye.x, camera->eye.y, camera->eye.z,
+      camera->getLook().x, camera->getLook().y, camera->getLook().z ) ;
+}
+
+void BatchRenderer::start( BatchStep step )
+{
+  window->programState = ProgramState::Busy ;
+
+  switch( step )
+  {
+  case BatchRaytrace:
+    if( checkpointFile.size() )
+      window->rtCore->checkpointFile = checkpointFile ;
+    // only the first rt step picks up the checkpoint, after that it's this run's own
+    if( resume )
+    {
+      FILE *f = fopen( checkpointFile.c_str(), "rb" ) ;
+      if( !f )
+        info( "Batch: no checkpoint at %s yet, starting from scratch", checkpointFile.c_str() ) ;
+      else
+      {
+        fclose( f ) ;
+        if( !window->rtCore->loadCheckpoint( checkpointFile.c_str() ) )
+          warning( "Batch: couldn't resume from %s, starting from scratch", checkpointFile.c_str() ) ;
+      }
+      resume = false ;
+    }
+    window->bakeRotationsIntoLights() ;
+    if( farm )
+    {
+      farm->raytrace( window->camera->eye, window->camera->getLook(), window->camera->up ) ;
+      break ;
+    }
+    window->rtCore->raytrace(
+      window->camera->eye,
+      window->camera->getLook(),
+      window->camera->up,
+      window->scene,
+      budgetSeconds
+    ) ;
+    break ;
+
+  case BatchRadiosity:
+    // no device, so it's the software hemicube (vo below only knows gpu hemicube or raycast)
+    window->radCore->radiosity( window->scene,
+      FormFactorDetermination::FormFactorsSoftwareHemicube, (MatrixSolverMethod)window->radCore->matrixSolverMethod ) ;
+    break ;
+
+  case BatchVectorOccluders:
+    window->radCore->vectorOccluders( window->scene, FormFactorDetermination::FormFactorsRaycast ) ;
+    break ;
+
+  case BatchSH:
+    window->shCompute() ;
+    break ;
+
+  case BatchAmbientOcclusion:
+    if( farm )
+      farm->ambientOcclusion() ;
+    else
+    {
+      ParallelBatch *pb = new ParallelBatch( "ao", new Callback0( [](){
+        info( "Smoothing AO . . . " ) ;
+        window->smoothAO() ;
+        window->programState = ProgramState::Idle ;
+      } ) ) ;
+      window->raycaster->QAO( pb, window->scene, 120 ) ;
+      threadPool.addBatch( pb ) ;
+    }
+    break ;
+  }
+}
+
+void BatchRenderer::waitUntilIdle()
+{
+  // Some batches post their last step to the main thread
+  // (updateVertexBuffers etc), so those have to be pumped here
+  // since there's no message loop running.
+  while( window->programState == ProgramState::Busy )
+  {
+    if( !threadPool.execJobMainThread() )
+      Sleep( 10 ) ;
+    logflush() ;
+  }
+}
+
+int BatchRenderer::run()
+{
+  // a worker just does what the coordinator sends it
+  if( workerPipe.size() )
+    return RenderFarm::serve( workerPipe ) ;
+
+  if( numWorkers > 0 )
+  {
+    farm = new RenderFarm() ;
+    if( !farm->launch( numWorkers, sceneFile ) )
+    {
+      warning( "Batch: no farm workers, running everything here" ) ;
+      DESTROY( farm ) ;
+    }
+  }
+
+  info( Cyan, "Batch: %d step(s), scene '%s', output '%s'",
+    (int)steps.size(), sceneFile.size() ? sceneFile.c_str() : "(default)", outBase.c_str() ) ;
+
+  vector<double> seconds ;
+  bool traced = false ;
+  bool ok = true ;
+
+  for( int i = 0 ; i < steps.size() ; i++ )
+  {
+    Timer stepTimer ;
+    if( steps[i] == BatchWavefrontCheck )
+      ok &= checkWavefront() ; // runs its own traces
+    else
+    {
+      start( steps[i] ) ;
+      waitUntilIdle() ;
+    }
+    seconds.push_back( stepTimer.getTime() ) ;
+    info( Cyan, "Batch: %s took %.3f seconds", BatchStepName[ steps[i] ], seconds.back() ) ;
+
+    if( steps[i] == BatchRaytrace )
+      traced = true ;
+  }
+
+  if( farm )
+  {
+    ok &= !farm->failed() ;
+    DESTROY( farm ) ; // sends the workers home
+  }
+  if( traced )
+  {
+    ok &= window->rtCore->savePFM( (outBase + ".pfm").c_str() ) ;
+    ok &= window->rtCore->savePPM( (outBase + ".ppm").c_str() ) ;
+  }
+  ok &= writeReport( seconds ) ;
+
+  return ok ? 0 : 1 ;
+}
+
+bool BatchRenderer::checkWavefront()
+{
+  RaytracingCore *rt = window->rtCore ;
+
+  // the denoiser would blur the difference between neighbouring pixels
+  // together, and the test below needs them independent
+  ATrousDenoiser *denoiser = rt->denoiser ;
+  rt->denoiser = 0 ;
+  int waveSize = rt->waveSize ;
+
+  // [0] depth first, [1] wavefront.  Each trace is on fresh streams
+  // (the trace number seeds them), so the two are independent estimates.
+  vector<Vector> images[ 2 ] ;
+  for( int pass = 0 ; pass < 2 ; pass++ )
+  {
+    rt->waveSize = pass ? ( waveSize ? waveSize : 4096 ) : 0 ;
+    info( "Batch: wavecheck, tracing %s", pass ? "wavefront" : "depth first" ) ;
+    window->programState = ProgramState::Busy ;
+    window->bakeRotationsIntoLights() ;
+    rt->raytrace( window->camera->eye, window->camera->getLook(), window->camera->up, window->scene ) ;
+    waitUntilIdle() ;
+    images[ pass ] = rt->frameBuffer->colors ;
+  }
+
+  rt->waveSize = waveSize ;
+  rt->denoiser = denoiser ;
+
+  // Paired test on every channel: if wavefront is the same estimator,
+  // the per pixel differences average out to 0, and their mean is within a
+  // few standard errors of it.  A sampler correlation or a dropped term
+  // shows up as a shift of the mean (it's over every pixel, so even a small
+  // bias is many standard errors).
+  int n = (int)images[0].size() ;
+  bool ok = n > 1 ;
+  for( int c = 0 ; c < 3 && n > 1 ; c++ )
+  {
+    double sum = 0, sum2 = 0, mean0 = 0, mean1 = 0 ;
+    for( int i = 0 ; i < n ; i++ )
+    {
+      double d = images[1][i].e[c] - images[0][i].e[c] ;
+      sum += d ;
+      sum2 += d*d ;
+      mean0 += images[0][i].e[c] ;
+      mean1 += images[1][i].e[c] ;
+    }
+    double mean = sum / n ;
+    double var = max( 0.0, ( sum2 - sum*mean ) / ( n - 1 ) ) ;
+    double stdErr = sqrt( var / n ) ;
+    double z = stdErr > 0 ? mean / stdErr : ( mean ? 1e30 : 0 ) ;
+
+    bool agree = fabs( z ) < 4 ;
+    ok &= agree ;
+    info( agree ? Cyan : Red, "Batch: wavecheck %c: depth first mean %f, wavefront mean %f, difference %f (%.2f standard errors)",
+      "rgb"[c], mean0/n, mean1/n, mean, z ) ;
+  }
+
+  if( ok )
+    info( Cyan, "Batch: wavecheck passed" ) ;
+  else
+    error( "Batch: wavecheck FAILED, wavefront doesn't match depth first" ) ;
+  return ok ;
+}
+
+bool BatchRenderer::writeReport( const vector<double>& seconds )
+{
+  string filename = outBase + ".txt" ;
+  FILE *f = fopen( filename.c_str(), "w" ) ;
+  if( !f )
+  {
+    error( "Batch: couldn't open %s for writing", filename.c_str() ) ;
+    return false ;
+  }
+
+  fprintf( f, "scene       %s\n", sceneFile.size() ? sceneFile.c_str() : "(default)" ) ;
+  fprintf( f, "resolution  %d x %d\n", window->rtCore->getWidth(), window->rtCore->getHeight() ) ;
+  fprintf( f, "rpp         %d\n", window->rtCore->getRaysPerPixel() ) ;
+  if( budgetSeconds )
+    fprintf( f, "rt budget   %.3f s\n", budgetSeconds ) ;
+  if( numWorkers )
+    fprintf( f, "workers     %d\n", numWorkers ) ;
+  fprintf( f, "patches     %lld\n", window->radCore->getNumPatches() ) ;
+
+  double total = 0 ;
+  for( int i = 0 ; i < steps.size() ; i++ )
+  {
+    fprintf( f, "%-11s %.3f s\n", BatchStepName[ steps[i] ], seconds[i] ) ;
+    total += seconds[i] ;
+  }
+  fprintf( f, "total       %.3f s\n", total ) ;
+  fclose( f ) ;
+
+  info( "Batch: wrote %s", filename.c_str() ) ;
+  return true ;
+}
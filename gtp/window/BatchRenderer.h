@@ -0,0 +1,105 @@
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+#include "../util/StdWilUtil.h"
+#include "../math/Vector.h"
+
+struct RenderFarm ;
+struct Camera ;
+
+// What a batch run computes.  Steps run in the order given.
+enum BatchStep
+{
+  BatchRaytrace, BatchRadiosity, BatchVectorOccluders, BatchSH, BatchAmbientOcclusion,
+  BatchWavefrontCheck
+} ;
+
+extern const char* BatchStepName[] ;
+
+// Runs gtp from the command line with no interaction:
+//
+//   gtp.exe -batch [-mode rt|rad|vo|sh|ao|wavecheck[+...]] [-scene file.wsh|.obj|.ply] [-out basename]
+//                  [-eye x,y,z] [-look x,y,z] [-up x,y,z]
+//                  [-checkpoint file.ckpt [-resume]] [-seconds budget] [-workers N]
+//
+// The scene comes from -scene (a .wsh saved with GTPWindow::save,
+// or a bare .obj/.ply mesh which gets the default Sun light since meshes
+// carry no lights), or the built in default scene if none is given.
+// -eye/-look/-up place the camera (no spaces around the commas), whatever
+// isn't given stays where the scene file or default prepos put it. Everything else
+// (rpp, trace type, sampler, ..) comes from options.json as usual.
+// Radiosity uses the software hemicube for its form factors, vo raycasts.
+//
+// Writes basename.pfm (linear float) and basename.ppm (clamped, like the
+// on screen display) if a raytrace step ran, and basename.txt with timings.
+// PFM is the float output, there's no EXR writer in the tree.
+//
+// -checkpoint makes the raytrace write its sample sums there every
+// "ray::checkpoint seconds", so a render on a preemptible machine can
+// be rerun with -resume and carry on from the last checkpoint.  Resuming a
+// finished render's checkpoint adds another rpp samples on top of it.
+//
+// -seconds gives each raytrace a wall clock budget instead of a sample
+// count: it makes progressive passes over the image until time is up.
+//
+// -mode wavecheck is a regression test for "ray::wavefront": it traces the
+// scene depth first, then again in waves, and fails the run (exit code 1)
+// if the two images' difference is more than noise.
+//
+// -workers N farms the rt and ao steps out to N worker processes
+// (see RenderFarm), the other steps still run here.  The workers are
+// this same exe started with -worker <pipe>, you don't run that yourself.
+//
+// -batch is headless (Window::headless): no window, no D3D11 device and no
+// log window, just the console and the log file.  Meshes skip their vertex
+// buffers, and SH/VO results stay on the vertices since there's no texture
+// to park them in.  A cubemap from a file can't load (that needs D3DX), one
+// made from the scene's lights still works.
+struct BatchRenderer
+{
+  bool enabled ;
+  vector<BatchStep> steps ;
+  string sceneFile ;
+  string outBase ;
+  string checkpointFile ;
+  bool resume ;
+  double budgetSeconds ; // raytrace time budget, 0 = trace "ray::rays per pixel"
+  int numWorkers ;       // -workers: farm rt & ao out to this many processes
+  string workerPipe ;    // -worker: this process IS a farm worker, fed through this pipe
+
+  // -eye, -look, -up.  Only the ones given get applied.
+  Vector eye, look, up ;
+  bool hasEye, hasLook, hasUp ;
+
+  BatchRenderer() ;
+
+  // returns true if -batch was on the command line
+  bool parseCommandLine( const char* cmdLine ) ;
+
+  // true if -scene is a bare mesh (.obj or .ply) rather than a .wsh
+  bool sceneIsMesh() const ;
+
+  // puts the camera where -eye/-look/-up say, after the scene's loaded
+  void applyCamera( Camera* camera ) const ;
+
+  // runs every step to completion, writes the outputs.
+  // returns the process exit code.
+  int run() ;
+
+  // pumps main thread jobs until the current step goes Idle
+  static void waitUntilIdle() ;
+
+private:
+  RenderFarm *farm ;
+
+  // kicks off one step.  They all run on the threadpool and
+  // set window->programState back to Idle when done.
+  void start( BatchStep step ) ;
+
+  bool writeReport( const vector<double>& seconds ) ;
+
+  // the wavecheck step.  true if the images agree.
+  bool checkWavefront() ;
+} ;
+
+#endif
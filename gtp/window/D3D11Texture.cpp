@@ -175,19 +175,21 @@ void D3D11Texture::generateNoise()
   // 3 offset values
   
   PerlinGenerator gen( PerlinNoiseType::Sky, 2, 1 ) ;
+  vector<Vector> uvs( width ), vals( width ) ;
   for( int row = 0 ; row < height ; row++ )
   {
+    // a whole row through the batch kernel at once
     for( int col = 0 ; col < width ; col++ )
-    {
-      Vector uv( (real)row/height, (real)col/width ) ;
-      
-      //Vector val = gen.marble( uv.x, uv.y, 0, uv.x ) ;
-      //Vector val = gen.wood( uv.x, uv.y, 0 ) ;
-      //printf( "x %f, y %f\n",x,y );
-      Vector val = gen.at( uv ) ;
+      uvs[col] = Vector( (real)row/height, (real)col/width ) ;
+    
+    //Vector val = gen.marble( uv.x, uv.y, 0, uv.x ) ;
+    //Vector val = gen.wood( uv.x, uv.y, 0 ) ;
+    gen.atBatch( &uvs[0], &vals[0], width ) ;
 
+    for( int col = 0 ; col < width ; col++ )
+    {
       int idx = index( row,col ) ;
-      colorValues[ idx ] = val ;
+      colorValues[ idx ] = vals[col] ;
       colorValues[ idx ].w = 1 ;
     }
   }
@@ -32,10 +32,10 @@ bool DX_CHECK( HRESULT hr, char * msg )
 
 D3D11Window::D3D11Window( HINSTANCE hInst, TCHAR* windowTitleBar,
                      int windowXPos, int windowYPos,
-                     int windowWidth, int windowHeight ) :
+                     int windowWidth, int windowHeight, bool iHeadless ) :
   IGraphicsWindow( hInst, windowTitleBar,
           windowXPos, windowYPos,
-          windowWidth, windowHeight )
+          windowWidth, windowHeight, iHeadless )
 {
   d3d=0,gpu=0,
   
@@ -58,7 +58,19 @@ D3D11Window::D3D11Window( HINSTANCE hInst, TCHAR* windowTitleBar,
   //sharedTexSurface=0;
   NO_RESOURCE[0]=0;
 
-  
+  if( headless )
+  {
+    // no device at all. I still keep the viewport, because
+    // getWidth()/getHeight() is where everyone gets the image size from.
+    info( "Headless, no Direct3D device" ) ;
+    memset( &viewport, 0, sizeof( viewport ) ) ;
+    viewport.Width = windowWidth ;
+    viewport.Height = windowHeight ;
+    sharedTex = 0 ;
+    sharedTexResView = 0 ;
+    deviceDirty = false ;
+    return ;
+  }
 
   info( "Starting up Direct3D..." ) ;
   if( !init( windowWidth, windowHeight ) )
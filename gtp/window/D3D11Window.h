@@ -156,7 +156,7 @@ public:
     *shaderDecal ;
   D3D11Shader *activeShader ;
  
-  D3D11Window( HINSTANCE hInst, TCHAR* windowTitleBar, int windowXPos, int windowYPos, int windowWidth, int windowHeight ) ;
+  D3D11Window( HINSTANCE hInst, TCHAR* windowTitleBar, int windowXPos, int windowYPos, int windowWidth, int windowHeight, bool iHeadless ) ;
   ~D3D11Window() ;
 
   void activate() ;
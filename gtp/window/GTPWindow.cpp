@@ -19,6 +19,11 @@
 #include "../threading/ParallelizableBatch.h"
 #include "../rendering/FullCubeRenderer.h"
 #include "../rendering/Raycaster.h"
+#include "../rendering/Denoiser.h"
+#include "../rendering/TemporalReprojector.h"
+#include "../rendering/BakedSky.h"
+#include "../rendering/IrradianceCache.h"
+#include "../rendering/PhotonMap.h"
 
 char *RenderingModeName[] =
 {
@@ -79,10 +84,10 @@ char* DEFAULT_PROPERTIES_FILE = "options.json" ;
 
 GTPWindow::GTPWindow( HINSTANCE hInst, TCHAR* windowTitleBar,
                     int windowXPos, int windowYPos,
-                    int windowWidth, int windowHeight ) :
+                    int windowWidth, int windowHeight, bool iHeadless ) :
   D3D11Window( hInst, windowTitleBar,
              windowXPos, windowYPos,
-             windowWidth, windowHeight )
+             windowWidth, windowHeight, iHeadless )
 {
   MAX_LIGHTS = 32 ; // shader variable.. hard coded maximum for # lights
   // the shader supports (cbuffer size)
@@ -130,6 +135,7 @@ GTPWindow::GTPWindow( HINSTANCE hInst, TCHAR* windowTitleBar,
   camera = viewCam ; // default
   lightForCam = NULL ;
 
+  Sampler::deterministic = props->getInt( "ray::deterministic" ) ;
   rtCore = new RaytracingCore( windowHeight, windowWidth,
     props->getInt( "ray::rays per pixel" ),
     props->getInt( "ray::stratified" ),
@@ -138,10 +144,60 @@ GTPWindow::GTPWindow( HINSTANCE hInst, TCHAR* windowTitleBar,
     props->getInt( "ray::rays cubemap lighting" ),
     props->getInt( "ray::num bounces" ),
     props->getDouble( "ray::termination energy" ),
-    props->getInt( "ray::show bg" )
+    props->getInt( "ray::show bg" ),
+    props->getString( "ray::sampler" )
   ) ;
+  if( props->getInt( "ray::denoise passes" ) )
+    rtCore->denoiser = new ATrousDenoiser( props->getInt( "ray::denoise passes" ),
+      props->getDouble( "ray::denoise sigma color" ),
+      props->getDouble( "ray::denoise sigma normal" ),
+      props->getDouble( "ray::denoise sigma depth" ) ) ;
+  rtCore->temporal = new TemporalReprojector( windowHeight, windowWidth,
+    props->getInt( "ray::real time rays per pixel" ),
+    props->getDouble( "ray::real time min blend" ),
+    props->getDouble( "ray::real time depth tolerance" ),
+    props->getDouble( "ray::real time normal tolerance" ) ) ;
+  if( props->getInt( "ray::sky bake size" ) )
+    rtCore->bakedSky = new BakedSky( props->getInt( "ray::sky bake size" ) ) ;
+  rtCore->waveSize = props->getInt( "ray::wavefront" ) ;
+  rtCore->checkpointFile = props->getString( "ray::checkpoint file" ) ;
+  rtCore->checkpointSeconds = props->getDouble( "ray::checkpoint seconds" ) ;
+  rtCore->passRpp = props->getInt( "ray::progressive pass rpp" ) ;
+  // records go in whichever order the threads get to them, and every later
+  // lookup interpolates from whatever's there by then, so a cached render
+  // can't be the same from run to run.  Deterministic mode path traces those hits the plain way.
+  if( props->getDouble( "ray::irradiance cache" ) > 0 )
+  {
+    if( Sampler::deterministic )
+      warning( "ray::irradiance cache is off, it fills in thread order so it can't be deterministic" ) ;
+    else
+      rtCore->irradianceCache = new IrradianceCache( props->getDouble( "ray::irradiance cache" ) ) ;
+  }
+  rtCore->irradianceRays = props->getInt( "ray::irradiance cache rays" ) ;
+  if( props->getInt( "ray::caustic photons" ) > 0 )
+    rtCore->photonMap = new PhotonMap( props->getInt( "ray::caustic photons" ),
+      props->getInt( "ray::caustic photons gathered" ),
+      props->getDouble( "ray::caustic radius" ),
+      props->getInt( "ray::caustic photon bounces" ) ) ;
+  string mis = props->getString( "ray::mis" ) ;
+  for( int i = MISOff ; i <= MISPower ; i++ )
+    if( mis == MISHeuristicName[i] )
+      rtCore->misHeuristic = (MISHeuristic)i ;
 
   radCore = new RadiosityCore( this, props->getInt( "radiosity::hemicube pixels per side" ) ) ;
+  radCore->formFactorThreshold = props->getDouble( "radiosity::form factor threshold" ) ;
+  radCore->formFactorDirectory = props->getString( "radiosity::form factor directory" ) ;
+  radCore->halfFormFactors = props->getInt( "radiosity::half form factors" ) ;
+  radCore->shotsPerUpdate = props->getInt( "radiosity::shots per update" ) ;
+  radCore->useSoftwareHemicube = props->getInt( "radiosity::software hemicube" ) ;
+  radCore->solveChannelsTogether = props->getInt( "radiosity::solve rgb together" ) ;
+  radCore->gmresRestart = props->getInt( "radiosity::gmres restart" ) ;
+  string solver = props->getString( "radiosity::solver" ) ;
+  radCore->hierarchicalEpsilon = props->getDouble( "radiosity::hierarchical epsilon" ) ;
+  radCore->hierarchicalVisibilityRays = props->getInt( "radiosity::hierarchical visibility rays" ) ;
+  for( int i = LUDecomposition ; i <= GMRES ; i++ )
+    if( solver == SolutionMethodName[i] )
+      radCore->matrixSolverMethod = i ;
   raycaster = new Raycaster( props->getInt( "ray::num caster rays" ) ) ;
 
   fcr = new FullCubeRenderer( scene, props->getInt( "wavelet::pixels per side" ) ) ;
@@ -165,17 +221,23 @@ GTPWindow::GTPWindow( HINSTANCE hInst, TCHAR* windowTitleBar,
     // 2nd must be 'k', ie octree with kdstyle subdivisions
     Octree<Shape*>::useKDDivisions = Octree<PhantomTriangle*>::useKDDivisions = true ;
   }
-  initTextures() ; // for rendering scene to texture
-  // for the radiosity/rt combined render
+  // headless (-batch) has no device, so no surfaces, shaders, fonts or input
+  texSubwindow = texRaytrace = 0 ;
+  if( !headless )
+  {
+    initTextures() ; // for rendering scene to texture
+    // for the radiosity/rt combined render
   
-  initInputMan( hwnd, windowWidth, windowHeight ) ;
+    initInputMan( hwnd, windowWidth, windowHeight ) ;
+  }
 
   subwindow = true ;
 
   renderingMode = RenderingMode::Rasterize | RenderingMode::DebugLines ;//| RenderingMode::Raytrace ;
 
   ss=TextureSamplingMode::Point;
-  setTextureSamplingMode( (TextureSamplingMode)ss ) ;
+  if( !headless )
+    setTextureSamplingMode( (TextureSamplingMode)ss ) ;
 
   scene->spacePartitioningOn = props->getInt( "space partitioning::on" ) ;
   movementOn = false ;
@@ -185,7 +247,6 @@ GTPWindow::GTPWindow( HINSTANCE hInst, TCHAR* windowTitleBar,
   // start cut off at about 98% of far plane
   textDisplayBackplane = HEMI_FAR*0.98 ;
   
-  char* shaderFile = "shader/effect.hlsl";
   expos = 1.0 ;
 
   // Init some of these values.
@@ -200,6 +261,28 @@ GTPWindow::GTPWindow( HINSTANCE hInst, TCHAR* windowTitleBar,
   gpuCData0.voI[2] = 1 ; // specular from specular interreflection strength
   gpuCData0.voI[3] = 4 ; // specular interreflection exponent
 
+  if( !headless )
+    initShaders() ;
+
+  shadingMode = ShadingMode::PhongLit ;
+
+  vbDebugLines = vbDebugPoints = vbDebugTris = NULL ;
+
+  mutexPbs = CreateMutexA( 0, 0, "mutex-pbs" ) ;
+
+  // create font
+  if( !headless )
+  {
+    createFont( Arial12, 12, 100, "Arial" ) ;
+    createFont( Arial14, 14, 100, "Arial" ) ;
+    createFont( Arial18, 18, 700, "Arial" ) ;
+  }
+}
+
+void GTPWindow::initShaders()
+{
+  char* shaderFile = "shader/effect.hlsl";
+
   shaderVcDebug = new VCShader( this, shaderFile, "vvc", shaderFile, "pxvc" ) ;
   
   //This doesn't actually get used, becausee i stopped using vnc format
@@ -232,17 +315,6 @@ GTPWindow::GTPWindow( HINSTANCE hInst, TCHAR* windowTitleBar,
   shaderWavelet = new VT10NC10Shader( this, shaderFile, "vGWavelet_vnc", shaderFile, "pxvncUnlit" ) ;
   
   shaderDecal = new VT10NC10Shader( this, shaderFile, "vGTexDecal_vtc", shaderFile, "pxvtc" ) ;
-
-  shadingMode = ShadingMode::PhongLit ;
-
-  vbDebugLines = vbDebugPoints = vbDebugTris = NULL ;
-
-  mutexPbs = CreateMutexA( 0, 0, "mutex-pbs" ) ;
-
-  // create font
-  createFont( Arial12, 12, 100, "Arial" ) ;
-  createFont( Arial14, 14, 100, "Arial" ) ;
-  createFont( Arial18, 18, 700, "Arial" ) ;
 }
 
 GTPWindow::~GTPWindow()
@@ -1416,6 +1488,10 @@ void GTPWindow::colorNormalize( ColorIndex colorIndex )
 
 void GTPWindow::updateVertexBuffers()
 {
+  // nothing to update without a device, the colors are already on the verts
+  if( headless )
+    return ;
+
   // if you're not the main thread, you need to
   // ask this to happen ON THE MAIN THREAD
   if( ! threadPool.onMainThread() )
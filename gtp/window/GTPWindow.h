@@ -214,7 +214,7 @@ public:
   vector<WaveParam> waveGroup ;
 
 public:
-  GTPWindow( HINSTANCE hInst, TCHAR* windowTitleBar, int windowXPos, int windowYPos, int windowWidth, int windowHeight ) ;
+  GTPWindow( HINSTANCE hInst, TCHAR* windowTitleBar, int windowXPos, int windowYPos, int windowWidth, int windowHeight, bool iHeadless ) ;
   ~GTPWindow() ;
 
   void textDisplayBackplaneFurther() ;
@@ -229,6 +229,7 @@ public:
   void toggleMovement() ;
 
   void initTextures() ;
+  void initShaders() ;
   
   // Bake in the current rotation matrix
   // by changing the LIGHTSOURCE geometry
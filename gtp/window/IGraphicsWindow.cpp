@@ -2,9 +2,9 @@
 
 IGraphicsWindow::IGraphicsWindow( HINSTANCE hInst, TCHAR* windowTitleBar,
                      int windowXPos, int windowYPos,
-                     int windowWidth, int windowHeight ) :
+                     int windowWidth, int windowHeight, bool iHeadless ) :
 Window( hInst, windowTitleBar,
         windowXPos, windowYPos,
-        windowWidth, windowHeight )
+        windowWidth, windowHeight, iHeadless )
 {
 }
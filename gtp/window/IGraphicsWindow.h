@@ -45,7 +45,7 @@ protected:
 public:
   IGraphicsWindow( HINSTANCE hInst, TCHAR* windowTitleBar,
                    int windowXPos, int windowYPos,
-                   int windowWidth, int windowHeight ) ;
+                   int windowWidth, int windowHeight, bool iHeadless ) ;
   
   /// Every IGraphicsWindow must provide::
   // these are partially implemented in class Window
@@ -0,0 +1,530 @@
+#include "RenderFarm.h"
+#include "GTPWindow.h"
+#include "BatchRenderer.h"
+#include "../rendering/RaytracingCore.h"
+#include "../rendering/Raycaster.h"
+#include "../threading/ParallelizableBatch.h"
+#include "../geometry/MeshGroup.h"
+#include "../geometry/Mesh.h"
+
+// the piece of one mesh's verts a global vertex range covers
+struct VertexRange
+{
+  vector<AllVertex>* verts ;
+  int first, last ; // [first,last) in verts
+  int global ;      // global index of verts[first]
+} ;
+
+// splits global vertices [begin,end) into per mesh pieces.
+// Same order as Scene::countVertices and Raycaster::QAO walk them.
+static vector<VertexRange> vertexRanges( Scene *scene, int begin, int end )
+{
+  vector<VertexRange> ranges ;
+  int global = 0 ;
+  for( int i = 0 ; i < scene->shapes.size() ; i++ )
+  {
+    for( int j = 0 ; j < scene->shapes[i]->meshGroup->meshes.size() ; j++ )
+    {
+      vector<AllVertex>& verts = scene->shapes[i]->meshGroup->meshes[j]->verts ;
+      int n = verts.size() ;
+      int first = max( begin - global, 0 ), last = min( end - global, n ) ;
+      if( first < last )
+      {
+        VertexRange r = { &verts, first, last, global + first } ;
+        ranges.push_back( r ) ;
+      }
+      global += n ;
+    }
+  }
+  return ranges ;
+}
+
+static bool writeAll( HANDLE pipe, const void* data, int bytes )
+{
+  const char *p = (const char*)data ;
+  while( bytes > 0 )
+  {
+    DWORD wrote ;
+    if( !WriteFile( pipe, p, bytes, &wrote, 0 ) )  return false ;
+    p += wrote ;
+    bytes -= wrote ;
+  }
+  return true ;
+}
+
+static bool readAll( HANDLE pipe, void* data, int bytes )
+{
+  char *p = (char*)data ;
+  while( bytes > 0 )
+  {
+    DWORD got ;
+    if( !ReadFile( pipe, p, bytes, &got, 0 ) || !got )  return false ; // broken pipe: the other end is gone
+    p += got ;
+    bytes -= got ;
+  }
+  return true ;
+}
+
+RenderFarm::RenderFarm()
+{
+  unitsTotal = 0 ;
+  unitsDone = 0 ;
+  threadsRunning = 0 ;
+  unitsFailed = false ;
+  stepType = TraceRows ;
+  queueMutex = CreateMutexA( 0, 0, 0 ) ;
+  vertexCount = 0 ;
+  for( int i = 0 ; i < 9 ; i++ )
+    camera[i] = 0 ;
+}
+
+RenderFarm::~RenderFarm()
+{
+  for( int i = 0 ; i < workers.size() ; i++ )
+    if( workers[i].alive )
+      send( workers[i].pipe, Quit, 0, 0, 0, 0 ) ;
+
+  for( int i = 0 ; i < workers.size() ; i++ )
+  {
+    if( WaitForSingleObject( workers[i].process, 10000 ) != WAIT_OBJECT_0 )
+    {
+      warning( "Farm: worker %d didn't quit, killing it", i ) ;
+      TerminateProcess( workers[i].process, 1 ) ;
+    }
+    CloseHandle( workers[i].pipe ) ;
+    CloseHandle( workers[i].process ) ;
+  }
+  CloseHandle( queueMutex ) ;
+}
+
+int RenderFarm::launch( int numWorkers, const string& sceneFile )
+{
+  char exe[ MAX_PATH ] ;
+  GetModuleFileNameA( 0, exe, MAX_PATH ) ;
+  vertexCount = window->scene->countVertices() ;
+
+  // start them all first, so they load the scene at the same time
+  for( int i = 0 ; i < numWorkers ; i++ )
+  {
+    char pipeName[ 128 ] ;
+    sprintf( pipeName, "\\\\.\\pipe\\gtp-farm-%lu-%d", GetCurrentProcessId(), i ) ;
+
+    // non-blocking until it connects, so a worker that never shows up can't hang us
+    HANDLE pipe = CreateNamedPipeA( pipeName, PIPE_ACCESS_DUPLEX,
+      PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_NOWAIT, 1, 1<<20, 1<<20, 0, 0 ) ;
+    if( pipe == INVALID_HANDLE_VALUE )
+    {
+      error( "Farm: couldn't create pipe %s (error %lu)", pipeName, GetLastError() ) ;
+      continue ;
+    }
+
+    string cmdLine = string( "\"" ) + exe + "\" -batch -worker " + pipeName ;
+    if( sceneFile.size() )
+      cmdLine += " -scene " + sceneFile ;
+    vector<char> cmd( cmdLine.begin(), cmdLine.end() ) ; // CreateProcess may write to it
+    cmd.push_back( 0 ) ;
+
+    STARTUPINFOA si = { sizeof( STARTUPINFOA ) } ;
+    PROCESS_INFORMATION pi ;
+    if( !CreateProcessA( exe, &cmd[0], 0, 0, FALSE, 0, 0, 0, &si, &pi ) )
+    {
+      error( "Farm: couldn't start worker %d (error %lu)", i, GetLastError() ) ;
+      CloseHandle( pipe ) ;
+      continue ;
+    }
+    CloseHandle( pi.hThread ) ;
+
+    Worker worker = { pipe, pi.hProcess, false } ;
+    workers.push_back( worker ) ;
+  }
+
+  int connected = 0 ;
+  for( int i = 0 ; i < workers.size() ; i++ )
+  {
+    Worker& worker = workers[i] ;
+
+    // it opens its end once it has the scene loaded
+    Timer waited ;
+    while( !worker.alive )
+    {
+      if( !ConnectNamedPipe( worker.pipe, 0 ) && GetLastError() == ERROR_PIPE_CONNECTED )
+        worker.alive = true ;
+      else if( WaitForSingleObject( worker.process, 0 ) == WAIT_OBJECT_0 || waited.getTime() > 600 )
+        break ;
+      else
+        Sleep( 20 ) ;
+    }
+    if( !worker.alive )
+    {
+      error( "Farm: worker %d never connected", i ) ;
+      continue ;
+    }
+
+    DWORD mode = PIPE_READMODE_BYTE | PIPE_WAIT ;
+    SetNamedPipeHandleState( worker.pipe, &mode, 0, 0 ) ;
+
+    // make sure it loaded the same thing we did
+    MsgHeader msg ;
+    vector<char> payload ;
+    int *hello = 0 ;
+    if( receive( worker.pipe, msg, payload ) && msg.type == Hello && payload.size() == 3*sizeof(int) )
+      hello = (int*)&payload[0] ;
+    if( !hello || hello[0] != window->rtCore->getWidth() || hello[1] != window->rtCore->getHeight() || hello[2] != vertexCount )
+    {
+      error( "Farm: worker %d doesn't have the same scene/resolution, not using it", i ) ;
+      send( worker.pipe, Quit, 0, 0, 0, 0 ) ;
+      worker.alive = false ;
+      continue ;
+    }
+    connected++ ;
+  }
+
+  info( Cyan, "Farm: %d of %d workers ready", connected, numWorkers ) ;
+  return connected ;
+}
+
+void RenderFarm::raytrace( const Vector& eye, const Vector& look, const Vector& up )
+{
+  RaytracingCore *rt = window->rtCore ;
+  for( int i = 0 ; i < 3 ; i++ )
+  {
+    camera[ i ] = eye.e[i] ;
+    camera[ 3+i ] = look.e[i] ;
+    camera[ 6+i ] = up.e[i] ;
+  }
+
+  rt->clear( Vector( .5,.5,.5,.25 ) ) ;
+  FrameBuffer *fb = rt->frameBuffer ;
+  for( int i = 0 ; i < fb->sums.size() ; i++ )
+  {
+    fb->sums[i] = Vector( 0,0,0,0 ) ;
+    fb->sampleCounts[i] = 0 ;
+  }
+
+  // ~4 bands per worker, so a slow one doesn't hold up the end for long.
+  // Even, so a band is whole 2 row strips.
+  int live = 0 ;
+  for( int i = 0 ; i < workers.size() ; i++ )
+    live += workers[i].alive ;
+  int bandRows = max( 2, rt->getHeight() / max( 1, 4*live ) ) ;
+  bandRows += bandRows & 1 ;
+
+  vector<Unit> units ;
+  for( int row = 0 ; row < rt->getHeight() ; row += bandRows )
+  {
+    Unit u = { TraceRows, row, min( row + bandRows, rt->getHeight() ) } ;
+    units.push_back( u ) ;
+  }
+  info( "Farm: tracing %d bands of %d rows", (int)units.size(), bandRows ) ;
+  start( TraceRows, units ) ;
+}
+
+void RenderFarm::ambientOcclusion()
+{
+  int live = 0 ;
+  for( int i = 0 ; i < workers.size() ; i++ )
+    live += workers[i].alive ;
+  int vertsPerUnit = max( 120, vertexCount / max( 1, 8*live ) ) ;
+
+  vector<Unit> units ;
+  for( int v = 0 ; v < vertexCount ; v += vertsPerUnit )
+  {
+    Unit u = { AOVerts, v, min( v + vertsPerUnit, vertexCount ) } ;
+    units.push_back( u ) ;
+  }
+  info( "Farm: ao for %d vertices in %d ranges", vertexCount, (int)units.size() ) ;
+  start( AOVerts, units ) ;
+}
+
+void RenderFarm::start( int type, const vector<Unit>& units )
+{
+  stepType = type ;
+
+  // handed out from the back, so reverse to go in order
+  queue.assign( units.rbegin(), units.rend() ) ;
+  unitsTotal = units.size() ;
+  unitsDone = 0 ;
+  unitsFailed = false ;
+
+  int live = 0 ;
+  for( int i = 0 ; i < workers.size() ; i++ )
+    live += workers[i].alive ;
+  if( !live )
+  {
+    error( "Farm: no workers left" ) ;
+    unitsFailed = unitsTotal > 0 ;
+    doneStep() ;
+    return ;
+  }
+
+  // a thread per worker, they mostly sit blocked on their pipe
+  threadsRunning = live ;
+  for( int i = 0 ; i < workers.size() ; i++ )
+  {
+    if( !workers[i].alive )  continue ;
+    pair<RenderFarm*,int> *param = new pair<RenderFarm*,int>( this, i ) ;
+    HANDLE thread = CreateThread( 0, 0, feedWorkerThread, param, 0, 0 ) ;
+    CloseHandle( thread ) ;
+  }
+}
+
+DWORD WINAPI RenderFarm::feedWorkerThread( LPVOID param )
+{
+  pair<RenderFarm*,int> *p = (pair<RenderFarm*,int>*)param ;
+  p->first->feedWorker( p->second ) ;
+  delete p ;
+  return 0 ;
+}
+
+void RenderFarm::feedWorker( int w )
+{
+  Worker& worker = workers[ w ] ;
+  while( 1 )
+  {
+    Unit unit ;
+    bool got = false ;
+    {
+      MutexLock lock( queueMutex, INFINITE ) ;
+      if( queue.size() )
+      {
+        unit = queue.back() ;
+        queue.pop_back() ;
+        got = true ;
+      }
+    }
+
+    if( !got )
+    {
+      if( unitsDone == unitsTotal )  break ;
+
+      // the rest are out with other workers.  Hang around
+      // in case one of them dies and its unit comes back.
+      Sleep( 20 ) ;
+      continue ;
+    }
+
+    if( !runUnit( worker, unit ) )
+    {
+      warning( "Farm: lost worker %d, handing [%d,%d) to another", w, unit.begin, unit.end ) ;
+      worker.alive = false ;
+      MutexLock lock( queueMutex, INFINITE ) ;
+      queue.push_back( unit ) ;
+      break ;
+    }
+    InterlockedIncrement( &unitsDone ) ;
+  }
+
+  // the last one out finishes the step
+  if( !InterlockedDecrement( &threadsRunning ) )
+  {
+    unitsFailed = unitsDone < unitsTotal ;
+    doneStep() ;
+  }
+}
+
+bool RenderFarm::runUnit( Worker& worker, const Unit& unit )
+{
+  bool trace = unit.type == TraceRows ;
+  if( !send( worker.pipe, unit.type, unit.begin, unit.end, trace ? camera : 0, trace ? sizeof( camera ) : 0 ) )
+    return false ;
+
+  MsgHeader msg ;
+  vector<char> payload ;
+  if( !receive( worker.pipe, msg, payload ) || msg.begin != unit.begin || msg.end != unit.end )
+    return false ;
+
+  if( trace && msg.type == RowsDone )
+    return gatherRows( msg, payload ) ;
+  else if( !trace && msg.type == AODone )
+    return gatherAO( msg, payload ) ;
+  else
+    return false ;
+}
+
+bool RenderFarm::gatherRows( const MsgHeader& msg, const vector<char>& payload )
+{
+  RaytracingCore *rt = window->rtCore ;
+  int cols = rt->getWidth() ;
+  int n = ( msg.end - msg.begin )*cols ;
+  if( payload.size() != n*sizeof( Pixel ) )
+  {
+    error( "Farm: rows [%d,%d) came back the wrong size", msg.begin, msg.end ) ;
+    return false ;
+  }
+
+  // bands don't overlap, so no lock
+  FrameBuffer *fb = rt->frameBuffer ;
+  const Pixel *px = (const Pixel*)&payload[0] ;
+  for( int i = 0 ; i < n ; i++ )
+  {
+    int idx = msg.begin*cols + i ;
+    fb->sums[ idx ] = Vector( px[i].sum[0], px[i].sum[1], px[i].sum[2], px[i].sum[3] ) ;
+    fb->sampleCounts[ idx ] = px[i].count ;
+    fb->normals[ idx ] = Vector( px[i].normal[0], px[i].normal[1], px[i].normal[2] ) ;
+    fb->depths[ idx ] = px[i].depth ;
+  }
+  return true ;
+}
+
+bool RenderFarm::gatherAO( const MsgHeader& msg, const vector<char>& payload )
+{
+  if( payload.size() != ( msg.end - msg.begin )*sizeof( float ) )
+  {
+    error( "Farm: ao for [%d,%d) came back the wrong size", msg.begin, msg.end ) ;
+    return false ;
+  }
+
+  const float *ao = (const float*)&payload[0] ;
+  vector<VertexRange> ranges = vertexRanges( window->scene, msg.begin, msg.end ) ;
+  for( int r = 0 ; r < ranges.size() ; r++ )
+    for( int v = ranges[r].first ; v < ranges[r].last ; v++ )
+      (*ranges[r].verts)[ v ].ambientOcclusion = ao[ ranges[r].global + v - ranges[r].first - msg.begin ] ;
+  return true ;
+}
+
+void RenderFarm::doneStep()
+{
+  if( unitsFailed )
+    error( "Farm: every worker died, only %d of %d units came back", (int)unitsDone, unitsTotal ) ;
+
+  if( stepType == TraceRows )
+    window->rtCore->finishGathered() ; // goes Idle when it's done
+  else
+  {
+    info( "Smoothing AO . . . " ) ;
+    window->smoothAO() ;
+    window->programState = ProgramState::Idle ;
+  }
+}
+
+int RenderFarm::serve( const string& pipeName )
+{
+  HANDLE pipe = CreateFileA( pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, 0, 0 ) ;
+  if( pipe == INVALID_HANDLE_VALUE )
+  {
+    error( "Farm worker: couldn't open %s (error %lu)", pipeName.c_str(), GetLastError() ) ;
+    return 1 ;
+  }
+  info( Cyan, "Farm worker: connected to %s", pipeName.c_str() ) ;
+
+  // the coordinator checkpoints the whole image, not each band
+  window->rtCore->checkpointFile = "" ;
+  window->bakeRotationsIntoLights() ;
+
+  int hello[3] = { window->rtCore->getWidth(), window->rtCore->getHeight(), window->scene->countVertices() } ;
+  bool ok = send( pipe, Hello, 0, 0, hello, sizeof( hello ) ) ;
+
+  MsgHeader msg ;
+  vector<char> payload ;
+  bool quit = false ;
+  while( ok && !quit )
+  {
+    if( !receive( pipe, msg, payload ) )
+    {
+      error( "Farm worker: lost the coordinator" ) ;
+      ok = false ;
+    }
+    else if( msg.type == Quit )
+      quit = true ;
+    else if( msg.type == TraceRows )
+      ok = traceRows( pipe, msg, payload ) ;
+    else if( msg.type == AOVerts )
+      ok = computeAO( pipe, msg ) ;
+    else
+    {
+      error( "Farm worker: unexpected message %d", msg.type ) ;
+      ok = false ;
+    }
+  }
+
+  CloseHandle( pipe ) ;
+  return ok ? 0 : 1 ;
+}
+
+bool RenderFarm::traceRows( HANDLE pipe, const MsgHeader& msg, const vector<char>& payload )
+{
+  if( payload.size() != 9*sizeof( double ) )  return false ;
+  const double *c = (const double*)&payload[0] ;
+
+  // the frame is the camera, the scene never changes under a worker.
+  // Another band of the frame this worker last traced reuses its photon map & cache.
+  static double lastCamera[9] ;
+  static bool tracedAny = false ;
+
+  RaytracingCore *rt = window->rtCore ;
+  rt->traceRowStart = msg.begin ;
+  rt->traceRowEnd = msg.end ;
+  rt->sameFrame = tracedAny && !memcmp( lastCamera, c, sizeof( lastCamera ) ) ;
+  memcpy( lastCamera, c, sizeof( lastCamera ) ) ;
+  tracedAny = true ;
+  window->programState = ProgramState::Busy ;
+  rt->raytrace( Vector( c[0], c[1], c[2] ), Vector( c[3], c[4], c[5] ), Vector( c[6], c[7], c[8] ), window->scene ) ;
+  BatchRenderer::waitUntilIdle() ;
+  rt->traceRowStart = rt->traceRowEnd = 0 ;
+  rt->sameFrame = false ;
+
+  int cols = rt->getWidth() ;
+  FrameBuffer *fb = rt->frameBuffer ;
+  vector<Pixel> pixels( ( msg.end - msg.begin )*cols ) ;
+  for( int i = 0 ; i < pixels.size() ; i++ )
+  {
+    int idx = msg.begin*cols + i ;
+    for( int j = 0 ; j < 4 ; j++ )
+      pixels[i].sum[j] = fb->sums[ idx ].e[j] ;
+    pixels[i].count = fb->sampleCounts[ idx ] ;
+    for( int j = 0 ; j < 3 ; j++ )
+      pixels[i].normal[j] = fb->normals[ idx ].e[j] ;
+    pixels[i].depth = fb->depths[ idx ] ;
+  }
+  return send( pipe, RowsDone, msg.begin, msg.end, &pixels[0], pixels.size()*sizeof( Pixel ) ) ;
+}
+
+bool RenderFarm::computeAO( HANDLE pipe, const MsgHeader& msg )
+{
+  vector<VertexRange> ranges = vertexRanges( window->scene, msg.begin, msg.end ) ;
+
+  // same job size QAO uses
+  ParallelBatch *pb = new ParallelBatch( "farm ao", new Callback0( [](){
+    window->programState = ProgramState::Idle ;
+  } ) ) ;
+  int jobs = 0 ;
+  for( int r = 0 ; r < ranges.size() ; r++ )
+  {
+    for( int k = ranges[r].first ; k < ranges[r].last ; k += 120 )
+    {
+      // same vertexBase QAO would give it, so deterministic mode matches a local run
+      pb->addJob( new CallbackObject4< Raycaster*, void(Raycaster::*)(vector<AllVertex>*,int,int,int), vector<AllVertex>*,int,int,int >
+        ( window->raycaster, &Raycaster::ambientOcclusion, ranges[r].verts, k, min( k+120, ranges[r].last ), ranges[r].global - ranges[r].first ) ) ;
+      jobs++ ;
+    }
+  }
+
+  if( jobs )
+  {
+    window->programState = ProgramState::Busy ;
+    threadPool.addBatch( pb ) ;
+    BatchRenderer::waitUntilIdle() ;
+  }
+  else
+    delete pb ;
+
+  vector<float> ao( msg.end - msg.begin ) ;
+  for( int r = 0 ; r < ranges.size() ; r++ )
+    for( int v = ranges[r].first ; v < ranges[r].last ; v++ )
+      ao[ ranges[r].global + v - ranges[r].first - msg.begin ] = (*ranges[r].verts)[ v ].ambientOcclusion ;
+  return send( pipe, AODone, msg.begin, msg.end, ao.size() ? &ao[0] : 0, ao.size()*sizeof( float ) ) ;
+}
+
+bool RenderFarm::send( HANDLE pipe, int type, int begin, int end, const void* payload, int bytes )
+{
+  MsgHeader msg = { type, begin, end, bytes } ;
+  return writeAll( pipe, &msg, sizeof( msg ) ) && writeAll( pipe, payload, bytes ) ;
+}
+
+bool RenderFarm::receive( HANDLE pipe, MsgHeader& msg, vector<char>& payload )
+{
+  if( !readAll( pipe, &msg, sizeof( msg ) ) )  return false ;
+  if( msg.bytes < 0 || msg.bytes > (1<<30) )  return false ;
+  payload.resize( msg.bytes ) ;
+  return !msg.bytes || readAll( pipe, &payload[0], msg.bytes ) ;
+}
@@ -0,0 +1,121 @@
+#ifndef RENDERFARM_H
+#define RENDERFARM_H
+
+#include "../util/StdWilUtil.h"
+#include "../math/Vector.h"
+
+// Spreads batch work over other gtp processes.
+//
+//   gtp.exe -batch -workers N ...
+//
+// makes this process the coordinator.  It starts N copies of itself
+// with -worker <pipe>, each loads the same -scene, and then hands them work
+// units over their named pipe: bands of image rows to raytrace, and ranges of
+// vertices to compute ambient occlusion for.  Each worker runs a unit on
+// its own threadpool and sends back the result, the coordinator folds it in.
+//
+// A worker that dies gets its unit handed to another.
+// The pipe names are plain \\.\pipe\ names, so a worker on another machine
+// could open \\coordinator\pipe\<name> instead, all workers being local is
+// just what the coordinator launches.
+//
+// Every worker traces with the same options and the sampler streams are
+// keyed by the strip's first pixel, so in "ray::deterministic" mode the
+// farmed image matches a single process render.  A worker builds the
+// photon map and irradiance cache once a frame, on its first band of it;
+// the photon map always gets the same seed in a band trace, so each
+// worker's matches.  (Deterministic mode has no irradiance cache.)
+struct RenderFarm
+{
+  // what goes over the pipe.  A message is this header,
+  // then bytes of payload.
+  enum MsgType
+  {
+    Hello,        // worker -> coordinator: payload int cols, rows, vertices
+    TraceRows,    // [begin,end) rows.  payload eye, look, up (9 doubles)
+    RowsDone,     // [begin,end) rows.  payload a Pixel per pixel
+    AOVerts,      // [begin,end) vertices, in scene->shapes/meshes/verts order
+    AODone,       // [begin,end) vertices.  payload a float per vertex
+    Quit
+  } ;
+
+  struct MsgHeader
+  {
+    int type ;
+    int begin, end ;
+    int bytes ;
+  } ;
+
+  // one traced pixel: its sample sum & count, and the AOVs the denoiser wants
+  struct Pixel
+  {
+    float sum[4] ;
+    int count ;
+    float normal[3] ;
+    float depth ;
+  } ;
+
+  RenderFarm() ;
+  ~RenderFarm() ; // quits the workers
+
+  // Starts numWorkers copies of this exe and waits for them to connect
+  // and say hello.  Returns how many made it.
+  int launch( int numWorkers, const string& sceneFile ) ;
+
+  // Coordinator side.  Each queues the units and starts a thread per
+  // worker to feed them; window->programState goes Idle when it's all in.
+  void raytrace( const Vector& eye, const Vector& look, const Vector& up ) ;
+  void ambientOcclusion() ;
+
+  // true if some units never came back (every worker died)
+  inline bool failed() const { return unitsFailed ; }
+
+  // Worker side: connects to the coordinator's pipe and runs what
+  // it's sent until it says Quit.  Returns the process exit code.
+  static int serve( const string& pipeName ) ;
+
+private:
+  struct Worker
+  {
+    HANDLE pipe, process ;
+    bool alive ;
+  } ;
+  vector<Worker> workers ;
+
+  struct Unit
+  {
+    int type ; // TraceRows or AOVerts
+    int begin, end ;
+  } ;
+  vector<Unit> queue ;  // units not handed out yet (or handed back)
+  int unitsTotal ;
+  volatile LONG unitsDone ;
+  volatile LONG threadsRunning ;
+  bool unitsFailed ;
+  int stepType ; // TraceRows or AOVerts, what doneStep finishes
+  HANDLE queueMutex ;
+
+  double camera[9] ; // eye, look, up for TraceRows
+  int vertexCount ;
+
+  // the coordinator end of one step
+  void start( int type, const vector<Unit>& units ) ;
+  static DWORD WINAPI feedWorkerThread( LPVOID param ) ;
+  void feedWorker( int w ) ;
+  bool runUnit( Worker& worker, const Unit& unit ) ;
+  void doneStep() ;
+
+  // what each worker's units fill in
+  bool gatherRows( const MsgHeader& msg, const vector<char>& payload ) ;
+  bool gatherAO( const MsgHeader& msg, const vector<char>& payload ) ;
+
+  // worker side of one unit
+  static bool traceRows( HANDLE pipe, const MsgHeader& msg, const vector<char>& payload ) ;
+  static bool computeAO( HANDLE pipe, const MsgHeader& msg ) ;
+
+  // whole messages over a blocking pipe
+  static bool send( HANDLE pipe, int type, int begin, int end, const void* payload, int bytes ) ;
+  static bool receive( HANDLE pipe, MsgHeader& msg, vector<char>& payload ) ;
+} ;
+
+#endif
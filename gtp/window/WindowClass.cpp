@@ -1,9 +1,14 @@
 #include "WindowClass.h"
 
-Window::Window( HINSTANCE hInst, TCHAR* windowTitleBar, int windowXPos, int windowYPos, int windowWidth, int windowHeight )
+Window::Window( HINSTANCE hInst, TCHAR* windowTitleBar, int windowXPos, int windowYPos, int windowWidth, int windowHeight, bool iHeadless )
 {
   // Save off these parameters in private instance variables.
   hInstance = hInst ;
+  headless = iHeadless ;
+  hwnd = 0 ;
+  focus = false ;
+  if( headless )
+    return ; // nothing on screen, ever
 
   // Create a window.
   WNDCLASSEX window = { 0 } ;
@@ -71,7 +76,8 @@ Window::~Window()
 
 
   // cheesy fade exit
-  AnimateWindow( hwnd, 200, AW_HIDE | AW_BLEND );
+  if( hwnd )
+    AnimateWindow( hwnd, 200, AW_HIDE | AW_BLEND );
 }
 
 void Window::activate()
@@ -25,11 +25,17 @@ protected:
   bool focus ;
 
 public:
-  Window( HINSTANCE hInst, TCHAR* windowTitleBar, int windowXPos, int windowYPos, int windowWidth, int windowHeight ) ;
+  // Batch mode (see BatchRenderer): there's no HWND, and the
+  // D3D11Window on top of this never makes a device.  Anything
+  // that would draw or make a gpu resource checks this first.
+  bool headless ;
+
+  Window( HINSTANCE hInst, TCHAR* windowTitleBar, int windowXPos, int windowYPos, int windowWidth, int windowHeight, bool iHeadless ) ;
   ~Window() ;
 
   virtual void activate() ;
   virtual void deactivate() ;
+
   virtual bool setSize( int width, int height, bool fullScreen ) ;
   
   virtual int getWidth() ;